@@ -0,0 +1,156 @@
+/*! \file bench.c
+ *  \brief Times the graph layouts and searches on a generated grid
+ *
+ *  bench [--counters] [size]
+ *
+ *  Builds a size x size 8-connected grid, like the worlds robots move in,
+ *  and runs each phase on it. With --counters the hardware performance
+ *  counters are read around every phase and reported per vertex.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libhowderek/howderek.h"
+#include "libhowderek/howderek_graph.h"
+#include "libhowderek/howderek_grid.h"
+#include "libhowderek/howderek_perf.h"
+
+#define BENCH_DEFAULT_SIZE 512
+
+
+uint64_t grid_id(uint32_t x, uint32_t y) {
+  return ((uint64_t) y << 32) | x;
+}
+
+double grid_octile(struct howderek_graph_frozen* graph, uint32_t vertex, uint32_t goal) {
+  const int64_t dx = llabs((int64_t) (graph->ids[vertex] & UINT32_MAX) - (int64_t) (graph->ids[goal] & UINT32_MAX));
+  const int64_t dy = llabs((int64_t) (graph->ids[vertex] >> 32) - (int64_t) (graph->ids[goal] >> 32));
+  return (dx > dy) ? dx : dy;
+}
+
+uint64_t reached(struct howderek_graph_paths* paths) {
+  uint64_t count = 0;
+  uint32_t v;
+  for (v = 0; v < paths->vertexCount; v++) {
+    count += (howderek_graph_paths_distance(paths, v) != INFINITY);
+  }
+  return count;
+}
+
+void bench_begin(struct howderek_perf* perf) {
+  howderek_perf_begin(perf);
+}
+
+void bench_end(struct howderek_perf* perf, const char* phase, uint64_t units, const char* unitName) {
+  howderek_perf_end(perf);
+  howderek_perf_report(perf, stdout, phase, units, unitName);
+}
+
+int main(int argc, char** argv) {
+  struct howderek_perf perf;
+  uint32_t size = BENCH_DEFAULT_SIZE;
+  int counters = 0;
+  int i;
+  uint32_t x, y;
+  int dx, dy;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--counters") == 0) {
+      counters = 1;
+    } else {
+      size = atoi(argv[i]);
+    }
+  }
+  if (size < 2) {
+    howderek_log(HOWDEREK_LOG_FATAL, "usage: %s [--counters] [size]", argv[0]);
+    return 1;
+  }
+  if (counters) {
+    if (howderek_perf_open(&perf) == 0) {
+      howderek_log(HOWDEREK_LOG_WARN, "no hardware counters available, reporting times only");
+    }
+  } else {
+    memset(&perf, 0, sizeof(perf));
+    for (i = 0; i < HOWDEREK_PERF_COUNTERS; i++) {
+      perf.fds[i] = -1;
+    }
+  }
+
+  const uint64_t vertices = (uint64_t) size * size;
+  printf("%u x %u grid, %lu vertices\n\n", size, size, vertices);
+
+  bench_begin(&perf);
+  struct howderek_graph* graph = howderek_graph_create(HOWDEREK_GRAPH_DIRECTED, vertices);
+  for (y = 0; y < size; y++) {
+    for (x = 0; x < size; x++) {
+      howderek_graph_add_vertex(graph, grid_id(x, y), NULL);
+    }
+  }
+  for (y = 0; y < size; y++) {
+    for (x = 0; x < size; x++) {
+      for (dy = -1; dy <= 1; dy++) {
+        for (dx = -1; dx <= 1; dx++) {
+          if ((dx != 0 || dy != 0) && x + dx < size && y + dy < size) {
+            howderek_graph_add_edge_by_id(graph, grid_id(x, y), grid_id(x + dx, y + dy), 1.0);
+          }
+        }
+      }
+    }
+  }
+  bench_end(&perf, "build linked", vertices, "vertex");
+
+  bench_begin(&perf);
+  struct howderek_graph_frozen* frozen = howderek_graph_freeze(graph);
+  bench_end(&perf, "freeze to CSR", vertices, "vertex");
+
+  struct howderek_graph_paths* paths = howderek_graph_paths_create(vertices);
+
+  bench_begin(&perf);
+  howderek_graph_bfs(graph, grid_id(0, 0), paths);
+  bench_end(&perf, "bfs linked", reached(paths), "vertex");
+
+  bench_begin(&perf);
+  howderek_graph_frozen_bfs(frozen, 0, paths);
+  bench_end(&perf, "bfs CSR", reached(paths), "vertex");
+
+  bench_begin(&perf);
+  howderek_graph_dijkstra_to(graph, grid_id(0, 0), NULL, 0, paths);
+  bench_end(&perf, "dijkstra linked", reached(paths), "vertex");
+
+  bench_begin(&perf);
+  howderek_graph_frozen_dijkstra(frozen, 0, paths);
+  bench_end(&perf, "dijkstra CSR", reached(paths), "vertex");
+
+  bench_begin(&perf);
+  howderek_graph_frozen_astar(frozen, 0, frozen->vertexCount - 1, grid_octile, paths);
+  bench_end(&perf, "astar CSR", reached(paths), "vertex");
+
+  // The same grid as cells instead of vertices, for the distance transform
+  struct howderek_grid* cells = howderek_grid_create(size, size, 1);
+  uint32_t* field = malloc(sizeof(uint32_t) * vertices);
+  uint64_t v;
+  uint64_t fieldReached = 0;
+  bench_begin(&perf);
+  for (v = 0; v < vertices; v++) {
+    field[v] = HOWDEREK_GRID_FAR;
+  }
+  field[0] = 0;
+  howderek_grid_distances(cells, 1, size, size, field, 0);
+  bench_end(&perf, "distances grid", vertices, "vertex");
+  for (v = 0; v < vertices; v++) {
+    fieldReached += (field[v] != HOWDEREK_GRID_FAR);
+  }
+  if (fieldReached != vertices) {
+    howderek_log(HOWDEREK_LOG_ERROR, "distances grid reached %lu of %lu cells", fieldReached, vertices);
+  }
+  free(field);
+  howderek_grid_destroy(cells);
+
+  howderek_graph_paths_destroy(paths);
+  howderek_graph_frozen_destroy(frozen);
+  howderek_graph_destroy(&graph, 0);
+  howderek_perf_close(&perf);
+  return 0;
+}
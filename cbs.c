@@ -0,0 +1,561 @@
+/*! \file cbs.c
+ *  \brief Conflict-Based Search for any number of robots
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "libhowderek/howderek.h"
+#include "libhowderek/howderek_memory.h"
+#include "libhowderek/howderek_graph.h"
+#include "libhowderek/howderek_heap.h"
+#include "libhowderek/howderek_trace.h"
+#include "world.h"
+#include "cbs.h"
+
+#define CBS_NO_VERTEX UINT32_MAX
+#define CBS_STATE_BLOCK 1024
+// Check the clock this often while expanding states
+#define CBS_CLOCK_INTERVAL 4096
+// Time of the entries that say from when a robot waits at its goal
+#define CBS_PARKED UINT32_MAX
+
+/**
+ * Open addressed hash table keyed by (time << 32 | vertex, to). Vertices
+ * are stored with to = CBS_NO_VERTEX, moves with where they went. Slots
+ * from before the last clear are stamped with an older epoch, so clearing
+ * doesn't have to touch them.
+ */
+struct cbs_slot {
+  uint64_t key;
+  uint32_t to;
+  uint32_t value;
+  uint32_t epoch;                    // empty unless it's the table's epoch
+};
+
+struct cbs_table {
+  struct cbs_slot* slots;
+  size_t mask;
+  size_t count;
+  uint32_t epoch;
+};
+
+struct cbs_constraint {
+  uint32_t robot;
+  uint32_t vertex;                   // where it can't be, or where it can't move from
+  uint32_t to;                       // where it can't move to, CBS_NO_VERTEX for a vertex constraint
+  uint32_t time;                     // when it can't be there or arrive
+  struct cbs_constraint* next;       // constraints of the parent node
+};
+
+struct cbs_node {
+  uint64_t cost;
+  struct cbs_constraint* constraints;
+  uint32_t** paths;                  // vertex indices, shared with the parent unless replanned
+  uint32_t* lengths;
+};
+
+struct cbs_state {
+  uint32_t vertex;
+  uint32_t time;
+  uint32_t f;                        // time + distance to the goal
+  uint32_t conflicts;                // with the other robots' paths on the way here
+  struct cbs_state* parent;
+};
+
+struct cbs_conflict {
+  uint32_t robots[2];
+  uint32_t vertices[2];              // where each robot can't be or move from
+  uint32_t to[2];                    // where each robot can't move to, CBS_NO_VERTEX for vertices
+  uint32_t time;
+};
+
+struct cbs_search {
+  struct world* world;
+  uint32_t robotCount;
+  uint32_t vertexCount;
+  uint32_t* starts;
+  uint32_t* goals;
+  uint32_t** distances;              // true distance to each robot's goal
+  const uint32_t* heuristic;         // distances of the robot being planned
+  uint32_t earliest;                 // first step it can stop at its goal
+  struct cbs_table constraints;      // constraints of the robot being planned
+  struct cbs_table closed;           // (vertex, time) expanded by A*
+  struct cbs_table occupied;         // (vertex, time) and moves of every robot, for conflicts
+  struct cbs_table avoid;            // robots at each (vertex, time) besides the one being planned
+  void* scratch;                     // root the low level's states are in, reset after each search
+  struct cbs_state* states;          // block states are taken from
+  size_t statesLeft;
+  uint64_t deadline;                 // nanoseconds, monotonic clock
+  int timedOut;
+};
+
+
+
+uint64_t __cbs_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+uint64_t __cbs_key(uint32_t time, uint32_t vertex) {
+  return ((uint64_t) time << 32) | vertex;
+}
+
+void __cbs_table_init(struct cbs_table* table, size_t expected) {
+  size_t size = 16;
+  while (size < expected * 2) {
+    size *= 2;
+  }
+  table->slots = calloc(size, sizeof(struct cbs_slot));
+  table->mask = size - 1;
+  table->count = 0;
+  table->epoch = 1;
+}
+
+void __cbs_table_clear(struct cbs_table* table) {
+  if (table->count == 0) {
+    return;
+  }
+  table->count = 0;
+  if (++table->epoch == 0) {
+    memset(table->slots, 0, sizeof(struct cbs_slot) * (table->mask + 1));
+    table->epoch = 1;
+  }
+}
+
+struct cbs_slot* __cbs_table_find(struct cbs_table* table, uint64_t key, uint32_t to) {
+  uint64_t hash = key ^ ((uint64_t) to << 29);
+  size_t i;
+  // splitmix64's finalizer, times and vertices are small and close together
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+  hash ^= hash >> 31;
+  for (i = hash & table->mask; table->slots[i].epoch == table->epoch; i = (i + 1) & table->mask) {
+    if (table->slots[i].key == key && table->slots[i].to == to) {
+      break;
+    }
+  }
+  return &table->slots[i];
+}
+
+/**
+ * \return  value stored for the key, 0 if there isn't one
+ */
+uint32_t __cbs_table_get(struct cbs_table* table, uint64_t key, uint32_t to) {
+  const struct cbs_slot* slot = __cbs_table_find(table, key, to);
+  return (slot->epoch == table->epoch) ? slot->value : 0;
+}
+
+void __cbs_table_set(struct cbs_table* table, uint64_t key, uint32_t to, uint32_t value) {
+  struct cbs_slot* slot;
+  struct cbs_slot* old;
+  size_t oldSize;
+  size_t i;
+  // Keep at most half the slots full so probes stay short
+  if ((table->count + 1) * 2 > table->mask + 1) {
+    old = table->slots;
+    oldSize = table->mask + 1;
+    table->slots = calloc(oldSize * 2, sizeof(struct cbs_slot));
+    table->mask = oldSize * 2 - 1;
+    for (i = 0; i < oldSize; i++) {
+      if (old[i].epoch == table->epoch) {
+        *__cbs_table_find(table, old[i].key, old[i].to) = old[i];
+      }
+    }
+    free(old);
+  }
+  slot = __cbs_table_find(table, key, to);
+  if (slot->epoch != table->epoch) {
+    table->count++;
+  }
+  slot->key = key;
+  slot->to = to;
+  slot->value = value;
+  slot->epoch = table->epoch;
+}
+
+void __cbs_table_destroy(struct cbs_table* table) {
+  free(table->slots);
+}
+
+int8_t __cbs_state_compare(howderek_array_value_t left, howderek_array_value_t right) {
+  const struct cbs_state* l = left;
+  const struct cbs_state* r = right;
+  if (l->f != r->f) {
+    return (l->f > r->f) - (l->f < r->f);
+  }
+  // Among equally short paths, the one that runs into the fewest robots
+  // splits the constraint tree the least
+  if (l->conflicts != r->conflicts) {
+    return (l->conflicts > r->conflicts) - (l->conflicts < r->conflicts);
+  }
+  // Then deeper first, they're closer to the goal
+  return (l->time < r->time) - (l->time > r->time);
+}
+
+int8_t __cbs_node_compare(howderek_array_value_t left, howderek_array_value_t right) {
+  const struct cbs_node* l = left;
+  const struct cbs_node* r = right;
+  return (l->cost > r->cost) - (l->cost < r->cost);
+}
+
+/**
+ * States live until the low level search is done, so they're taken from
+ * blocks in the scratch region and reset with it
+ */
+struct cbs_state* __cbs_state(struct cbs_search* search, void* region, uint32_t vertex, uint32_t time,
+                              struct cbs_state* parent) {
+  struct cbs_state* state;
+  uint32_t parked;
+  if (search->statesLeft == 0) {
+    search->states = howderek_allocate("cbs_states", region, sizeof(struct cbs_state) * CBS_STATE_BLOCK);
+    search->statesLeft = CBS_STATE_BLOCK;
+  }
+  state = search->states++;
+  search->statesLeft--;
+  state->vertex = vertex;
+  state->time = time;
+  state->f = time + search->heuristic[vertex];
+  // Without this every state that could arrive too early ties for the best
+  state->f = (state->f > search->earliest) ? state->f : search->earliest;
+  state->parent = parent;
+  state->conflicts = (parent != NULL) ? parent->conflicts : 0;
+  state->conflicts += __cbs_table_get(&search->avoid, __cbs_key(time, vertex), CBS_NO_VERTEX);
+  parked = __cbs_table_get(&search->avoid, __cbs_key(CBS_PARKED, vertex), CBS_NO_VERTEX);
+  state->conflicts += (parked != 0 && time >= parked - 1);
+  return state;
+}
+
+/**
+ * Queue the move from state to next unless a constraint forbids it
+ */
+void __cbs_expand(struct cbs_search* search, struct howderek_heap* open, void* region,
+                  struct cbs_state* state, uint32_t next) {
+  const uint32_t time = state->time + 1;
+  // Blocked spaces are unreachable too
+  if (search->heuristic[next] == WORLD_UNREACHABLE
+      || __cbs_table_get(&search->closed, __cbs_key(time, next), CBS_NO_VERTEX) != 0
+      || __cbs_table_get(&search->constraints, __cbs_key(time, next), CBS_NO_VERTEX) != 0
+      || (next != state->vertex
+          && __cbs_table_get(&search->constraints, __cbs_key(time, state->vertex), next) != 0)) {
+    return;
+  }
+  howderek_heap_push(open, __cbs_state(search, region, next, time, state));
+}
+
+/**
+ * Count the other robots at every step, so the low level can break ties
+ * toward paths that don't run into them
+ */
+void __cbs_avoid(struct cbs_search* search, struct cbs_node* node, uint32_t robot) {
+  struct cbs_table* avoid = &search->avoid;
+  uint32_t other;
+  uint32_t time;
+  uint32_t v;
+  __cbs_table_clear(avoid);
+  if (node == NULL) {
+    return;
+  }
+  for (other = 0; other < search->robotCount; other++) {
+    if (other == robot || node->paths[other] == NULL) {
+      continue;
+    }
+    for (time = 0; time < node->lengths[other]; time++) {
+      v = node->paths[other][time];
+      __cbs_table_set(avoid, __cbs_key(time, v), CBS_NO_VERTEX,
+                      __cbs_table_get(avoid, __cbs_key(time, v), CBS_NO_VERTEX) + 1);
+    }
+    // From its last step on it waits at its goal
+    v = node->paths[other][node->lengths[other] - 1];
+    __cbs_table_set(avoid, __cbs_key(CBS_PARKED, v), CBS_NO_VERTEX, node->lengths[other]);
+  }
+}
+
+/**
+ * Space-time A* for one robot, obeying its constraints. Waiting in place
+ * costs a step like moving does.
+ *
+ * \param search       the search
+ * \param region       what the path is allocated from
+ * \param robot        robot to plan
+ * \param node         constraints and the paths of the other robots, which
+ *                     are NULL until they're planned
+ * \param length       set to the positions in the path
+ * \return             vertex index at each step, NULL if there's no path
+ */
+uint32_t* __cbs_plan(struct cbs_search* search, void* region, uint32_t robot,
+                     struct cbs_node* node, uint32_t* length) {
+  struct cbs_constraint* constraints = (node != NULL) ? node->constraints : NULL;
+  const uint32_t goal = search->goals[robot];
+  const uint32_t* distances = search->distances[robot];
+  struct howderek_heap* open;
+  struct cbs_constraint* constraint;
+  struct cbs_state* state;
+  struct howderek_graph_edge* edge;
+  void* states = search->scratch;
+  uint32_t* path = NULL;
+  uint32_t lastGoalConstraint = 0;
+  uint32_t lastConstraint = 0;
+  uint32_t horizon;
+  uint64_t expanded = 0;
+  int goalConstrained = 0;
+
+  if (distances[search->starts[robot]] == WORLD_UNREACHABLE) {
+    return NULL;
+  }
+  __cbs_avoid(search, node, robot);
+  __cbs_table_clear(&search->constraints);
+  for (constraint = constraints; constraint != NULL; constraint = constraint->next) {
+    if (constraint->robot != robot) {
+      continue;
+    }
+    __cbs_table_set(&search->constraints, __cbs_key(constraint->time, constraint->vertex), constraint->to, 1);
+    lastConstraint = (constraint->time > lastConstraint) ? constraint->time : lastConstraint;
+    if (constraint->vertex == goal && constraint->to == CBS_NO_VERTEX) {
+      // It can't stop at the goal until nobody needs it to be elsewhere
+      goalConstrained = 1;
+      lastGoalConstraint = (constraint->time > lastGoalConstraint) ? constraint->time : lastGoalConstraint;
+    }
+  }
+  // After its last constraint a robot is free to take its shortest path,
+  // so waiting longer than that can't help
+  horizon = lastConstraint + search->vertexCount + 1;
+
+  search->heuristic = distances;
+  search->earliest = goalConstrained ? lastGoalConstraint + 1 : 0;
+  search->statesLeft = 0;
+  __cbs_table_clear(&search->closed);
+  open = howderek_heap_create(HOWDEREK_HEAP_DEFAULT_D, __cbs_state_compare);
+  howderek_heap_push(open, __cbs_state(search, states, search->starts[robot], 0, NULL));
+  while ((state = howderek_heap_pop(open)) != NULL) {
+    if (__cbs_table_get(&search->closed, __cbs_key(state->time, state->vertex), CBS_NO_VERTEX) != 0) {
+      continue;
+    }
+    __cbs_table_set(&search->closed, __cbs_key(state->time, state->vertex), CBS_NO_VERTEX, 1);
+    if (state->vertex == goal && (!goalConstrained || state->time > lastGoalConstraint)) {
+      *length = state->time + 1;
+      path = howderek_allocate("cbs_path", region, sizeof(uint32_t) * *length);
+      for (; state != NULL; state = state->parent) {
+        path[state->time] = state->vertex;
+      }
+      break;
+    }
+    if (++expanded % CBS_CLOCK_INTERVAL == 0 && __cbs_now() > search->deadline) {
+      search->timedOut = 1;
+      break;
+    }
+    if (state->time >= horizon) {
+      continue;
+    }
+    // Waiting is moving to the same vertex
+    __cbs_expand(search, open, states, state, state->vertex);
+    for (edge = search->world->graph->vertices[state->vertex]->edges; edge != NULL; edge = edge->next) {
+      __cbs_expand(search, open, states, state, edge->vertex->index);
+    }
+  }
+  howderek_heap_destroy(open, 0);
+  howderek_reset(states);
+  return path;
+}
+
+/**
+ * Where a robot is at a step, robots stay at their goals once they arrive
+ */
+uint32_t __cbs_at(struct cbs_node* node, uint32_t robot, uint32_t time) {
+  const uint32_t last = node->lengths[robot] - 1;
+  return node->paths[robot][(time < last) ? time : last];
+}
+
+/**
+ * Find the earliest conflict between two robots' paths by hashing where
+ * each robot is and which edge it took at every step
+ *
+ * \return 1 if there's a conflict
+ */
+int __cbs_find_conflict(struct cbs_search* search, struct cbs_node* node, struct cbs_conflict* conflict) {
+  uint32_t longest = 0;
+  uint32_t time;
+  uint32_t robot;
+  uint32_t other;
+  uint32_t from;
+  uint32_t to;
+
+  for (robot = 0; robot < search->robotCount; robot++) {
+    longest = (node->lengths[robot] > longest) ? node->lengths[robot] : longest;
+  }
+  __cbs_table_clear(&search->occupied);
+  for (time = 0; time < longest; time++) {
+    for (robot = 0; robot < search->robotCount; robot++) {
+      to = __cbs_at(node, robot, time);
+      other = __cbs_table_get(&search->occupied, __cbs_key(time, to), CBS_NO_VERTEX);
+      if (other != 0) {
+        conflict->robots[0] = other - 1;
+        conflict->robots[1] = robot;
+        conflict->vertices[0] = conflict->vertices[1] = to;
+        conflict->to[0] = conflict->to[1] = CBS_NO_VERTEX;
+        conflict->time = time;
+        return 1;
+      }
+      __cbs_table_set(&search->occupied, __cbs_key(time, to), CBS_NO_VERTEX, robot + 1);
+      if (time == 0 || (from = __cbs_at(node, robot, time - 1)) == to) {
+        continue;
+      }
+      // Another robot went the other way along the same edge
+      other = __cbs_table_get(&search->occupied, __cbs_key(time, to), from);
+      if (other != 0) {
+        conflict->robots[0] = other - 1;
+        conflict->robots[1] = robot;
+        conflict->vertices[0] = to;
+        conflict->to[0] = from;
+        conflict->vertices[1] = from;
+        conflict->to[1] = to;
+        conflict->time = time;
+        return 1;
+      }
+      __cbs_table_set(&search->occupied, __cbs_key(time, from), to, robot + 1);
+    }
+  }
+  return 0;
+}
+
+struct cbs_solution* __cbs_solution(struct cbs_search* search, struct cbs_node* node, uint64_t expanded) {
+  struct cbs_solution* solution = howderek_allocate_and_zero("cbs_solution", NULL, sizeof(struct cbs_solution));
+  uint32_t robot;
+  uint32_t time;
+  solution->robotCount = search->robotCount;
+  solution->cost = node->cost;
+  solution->expanded = expanded;
+  solution->lengths = howderek_allocate("cbs_solution_lengths", solution, sizeof(uint32_t) * search->robotCount);
+  solution->paths = howderek_allocate("cbs_solution_paths", solution, sizeof(position_t*) * search->robotCount);
+  for (robot = 0; robot < search->robotCount; robot++) {
+    solution->lengths[robot] = node->lengths[robot];
+    solution->paths[robot] = howderek_allocate("cbs_solution_path", solution,
+                                               sizeof(position_t) * node->lengths[robot]);
+    for (time = 0; time < node->lengths[robot]; time++) {
+      solution->paths[robot][time].bits = search->world->graph->vertices[node->paths[robot][time]]->id;
+    }
+  }
+  return solution;
+}
+
+uint64_t __cbs_cost(struct cbs_search* search, struct cbs_node* node) {
+  uint64_t cost = 0;
+  uint32_t robot;
+  for (robot = 0; robot < search->robotCount; robot++) {
+    cost += node->lengths[robot] - 1;
+  }
+  return cost;
+}
+
+struct cbs_node* __cbs_node(struct cbs_search* search, struct cbs_node* parent) {
+  struct cbs_node* node = howderek_allocate("cbs_node", search, sizeof(struct cbs_node));
+  node->paths = howderek_allocate("cbs_node_paths", search, sizeof(uint32_t*) * search->robotCount);
+  node->lengths = howderek_allocate("cbs_node_lengths", search, sizeof(uint32_t) * search->robotCount);
+  if (parent != NULL) {
+    memcpy(node->paths, parent->paths, sizeof(uint32_t*) * search->robotCount);
+    memcpy(node->lengths, parent->lengths, sizeof(uint32_t) * search->robotCount);
+    node->constraints = parent->constraints;
+  } else {
+    memset(node->paths, 0, sizeof(uint32_t*) * search->robotCount);
+    node->constraints = NULL;
+  }
+  return node;
+}
+
+struct cbs_solution* cbs_solve(struct world* w, double budget) {
+  HOWDEREK_TRACE_SCOPE("cbs_solve");
+  struct cbs_search* search = howderek_allocate_and_zero("cbs_search", NULL, sizeof(struct cbs_search));
+  struct cbs_solution* solution = NULL;
+  struct howderek_heap* open = howderek_heap_create(HOWDEREK_HEAP_DEFAULT_D, __cbs_node_compare);
+  struct cbs_conflict conflict;
+  struct cbs_constraint* constraint;
+  struct cbs_node* node;
+  struct cbs_node* child;
+  uint64_t expanded = 0;
+  position_t* goals;
+  uint32_t robot;
+  int i;
+
+  search->world = w;
+  search->robotCount = w->robotCount;
+  search->vertexCount = w->graph->vertex_map->count;
+  search->deadline = __cbs_now() + (uint64_t) (budget * 1e9);
+  search->scratch = howderek_allocate("cbs_plan", NULL, 1);
+  search->starts = howderek_allocate("cbs_starts", search, sizeof(uint32_t) * w->robotCount);
+  search->goals = howderek_allocate("cbs_goals", search, sizeof(uint32_t) * w->robotCount);
+  search->distances = howderek_allocate("cbs_distances", search, sizeof(uint32_t*) * w->robotCount);
+  goals = howderek_allocate("cbs_goal_positions", search, sizeof(position_t) * w->robotCount);
+  for (robot = 0; robot < w->robotCount; robot++) {
+    search->starts[robot] = w->robots[robot].pos->index;
+    search->goals[robot] = w->robots[robot].goal->index;
+    search->distances[robot] = howderek_allocate("cbs_distance", search, sizeof(uint32_t) * search->vertexCount);
+    goals[robot].bits = w->robots[robot].goal->id;
+  }
+  world_distances_many(w, goals, w->robotCount, search->distances, 0);
+  __cbs_table_init(&search->constraints, 64);
+  __cbs_table_init(&search->closed, 1024);
+  __cbs_table_init(&search->occupied, (size_t) w->robotCount * 64);
+  __cbs_table_init(&search->avoid, (size_t) w->robotCount * 64);
+
+  node = __cbs_node(search, NULL);
+  for (robot = 0; robot < w->robotCount; robot++) {
+    node->paths[robot] = __cbs_plan(search, search, robot, node, &node->lengths[robot]);
+    if (node->paths[robot] == NULL) {
+      if (!search->timedOut) {
+        howderek_log(HOWDEREK_LOG_INFO, "cbs: robot %u can't reach its goal", robot);
+      }
+      node = NULL;
+      break;
+    }
+  }
+  if (node != NULL) {
+    node->cost = __cbs_cost(search, node);
+    howderek_heap_push(open, node);
+  }
+
+  while ((node = howderek_heap_pop(open)) != NULL) {
+    if (!__cbs_find_conflict(search, node, &conflict)) {
+      solution = __cbs_solution(search, node, expanded);
+      break;
+    }
+    if (__cbs_now() > search->deadline) {
+      search->timedOut = 1;
+      break;
+    }
+    expanded++;
+    for (i = 0; i < 2; i++) {
+      child = __cbs_node(search, node);
+      constraint = howderek_allocate("cbs_constraint", search, sizeof(struct cbs_constraint));
+      constraint->robot = conflict.robots[i];
+      constraint->vertex = conflict.vertices[i];
+      constraint->to = conflict.to[i];
+      constraint->time = conflict.time;
+      constraint->next = node->constraints;
+      child->constraints = constraint;
+      robot = conflict.robots[i];
+      child->paths[robot] = __cbs_plan(search, search, robot, child, &child->lengths[robot]);
+      if (child->paths[robot] != NULL) {
+        child->cost = __cbs_cost(search, child);
+        howderek_heap_push(open, child);
+      }
+    }
+  }
+  if (solution == NULL && search->timedOut) {
+    howderek_log(HOWDEREK_LOG_INFO, "cbs: no solution for %u robots within %.3fs, %lu nodes expanded",
+                 w->robotCount, budget, expanded);
+  }
+
+  howderek_heap_destroy(open, 0);
+  __cbs_table_destroy(&search->constraints);
+  __cbs_table_destroy(&search->closed);
+  __cbs_table_destroy(&search->occupied);
+  __cbs_table_destroy(&search->avoid);
+  howderek_free(search->scratch);
+  howderek_free(search);
+  return solution;
+}
+
+void cbs_solution_destroy(struct cbs_solution* solution) {
+  howderek_free(solution);
+}
@@ -0,0 +1,45 @@
+/*! \file cbs.h
+ *  \brief Conflict-Based Search for any number of robots. Finds paths for
+ *         every robot in the world that never put two robots in the same
+ *         space at once or swap two robots along an edge, with the least
+ *         total number of moves and waits.
+ *
+ *  The high level searches a tree of constraints, cheapest first. Each node
+ *  plans every robot alone with space-time A*, obeying only that robot's
+ *  constraints. The first conflict between two of the paths splits the
+ *  node in two, forbidding it for one robot in each child.
+ *
+ *  struct cbs_solution* solution = cbs_solve(w, 0.5);
+ *  solution->paths[robot][t] is where robot is at step t
+ *  cbs_solution_destroy(solution);
+ */
+
+#pragma once
+
+#include "world.h"
+
+struct cbs_solution {
+  uint32_t robotCount;
+  uint32_t* lengths;                 // positions in each robot's path
+  position_t** paths;                // paths[robot][t], robots wait at their goals once their paths end
+  uint64_t cost;                     // moves and waits until every robot has arrived for good
+  uint64_t expanded;                 // constraint tree nodes expanded
+};
+
+/**
+ * Plan paths for every robot in the world
+ *
+ * \param w           the world, with robots added by world_add_robot
+ * \param budget      seconds to search for
+ *
+ * \return            the paths, NULL if a robot can't reach its goal or
+ *                    nothing was found within the budget
+ */
+struct cbs_solution* cbs_solve(struct world* w, double budget);
+
+/**
+ * Destroy a solution
+ *
+ * \param solution    the solution
+ */
+void cbs_solution_destroy(struct cbs_solution* solution);
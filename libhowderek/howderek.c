@@ -5,72 +5,221 @@
 #include <time.h>
 #include <stdint.h>
 #include <errno.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "howderek.h"
 
 
-howderek_log_level_t howderek_log(howderek_log_level_t level, const char* format, ...) {
+howderek_log_level_t __howderek_log_level = HOWDEREK_LOG_INFO;
 
-  static howderek_log_level_t logLevel = HOWDEREK_LOG_INFO;
-  char* prefix;
+/*
+ * Bounded multi-producer queue from Dmitry Vyukov. Each slot's sequence says
+ * whose turn it is: a producer may fill slot i when sequence == position,
+ * the writer may read it when sequence == position + 1. Producers never
+ * wait, a full ring drops the message.
+ */
+struct __howderek_log_slot {
+  size_t sequence;
+  howderek_log_level_t level;
+  time_t time;
+  clock_t clock;
+  char message[HOWDEREK_LOG_MESSAGE_SIZE];
+};
+
+static struct __howderek_log_slot __howderek_log_ring[HOWDEREK_LOG_RING_SIZE];
+static size_t __howderek_log_enqueue = 0;
+static size_t __howderek_log_dequeue = 0;
+static size_t __howderek_log_dropped = 0;
+static clock_t __howderek_log_last = 0;
+static int __howderek_log_stopping = 0;
+// Set while the background writer is running, otherwise messages are
+// written right away
+static int __howderek_log_async = 0;
+static pthread_once_t __howderek_log_once = PTHREAD_ONCE_INIT;
+// Only held by whoever is writing messages out, never by producers
+static pthread_mutex_t __howderek_log_writer = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t __howderek_log_thread;
+// The writer sleeps on this when the ring is empty. Producers only take the
+// lock to wake it when __howderek_log_sleeping says it's waiting.
+static pthread_mutex_t __howderek_log_wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t __howderek_log_wake = PTHREAD_COND_INITIALIZER;
+static int __howderek_log_sleeping = 0;
+
+const char* __howderek_log_prefix(howderek_log_level_t level) {
   switch (level) {
-    case HOWDEREK_LOG_SILENT:
-      return logLevel;
     case HOWDEREK_LOG_FATAL:
-      prefix = HOWDEREK_BOLD HOWDEREK_RED "fatal   " HOWDEREK_RESET;
-      break;
+      return HOWDEREK_BOLD HOWDEREK_RED "fatal   " HOWDEREK_RESET;
     case HOWDEREK_LOG_ERROR:
-      prefix = HOWDEREK_RED "error " HOWDEREK_RESET;
-      break;
+      return HOWDEREK_RED "error " HOWDEREK_RESET;
     case HOWDEREK_LOG_SUCCESS:
-      prefix = HOWDEREK_GREEN "success " HOWDEREK_RESET;
-      break;
+      return HOWDEREK_GREEN "success " HOWDEREK_RESET;
     case HOWDEREK_LOG_WARN:
-      prefix = HOWDEREK_YELLOW "warn  " HOWDEREK_RESET;
-      break;
+      return HOWDEREK_YELLOW "warn  " HOWDEREK_RESET;
     case HOWDEREK_LOG_INFO:
-      prefix = "info";
-      break;
+      return "info";
     case HOWDEREK_LOG_VERBOSE:
-      prefix = HOWDEREK_BLUE "verbose " HOWDEREK_RESET;
-      break;
+      return HOWDEREK_BLUE "verbose " HOWDEREK_RESET;
     case HOWDEREK_LOG_DEBUG:
-      prefix = HOWDEREK_CYAN "debug " HOWDEREK_RESET;
-      break;
-    case HOWDEREK_LOG_SET_LEVEL:
     default:
-      logLevel = level - HOWDEREK_LOG_SET_LEVEL;
-      return logLevel;
+      return HOWDEREK_CYAN "debug " HOWDEREK_RESET;
   }
+}
 
-  if (level <= logLevel && format != NULL) {
-    //Get the time
-    time_t t = time(NULL);
-    struct tm *tm = localtime(&t);
-    char timestring[64];
-    strftime(timestring, sizeof(timestring), "%c", tm);
+// Writes out everything queued so far, returns how many messages it wrote
+size_t __howderek_log_drain(void) {
+  struct __howderek_log_slot* slot;
+  char timestring[64];
+  size_t written = 0;
+  size_t dropped;
 
+  pthread_mutex_lock(&__howderek_log_writer);
+  for (;;) {
+    slot = &__howderek_log_ring[__howderek_log_dequeue & (HOWDEREK_LOG_RING_SIZE - 1)];
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != __howderek_log_dequeue + 1) {
+      break;
+    }
     //Time since last log
-    static clock_t start = 0;
-    size_t result = (clock() - start)/(CLOCKS_PER_SEC / 1000);
-    start = clock();
+    size_t result = (slot->clock - __howderek_log_last) / (CLOCKS_PER_SEC / 1000);
+    __howderek_log_last = slot->clock;
+    strftime(timestring, sizeof(timestring), "%c", localtime(&slot->time));
+    fprintf(stderr, "%-17s - %s - %-10lu %s\n", __howderek_log_prefix(slot->level), timestring, result, slot->message);
+    __atomic_store_n(&slot->sequence, __howderek_log_dequeue + HOWDEREK_LOG_RING_SIZE, __ATOMIC_RELEASE);
+    __howderek_log_dequeue++;
+    written++;
+  }
+  dropped = __atomic_exchange_n(&__howderek_log_dropped, 0, __ATOMIC_RELAXED);
+  if (dropped != 0) {
+    fprintf(stderr, "%-17s - %lu messages dropped, the log ring was full\n", __howderek_log_prefix(HOWDEREK_LOG_WARN), dropped);
+  }
+  pthread_mutex_unlock(&__howderek_log_writer);
+  return written;
+}
 
-    fprintf(stderr, "%-17s - %s - %-10lu ", prefix, timestring, result);
+int __howderek_log_ready(void) {
+  int ready;
+  pthread_mutex_lock(&__howderek_log_writer);
+  ready = __atomic_load_n(&__howderek_log_ring[__howderek_log_dequeue & (HOWDEREK_LOG_RING_SIZE - 1)].sequence,
+                          __ATOMIC_SEQ_CST) == __howderek_log_dequeue + 1;
+  pthread_mutex_unlock(&__howderek_log_writer);
+  return ready;
+}
 
-    va_list args;
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    va_end(args);
+void __howderek_log_signal(void) {
+  // The message was published with a seq_cst store, so either the writer
+  // sees it before it sleeps or we see it sleeping and wake it
+  if (__atomic_load_n(&__howderek_log_sleeping, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&__howderek_log_wake_lock);
+    pthread_cond_signal(&__howderek_log_wake);
+    pthread_mutex_unlock(&__howderek_log_wake_lock);
+  }
+}
 
-    fprintf(stderr, "\n");
+void* __howderek_log_run(void* unused) {
+  while (!__atomic_load_n(&__howderek_log_stopping, __ATOMIC_ACQUIRE)) {
+    if (__howderek_log_drain() != 0) {
+      continue;
+    }
+    pthread_mutex_lock(&__howderek_log_wake_lock);
+    __atomic_store_n(&__howderek_log_sleeping, 1, __ATOMIC_SEQ_CST);
+    if (!__howderek_log_ready() && !__atomic_load_n(&__howderek_log_stopping, __ATOMIC_ACQUIRE)) {
+      pthread_cond_wait(&__howderek_log_wake, &__howderek_log_wake_lock);
+    }
+    __atomic_store_n(&__howderek_log_sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&__howderek_log_wake_lock);
   }
+  return NULL;
+}
 
-  return logLevel;
+void __howderek_log_stop(void) {
+  __atomic_store_n(&__howderek_log_async, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&__howderek_log_stopping, 1, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&__howderek_log_wake_lock);
+  pthread_cond_signal(&__howderek_log_wake);
+  pthread_mutex_unlock(&__howderek_log_wake_lock);
+  pthread_join(__howderek_log_thread, NULL);
+  __howderek_log_drain();
+}
+
+void __howderek_log_start(void) {
+  size_t i;
+  for (i = 0; i < HOWDEREK_LOG_RING_SIZE; i++) {
+    __howderek_log_ring[i].sequence = i;
+  }
+  __howderek_log_last = clock();
+  if (pthread_create(&__howderek_log_thread, NULL, __howderek_log_run, NULL) == 0) {
+    __howderek_log_async = 1;
+    atexit(__howderek_log_stop);
+  }
+}
+
+howderek_log_level_t __howderek_log(howderek_log_level_t level, const char* format, ...) {
+  struct __howderek_log_slot* slot;
+  size_t position;
+  intptr_t turn;
+
+  if (level >= HOWDEREK_LOG_SET_LEVEL) {
+    howderek_set_log_level(level - HOWDEREK_LOG_SET_LEVEL);
+    return __howderek_log_level;
+  }
+  if (level == HOWDEREK_LOG_SILENT || format == NULL) {
+    return __howderek_log_level;
+  }
+  pthread_once(&__howderek_log_once, __howderek_log_start);
+
+  position = __atomic_load_n(&__howderek_log_enqueue, __ATOMIC_RELAXED);
+  for (;;) {
+    slot = &__howderek_log_ring[position & (HOWDEREK_LOG_RING_SIZE - 1)];
+    turn = (intptr_t) __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - (intptr_t) position;
+    if (turn == 0) {
+      if (__atomic_compare_exchange_n(&__howderek_log_enqueue, &position, position + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (turn < 0) {
+      __atomic_fetch_add(&__howderek_log_dropped, 1, __ATOMIC_RELAXED);
+      return __howderek_log_level;
+    } else {
+      position = __atomic_load_n(&__howderek_log_enqueue, __ATOMIC_RELAXED);
+    }
+  }
 
+  slot->level = level;
+  slot->time = time(NULL);
+  slot->clock = clock();
+  va_list args;
+  va_start(args, format);
+  vsnprintf(slot->message, sizeof(slot->message), format, args);
+  va_end(args);
+  __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_SEQ_CST);
+
+  // Fatal errors are usually followed by exit(), so don't leave them queued
+  if (level == HOWDEREK_LOG_FATAL || !__atomic_load_n(&__howderek_log_async, __ATOMIC_ACQUIRE)) {
+    howderek_log_flush();
+  } else {
+    __howderek_log_signal();
+  }
+  return __howderek_log_level;
+}
+
+void howderek_log_flush(void) {
+  const size_t position = __atomic_load_n(&__howderek_log_enqueue, __ATOMIC_ACQUIRE);
+  pthread_once(&__howderek_log_once, __howderek_log_start);
+  // Producers that claimed a slot before now may still be filling it in
+  for (;;) {
+    __howderek_log_drain();
+    pthread_mutex_lock(&__howderek_log_writer);
+    const int done = (__howderek_log_dequeue - position) < ((size_t) 1 << (sizeof(size_t) * 8 - 1));
+    pthread_mutex_unlock(&__howderek_log_writer);
+    if (done) {
+      break;
+    }
+    sched_yield();
+  }
 }
 
 void howderek_set_log_level(howderek_log_level_t level) {
-  howderek_log(HOWDEREK_LOG_SET_LEVEL + level, NULL);
+  __howderek_log_level = level;
 }
 
 void howderek_clear() {
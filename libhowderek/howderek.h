@@ -35,6 +35,25 @@ typedef enum {
   HOWDEREK_LOG_SET_LEVEL =  100
 } howderek_log_level_t;
 
+// Each of these can be overridden on its own with -D
+
+#ifndef HOWDEREK_LOG_COMPILED_LEVEL
+// Calls more verbose than this are removed at compile time, along with the
+// work of evaluating their arguments. Debug builds raise it to DEBUG.
+#define HOWDEREK_LOG_COMPILED_LEVEL HOWDEREK_LOG_INFO
+#endif
+#ifndef HOWDEREK_LOG_RING_SIZE
+// Messages waiting to be written, must be a power of two
+#define HOWDEREK_LOG_RING_SIZE 1024
+#endif
+#ifndef HOWDEREK_LOG_MESSAGE_SIZE
+// Longest message, longer ones are cut off
+#define HOWDEREK_LOG_MESSAGE_SIZE 256
+#endif
+
+// Most verbose level displayed right now, set with howderek_set_log_level
+extern howderek_log_level_t __howderek_log_level;
+
 /** log_level_t defines which log level should be displayed to stderr. */
 struct howderek_configuration_t {
   FILE* in;
@@ -52,12 +71,38 @@ struct howderek_configuration_t {
 void howderek_set_log_level(howderek_log_level_t level);
 
 /**
- * Logs an error
+ * Logs an error. Messages are formatted on the calling thread and written
+ * to stderr by a background thread, so logging never waits on the terminal.
+ * Fatal messages are written before howderek_log returns.
+ *
+ * Filtered out messages cost one comparison, and ones more verbose than
+ * HOWDEREK_LOG_COMPILED_LEVEL aren't compiled at all. Logging at
+ * HOWDEREK_LOG_SET_LEVEL + level sets the level like howderek_set_log_level.
+ *
+ * \param level     Log level (ERROR, WARN, INFO, VERBOSE, DEBUG) of the error
+ * \param message   Error message
+ */
+#define howderek_log(level, ...)                                                   \
+  do {                                                                             \
+    if ((level) >= HOWDEREK_LOG_SET_LEVEL                                          \
+        || (((level) <= HOWDEREK_LOG_COMPILED_LEVEL) && ((level) <= __howderek_log_level))) { \
+      __howderek_log((level), __VA_ARGS__);                                        \
+    }                                                                              \
+  } while (0)
+
+/**
+ * Logs an error without checking the level first, use howderek_log
  *
  * \param level     Log level (ERROR, WARN, INFO, VERBOSE, DEBUG) of the error
  * \param message   Error message
  */
-howderek_log_level_t howderek_log(howderek_log_level_t level, const char* message, ...);
+howderek_log_level_t __howderek_log(howderek_log_level_t level, const char* message, ...)
+  __attribute__((format(printf, 2, 3)));
+
+/**
+ * Wait until every message logged so far has been written
+ */
+void howderek_log_flush(void);
 
 /**
  * Sets what level should be logged
@@ -21,6 +21,7 @@ struct howderek_array* howderek_array_create(size_t size) {
   struct howderek_array* newArray;
   newArray = malloc(sizeof(struct howderek_array));
   newArray->count = 0;
+  newArray->end = 0;
   newArray->array = NULL;
   howderek_array_grow(newArray, size);
   return newArray;
@@ -185,9 +186,11 @@ howderek_array_value_t howderek_array_remove(struct howderek_array* array, size_
   if (index == array->end) {
     size_t pos;
     // We have to find the new last value
-    for (pos = array->size - 1 ;pos != SIZE_MAX; pos--) {
+    array->end = 0;
+    for (pos = index - 1; pos != SIZE_MAX; pos--) {
       if (howderek_array_get(array, pos) != HOWDEREK_ARRAY_EMPTY_VALUE) {
         array->end = pos;
+        break;
       }
     }
   }
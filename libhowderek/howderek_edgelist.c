@@ -0,0 +1,313 @@
+/*! \file howderek_edgelist.c
+ *  \brief Loads weighted edge lists straight into frozen graphs
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "howderek.h"
+#include "howderek_memory.h"
+#include "howderek_edgelist.h"
+
+struct __howderek_edgelist_edges {
+  uint32_t* sources;
+  uint32_t* targets;
+  double* weights;
+  uint64_t count;
+  uint64_t capacity;
+};
+
+
+
+void* __howderek_edgelist_alloc(void* old, size_t size) {
+  void* result = realloc(old, size);
+  if (result == NULL) {
+    howderek_log(HOWDEREK_LOG_FATAL, "libhowderek_edgelist: allocation failed for %lu bytes", size);
+    exit(ENOMEM);
+  }
+  return result;
+}
+
+
+
+void __howderek_edgelist_reserve(struct __howderek_edgelist_edges* edges, uint64_t capacity) {
+  edges->capacity = capacity;
+  edges->sources = __howderek_edgelist_alloc(edges->sources, sizeof(uint32_t) * capacity);
+  edges->targets = __howderek_edgelist_alloc(edges->targets, sizeof(uint32_t) * capacity);
+  edges->weights = __howderek_edgelist_alloc(edges->weights, sizeof(double) * capacity);
+}
+
+
+
+static inline const char* __howderek_edgelist_skip(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+    p++;
+  }
+  return p;
+}
+
+
+
+// Reads an unsigned integer, returns NULL if there are no digits or too
+// many to fit
+static inline const char* __howderek_edgelist_integer(const char* p, const char* end, uint64_t* value) {
+  const char* start = p;
+  uint64_t result = 0;
+  unsigned digit;
+  while (p < end && (digit = (unsigned char) *p - '0') < 10) {
+    result = result * 10 + digit;
+    p++;
+  }
+  if (p == start || p - start > 19) {
+    return NULL;
+  }
+  *value = result;
+  return p;
+}
+
+
+
+// Reads a weight, an optionally negative integer with an optional fraction
+static inline const char* __howderek_edgelist_weight(const char* p, const char* end, double* value) {
+  const int negative = (p < end && *p == '-');
+  uint64_t whole;
+  uint64_t fraction = 0;
+  double scale = 1.0;
+  unsigned digit;
+  p = __howderek_edgelist_integer(p + negative, end, &whole);
+  if (p == NULL) {
+    return NULL;
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && (digit = (unsigned char) *p - '0') < 10 && scale < 1e18; p++) {
+      fraction = fraction * 10 + digit;
+      scale *= 10.0;
+    }
+  }
+  *value = (whole + fraction / scale) * (negative ? -1.0 : 1.0);
+  return p;
+}
+
+
+
+uint64_t __howderek_edgelist_line(const char* start, const char* at) {
+  uint64_t line = 1;
+  for (; start < at; start++) {
+    line += (*start == '\n');
+  }
+  return line;
+}
+
+
+
+enum howderek_edgelist_status __howderek_edgelist_parse(const char* path, const char* text, const char* end,
+                                                         uint64_t* vertexCount,
+                                                         struct __howderek_edgelist_edges* edges) {
+  const char* p = __howderek_edgelist_skip(text, end);
+  uint64_t source, target;
+  double weight;
+
+  if (p == end) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_edgelist: %s is empty", path);
+    return HOWDEREK_EDGELIST_EMPTY_INPUT_FILE;
+  }
+  p = __howderek_edgelist_integer(p, end, vertexCount);
+  if (p == NULL || *vertexCount >= HOWDEREK_GRAPH_NO_VERTEX) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_edgelist: %s:1: expected the number of vertices", path);
+    return HOWDEREK_EDGELIST_INVALID_FORMAT;
+  }
+  if (*vertexCount == 0) {
+    return HOWDEREK_EDGELIST_OK;
+  }
+
+  while ((p = __howderek_edgelist_skip(p, end)) < end) {
+    const char* line = p;
+    if (*p != '(') {
+      goto invalid;
+    }
+    p = __howderek_edgelist_integer(__howderek_edgelist_skip(p + 1, end), end, &source);
+    if (p == NULL || (p = __howderek_edgelist_skip(p, end)) == end || *p != ',') {
+      goto invalid;
+    }
+    p = __howderek_edgelist_integer(__howderek_edgelist_skip(p + 1, end), end, &target);
+    if (p == NULL || (p = __howderek_edgelist_skip(p, end)) == end) {
+      goto invalid;
+    }
+    weight = 1.0;
+    if (*p == ',') {
+      p = __howderek_edgelist_weight(__howderek_edgelist_skip(p + 1, end), end, &weight);
+      if (p == NULL || (p = __howderek_edgelist_skip(p, end)) == end) {
+        goto invalid;
+      }
+    }
+    if (*p != ')') {
+      goto invalid;
+    }
+    p++;
+    if (source == 0 || target == 0 || source > *vertexCount || target > *vertexCount) {
+      howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_edgelist: %s:%lu: vertices are numbered 1 to %lu",
+                   path, __howderek_edgelist_line(text, line), *vertexCount);
+      return HOWDEREK_EDGELIST_INTEGER_IS_NOT_A_VERTEX;
+    }
+
+    if (edges->count == edges->capacity) {
+      __howderek_edgelist_reserve(edges, edges->capacity * 2);
+    }
+    edges->sources[edges->count] = source - 1;
+    edges->targets[edges->count] = target - 1;
+    edges->weights[edges->count] = weight;
+    edges->count++;
+    continue;
+
+invalid:
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_edgelist: %s:%lu: expected (from,to) or (from,to,weight)",
+                 path, __howderek_edgelist_line(text, line));
+    return HOWDEREK_EDGELIST_INVALID_FORMAT;
+  }
+  return HOWDEREK_EDGELIST_OK;
+}
+
+
+
+struct howderek_graph_frozen* __howderek_edgelist_build(uint32_t vertexCount,
+                                                        enum howderek_graph_type type,
+                                                        struct __howderek_edgelist_edges* edges) {
+  struct howderek_graph_frozen* frozen = howderek_allocate_and_zero("graph_frozen", NULL, sizeof(struct howderek_graph_frozen));
+  const int undirected = (type == HOWDEREK_GRAPH_UNDIRECTED);
+  uint64_t* next;
+  uint64_t e, slot;
+  uint32_t v;
+
+  frozen->vertexCount = vertexCount;
+  frozen->edgeCount = edges->count << undirected;
+  frozen->type = type;
+  frozen->ids = howderek_allocate("graph_frozen_ids", frozen, sizeof(uint64_t) * vertexCount);
+  frozen->offsets = howderek_allocate_and_zero("graph_frozen_offsets", frozen, sizeof(uint64_t) * (vertexCount + 1));
+  frozen->targets = howderek_allocate("graph_frozen_targets", frozen, sizeof(uint32_t) * frozen->edgeCount);
+  frozen->weights = howderek_allocate("graph_frozen_weights", frozen, sizeof(double) * frozen->edgeCount);
+  for (v = 0; v < vertexCount; v++) {
+    frozen->ids[v] = (uint64_t) v + 1;
+  }
+
+  // Counting sort by source, which keeps each vertex's edges in file order
+  for (e = 0; e < edges->count; e++) {
+    frozen->offsets[edges->sources[e] + 1]++;
+    if (undirected) {
+      frozen->offsets[edges->targets[e] + 1]++;
+    }
+  }
+  for (v = 0; v < vertexCount; v++) {
+    frozen->offsets[v + 1] += frozen->offsets[v];
+  }
+  next = __howderek_edgelist_alloc(NULL, sizeof(uint64_t) * vertexCount);
+  memcpy(next, frozen->offsets, sizeof(uint64_t) * vertexCount);
+  for (e = 0; e < edges->count; e++) {
+    slot = next[edges->sources[e]]++;
+    frozen->targets[slot] = edges->targets[e];
+    frozen->weights[slot] = edges->weights[e];
+    if (undirected) {
+      slot = next[edges->targets[e]]++;
+      frozen->targets[slot] = edges->sources[e];
+      frozen->weights[slot] = edges->weights[e];
+    }
+  }
+  free(next);
+  return frozen;
+}
+
+
+
+struct howderek_graph_frozen* howderek_edgelist_load(const char* path,
+                                                     enum howderek_graph_type type,
+                                                     enum howderek_edgelist_status* status) {
+  struct __howderek_edgelist_edges edges;
+  struct howderek_graph_frozen* frozen = NULL;
+  enum howderek_edgelist_status result;
+  struct stat info;
+  uint64_t vertexCount = 0;
+  uint64_t estimate;
+  char* text;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_edgelist: could not open %s", path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    result = HOWDEREK_EDGELIST_FAILED_TO_OPEN;
+    goto done;
+  }
+  if (info.st_size == 0) {
+    // Zero length mappings aren't allowed
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_edgelist: %s is empty", path);
+    close(fd);
+    result = HOWDEREK_EDGELIST_EMPTY_INPUT_FILE;
+    goto done;
+  }
+  text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (close(fd) != 0) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_edgelist: could not close %s", path);
+    if (text != MAP_FAILED) {
+      munmap(text, info.st_size);
+    }
+    result = HOWDEREK_EDGELIST_FAILED_TO_CLOSE;
+    goto done;
+  }
+  if (text == MAP_FAILED) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_edgelist: could not map %s", path);
+    result = HOWDEREK_EDGELIST_FAILED_TO_OPEN;
+    goto done;
+  }
+  madvise(text, info.st_size, MADV_SEQUENTIAL);
+
+  // Most edges take 16 bytes or more, like "(1234,5678,1.5)\n". Files of
+  // short edges just grow the arrays a few times instead of every file
+  // reserving for the 6 byte "(1,2)\n".
+  memset(&edges, 0, sizeof(edges));
+  estimate = info.st_size / 16;
+  if (estimate < HOWDEREK_EDGELIST_MIN_EDGES) {
+    estimate = HOWDEREK_EDGELIST_MIN_EDGES;
+  } else if (estimate > HOWDEREK_EDGELIST_MAX_RESERVED_EDGES) {
+    estimate = HOWDEREK_EDGELIST_MAX_RESERVED_EDGES;
+  }
+  __howderek_edgelist_reserve(&edges, estimate);
+  result = __howderek_edgelist_parse(path, text, text + info.st_size, &vertexCount, &edges);
+  munmap(text, info.st_size);
+  if (result == HOWDEREK_EDGELIST_OK) {
+    frozen = __howderek_edgelist_build(vertexCount, type, &edges);
+  }
+  free(edges.sources);
+  free(edges.targets);
+  free(edges.weights);
+
+done:
+  if (status != NULL) {
+    *status = result;
+  }
+  return frozen;
+}
+
+
+
+const char* howderek_edgelist_status_string(enum howderek_edgelist_status status) {
+  switch (status) {
+    case HOWDEREK_EDGELIST_OK:
+      return "ok";
+    case HOWDEREK_EDGELIST_FAILED_TO_OPEN:
+      return "input file failed to open";
+    case HOWDEREK_EDGELIST_FAILED_TO_CLOSE:
+      return "input file failed to close";
+    case HOWDEREK_EDGELIST_EMPTY_INPUT_FILE:
+      return "empty input file";
+    case HOWDEREK_EDGELIST_INTEGER_IS_NOT_A_VERTEX:
+      return "integer is not a vertex";
+    case HOWDEREK_EDGELIST_INVALID_FORMAT:
+      return "invalid format";
+  }
+  return "unknown";
+}
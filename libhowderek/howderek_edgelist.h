@@ -0,0 +1,70 @@
+/*! \file howderek_edgelist.h
+ *  \brief Loads weighted edge lists straight into frozen graphs
+ *
+ *  Edge lists are the text format used by the HW3 tests: the number of
+ *  vertices on the first line, then one edge per line. Vertices are numbered
+ *  1 to N and the weight is optional (1 if missing).
+ *
+ *     3
+ *     (1,2,5)
+ *     (2,3)
+ *
+ *  The file is mapped and scanned once, then the edges are sorted into a CSR
+ *  graph with a counting sort, so nothing is allocated per edge.
+*/
+
+#ifndef H_LIBHOWDEREK_EDGELIST_H
+#define H_LIBHOWDEREK_EDGELIST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "howderek.h"
+#include "howderek_graph.h"
+
+#ifndef HOWDEREK_EDGELIST_MIN_EDGES
+// Edges to make room for before the size of the file is taken into account
+#define HOWDEREK_EDGELIST_MIN_EDGES 1024
+#endif
+#ifndef HOWDEREK_EDGELIST_MAX_RESERVED_EDGES
+// Most edges to make room for up front, past this the arrays double as the
+// file is read
+#define HOWDEREK_EDGELIST_MAX_RESERVED_EDGES (1 << 20)
+#endif
+
+/*
+ * Values match the exit codes the HW3 tests expect, so they can be passed
+ * straight to exit()
+ */
+enum howderek_edgelist_status {
+  HOWDEREK_EDGELIST_OK = 0,
+  HOWDEREK_EDGELIST_FAILED_TO_OPEN = 2,
+  HOWDEREK_EDGELIST_FAILED_TO_CLOSE = 3,
+  HOWDEREK_EDGELIST_EMPTY_INPUT_FILE = 4,
+  HOWDEREK_EDGELIST_INTEGER_IS_NOT_A_VERTEX = 7,
+  HOWDEREK_EDGELIST_INVALID_FORMAT = 8
+};
+
+/**
+ * Load an edge list into a frozen graph. Vertex ids are the numbers in the
+ * file, so vertex n has index n - 1. A vertex count of 0 gives an empty
+ * graph and the rest of the file isn't read.
+ *
+ * \param path    file to load
+ * \param type    HOWDEREK_GRAPH_UNDIRECTED to add every edge both ways
+ * \param status  set to why loading failed, may be NULL
+ * \return        graph to free with howderek_graph_frozen_destroy, NULL if
+ *                loading failed
+ */
+struct howderek_graph_frozen* howderek_edgelist_load(const char* path,
+                                                     enum howderek_graph_type type,
+                                                     enum howderek_edgelist_status* status);
+
+/**
+ * Describe a status
+ *
+ * \param status  status to describe
+ */
+const char* howderek_edgelist_status_string(enum howderek_edgelist_status status);
+
+#endif
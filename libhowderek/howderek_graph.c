@@ -5,12 +5,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "howderek.h"
 #include "howderek_memory.h"
-#include "howderek_kv.h"
+#include "howderek_idmap.h"
+#include "howderek_hashmap.h"
 #include "howderek_skiplist.h"
 #include "howderek_heap.h"
 #include "howderek_graph.h"
+#include "howderek_parallel.h"
+#include "howderek_trace.h"
+
+// Vertices each thread takes at a time in the parallel BFS
+#define __HOWDEREK_GRAPH_BFS_CHUNK 256
+#define __HOWDEREK_GRAPH_BIT(bitmap, v)  ((bitmap)[(v) >> 6] & ((uint64_t) 1 << ((v) & 63)))
 
  /**
  * Create a graph
@@ -26,9 +39,10 @@
 struct howderek_graph* howderek_graph_create(enum howderek_graph_type type, int expectedCount) {
   expectedCount = (expectedCount >= 0) ? expectedCount : 0;
   struct howderek_graph* graph =  malloc(sizeof(struct howderek_graph));
-  graph->vertex_map = howderek_kv_create(expectedCount, HOWDEREK_KV_ARRAY);
-  graph->vertex_map = howderek_kv_create(expectedCount, HOWDEREK_KV_ARRAY);
-  graph->vertex_map = howderek_kv_create(expectedCount, HOWDEREK_KV_ARRAY);
+  graph->vertex_map = howderek_idmap_create(expectedCount);
+  graph->vertices = malloc(sizeof(struct howderek_graph_vertex*) * graph->vertex_map->capacity);
+  graph->count = 0;
+  graph->paths = NULL;
   graph->root = NULL;
   graph->type = type;
   return graph;
@@ -37,7 +51,8 @@ struct howderek_graph* howderek_graph_create(enum howderek_graph_type type, int
 
 
 struct howderek_graph_vertex* howderek_graph_get(struct howderek_graph* graph, uint64_t key) {
-  return howderek_kv_get(graph->vertex_map, key);
+  const uint32_t index = howderek_idmap_get(graph->vertex_map, key);
+  return (index == HOWDEREK_IDMAP_NOT_FOUND) ? NULL : graph->vertices[index];
 }
 
 
@@ -68,10 +83,12 @@ int howderek_graph_delete(struct howderek_graph* graph, uint64_t key) {
     return 0;
   } else {
     if (vertex == graph->root) {
-      graph->root = vertex->edges->vertex;
+      graph->root = (vertex->edges != NULL) ? vertex->edges->vertex : NULL;
     }
+    // The index stays reserved for this id
+    graph->vertices[vertex->index] = NULL;
+    graph->count--;
     __howderek_graph_destroy_vertex(vertex);
-    howderek_kv_delete(graph->vertex_map, key);
     return 1;
   }
 }
@@ -79,16 +96,22 @@ int howderek_graph_delete(struct howderek_graph* graph, uint64_t key) {
 
 
 void howderek_graph_destroy(struct howderek_graph** graphPtr, int freeData) {
-  struct howderek_kv_iter iter;
-  howderek_kv_fill_iter((*graphPtr)->vertex_map, &iter);
-  while (howderek_kv_iterate((*graphPtr)->vertex_map, &iter)) {
-    struct howderek_graph_vertex* vertex = iter.value;
-    if (freeData) {
+  uint32_t i;
+  for (i = 0; i < (*graphPtr)->vertex_map->count; i++) {
+    struct howderek_graph_vertex* vertex = (*graphPtr)->vertices[i];
+    if (vertex == NULL) {
+      continue;
+    }
+    if (freeData || HOWDEREK_GRAPH_DATA_ALLOCATED(vertex->status)) {
       free(vertex->data);
     }
     __howderek_graph_destroy_vertex(vertex);
   }
-  howderek_kv_destroy((*graphPtr)->vertex_map, 0);
+  if ((*graphPtr)->paths != NULL) {
+    howderek_graph_paths_destroy((*graphPtr)->paths);
+  }
+  howderek_idmap_destroy((*graphPtr)->vertex_map);
+  free((*graphPtr)->vertices);
   free(*graphPtr);
   *graphPtr = NULL;
 }
@@ -101,20 +124,46 @@ void howderek_graph_destroy(struct howderek_graph** graphPtr, int freeData) {
  * \param data   pointer to data to store
  */
 struct howderek_graph_vertex* howderek_graph_add_vertex(struct howderek_graph* graph, uint64_t key, void* data) {
+  const uint32_t capacity = graph->vertex_map->capacity;
+  const uint32_t known = graph->vertex_map->count;
+  const uint32_t index = howderek_idmap_insert(graph->vertex_map, key);
+  if (graph->vertex_map->capacity != capacity) {
+    // Keep vertices the same size as the id map
+    graph->vertices = realloc(graph->vertices, sizeof(struct howderek_graph_vertex*) * graph->vertex_map->capacity);
+  }
+  if (index < known && graph->vertices[index] != NULL) {
+    // Already in the graph, only the data changes so edges stay valid
+    graph->vertices[index]->data = data;
+    return graph->vertices[index];
+  }
   struct howderek_graph_vertex* vertex = malloc(sizeof(struct howderek_graph_vertex));
   vertex->id = key;
+  vertex->index = index;
   vertex->data = data;
   vertex->status = 0;
   vertex->edges = NULL;
   if (graph->root == NULL) {
     graph->root = vertex;
   }
-  howderek_kv_set(graph->vertex_map, key, vertex);
+  graph->vertices[index] = vertex;
+  graph->count++;
   return vertex;
 }
 
 
 
+void* howderek_graph_set_data(struct howderek_graph_vertex* vertex, void* data, uint64_t size) {
+  if (HOWDEREK_GRAPH_DATA_ALLOCATED(vertex->status)) {
+    free(vertex->data);
+  }
+  vertex->data = malloc(size);
+  memcpy(vertex->data, data, size);
+  vertex->status |= HOWDEREK_GRAPH_ALLOCATED;
+  return vertex->data;
+}
+
+
+
 struct howderek_graph_edge* howderek_graph_add_edge_by_id(struct howderek_graph* graph, uint64_t begin,
                                                    uint64_t end, double weight) {
   struct howderek_graph_vertex* from = howderek_graph_get(graph, begin);
@@ -154,25 +203,30 @@ struct howderek_graph* howderek_graph_clone_without_data(struct howderek_graph*
   if (graph == NULL) {
     return howderek_graph_create(HOWDEREK_GRAPH_UNDIRECTED, 0);
   }
-  struct howderek_graph* newGraph = howderek_graph_create(HOWDEREK_GRAPH_UNDIRECTED, graph->vertex_map->count);
-  howderek_graph_add_vertex(newGraph, graph->root->id, NULL);
-  struct howderek_kv_iter iter;
-  howderek_kv_fill_iter(graph->vertex_map, &iter);
-  while (howderek_kv_iterate(graph->vertex_map, &iter)) {
-    if (iter.key != graph->root->id) {
-      howderek_graph_add_vertex(newGraph, iter.key, NULL);
+  struct howderek_graph* newGraph = howderek_graph_create(graph->type, graph->vertex_map->count);
+  struct howderek_graph_vertex* vertex;
+  struct howderek_graph_edge* edge;
+  uint32_t i;
+  // Same insertion order, so indices match when nothing was deleted
+  for (i = 0; i < graph->vertex_map->count; i++) {
+    if (graph->vertices[i] != NULL) {
+      howderek_graph_add_vertex(newGraph, graph->vertices[i]->id, NULL);
     }
   }
-  howderek_kv_fill_iter(graph->vertex_map, &iter);
-  while (howderek_kv_iterate(graph->vertex_map, &iter)) {
-    struct howderek_graph_vertex* vertex = ((struct howderek_graph_vertex*)(iter.value));
-    struct howderek_graph_edge* edge = vertex->edges;
-    while (edge != NULL) {
-      howderek_graph_add_edge_by_id(newGraph, iter.key, edge->vertex->id, edge->weight);
-      edge = edge->next;
+  for (i = 0; i < graph->vertex_map->count; i++) {
+    vertex = graph->vertices[i];
+    if (vertex == NULL) {
+      continue;
     }
+    for (edge = vertex->edges; edge != NULL; edge = edge->next) {
+      // Reverse edges are already in the list, so add each one as directed
+      howderek_graph_add_edge(NULL, howderek_graph_get(newGraph, vertex->id),
+                              howderek_graph_get(newGraph, edge->vertex->id), edge->weight);
+    }
+  }
+  if (graph->root != NULL) {
+    newGraph->root = howderek_graph_get(newGraph, graph->root->id);
   }
-  newGraph->root = howderek_graph_get(newGraph, graph->root->id);
   return newGraph;
 }
 
@@ -190,34 +244,6 @@ struct howderek_graph_search_result howderek_graph_search(
     struct howderek_graph_vertex* to);
 
 
-int8_t __howderek_graph_weighted_distance_compare(howderek_array_value_t left, howderek_array_value_t right) {
-  struct howderek_graph_vertex* u = left;
-  struct howderek_graph_vertex* v = right;
-
-  if (u != NULL &&
-      v != NULL &&
-      u->id != HOWDEREK_HASHMAP_NULL_ID &&
-      v->id != HOWDEREK_HASHMAP_NULL_ID &&
-      u->data != NULL &&
-      v->data != NULL) {
-
-    struct howderek_graph_pathfinding_data* uData = u->data;
-    struct howderek_graph_pathfinding_data* vData = v->data;
-
-    if (u->id == v->id) {
-      return 0;
-    } else {
-      int8_t result = (uData->weightedDistance == vData->weightedDistance) ? 0 : ((uData->weightedDistance > vData->weightedDistance) ? 1 : -1);
-      return result;
-    }
-
-  } else if (u != NULL && v != NULL) {
-    return u->id - v->id;
-  } else {
-    return -1;
-  }
-}
-
 void __howderek_weight_display(howderek_array_value_t distances_as_void_ptr) {
   struct howderek_graph_pathfinding_data* distances = distances_as_void_ptr;
   if (isfinite(distances->weightedDistance)) {
@@ -254,105 +280,258 @@ int8_t __howderek_graph_weighted_compare(howderek_array_value_t left, howderek_a
 }
 
 struct howderek_graph* howderek_graph_dijkstra(struct howderek_graph* graph, uint64_t starting) {
+  HOWDEREK_TRACE_SCOPE("howderek_graph_dijkstra");
   struct howderek_graph* distanceGraph = howderek_graph_clone_without_data(graph);
   distanceGraph->onDataDisplay = __howderek_weight_display;
-  struct howderek_heap* queue = howderek_heap_create(0, __howderek_graph_weighted_distance_compare);
   struct howderek_graph_pathfinding_data* dataPool =  malloc(sizeof(struct howderek_graph_pathfinding_data)
                                                              * distanceGraph->vertex_map->count);
-  uint64_t k = 0;
-  struct howderek_kv_iter iter;
-  howderek_kv_fill_iter(graph->vertex_map, &iter);
-
-  while (howderek_kv_iterate(distanceGraph->vertex_map, &iter)) {
-    dataPool[k].distance = HOWDEREK_HASHMAP_INFINITY;
-    dataPool[k].weightedDistance = INFINITY;
-    dataPool[k].predecessor = NULL;
-    struct howderek_graph_vertex* currentVertex = iter.value;
-    currentVertex->data = &dataPool[k];
-    howderek_heap_push(queue, currentVertex);
-    k++;
-  }
+  // Searching with our own paths leaves the vertex status bits alone, so
+  // this can run while other threads search the same graph
+  struct howderek_graph_paths* paths = howderek_graph_paths_create(distanceGraph->vertex_map->count);
+  uint32_t i;
+
   if (starting == 0) {
      starting = graph->root->id;
   }
-  struct howderek_graph_vertex* parentVertex = howderek_graph_get(distanceGraph, starting);
-  const enum howderek_vertex_status unvisitedColor = HOWDEREK_GRAPH_COLOR(parentVertex->status);
-  const enum howderek_vertex_status visitedColor = (unvisitedColor == HOWDEREK_GRAPH_BLACK) ? HOWDEREK_GRAPH_WHITE : HOWDEREK_GRAPH_BLACK;
-  HOWDEREK_GRAPH_SET_COLOR(parentVertex->status, visitedColor);
-  // Set the distance of the first node to 0
-  struct howderek_graph_pathfinding_data* parentDistance = parentVertex->data;
-  parentDistance->distance = 0;
-  parentDistance->weightedDistance = 0.0f;
-  // Make sure it will be in the front of the queue
-  howderek_heap_push(queue, parentVertex);
-  struct howderek_graph_vertex* currentVertex;
-  while ((currentVertex = howderek_heap_pop(queue))) {
-    if (HOWDEREK_GRAPH_COLOR(currentVertex->status) != visitedColor) {
-      struct howderek_graph_edge* iter = currentVertex->edges;
-      while (iter != NULL) {
-        struct howderek_graph_pathfinding_data* storedDistances = iter->vertex->data;
-        double distance = ((struct howderek_graph_pathfinding_data*)currentVertex->data)->weightedDistance + iter->weight;
-        if (distance < storedDistances->weightedDistance) {
-          storedDistances->predecessor = currentVertex;
-          storedDistances->weightedDistance = distance;
-          storedDistances->distance = ceil(distance);
-          howderek_heap_push(queue, iter->vertex);
-        }
-        iter = iter->next;
-      }
-      parentVertex = currentVertex;
+  // This used to heapify every vertex at once with howderek_heap_build.
+  // dijkstra_to only queues a vertex once it's reached, so the heap holds
+  // the frontier rather than the whole graph and there's nothing to build.
+  howderek_graph_dijkstra_to(distanceGraph, starting, NULL, 0, paths);
+  for (i = 0; i < distanceGraph->vertex_map->count; i++) {
+    struct howderek_graph_vertex* currentVertex = distanceGraph->vertices[i];
+    if (currentVertex == NULL) {
+      continue;
+    }
+    const double distance = howderek_graph_paths_distance(paths, i);
+    const uint32_t predecessor = howderek_graph_paths_predecessor(paths, i);
+    dataPool[i].weightedDistance = distance;
+    if (distance == INFINITY) {
+      dataPool[i].distance = HOWDEREK_HASHMAP_INFINITY;
+    } else {
+      dataPool[i].distance = ceil(distance);
     }
+    dataPool[i].predecessor = (predecessor == HOWDEREK_GRAPH_NO_VERTEX) ? NULL : distanceGraph->vertices[predecessor];
+    currentVertex->data = &dataPool[i];
   }
+  howderek_graph_paths_destroy(paths);
   return distanceGraph;
 }
 
-struct howderek_graph_pathfinding_data* __howderek_graph_create_distance(double weighted,
-                                                          uint64_t unweighted,
-                                                          struct howderek_graph_vertex* pred) {
-  struct howderek_graph_pathfinding_data* distanceData = malloc(sizeof(struct howderek_graph_pathfinding_data));
-  distanceData->distance = unweighted;
-  distanceData->weightedDistance = weighted;
-  distanceData->predecessor = pred;
-  return distanceData;
+int8_t __howderek_graph_queue_compare(howderek_array_value_t left, howderek_array_value_t right) {
+  const double l = ((struct howderek_graph_queue_entry*) left)->key;
+  const double r = ((struct howderek_graph_queue_entry*) right)->key;
+  return (l > r) - (l < r);
 }
 
 
-void howderek_graph_bfs(struct howderek_graph* graph,
-                        uint64_t starting) {
+
+struct howderek_graph_paths* howderek_graph_paths_create(uint32_t vertexCount) {
+  struct howderek_graph_paths* paths = howderek_allocate_and_zero("graph_paths", NULL, sizeof(struct howderek_graph_paths));
+  paths->vertexCount = vertexCount;
+  paths->epoch = 1;
+  paths->stamp = howderek_allocate_and_zero("graph_paths_stamp", paths, sizeof(uint32_t) * vertexCount);
+  paths->distance = howderek_allocate("graph_paths_distance", paths, sizeof(double) * vertexCount);
+  paths->predecessor = howderek_allocate("graph_paths_predecessor", paths, sizeof(uint32_t) * vertexCount);
+  paths->queue = howderek_allocate("graph_paths_queue", paths, sizeof(uint32_t) * vertexCount);
+  paths->heap = howderek_heap_create(HOWDEREK_HEAP_DEFAULT_D, __howderek_graph_queue_compare);
+  paths->freeEntries = NULL;
+  return paths;
+}
+
+
+
+void howderek_graph_paths_destroy(struct howderek_graph_paths* paths) {
+  howderek_heap_destroy(paths->heap, 0);
+  howderek_destroy(paths);
+}
+
+
+
+void howderek_graph_paths_clear(struct howderek_graph_paths* paths) {
+  if (++paths->epoch == 0) {
+    // Once every 2^32 searches the stamps have to be cleared for real
+    memset(paths->stamp, 0, sizeof(uint32_t) * paths->vertexCount);
+    paths->epoch = 1;
+  }
+}
+
+
+
+void __howderek_graph_paths_reset(struct howderek_graph_paths* paths, uint32_t source) {
+  struct howderek_graph_queue_entry* entry;
+  howderek_graph_paths_clear(paths);
+  // Entries left over from an early exit go back on the free list
+  while ((entry = howderek_heap_pop(paths->heap)) != NULL) {
+    entry->next = paths->freeEntries;
+    paths->freeEntries = entry;
+  }
+  howderek_graph_paths_set(paths, source, 0.0, HOWDEREK_GRAPH_NO_VERTEX);
+}
+
+
+
+void __howderek_graph_paths_push(struct howderek_graph_paths* paths, uint32_t vertex,
+                                  double distance, double key) {
+  struct howderek_graph_queue_entry* entry;
+  size_t i;
+  if (paths->freeEntries == NULL) {
+    // Entries come from the paths' region, so they are freed with it
+    entry = howderek_allocate("graph_paths_entry", paths,
+                              sizeof(struct howderek_graph_queue_entry) * HOWDEREK_GRAPH_ENTRY_BLOCK);
+    for (i = 0; i < HOWDEREK_GRAPH_ENTRY_BLOCK; i++) {
+      entry[i].next = paths->freeEntries;
+      paths->freeEntries = &entry[i];
+    }
+  }
+  entry = paths->freeEntries;
+  paths->freeEntries = entry->next;
+  entry->vertex = vertex;
+  entry->distance = distance;
+  entry->key = key;
+  howderek_heap_push(paths->heap, entry);
+}
+
+
+
+int __howderek_graph_compare_indices(const void* left, const void* right) {
+  const uint32_t l = *(const uint32_t*) left;
+  const uint32_t r = *(const uint32_t*) right;
+  return (l > r) - (l < r);
+}
+
+
+
+struct howderek_graph_paths* howderek_graph_pooled_paths(struct howderek_graph* graph) {
+  if (graph->paths != NULL && graph->paths->vertexCount < graph->vertex_map->count) {
+    howderek_graph_paths_destroy(graph->paths);
+    graph->paths = NULL;
+  }
+  if (graph->paths == NULL) {
+    graph->paths = howderek_graph_paths_create(graph->vertex_map->capacity);
+  }
+  return graph->paths;
+}
+
+
+
+uint32_t howderek_graph_dijkstra_to(struct howderek_graph* graph,
+                                    uint64_t starting,
+                                    const uint64_t* targets,
+                                    size_t targetCount,
+                                    struct howderek_graph_paths* paths) {
+  HOWDEREK_TRACE_SCOPE("howderek_graph_dijkstra_to");
   struct howderek_graph_vertex* startingVertex = howderek_graph_get(graph, starting);
+  struct howderek_graph_queue_entry* entry;
+  struct howderek_graph_edge* edge;
+  uint32_t* goals = NULL;
+  uint32_t goalCount = 0;
+  uint32_t result = HOWDEREK_GRAPH_NO_VERTEX;
+  size_t i;
+
   if (startingVertex == NULL) {
     startingVertex = graph->root;
   }
-  startingVertex->data = __howderek_graph_create_distance(0.0, 0, NULL);
-  struct howderek_array* queue = howderek_array_create(1);
-  const enum howderek_vertex_status unvisitedColor = HOWDEREK_GRAPH_COLOR(startingVertex->status);
-  const enum howderek_vertex_status visitedColor = (unvisitedColor == HOWDEREK_GRAPH_BLACK) ? HOWDEREK_GRAPH_WHITE : HOWDEREK_GRAPH_BLACK;
-  howderek_array_push(queue, startingVertex);
-  while (queue->count > 0) {
-    struct howderek_graph_vertex* parent = howderek_array_dequeue(queue);
-    if (parent == NULL || HOWDEREK_GRAPH_COLOR(parent->status) == visitedColor) {
+  paths = (paths != NULL) ? paths : howderek_graph_pooled_paths(graph);
+  if (paths->vertexCount < graph->vertex_map->count) {
+    howderek_log(HOWDEREK_LOG_ERROR, "%s: paths hold %u vertices, the graph has %u", __func__,
+                 paths->vertexCount, graph->vertex_map->count);
+    return HOWDEREK_GRAPH_NO_VERTEX;
+  }
+  if (targetCount != 0) {
+    // Sorted so each settled vertex is checked with a binary search
+    goals = malloc(sizeof(uint32_t) * targetCount);
+    for (i = 0; i < targetCount; i++) {
+      const uint32_t index = howderek_idmap_get(graph->vertex_map, targets[i]);
+      if (index != HOWDEREK_IDMAP_NOT_FOUND && graph->vertices[index] != NULL) {
+        goals[goalCount++] = index;
+      }
+    }
+    qsort(goals, goalCount, sizeof(uint32_t), __howderek_graph_compare_indices);
+    if (goalCount == 0) {
+      free(goals);
+      return HOWDEREK_GRAPH_NO_VERTEX;
+    }
+  }
+
+  __howderek_graph_paths_reset(paths, startingVertex->index);
+  __howderek_graph_paths_push(paths, startingVertex->index, 0.0, 0.0);
+  while ((entry = howderek_heap_pop(paths->heap)) != NULL) {
+    const uint32_t u = entry->vertex;
+    const double distance = entry->distance;
+    entry->next = paths->freeEntries;
+    paths->freeEntries = entry;
+    if (distance > howderek_graph_paths_distance(paths, u)) {
       continue;
     }
-    struct howderek_graph_edge* iter = parent->edges;
-    while (iter != NULL) {
-      uint64_t potentialDistance = ((struct howderek_graph_pathfinding_data*)(parent->data))->distance + 1;
-      if ((iter->vertex->data != NULL
-          && potentialDistance < ((struct howderek_graph_pathfinding_data*)(iter->vertex->data))->distance)
-          || iter->vertex->data == NULL) {
-        if (iter->vertex->data == NULL) {
-          iter->vertex->data = __howderek_graph_create_distance(0.0, potentialDistance, parent);
-        } else {
-          ((struct howderek_graph_pathfinding_data*)(iter->vertex->data))->distance = potentialDistance;
-          ((struct howderek_graph_pathfinding_data*)(iter->vertex->data))->predecessor = parent;
-        }
+    if (goals != NULL && bsearch(&u, goals, goalCount, sizeof(uint32_t), __howderek_graph_compare_indices) != NULL) {
+      result = u;
+      break;
+    }
+    for (edge = graph->vertices[u]->edges; edge != NULL; edge = edge->next) {
+      const uint32_t v = edge->vertex->index;
+      const double candidate = distance + edge->weight;
+      if (candidate < howderek_graph_paths_distance(paths, v)) {
+        howderek_graph_paths_set(paths, v, candidate, u);
+        __howderek_graph_paths_push(paths, v, candidate, candidate);
       }
-      if (HOWDEREK_GRAPH_COLOR(iter->vertex->status) == unvisitedColor) {
-        HOWDEREK_GRAPH_SET_COLOR(iter->vertex->status, HOWDEREK_GRAPH_GREY);
-        howderek_array_push(queue, iter->vertex);
+    }
+  }
+  free(goals);
+  return result;
+}
+
+
+
+size_t howderek_graph_paths_path(struct howderek_graph_paths* paths, uint32_t target,
+                                 uint32_t* path, size_t maxLength) {
+  size_t length = 0;
+  size_t i;
+  uint32_t v;
+  if (target >= paths->vertexCount || howderek_graph_paths_distance(paths, target) == INFINITY) {
+    return 0;
+  }
+  for (v = target; v != HOWDEREK_GRAPH_NO_VERTEX; v = howderek_graph_paths_predecessor(paths, v)) {
+    length++;
+  }
+  if (path != NULL && length <= maxLength) {
+    i = length;
+    for (v = target; v != HOWDEREK_GRAPH_NO_VERTEX; v = howderek_graph_paths_predecessor(paths, v)) {
+      path[--i] = v;
+    }
+  }
+  return length;
+}
+
+
+
+void howderek_graph_bfs(struct howderek_graph* graph,
+                        uint64_t starting,
+                        struct howderek_graph_paths* paths) {
+  struct howderek_graph_vertex* startingVertex = howderek_graph_get(graph, starting);
+  struct howderek_graph_edge* iter;
+  uint32_t head = 0;
+  uint32_t tail = 0;
+  if (startingVertex == NULL) {
+    startingVertex = graph->root;
+  }
+  if (paths->vertexCount < graph->vertex_map->count) {
+    howderek_log(HOWDEREK_LOG_ERROR, "%s: paths hold %u vertices, the graph has %u", __func__,
+                 paths->vertexCount, graph->vertex_map->count);
+    return;
+  }
+  __howderek_graph_paths_reset(paths, startingVertex->index);
+  // Every vertex is queued at most once, so the queue never wraps
+  paths->queue[tail++] = startingVertex->index;
+  while (head < tail) {
+    const uint32_t parent = paths->queue[head++];
+    const double next = paths->distance[parent] + 1;
+    for (iter = graph->vertices[parent]->edges; iter != NULL; iter = iter->next) {
+      const uint32_t child = iter->vertex->index;
+      if (paths->stamp[child] != paths->epoch) {
+        howderek_graph_paths_set(paths, child, next, parent);
+        paths->queue[tail++] = child;
       }
-      iter = iter->next;
     }
-    HOWDEREK_GRAPH_SET_COLOR(parent->status, visitedColor);
   }
 }
 
@@ -396,31 +575,986 @@ void howderek_graph_display_vertex_info(struct howderek_graph_vertex* vertex,
 
 
 
-struct howderek_graph* howderek_graph_import(FILE* input, enum howderek_graph_type type);
+/**
+ * Bytes a graph file with this header takes
+ *
+ * \return 0 if the sizes in the header overflow
+ */
+uint64_t __howderek_graph_file_size(struct howderek_graph_file* header) {
+  uint64_t payload;
+  uint64_t size;
+  // Edge and vertex counts are checked against the largest file there can
+  // be first, so only the payload can overflow
+  if (header->vertexCount > UINT64_MAX / 64 || header->edgeCount > UINT64_MAX / 64
+      || __builtin_mul_overflow(header->payloadSize, header->vertexCount, &payload) || payload > UINT64_MAX / 2) {
+    return 0;
+  }
+  size = sizeof(struct howderek_graph_file)
+       + sizeof(uint64_t) * header->vertexCount
+       + sizeof(uint64_t) * (header->vertexCount + 1)
+       + HOWDEREK_GRAPH_FILE_PAD(sizeof(uint32_t) * header->edgeCount)
+       + sizeof(double) * header->edgeCount;
+  return (payload > UINT64_MAX / 2 - size) ? 0 : size + HOWDEREK_GRAPH_FILE_PAD(payload);
+}
+
+
+
+/**
+ * Check a graph file's header
+ *
+ * \param header    the header
+ * \param fileSize  bytes in the file, 0 if it can't be told
+ * \return          1 if the sections it describes fit in the file
+ */
+int __howderek_graph_file_check(struct howderek_graph_file* header, uint64_t fileSize) {
+  uint64_t size;
+  if (memcmp(header->magic, HOWDEREK_GRAPH_FILE_MAGIC, sizeof(header->magic)) != 0
+      || header->version != HOWDEREK_GRAPH_FILE_VERSION
+      || header->vertexCount >= HOWDEREK_GRAPH_NO_VERTEX) {
+    return 0;
+  }
+  size = __howderek_graph_file_size(header);
+  return size != 0 && (fileSize == 0 || size <= fileSize);
+}
+
+
+
+/**
+ * Check the arrays of a graph file, so searches never index past them.
+ * Offsets have to start at 0, never go down and end at edgeCount, every
+ * target has to be a vertex and ids have to be sorted with no repeats.
+ *
+ * \return 1 if they're consistent
+ */
+int __howderek_graph_csr_check(uint64_t vertexCount, uint64_t edgeCount, const uint64_t* ids,
+                               const uint64_t* offsets, const uint32_t* targets) {
+  uint64_t i;
+  if (offsets[0] != 0 || offsets[vertexCount] != edgeCount) {
+    return 0;
+  }
+  for (i = 0; i < vertexCount; i++) {
+    if (offsets[i] > offsets[i + 1] || (i > 0 && ids[i - 1] >= ids[i])) {
+      return 0;
+    }
+  }
+  for (i = 0; i < edgeCount; i++) {
+    if (targets[i] >= vertexCount) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+
+int __howderek_graph_read(FILE* input, void* to, uint64_t size) {
+  char padding[8];
+  if (fread(to, 1, size, input) != size) {
+    return 0;
+  }
+  size = HOWDEREK_GRAPH_FILE_PAD(size) - size;
+  return fread(padding, 1, size, input) == size;
+}
+
+
+
+struct howderek_graph* howderek_graph_import(FILE* input, enum howderek_graph_type type) {
+  struct howderek_graph_file header;
+  struct howderek_graph* graph;
+  struct howderek_graph_vertex* vertex;
+  struct howderek_graph_edge* edge;
+  uint64_t* ids = NULL;
+  uint64_t* offsets = NULL;
+  uint32_t* targets = NULL;
+  double* weights = NULL;
+  char* payload = NULL;
+  uint64_t v, e;
+  struct stat info;
+  uint64_t fileSize = 0;
+
+  // Regular files can be checked against their size before anything is allocated
+  if (fstat(fileno(input), &info) == 0 && S_ISREG(info.st_mode) && info.st_size > ftell(input)) {
+    fileSize = info.st_size - ftell(input);
+  }
+  if (fread(&header, sizeof(header), 1, input) != 1 || !__howderek_graph_file_check(&header, fileSize)) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_graph: not a graph file (version %d)", HOWDEREK_GRAPH_FILE_VERSION);
+    errno = EINVAL;
+    return NULL;
+  }
+  ids = malloc(sizeof(uint64_t) * header.vertexCount + 1);
+  offsets = malloc(sizeof(uint64_t) * (header.vertexCount + 1));
+  targets = malloc(sizeof(uint32_t) * header.edgeCount + 1);
+  weights = malloc(sizeof(double) * header.edgeCount + 1);
+  payload = malloc(header.payloadSize * header.vertexCount + 1);
+  if (ids == NULL || offsets == NULL || targets == NULL || weights == NULL || payload == NULL
+      || !__howderek_graph_read(input, ids, sizeof(uint64_t) * header.vertexCount)
+      || !__howderek_graph_read(input, offsets, sizeof(uint64_t) * (header.vertexCount + 1))
+      || !__howderek_graph_read(input, targets, sizeof(uint32_t) * header.edgeCount)
+      || !__howderek_graph_read(input, weights, sizeof(double) * header.edgeCount)
+      || !__howderek_graph_read(input, payload, header.payloadSize * header.vertexCount)) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_graph: graph file is truncated");
+    graph = NULL;
+    goto done;
+  }
+  if (!__howderek_graph_csr_check(header.vertexCount, header.edgeCount, ids, offsets, targets)) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_graph: graph file has edges out of range");
+    errno = EINVAL;
+    graph = NULL;
+    goto done;
+  }
+
+  graph = howderek_graph_create((type != 0) ? type : (enum howderek_graph_type) header.type, header.vertexCount);
+  for (v = 0; v < header.vertexCount; v++) {
+    vertex = howderek_graph_add_vertex(graph, ids[v], NULL);
+    if (header.payloadSize != 0) {
+      howderek_graph_set_data(vertex, payload + header.payloadSize * v, header.payloadSize);
+    }
+  }
+  for (v = 0; v < header.vertexCount; v++) {
+    vertex = graph->vertices[v];
+    // Build each list back to front so edges keep their order without
+    // walking the list for every append
+    for (e = offsets[v + 1]; e > offsets[v]; e--) {
+      edge = malloc(sizeof(struct howderek_graph_edge));
+      edge->vertex = graph->vertices[targets[e - 1]];
+      edge->weight = weights[e - 1];
+      edge->next = vertex->edges;
+      vertex->edges = edge;
+    }
+  }
+
+done:
+  free(ids);
+  free(offsets);
+  free(targets);
+  free(weights);
+  free(payload);
+  return graph;
+}
+
+
 
 
 
 struct howderek_skip* howderek_graph_index_skiplist(struct howderek_graph* graph, struct howderek_skip* skiplist) {
   skiplist = (skiplist == NULL) ? howderek_skip_create() : skiplist;
-  struct howderek_kv_iter iter;
-  howderek_kv_fill_iter(graph->vertex_map, &iter);
-  while (howderek_kv_iterate(graph->vertex_map, &iter)) {
-    howderek_skip_push(skiplist, iter.key, iter.value);
+  uint32_t i;
+  for (i = 0; i < graph->vertex_map->count; i++) {
+    if (graph->vertices[i] != NULL) {
+      howderek_skip_push(skiplist, graph->vertices[i]->id, graph->vertices[i]);
+    }
   }
   return skiplist;
 }
 
 
 
-int howderek_graph_export(struct howderek_graph* graph, FILE* output);
+int howderek_graph_export(struct howderek_graph* graph, FILE* output) {
+  struct howderek_graph_frozen* frozen = howderek_graph_freeze(graph);
+  int result = howderek_graph_frozen_export(frozen, output, 0);
+  howderek_graph_frozen_destroy(frozen);
+  return result;
+}
+
+
 
 
 
 void howderek_graph_display(struct howderek_graph* graph) {
-  printf("Graph Type: %s\n\nInternal KV\n", (graph->type == HOWDEREK_GRAPH_UNDIRECTED) ? "Undirected" : "Directed");
-  struct howderek_kv_iter iter;
-  howderek_kv_fill_iter(graph->vertex_map, &iter);
-  while (howderek_kv_iterate(graph->vertex_map, &iter)) {
-    howderek_graph_display_vertex_info(iter.value, NULL);
+  printf("Graph Type: %s\n\nVerticies\n", (graph->type == HOWDEREK_GRAPH_UNDIRECTED) ? "Undirected" : "Directed");
+  uint32_t i;
+  for (i = 0; i < graph->vertex_map->count; i++) {
+    if (graph->vertices[i] != NULL) {
+      howderek_graph_display_vertex_info(graph->vertices[i], NULL);
+    }
+  }
+}
+
+
+
+int __howderek_graph_compare_vertex_ids(const void* left, const void* right) {
+  uint64_t l = (*(struct howderek_graph_vertex* const*) left)->id;
+  uint64_t r = (*(struct howderek_graph_vertex* const*) right)->id;
+  return (l > r) - (l < r);
+}
+
+
+
+struct howderek_graph_frozen* howderek_graph_freeze(struct howderek_graph* graph) {
+  struct howderek_graph_frozen* frozen = howderek_allocate_and_zero("graph_frozen", NULL, sizeof(struct howderek_graph_frozen));
+  struct howderek_graph_vertex** vertices = malloc(sizeof(struct howderek_graph_vertex*) * (graph->count + 1));
+  struct howderek_graph_edge* edge;
+  uint64_t e = 0;
+  uint32_t v = 0;
+  uint32_t i;
+
+  for (i = 0; i < graph->vertex_map->count; i++) {
+    if (graph->vertices[i] != NULL) {
+      vertices[v++] = graph->vertices[i];
+    }
+  }
+  qsort(vertices, v, sizeof(struct howderek_graph_vertex*), __howderek_graph_compare_vertex_ids);
+
+  frozen->vertexCount = v;
+  frozen->type = graph->type;
+  frozen->ids = howderek_allocate("graph_frozen_ids", frozen, sizeof(uint64_t) * v);
+  frozen->data = howderek_allocate("graph_frozen_data", frozen, sizeof(howderek_array_value_t) * v);
+  frozen->offsets = howderek_allocate("graph_frozen_offsets", frozen, sizeof(uint64_t) * (v + 1));
+  for (v = 0; v < frozen->vertexCount; v++) {
+    frozen->ids[v] = vertices[v]->id;
+    frozen->data[v] = vertices[v]->data;
+    frozen->offsets[v] = e;
+    for (edge = vertices[v]->edges; edge != NULL; edge = edge->next) {
+      e++;
+    }
+  }
+  frozen->offsets[v] = e;
+  frozen->edgeCount = e;
+
+  // Edges are copied in list order, targets are found with a binary search
+  // now that the ids are sorted
+  frozen->targets = howderek_allocate("graph_frozen_targets", frozen, sizeof(uint32_t) * e);
+  frozen->weights = howderek_allocate("graph_frozen_weights", frozen, sizeof(double) * e);
+  for (v = 0, e = 0; v < frozen->vertexCount; v++) {
+    for (edge = vertices[v]->edges; edge != NULL; edge = edge->next, e++) {
+      frozen->targets[e] = howderek_graph_frozen_index(frozen, edge->vertex->id);
+      frozen->weights[e] = edge->weight;
+    }
+  }
+  free(vertices);
+  return frozen;
+}
+
+
+
+void howderek_graph_frozen_destroy(struct howderek_graph_frozen* graph) {
+  if (graph->mapping != NULL) {
+    munmap(graph->mapping, graph->mappingSize);
+  }
+  howderek_destroy(graph);
+}
+
+
+
+int __howderek_graph_pad(FILE* output, uint64_t size) {
+  const char padding[8] = { 0 };
+  size = HOWDEREK_GRAPH_FILE_PAD(size) - size;
+  return fwrite(padding, 1, size, output) == size;
+}
+
+
+
+int __howderek_graph_write(FILE* output, const void* from, uint64_t size) {
+  if (size != 0 && fwrite(from, 1, size, output) != size) {
+    return 0;
+  }
+  return __howderek_graph_pad(output, size);
+}
+
+
+
+int howderek_graph_frozen_export(struct howderek_graph_frozen* graph, FILE* output, uint64_t payloadSize) {
+  struct howderek_graph_file header;
+  uint32_t v;
+  int success;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, HOWDEREK_GRAPH_FILE_MAGIC, sizeof(header.magic));
+  header.version = HOWDEREK_GRAPH_FILE_VERSION;
+  header.type = graph->type;
+  header.vertexCount = graph->vertexCount;
+  header.edgeCount = graph->edgeCount;
+  header.payloadSize = payloadSize;
+
+  success = __howderek_graph_write(output, &header, sizeof(header))
+         && __howderek_graph_write(output, graph->ids, sizeof(uint64_t) * graph->vertexCount)
+         && __howderek_graph_write(output, graph->offsets, sizeof(uint64_t) * (graph->vertexCount + 1))
+         && __howderek_graph_write(output, graph->targets, sizeof(uint32_t) * graph->edgeCount)
+         && __howderek_graph_write(output, graph->weights, sizeof(double) * graph->edgeCount);
+  if (success && payloadSize != 0) {
+    char* zeros = calloc(1, payloadSize);
+    for (v = 0; v < graph->vertexCount && success; v++) {
+      void* data = howderek_graph_frozen_payload(graph, v);
+      success = fwrite((data != NULL) ? data : zeros, 1, payloadSize, output) == payloadSize;
+    }
+    free(zeros);
+    success = success && __howderek_graph_pad(output, payloadSize * graph->vertexCount);
+  }
+  if (!success) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_graph: failed to write graph file");
+    return EIO;
+  }
+  return 0;
+}
+
+
+
+struct howderek_graph_frozen* howderek_graph_frozen_map(const char* path) {
+  struct howderek_graph_frozen* frozen;
+  struct howderek_graph_file* header;
+  struct stat info;
+  char* mapping;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0 || fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(struct howderek_graph_file)) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_graph: could not open graph file %s", path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return NULL;
+  }
+  mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file alive
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_graph: could not map graph file %s", path);
+    return NULL;
+  }
+
+  header = (struct howderek_graph_file*) mapping;
+  if (!__howderek_graph_file_check(header, info.st_size)) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_graph: %s is not a valid graph file", path);
+    munmap(mapping, info.st_size);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  frozen = howderek_allocate_and_zero("graph_frozen", NULL, sizeof(struct howderek_graph_frozen));
+  frozen->mapping = mapping;
+  frozen->mappingSize = info.st_size;
+  frozen->vertexCount = header->vertexCount;
+  frozen->edgeCount = header->edgeCount;
+  frozen->type = header->type;
+  frozen->payloadSize = header->payloadSize;
+  mapping += sizeof(struct howderek_graph_file);
+  frozen->ids = (uint64_t*) mapping;
+  mapping += sizeof(uint64_t) * frozen->vertexCount;
+  frozen->offsets = (uint64_t*) mapping;
+  mapping += sizeof(uint64_t) * (frozen->vertexCount + 1);
+  frozen->targets = (uint32_t*) mapping;
+  mapping += HOWDEREK_GRAPH_FILE_PAD(sizeof(uint32_t) * frozen->edgeCount);
+  frozen->weights = (double*) mapping;
+  mapping += sizeof(double) * frozen->edgeCount;
+  frozen->payload = (frozen->payloadSize != 0) ? mapping : NULL;
+  // Every search trusts the arrays, so a corrupt file is caught here once
+  if (!__howderek_graph_csr_check(frozen->vertexCount, frozen->edgeCount, frozen->ids, frozen->offsets,
+                                  frozen->targets)) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_graph: %s has edges out of range", path);
+    howderek_graph_frozen_destroy(frozen);
+    errno = EINVAL;
+    return NULL;
+  }
+  return frozen;
+}
+
+
+
+uint32_t howderek_graph_frozen_index(struct howderek_graph_frozen* graph, uint64_t id) {
+  uint32_t low = 0;
+  uint32_t high = graph->vertexCount;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (graph->ids[mid] < id) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return (low < graph->vertexCount && graph->ids[low] == id) ? low : HOWDEREK_GRAPH_NO_VERTEX;
+}
+
+
+
+void howderek_graph_frozen_bfs(struct howderek_graph_frozen* graph, uint32_t source,
+                               struct howderek_graph_paths* paths) {
+  uint32_t head = 0;
+  uint32_t tail = 0;
+  uint64_t e;
+  __howderek_graph_paths_reset(paths, source);
+  paths->queue[tail++] = source;
+  while (head < tail) {
+    const uint32_t u = paths->queue[head++];
+    const double next = paths->distance[u] + 1;
+    for (e = graph->offsets[u]; e < graph->offsets[u + 1]; e++) {
+      const uint32_t v = graph->targets[e];
+      if (paths->stamp[v] != paths->epoch) {
+        howderek_graph_paths_set(paths, v, next, u);
+        paths->queue[tail++] = v;
+      }
+    }
+  }
+}
+
+
+
+struct __howderek_graph_bfs_state {
+  struct howderek_graph_frozen* graph;
+  struct howderek_graph_paths* paths;
+  struct howderek_barrier barrier;
+  uint32_t source;
+  uint64_t words;                    // 64 vertices per bitmap word
+  uint64_t* visited;
+  uint64_t* frontier;                // bottom-up only
+  uint64_t* next;                    // bottom-up only
+  uint32_t* queue;                   // top-down only
+  uint32_t* nextQueue;               // top-down only
+  uint32_t queueCount;
+  uint32_t nextCount;
+  uint64_t nextEdges;                // edges leaving the next frontier
+  uint64_t unexploredEdges;          // edges leaving unvisited vertices
+  uint64_t cursor;                   // next chunk of work
+  double level;
+  int bottomUp;
+  int done;
+};
+
+
+
+void __howderek_graph_bfs_flush(struct __howderek_graph_bfs_state* state, uint32_t* buffer, uint32_t count) {
+  const uint32_t at = __atomic_fetch_add(&state->nextCount, count, __ATOMIC_RELAXED);
+  memcpy(state->nextQueue + at, buffer, sizeof(uint32_t) * count);
+}
+
+
+
+void __howderek_graph_bfs_top_down(struct __howderek_graph_bfs_state* state) {
+  struct howderek_graph_frozen* graph = state->graph;
+  struct howderek_graph_paths* paths = state->paths;
+  uint32_t buffer[__HOWDEREK_GRAPH_BFS_CHUNK];
+  uint32_t count = 0;
+  uint64_t edges = 0;
+  uint64_t begin, i, e;
+
+  while ((begin = __atomic_fetch_add(&state->cursor, __HOWDEREK_GRAPH_BFS_CHUNK, __ATOMIC_RELAXED)) < state->queueCount) {
+    const uint64_t end = (begin + __HOWDEREK_GRAPH_BFS_CHUNK < state->queueCount)
+                       ? begin + __HOWDEREK_GRAPH_BFS_CHUNK : state->queueCount;
+    for (i = begin; i < end; i++) {
+      const uint32_t u = state->queue[i];
+      for (e = graph->offsets[u]; e < graph->offsets[u + 1]; e++) {
+        const uint32_t v = graph->targets[e];
+        uint64_t* word = &state->visited[v >> 6];
+        const uint64_t bit = (uint64_t) 1 << (v & 63);
+        // Check before claiming, most neighbours are already visited
+        if ((__atomic_load_n(word, __ATOMIC_RELAXED) & bit) == 0
+            && (__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit) == 0) {
+          paths->distance[v] = state->level + 1;
+          paths->predecessor[v] = u;
+          edges += graph->offsets[v + 1] - graph->offsets[v];
+          buffer[count++] = v;
+          if (count == __HOWDEREK_GRAPH_BFS_CHUNK) {
+            __howderek_graph_bfs_flush(state, buffer, count);
+            count = 0;
+          }
+        }
+      }
+    }
+  }
+  __howderek_graph_bfs_flush(state, buffer, count);
+  __atomic_fetch_add(&state->nextEdges, edges, __ATOMIC_RELAXED);
+}
+
+
+
+void __howderek_graph_bfs_bottom_up(struct __howderek_graph_bfs_state* state) {
+  struct howderek_graph_frozen* graph = state->graph;
+  struct howderek_graph_paths* paths = state->paths;
+  const uint64_t chunkWords = __HOWDEREK_GRAPH_BFS_CHUNK / 64;
+  uint32_t count = 0;
+  uint64_t edges = 0;
+  uint64_t begin, w, e;
+
+  // Each word of visited and next belongs to one thread, so no atomics
+  while ((begin = __atomic_fetch_add(&state->cursor, chunkWords, __ATOMIC_RELAXED)) < state->words) {
+    const uint64_t end = (begin + chunkWords < state->words) ? begin + chunkWords : state->words;
+    for (w = begin; w < end; w++) {
+      uint64_t unvisited = ~state->visited[w];
+      if (w == state->words - 1 && (graph->vertexCount & 63) != 0) {
+        unvisited &= ((uint64_t) 1 << (graph->vertexCount & 63)) - 1;
+      }
+      while (unvisited != 0) {
+        const uint32_t v = (w << 6) + __builtin_ctzll(unvisited);
+        unvisited &= unvisited - 1;
+        for (e = graph->offsets[v]; e < graph->offsets[v + 1]; e++) {
+          const uint32_t u = graph->targets[e];
+          if (__HOWDEREK_GRAPH_BIT(state->frontier, u)) {
+            state->visited[w] |= (uint64_t) 1 << (v & 63);
+            state->next[w] |= (uint64_t) 1 << (v & 63);
+            paths->distance[v] = state->level + 1;
+            paths->predecessor[v] = u;
+            edges += graph->offsets[v + 1] - graph->offsets[v];
+            count++;
+            break;
+          }
+        }
+      }
+    }
+  }
+  __atomic_fetch_add(&state->nextCount, count, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&state->nextEdges, edges, __ATOMIC_RELAXED);
+}
+
+
+
+// Runs on one thread between levels, picks the direction of the next one
+void __howderek_graph_bfs_advance(struct __howderek_graph_bfs_state* state) {
+  struct howderek_graph_frozen* graph = state->graph;
+  uint32_t* swapQueue;
+  uint64_t* swapBitmap;
+  uint64_t i, w, bits;
+
+  state->unexploredEdges -= (state->nextEdges < state->unexploredEdges) ? state->nextEdges : state->unexploredEdges;
+  state->level += 1;
+  state->cursor = 0;
+  if (state->nextCount == 0) {
+    state->done = 1;
+    return;
+  }
+
+  if (!state->bottomUp) {
+    if (graph->type == HOWDEREK_GRAPH_UNDIRECTED
+        && state->nextEdges > state->unexploredEdges / HOWDEREK_GRAPH_BFS_ALPHA) {
+      memset(state->frontier, 0, sizeof(uint64_t) * state->words);
+      for (i = 0; i < state->nextCount; i++) {
+        state->frontier[state->nextQueue[i] >> 6] |= (uint64_t) 1 << (state->nextQueue[i] & 63);
+      }
+      state->bottomUp = 1;
+    } else {
+      swapQueue = state->queue;
+      state->queue = state->nextQueue;
+      state->nextQueue = swapQueue;
+      state->queueCount = state->nextCount;
+    }
+  } else {
+    if (state->nextCount < graph->vertexCount / HOWDEREK_GRAPH_BFS_BETA) {
+      state->queueCount = 0;
+      for (w = 0; w < state->words; w++) {
+        for (bits = state->next[w]; bits != 0; bits &= bits - 1) {
+          state->queue[state->queueCount++] = (w << 6) + __builtin_ctzll(bits);
+        }
+      }
+      state->bottomUp = 0;
+    } else {
+      swapBitmap = state->frontier;
+      state->frontier = state->next;
+      state->next = swapBitmap;
+    }
+    memset(state->next, 0, sizeof(uint64_t) * state->words);
+  }
+  state->nextCount = 0;
+  state->nextEdges = 0;
+}
+
+
+
+void __howderek_graph_bfs_worker(void* state_as_void_ptr, unsigned thread, unsigned threads) {
+  struct __howderek_graph_bfs_state* state = state_as_void_ptr;
+  struct howderek_graph_frozen* graph = state->graph;
+  struct howderek_graph_paths* paths = state->paths;
+  uint64_t v;
+
+  // Every vertex is written anyway, so clearing is split up too rather than
+  // relying on the epoch
+  const uint64_t first = (uint64_t) graph->vertexCount * thread / threads;
+  const uint64_t last = (uint64_t) graph->vertexCount * (thread + 1) / threads;
+  for (v = first; v < last; v++) {
+    paths->stamp[v] = paths->epoch;
+    paths->distance[v] = INFINITY;
+    paths->predecessor[v] = HOWDEREK_GRAPH_NO_VERTEX;
+  }
+  howderek_barrier_wait(&state->barrier);
+  if (thread == 0) {
+    state->visited[state->source >> 6] |= (uint64_t) 1 << (state->source & 63);
+    paths->distance[state->source] = 0.0;
+    state->queue[0] = state->source;
+    state->queueCount = 1;
+    state->unexploredEdges = graph->edgeCount - (graph->offsets[state->source + 1] - graph->offsets[state->source]);
+  }
+  howderek_barrier_wait(&state->barrier);
+
+  while (!state->done) {
+    if (state->bottomUp) {
+      __howderek_graph_bfs_bottom_up(state);
+    } else {
+      __howderek_graph_bfs_top_down(state);
+    }
+    howderek_barrier_wait(&state->barrier);
+    if (thread == 0) {
+      __howderek_graph_bfs_advance(state);
+    }
+    howderek_barrier_wait(&state->barrier);
+  }
+}
+
+
+
+void howderek_graph_frozen_bfs_parallel(struct howderek_graph_frozen* graph, uint32_t source,
+                                        struct howderek_graph_paths* paths, unsigned threads) {
+  struct __howderek_graph_bfs_state state;
+  memset(&state, 0, sizeof(state));
+  threads = (threads == 0) ? howderek_parallel_threads() : threads;
+  threads = (threads > HOWDEREK_PARALLEL_MAX_THREADS) ? HOWDEREK_PARALLEL_MAX_THREADS : threads;
+  state.graph = graph;
+  state.paths = paths;
+  state.source = source;
+  state.words = ((uint64_t) graph->vertexCount + 63) / 64;
+  state.visited = calloc(state.words + 1, sizeof(uint64_t));
+  state.frontier = calloc(state.words + 1, sizeof(uint64_t));
+  state.next = calloc(state.words + 1, sizeof(uint64_t));
+  state.queue = paths->queue;
+  state.nextQueue = malloc(sizeof(uint32_t) * ((uint64_t) graph->vertexCount + 1));
+  if (state.visited == NULL || state.frontier == NULL || state.next == NULL || state.nextQueue == NULL) {
+    howderek_log(HOWDEREK_LOG_FATAL, "libhowderek_graph: out of memory for BFS on %u vertices", graph->vertexCount);
+    exit(ENOMEM);
+  }
+  howderek_graph_paths_clear(paths);
+  howderek_barrier_init(&state.barrier, threads);
+  howderek_parallel_run(threads, __howderek_graph_bfs_worker, &state);
+  howderek_barrier_destroy(&state.barrier);
+
+  // The last level may have left its queue in either buffer
+  if (state.queue != paths->queue) {
+    state.nextQueue = state.queue;
   }
+  free(state.nextQueue);
+  free(state.visited);
+  free(state.frontier);
+  free(state.next);
+}
+
+
+
+struct __howderek_graph_delta_list {
+  uint32_t* items;
+  uint64_t count;
+  uint64_t size;
+};
+
+struct __howderek_graph_delta_worker {
+  struct __howderek_graph_delta_list* buckets;   // cyclic, bucket b is in b % bucketCount
+  struct __howderek_graph_delta_list frontier;   // read by every thread this round
+  struct __howderek_graph_delta_list next;       // found by this thread this round
+  struct __howderek_graph_delta_list settled;    // heavy edges still to relax
+  uint64_t earliest;                             // earliest bucket with anything in it
+};
+
+struct __howderek_graph_delta_state {
+  struct howderek_graph_frozen* graph;
+  struct howderek_graph_paths* paths;
+  struct howderek_barrier barrier;
+  struct __howderek_graph_delta_worker* workers;
+  uint64_t* distance;                // bits of the distances, so they can be CASed
+  uint64_t prefix[HOWDEREK_PARALLEL_MAX_THREADS + 1];
+  uint64_t cursor;
+  uint64_t bucket;
+  uint64_t bucketCount;
+  double delta;
+  uint32_t source;
+  int done;
+};
+
+
+
+static inline uint64_t __howderek_graph_double_bits(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+
+
+static inline double __howderek_graph_bits_double(uint64_t bits) {
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+
+
+void __howderek_graph_delta_push(struct __howderek_graph_delta_list* list, uint32_t vertex) {
+  if (list->count == list->size) {
+    list->size = (list->size == 0) ? 64 : list->size * 2;
+    list->items = realloc(list->items, sizeof(uint32_t) * list->size);
+    if (list->items == NULL) {
+      howderek_log(HOWDEREK_LOG_FATAL, "libhowderek_graph: out of memory for delta-stepping buckets");
+      exit(ENOMEM);
+    }
+  }
+  list->items[list->count++] = vertex;
+}
+
+
+
+void __howderek_graph_delta_relax(struct __howderek_graph_delta_state* state, struct __howderek_graph_delta_worker* worker,
+                                  uint32_t vertex, double distance) {
+  // Non-negative doubles order the same way as their bits
+  const uint64_t bits = __howderek_graph_double_bits(distance);
+  uint64_t old = __atomic_load_n(&state->distance[vertex], __ATOMIC_RELAXED);
+  while (bits < old) {
+    if (__atomic_compare_exchange_n(&state->distance[vertex], &old, bits, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      const uint64_t bucket = distance / state->delta;
+      if (bucket == state->bucket) {
+        __howderek_graph_delta_push(&worker->next, vertex);
+      } else {
+        __howderek_graph_delta_push(&worker->buckets[bucket % state->bucketCount], vertex);
+      }
+      return;
+    }
+  }
+}
+
+
+
+// Runs on one thread, makes every thread's next list the new frontier
+void __howderek_graph_delta_prefix(struct __howderek_graph_delta_state* state, unsigned threads, int swap) {
+  struct __howderek_graph_delta_list swapList;
+  unsigned t;
+  state->prefix[0] = 0;
+  for (t = 0; t < threads; t++) {
+    if (swap) {
+      swapList = state->workers[t].frontier;
+      state->workers[t].frontier = state->workers[t].next;
+      state->workers[t].next = swapList;
+      state->workers[t].next.count = 0;
+    }
+    state->prefix[t + 1] = state->prefix[t] + state->workers[t].frontier.count;
+  }
+  state->cursor = 0;
+}
+
+
+
+void __howderek_graph_delta_light(struct __howderek_graph_delta_state* state, struct __howderek_graph_delta_worker* worker,
+                                  unsigned threads) {
+  struct howderek_graph_frozen* graph = state->graph;
+  const uint64_t total = state->prefix[threads];
+  uint64_t begin, i, e;
+  unsigned t = 0;
+
+  while ((begin = __atomic_fetch_add(&state->cursor, __HOWDEREK_GRAPH_BFS_CHUNK, __ATOMIC_RELAXED)) < total) {
+    const uint64_t end = (begin + __HOWDEREK_GRAPH_BFS_CHUNK < total) ? begin + __HOWDEREK_GRAPH_BFS_CHUNK : total;
+    for (i = begin; i < end; i++) {
+      // Chunks can span the frontiers of several threads
+      while (i >= state->prefix[t + 1]) {
+        t++;
+      }
+      while (i < state->prefix[t]) {
+        t--;
+      }
+      const uint32_t u = state->workers[t].frontier.items[i - state->prefix[t]];
+      const double distance = __howderek_graph_bits_double(__atomic_load_n(&state->distance[u], __ATOMIC_RELAXED));
+      if ((uint64_t) (distance / state->delta) != state->bucket) {
+        continue;
+      }
+      __howderek_graph_delta_push(&worker->settled, u);
+      for (e = graph->offsets[u]; e < graph->offsets[u + 1]; e++) {
+        if (graph->weights[e] <= state->delta) {
+          __howderek_graph_delta_relax(state, worker, graph->targets[e], distance + graph->weights[e]);
+        }
+      }
+    }
+  }
+}
+
+
+
+void __howderek_graph_delta_worker(void* state_as_void_ptr, unsigned thread, unsigned threads) {
+  struct __howderek_graph_delta_state* state = state_as_void_ptr;
+  struct __howderek_graph_delta_worker* worker = &state->workers[thread];
+  struct howderek_graph_frozen* graph = state->graph;
+  struct howderek_graph_paths* paths = state->paths;
+  struct __howderek_graph_delta_list* slot;
+  const uint64_t first = (uint64_t) graph->vertexCount * thread / threads;
+  const uint64_t last = (uint64_t) graph->vertexCount * (thread + 1) / threads;
+  uint64_t v, i, e, k;
+  unsigned t;
+
+  for (v = first; v < last; v++) {
+    state->distance[v] = __howderek_graph_double_bits(INFINITY);
+    paths->stamp[v] = paths->epoch;
+    paths->predecessor[v] = HOWDEREK_GRAPH_NO_VERTEX;
+  }
+  howderek_barrier_wait(&state->barrier);
+  if (thread == 0) {
+    state->distance[state->source] = __howderek_graph_double_bits(0.0);
+    __howderek_graph_delta_push(&worker->buckets[0], state->source);
+  }
+
+  while (!state->done) {
+    // Take this thread's share of the bucket, skipping vertices that have
+    // since moved to an earlier one
+    slot = &worker->buckets[state->bucket % state->bucketCount];
+    worker->frontier.count = 0;
+    for (i = 0; i < slot->count; i++) {
+      const double distance = __howderek_graph_bits_double(state->distance[slot->items[i]]);
+      if ((uint64_t) (distance / state->delta) == state->bucket) {
+        __howderek_graph_delta_push(&worker->frontier, slot->items[i]);
+      }
+    }
+    slot->count = 0;
+    howderek_barrier_wait(&state->barrier);
+    if (thread == 0) {
+      __howderek_graph_delta_prefix(state, threads, 0);
+    }
+    howderek_barrier_wait(&state->barrier);
+
+    // Light edges can put vertices back in the same bucket, so repeat until
+    // it stays empty
+    while (state->prefix[threads] != 0) {
+      __howderek_graph_delta_light(state, worker, threads);
+      howderek_barrier_wait(&state->barrier);
+      if (thread == 0) {
+        __howderek_graph_delta_prefix(state, threads, 1);
+      }
+      howderek_barrier_wait(&state->barrier);
+    }
+
+    // Heavy edges always land in a later bucket
+    for (i = 0; i < worker->settled.count; i++) {
+      const uint32_t u = worker->settled.items[i];
+      const double distance = __howderek_graph_bits_double(__atomic_load_n(&state->distance[u], __ATOMIC_RELAXED));
+      for (e = graph->offsets[u]; e < graph->offsets[u + 1]; e++) {
+        if (graph->weights[e] > state->delta) {
+          __howderek_graph_delta_relax(state, worker, graph->targets[e], distance + graph->weights[e]);
+        }
+      }
+    }
+    worker->settled.count = 0;
+    // Rounding can land a heavy edge in this bucket, give it another pass
+    for (i = 0; i < worker->next.count; i++) {
+      __howderek_graph_delta_push(&worker->buckets[state->bucket % state->bucketCount], worker->next.items[i]);
+    }
+    worker->next.count = 0;
+    worker->earliest = UINT64_MAX;
+    for (k = 0; k < state->bucketCount; k++) {
+      if (worker->buckets[(state->bucket + k) % state->bucketCount].count != 0) {
+        worker->earliest = state->bucket + k;
+        break;
+      }
+    }
+    howderek_barrier_wait(&state->barrier);
+    if (thread == 0) {
+      state->bucket = UINT64_MAX;
+      for (t = 0; t < threads; t++) {
+        state->bucket = (state->workers[t].earliest < state->bucket) ? state->workers[t].earliest : state->bucket;
+      }
+      state->done = (state->bucket == UINT64_MAX);
+    }
+    howderek_barrier_wait(&state->barrier);
+  }
+
+  // Distances are final, any edge that is tight gives a shortest path tree
+  for (v = first; v < last; v++) {
+    const double distance = __howderek_graph_bits_double(state->distance[v]);
+    paths->distance[v] = distance;
+    if (distance == INFINITY) {
+      continue;
+    }
+    for (e = graph->offsets[v]; e < graph->offsets[v + 1]; e++) {
+      const uint32_t target = graph->targets[e];
+      if (target != state->source && distance + graph->weights[e] == __howderek_graph_bits_double(state->distance[target])) {
+        __atomic_store_n(&paths->predecessor[target], (uint32_t) v, __ATOMIC_RELAXED);
+      }
+    }
+  }
+}
+
+
+
+void howderek_graph_frozen_delta_stepping(struct howderek_graph_frozen* graph, uint32_t source,
+                                          struct howderek_graph_paths* paths, double delta, unsigned threads) {
+  struct __howderek_graph_delta_state state;
+  double maxWeight = 0.0;
+  uint64_t e;
+  unsigned t;
+
+  memset(&state, 0, sizeof(state));
+  threads = (threads == 0) ? howderek_parallel_threads() : threads;
+  threads = (threads > HOWDEREK_PARALLEL_MAX_THREADS) ? HOWDEREK_PARALLEL_MAX_THREADS : threads;
+  for (e = 0; e < graph->edgeCount; e++) {
+    maxWeight = (graph->weights[e] > maxWeight) ? graph->weights[e] : maxWeight;
+  }
+  if (delta <= 0.0) {
+    // About one heavy edge per vertex, the usual starting point
+    const double degree = (graph->vertexCount != 0) ? (double) graph->edgeCount / graph->vertexCount : 1.0;
+    delta = maxWeight / ((degree > 1.0) ? degree : 1.0);
+  }
+  if (delta <= 0.0 || maxWeight / delta > HOWDEREK_GRAPH_DELTA_MAX_BUCKETS - 2) {
+    delta = (maxWeight > 0.0) ? maxWeight / (HOWDEREK_GRAPH_DELTA_MAX_BUCKETS - 2) : 1.0;
+  }
+
+  state.graph = graph;
+  state.paths = paths;
+  state.source = source;
+  state.delta = delta;
+  // Relaxing bucket b reaches at most b + maxWeight / delta
+  state.bucketCount = (uint64_t) (maxWeight / delta) + 2;
+  state.distance = malloc(sizeof(uint64_t) * ((uint64_t) graph->vertexCount + 1));
+  state.workers = calloc(threads, sizeof(struct __howderek_graph_delta_worker));
+  if (state.distance == NULL || state.workers == NULL) {
+    howderek_log(HOWDEREK_LOG_FATAL, "libhowderek_graph: out of memory for delta-stepping on %u vertices", graph->vertexCount);
+    exit(ENOMEM);
+  }
+  for (t = 0; t < threads; t++) {
+    state.workers[t].buckets = calloc(state.bucketCount, sizeof(struct __howderek_graph_delta_list));
+  }
+  howderek_graph_paths_clear(paths);
+  howderek_barrier_init(&state.barrier, threads);
+  howderek_parallel_run(threads, __howderek_graph_delta_worker, &state);
+  howderek_barrier_destroy(&state.barrier);
+
+  for (t = 0; t < threads; t++) {
+    for (e = 0; e < state.bucketCount; e++) {
+      free(state.workers[t].buckets[e].items);
+    }
+    free(state.workers[t].buckets);
+    free(state.workers[t].frontier.items);
+    free(state.workers[t].next.items);
+    free(state.workers[t].settled.items);
+  }
+  free(state.workers);
+  free(state.distance);
+}
+
+
+
+double howderek_graph_frozen_astar(struct howderek_graph_frozen* graph, uint32_t source, uint32_t goal,
+                                   double (*heuristic)(struct howderek_graph_frozen* graph,
+                                                       uint32_t vertex, uint32_t goal),
+                                   struct howderek_graph_paths* paths) {
+  struct howderek_graph_queue_entry* entry;
+  uint64_t e;
+  __howderek_graph_paths_reset(paths, source);
+  __howderek_graph_paths_push(paths, source, 0.0, 0.0);
+  while ((entry = howderek_heap_pop(paths->heap)) != NULL) {
+    const uint32_t u = entry->vertex;
+    const double distance = entry->distance;
+    entry->next = paths->freeEntries;
+    paths->freeEntries = entry;
+    // A vertex is pushed again whenever its distance improves, so skip the
+    // stale copies instead of decreasing keys in place
+    if (distance > howderek_graph_paths_distance(paths, u)) {
+      continue;
+    }
+    if (u == goal) {
+      return distance;
+    }
+    for (e = graph->offsets[u]; e < graph->offsets[u + 1]; e++) {
+      const uint32_t v = graph->targets[e];
+      const double candidate = distance + graph->weights[e];
+      if (candidate < howderek_graph_paths_distance(paths, v)) {
+        howderek_graph_paths_set(paths, v, candidate, u);
+        __howderek_graph_paths_push(paths, v, candidate,
+                                     (heuristic == NULL) ? candidate : candidate + heuristic(graph, v, goal));
+      }
+    }
+  }
+  return (goal == HOWDEREK_GRAPH_NO_VERTEX) ? INFINITY : howderek_graph_paths_distance(paths, goal);
+}
+
+
+
+void howderek_graph_frozen_dijkstra(struct howderek_graph_frozen* graph, uint32_t source,
+                                    struct howderek_graph_paths* paths) {
+  // With no goal and no heuristic A* settles every reachable vertex
+  howderek_graph_frozen_astar(graph, source, HOWDEREK_GRAPH_NO_VERTEX, NULL, paths);
 }
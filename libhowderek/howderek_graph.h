@@ -7,12 +7,59 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
 #include "howderek.h"
-#include "howderek_kv.h"
+#include "howderek_idmap.h"
 #include "howderek_skiplist.h"
+#include "howderek_heap.h"
 
 #define HOWDEREK_GRAPH_VALUE_PRINTF_STR "%lu"
 
+// Index used for "no vertex" in frozen graphs
+#define HOWDEREK_GRAPH_NO_VERTEX UINT32_MAX
+
+#ifndef HOWDEREK_GRAPH_CONFIG
+// Queue entries are allocated this many at a time
+#define HOWDEREK_GRAPH_ENTRY_BLOCK 1024
+// Direction-optimizing BFS switches to bottom-up once the frontier has more
+// than 1/ALPHA of the unexplored edges, and back once it has fewer than
+// 1/BETA of the vertices
+#define HOWDEREK_GRAPH_BFS_ALPHA 14
+#define HOWDEREK_GRAPH_BFS_BETA  24
+// Most buckets delta-stepping keeps at once, delta is raised to fit
+#define HOWDEREK_GRAPH_DELTA_MAX_BUCKETS 65536
+#endif
+
+/*
+ * Binary graph files are a frozen graph written out as-is, so they can be
+ * mapped and searched without parsing. Every section starts on an 8 byte
+ * boundary. Numbers are in host byte order.
+ *
+ *    +--------------------------+  0
+ *    | howderek_graph_file      |
+ *    +--------------------------+  64
+ *    | ids       [vertexCount]  |  uint64_t
+ *    | offsets   [vertexCount+1]|  uint64_t
+ *    | targets   [edgeCount]    |  uint32_t, padded to 8 bytes
+ *    | weights   [edgeCount]    |  double
+ *    | payload   [vertexCount]  |  payloadSize bytes each, optional
+ *    +--------------------------+
+ */
+#define HOWDEREK_GRAPH_FILE_MAGIC    "HWDGRAPH"
+#define HOWDEREK_GRAPH_FILE_VERSION  1
+#define HOWDEREK_GRAPH_FILE_PAD(size) (((size) + 7) & ~((uint64_t) 7))
+
+struct howderek_graph_file {
+  char magic[8];
+  uint32_t version;
+  uint32_t type;                     // enum howderek_graph_type
+  uint64_t vertexCount;
+  uint64_t edgeCount;
+  uint64_t payloadSize;              // bytes of payload per vertex, 0 if none
+  uint64_t reserved[3];
+};
+
 enum howderek_graph_type {
   HOWDEREK_GRAPH_DIRECTED = 1,
   HOWDEREK_GRAPH_UNDIRECTED
@@ -44,6 +91,7 @@ struct howderek_graph_edge {
 
 struct howderek_graph_vertex {
   uint64_t id;              // Unique identified of the node. Avoid using 0
+  uint32_t index;           // Dense index of the node, for per-search arrays
   howderek_array_value_t data;          // Data associated with this vertex
   enum howderek_vertex_status status;     // Color and markedness of the vertex
   struct howderek_graph_edge* edges;  // Edges
@@ -51,7 +99,10 @@ struct howderek_graph_vertex {
 
 struct howderek_graph {
   struct howderek_graph_vertex* root;      // first node, where searches begin by default
-  struct howderek_kv* vertex_map;     //verticies
+  struct howderek_idmap* vertex_map;       // id -> index
+  struct howderek_graph_vertex** vertices; // index -> vertex, NULL once deleted
+  uint32_t count;                          // live verticies
+  struct howderek_graph_paths* paths;      // pooled results for searches that aren't given any
   enum howderek_graph_type type;
   void (*onDataDisplay)(howderek_array_value_t data);
 };
@@ -62,6 +113,60 @@ struct howderek_graph_pathfinding_data {
     struct howderek_graph_vertex* predecessor;
 };
 
+/*
+ * Immutable compressed sparse row copy of a graph. Vertices are numbered
+ * 0..vertexCount-1 in order of id, and the edges leaving vertex v are
+ * targets[offsets[v]] to targets[offsets[v + 1] - 1].
+ *
+ *    ids      | 3 | 8 | 9 |          3 -> 8, 3 -> 9, 9 -> 3
+ *    offsets  | 0 | 2 | 2 | 3 |
+ *    targets  | 1 | 2 | 0 |
+ *    weights  |1.0|2.5|1.0|
+ */
+struct howderek_graph_frozen {
+  uint32_t vertexCount;
+  uint64_t edgeCount;                // each undirected edge is counted twice
+  enum howderek_graph_type type;
+  uint64_t* ids;                     // sorted, so ids can be found with a binary search
+  uint64_t* offsets;                 // vertexCount + 1 entries
+  uint32_t* targets;
+  double* weights;
+  howderek_array_value_t* data;      // shared with the graph it was frozen from, NULL if mapped
+  char* payload;                     // payloadSize bytes per vertex, only when loaded from a file
+  uint64_t payloadSize;
+  void* mapping;                     // the file, if the graph was mapped
+  size_t mappingSize;
+};
+
+struct howderek_graph_queue_entry {
+  double key;                        // distance plus heuristic
+  double distance;
+  uint32_t vertex;
+  struct howderek_graph_queue_entry* next;  // free list
+};
+
+/*
+ * Results of a search, indexed by vertex index. Can be reused for any number
+ * of searches on graphs with at most vertexCount indices.
+ *
+ * All of the state of a search lives here rather than in the graph, so any
+ * number of threads can search the same graph at once as long as each has
+ * its own paths and nothing modifies the graph. distance and predecessor are
+ * only valid where stamp matches epoch. Starting a search bumps epoch
+ * instead of clearing every vertex, so read them with
+ * howderek_graph_paths_distance and howderek_graph_paths_predecessor.
+ */
+struct howderek_graph_paths {
+  uint32_t vertexCount;
+  uint32_t epoch;                    // bumped by every search
+  uint32_t* stamp;                   // epoch of the search that last reached each vertex
+  double* distance;                  // INFINITY if unreachable
+  uint32_t* predecessor;             // HOWDEREK_GRAPH_NO_VERTEX for the source and unreachable vertices
+  uint32_t* queue;                   // BFS queue
+  struct howderek_heap* heap;
+  struct howderek_graph_queue_entry* freeEntries;
+};
+
  /**
  * Create a graph
  */
@@ -103,13 +208,48 @@ struct howderek_graph* howderek_graph_dijkstra(struct howderek_graph* graph,
                                                uint64_t starting);
 
 /**
- * Uses BFS to create a distance graph from a given start node
+ * Uses Dijkstra's algorithm on the graph itself, without cloning it. Stops
+ * as soon as one of the targets is settled, so only vertices closer than
+ * that target have final distances.
+ *
+ * \param graph        graph to search
+ * \param starting     id to start from, the root if not found
+ * \param targets      ids to stop at, NULL to settle every vertex
+ * \param targetCount  number of targets
+ * \param paths        where to store the results, indexed by vertex->index.
+ *                     NULL to use the graph's pooled results, which are
+ *                     overwritten by the next search.
+ * \return             index of the nearest target, HOWDEREK_GRAPH_NO_VERTEX
+ *                     if none could be reached or paths was made for fewer
+ *                     vertices than the graph has now
+ */
+uint32_t howderek_graph_dijkstra_to(struct howderek_graph* graph,
+                                    uint64_t starting,
+                                    const uint64_t* targets,
+                                    size_t targetCount,
+                                    struct howderek_graph_paths* paths);
+
+/**
+ * Get the pooled results of the last search that wasn't given any, sized
+ * for every vertex in the graph
+ *
+ * \param graph  graph that was searched
+ */
+struct howderek_graph_paths* howderek_graph_pooled_paths(struct howderek_graph* graph);
+
+/**
+ * Uses BFS to find the distance in edges from a given start node to every
+ * other node
  *
  * \param graph      graph to build distances from
- * \param starting   id to start from
+ * \param starting   id to start from, the root if not found
+ * \param paths      where to store the results, indexed by vertex->index.
+ *                   Left alone if it was made for fewer vertices than the
+ *                   graph has now.
  */
 void howderek_graph_bfs(struct howderek_graph* graph,
-                        uint64_t starting);
+                        uint64_t starting,
+                        struct howderek_graph_paths* paths);
 
 /**
  * Returns a pointer to a vertex
@@ -183,9 +323,15 @@ char* howderek_graph_vertex_info(struct howderek_graph_vertex* vertex,
                                  void (*dataDisplayFunction)(howderek_array_value_t data));
 
 /**
- * Load the numbers in an input file, and return a graph
- * 
+ * Load a binary graph file written by howderek_graph_export. Payloads are
+ * copied into malloc'd vertex data.
+ *
  * \param input  input file
+ * \param type   type of the new graph, 0 to use the type in the file. Edges
+ *               are read as stored either way.
+ * \return       the graph, NULL if the file can't be read. errno is EINVAL if
+ *               it isn't a valid graph file, or its offsets or edge targets
+ *               are out of range.
  */
 struct howderek_graph* howderek_graph_import(FILE* input, enum howderek_graph_type type);
 
@@ -198,13 +344,228 @@ struct howderek_graph* howderek_graph_import(FILE* input, enum howderek_graph_ty
 struct howderek_skip* howderek_graph_index_skiplist(struct howderek_graph* graph, struct howderek_skip* skiplist);
 
 /**
- * Load the numbers in an input file, and return a graph
- * 
+ * Write a graph as a binary graph file, without payloads
+ *
  * \param graph   pointer to the graph to export
- * \param input  input file
+ * \param output  output file
+ * \return        0 on success, an errno value otherwise
  */
 int howderek_graph_export(struct howderek_graph* graph, FILE* output);
 
+/**
+ * Copy a graph into a frozen CSR layout. The graph can be changed or
+ * destroyed afterwards, but vertex data pointers are shared.
+ *
+ * \param graph  graph to freeze
+ */
+struct howderek_graph_frozen* howderek_graph_freeze(struct howderek_graph* graph);
+
+/**
+ * Destroy a frozen graph
+ *
+ * \param graph  frozen graph to destroy
+ */
+void howderek_graph_frozen_destroy(struct howderek_graph_frozen* graph);
+
+/**
+ * Write a frozen graph as a binary graph file
+ *
+ * \param graph        frozen graph to write
+ * \param output       output file
+ * \param payloadSize  bytes of vertex data to store per vertex, 0 for none.
+ *                     Vertices without data get zeros.
+ * \return             0 on success, an errno value otherwise
+ */
+int howderek_graph_frozen_export(struct howderek_graph_frozen* graph, FILE* output, uint64_t payloadSize);
+
+/**
+ * Map a binary graph file read-only and use it as a frozen graph without
+ * copying. Pages are loaded as searches touch them.
+ *
+ * \param path  file to map
+ * \return      the frozen graph, NULL if the file could not be mapped or
+ *              is not a valid graph file. The offsets and edge targets are
+ *              checked once here, in O(vertices + edges), and errno is
+ *              EINVAL if any are out of range.
+ */
+struct howderek_graph_frozen* howderek_graph_frozen_map(const char* path);
+
+/**
+ * Get the payload of a vertex in a frozen graph, from the file if it was
+ * loaded from one and from the source graph's data otherwise
+ *
+ * \param graph   frozen graph
+ * \param vertex  vertex index
+ */
+static inline void* howderek_graph_frozen_payload(struct howderek_graph_frozen* graph, uint32_t vertex) {
+  if (graph->payload != NULL) {
+    return graph->payload + graph->payloadSize * vertex;
+  }
+  return (graph->data != NULL) ? graph->data[vertex] : NULL;
+}
+
+/**
+ * Find the index of an id in a frozen graph. O(log n)
+ *
+ * \param graph  frozen graph to search
+ * \param id     id to find
+ * \return       index of the vertex, HOWDEREK_GRAPH_NO_VERTEX if not found
+ */
+uint32_t howderek_graph_frozen_index(struct howderek_graph_frozen* graph, uint64_t id);
+
+/**
+ * Create the result arrays for searches
+ *
+ * \param vertexCount  number of vertex indices in the graphs that will be
+ *                     searched (graph->vertex_map->count or frozen->vertexCount)
+ */
+struct howderek_graph_paths* howderek_graph_paths_create(uint32_t vertexCount);
+
+/**
+ * Destroy search results
+ *
+ * \param paths  results to destroy
+ */
+void howderek_graph_paths_destroy(struct howderek_graph_paths* paths);
+
+/**
+ * Distance to a vertex found by the last search
+ *
+ * \param paths   results of a search
+ * \param vertex  vertex index
+ * \return        INFINITY if the search didn't reach it
+ */
+static inline double howderek_graph_paths_distance(struct howderek_graph_paths* paths, uint32_t vertex) {
+  return (paths->stamp[vertex] == paths->epoch) ? paths->distance[vertex] : INFINITY;
+}
+
+/**
+ * Predecessor of a vertex found by the last search
+ *
+ * \param paths   results of a search
+ * \param vertex  vertex index
+ * \return        HOWDEREK_GRAPH_NO_VERTEX for the source and vertices the
+ *                search didn't reach
+ */
+static inline uint32_t howderek_graph_paths_predecessor(struct howderek_graph_paths* paths, uint32_t vertex) {
+  return (paths->stamp[vertex] == paths->epoch) ? paths->predecessor[vertex] : HOWDEREK_GRAPH_NO_VERTEX;
+}
+
+/**
+ * Record that a search reached a vertex
+ *
+ * \param paths        results of the current search
+ * \param vertex       vertex index
+ * \param distance     distance from the source
+ * \param predecessor  vertex it was reached from
+ */
+static inline void howderek_graph_paths_set(struct howderek_graph_paths* paths, uint32_t vertex,
+                                            double distance, uint32_t predecessor) {
+  paths->stamp[vertex] = paths->epoch;
+  paths->distance[vertex] = distance;
+  paths->predecessor[vertex] = predecessor;
+}
+
+/**
+ * Forget the last search in O(1), so every vertex reads as unreached
+ *
+ * \param paths  results to clear
+ */
+void howderek_graph_paths_clear(struct howderek_graph_paths* paths);
+
+/**
+ * Walk the predecessors back from target and write the path, source first
+ *
+ * \param paths      results of a search
+ * \param target     index to end at
+ * \param path       where to write the indices, may be NULL
+ * \param maxLength  room in path
+ * \return           number of vertices in the path, 0 if target is
+ *                   unreachable. Nothing is written if it is more than
+ *                   maxLength.
+ */
+size_t howderek_graph_paths_path(struct howderek_graph_paths* paths, uint32_t target,
+                                 uint32_t* path, size_t maxLength);
+
+/**
+ * BFS on a frozen graph. distance is set to the number of edges.
+ *
+ * \param graph   frozen graph to search
+ * \param source  index to start from
+ * \param paths   where to store the results
+ */
+void howderek_graph_frozen_bfs(struct howderek_graph_frozen* graph, uint32_t source,
+                               struct howderek_graph_paths* paths);
+
+/**
+ * Level-synchronous BFS on a frozen graph, spread over several threads.
+ * Each level either expands the frontier (top-down) or has every unvisited
+ * vertex look for a parent in the frontier (bottom-up), whichever touches
+ * fewer edges [1]. Bottom-up needs every edge to have a reverse edge, so
+ * directed graphs are only searched top-down.
+ *
+ * Distances match howderek_graph_frozen_bfs. Predecessors are a valid BFS
+ * tree but may differ between runs.
+ *
+ * [1] Beamer, Asanovic, Patterson. Direction-Optimizing Breadth-First Search
+ *
+ * \param graph    frozen graph to search
+ * \param source   index to start from
+ * \param paths    where to store the results
+ * \param threads  number of threads, 0 for one per core
+ */
+void howderek_graph_frozen_bfs_parallel(struct howderek_graph_frozen* graph, uint32_t source,
+                                        struct howderek_graph_paths* paths, unsigned threads);
+
+/**
+ * Delta-stepping single source shortest paths on a frozen graph [1].
+ * Vertices are kept in buckets of width delta, and every vertex in the
+ * lowest bucket is relaxed in parallel. Edges no heavier than delta are
+ * relaxed until the bucket stops changing, heavier ones once afterwards.
+ * Weights must not be negative.
+ *
+ * Predecessors are found after the distances, from edges where
+ * distance[u] + weight == distance[v]. Graphs with zero weight cycles can
+ * get cycles in the predecessors.
+ *
+ * [1] Meyer, Sanders. Delta-stepping: a parallelizable shortest path algorithm
+ *
+ * \param graph    frozen graph to search
+ * \param source   index to start from
+ * \param paths    where to store the results
+ * \param delta    bucket width, 0 to pick one from the weights and degree
+ * \param threads  number of threads, 0 for one per core
+ */
+void howderek_graph_frozen_delta_stepping(struct howderek_graph_frozen* graph, uint32_t source,
+                                          struct howderek_graph_paths* paths, double delta, unsigned threads);
+
+/**
+ * Dijkstra's algorithm on a frozen graph
+ *
+ * \param graph   frozen graph to search
+ * \param source  index to start from
+ * \param paths   where to store the results
+ */
+void howderek_graph_frozen_dijkstra(struct howderek_graph_frozen* graph, uint32_t source,
+                                    struct howderek_graph_paths* paths);
+
+/**
+ * A* on a frozen graph. Stops as soon as goal is reached, so only vertices
+ * that were expanded have final distances.
+ *
+ * \param graph      frozen graph to search
+ * \param source     index to start from
+ * \param goal       index to find
+ * \param heuristic  estimate of the distance from vertex to goal that never
+ *                   overestimates. NULL behaves like Dijkstra.
+ * \param paths      where to store the results
+ * \return           distance to goal, INFINITY if unreachable
+ */
+double howderek_graph_frozen_astar(struct howderek_graph_frozen* graph, uint32_t source, uint32_t goal,
+                                   double (*heuristic)(struct howderek_graph_frozen* graph,
+                                                       uint32_t vertex, uint32_t goal),
+                                   struct howderek_graph_paths* paths);
+
 /**
  * Draw the graph as ASCII art
  * 
@@ -0,0 +1,405 @@
+/*! \file howderek_grid.c
+ *  \brief Copy-on-write grid of cells split into square tiles
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include "howderek.h"
+#include "howderek_grid.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HOWDEREK_GRID_AVX2 1
+#endif
+
+
+
+void* __howderek_grid_alloc(size_t size) {
+  void* result = malloc(size);
+  if (result == NULL) {
+    howderek_log(HOWDEREK_LOG_FATAL, "libhowderek_grid: allocation failed for %lu bytes", size);
+    exit(ENOMEM);
+  }
+  return result;
+}
+
+
+
+struct howderek_grid_table* __howderek_grid_table_create(uint32_t tilesX, uint32_t tilesY) {
+  const size_t tiles = (size_t) tilesX * tilesY;
+  struct howderek_grid_table* table = __howderek_grid_alloc(sizeof(struct howderek_grid_table)
+                                                            + sizeof(struct howderek_grid_tile*) * tiles);
+  table->references = 1;
+  table->tilesX = tilesX;
+  table->tilesY = tilesY;
+  memset(table->tiles, 0, sizeof(struct howderek_grid_tile*) * tiles);
+  return table;
+}
+
+
+
+void __howderek_grid_tile_release(struct howderek_grid_tile* tile) {
+  if (tile != NULL && __atomic_sub_fetch(&tile->references, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(tile);
+  }
+}
+
+
+
+void __howderek_grid_table_release(struct howderek_grid_table* table) {
+  size_t i;
+  if (__atomic_sub_fetch(&table->references, 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+  for (i = 0; i < (size_t) table->tilesX * table->tilesY; i++) {
+    __howderek_grid_tile_release(table->tiles[i]);
+  }
+  free(table);
+}
+
+
+
+struct howderek_grid* howderek_grid_create(uint32_t width, uint32_t height, uint8_t fill) {
+  struct howderek_grid* grid = __howderek_grid_alloc(sizeof(struct howderek_grid));
+  grid->fill = fill & HOWDEREK_GRID_CELL_MASK;
+  grid->table = __howderek_grid_table_create((width + HOWDEREK_GRID_TILE_MASK) >> HOWDEREK_GRID_TILE_BITS,
+                                             (height + HOWDEREK_GRID_TILE_MASK) >> HOWDEREK_GRID_TILE_BITS);
+  return grid;
+}
+
+
+
+struct howderek_grid* howderek_grid_snapshot(struct howderek_grid* grid) {
+  struct howderek_grid* snapshot = __howderek_grid_alloc(sizeof(struct howderek_grid));
+  snapshot->fill = grid->fill;
+  snapshot->table = grid->table;
+  __atomic_add_fetch(&grid->table->references, 1, __ATOMIC_RELAXED);
+  return snapshot;
+}
+
+
+
+void howderek_grid_destroy(struct howderek_grid* grid) {
+  if (grid == NULL) {
+    return;
+  }
+  __howderek_grid_table_release(grid->table);
+  free(grid);
+}
+
+
+
+// Make sure the grid has a table of its own with room for the tile
+void __howderek_grid_own_table(struct howderek_grid* grid, uint32_t tileX, uint32_t tileY) {
+  struct howderek_grid_table* old = grid->table;
+  const int shared = __atomic_load_n(&old->references, __ATOMIC_ACQUIRE) > 1;
+  uint32_t tilesX = old->tilesX;
+  uint32_t tilesY = old->tilesY;
+  uint32_t x, y;
+
+  if (!shared && tileX < tilesX && tileY < tilesY) {
+    return;
+  }
+  // Grow by doubling so writing a row of new cells isn't quadratic
+  while (tileX >= tilesX) {
+    tilesX = (tilesX == 0) ? 1 : tilesX * 2;
+  }
+  while (tileY >= tilesY) {
+    tilesY = (tilesY == 0) ? 1 : tilesY * 2;
+  }
+  grid->table = __howderek_grid_table_create(tilesX, tilesY);
+  for (y = 0; y < old->tilesY; y++) {
+    for (x = 0; x < old->tilesX; x++) {
+      struct howderek_grid_tile* tile = old->tiles[(size_t) y * old->tilesX + x];
+      if (tile != NULL && shared) {
+        __atomic_add_fetch(&tile->references, 1, __ATOMIC_RELAXED);
+      }
+      grid->table->tiles[(size_t) y * tilesX + x] = tile;
+    }
+  }
+  if (shared) {
+    __howderek_grid_table_release(old);
+  } else {
+    // The tiles moved to the new table
+    free(old);
+  }
+}
+
+
+
+// Word holding (x, y) in a tile the grid has to itself, copying or
+// allocating the tile first
+uint64_t* __howderek_grid_own_word(struct howderek_grid* grid, uint32_t x, uint32_t y) {
+  const uint32_t tileX = x >> HOWDEREK_GRID_TILE_BITS;
+  const uint32_t tileY = y >> HOWDEREK_GRID_TILE_BITS;
+  struct howderek_grid_tile** slot;
+  struct howderek_grid_tile* copy;
+  size_t i;
+
+  __howderek_grid_own_table(grid, tileX, tileY);
+  slot = &grid->table->tiles[(size_t) tileY * grid->table->tilesX + tileX];
+  if (*slot == NULL) {
+    *slot = __howderek_grid_alloc(sizeof(struct howderek_grid_tile));
+    (*slot)->references = 1;
+    for (i = 0; i < HOWDEREK_GRID_TILE_WORDS; i++) {
+      (*slot)->words[i] = howderek_grid_fill_word(grid->fill);
+    }
+  } else if (__atomic_load_n(&(*slot)->references, __ATOMIC_ACQUIRE) > 1) {
+    copy = __howderek_grid_alloc(sizeof(struct howderek_grid_tile));
+    copy->references = 1;
+    memcpy(copy->words, (*slot)->words, sizeof(copy->words));
+    __howderek_grid_tile_release(*slot);
+    *slot = copy;
+  }
+  return &(*slot)->words[(y & HOWDEREK_GRID_TILE_MASK) * HOWDEREK_GRID_ROW_WORDS
+                         + ((x & HOWDEREK_GRID_TILE_MASK) >> HOWDEREK_GRID_WORD_BITS)];
+}
+
+
+
+void howderek_grid_set(struct howderek_grid* grid, uint32_t x, uint32_t y, uint8_t value) {
+  const unsigned shift = (x & HOWDEREK_GRID_WORD_MASK) * HOWDEREK_GRID_CELL_BITS;
+  uint64_t* word;
+
+  value &= HOWDEREK_GRID_CELL_MASK;
+  // Writing what's already there shouldn't copy anything
+  if (howderek_grid_get(grid, x, y) == value) {
+    return;
+  }
+  word = __howderek_grid_own_word(grid, x, y);
+  *word = (*word & ~((uint64_t) HOWDEREK_GRID_CELL_MASK << shift)) | ((uint64_t) value << shift);
+}
+
+
+
+void howderek_grid_set_word(struct howderek_grid* grid, uint32_t x, uint32_t y, uint64_t word) {
+  if (howderek_grid_word(grid, x, y) == word) {
+    return;
+  }
+  *__howderek_grid_own_word(grid, x, y) = word;
+}
+
+
+
+size_t howderek_grid_shared_tiles(struct howderek_grid* grid) {
+  const size_t tiles = (size_t) grid->table->tilesX * grid->table->tilesY;
+  size_t shared = 0;
+  size_t i;
+  if (__atomic_load_n(&grid->table->references, __ATOMIC_ACQUIRE) > 1) {
+    for (i = 0; i < tiles; i++) {
+      shared += (grid->table->tiles[i] != NULL);
+    }
+    return shared;
+  }
+  for (i = 0; i < tiles; i++) {
+    shared += (grid->table->tiles[i] != NULL && __atomic_load_n(&grid->table->tiles[i]->references, __ATOMIC_ACQUIRE) > 1);
+  }
+  return shared;
+}
+
+
+
+/**
+ * Unpack width cells of row y into row, a word at a time
+ */
+void __howderek_grid_copy_row(const struct howderek_grid* grid, uint32_t y, uint32_t width, uint8_t* row) {
+  uint64_t word;
+  uint32_t x;
+  uint32_t i;
+  uint32_t length;
+  for (x = 0; x < width; x += length) {
+    word = howderek_grid_word(grid, x, y);
+    length = (width - x < HOWDEREK_GRID_WORD_CELLS) ? width - x : HOWDEREK_GRID_WORD_CELLS;
+    // Most words are all walls or all open
+    if (word == howderek_grid_fill_word(word & HOWDEREK_GRID_CELL_MASK)) {
+      memset(row + x, word & HOWDEREK_GRID_CELL_MASK, length);
+      continue;
+    }
+    for (i = 0; i < length; i++) {
+      row[x + i] = (word >> (i * HOWDEREK_GRID_CELL_BITS)) & HOWDEREK_GRID_CELL_MASK;
+    }
+  }
+}
+
+
+
+/**
+ * One more than distance, staying at HOWDEREK_GRID_FAR
+ */
+static inline uint32_t __howderek_grid_next(uint32_t distance) {
+  return (distance == HOWDEREK_GRID_FAR) ? HOWDEREK_GRID_FAR : distance + 1;
+}
+
+
+
+/**
+ * Take the smallest of a cell and one more than the three cells next to it
+ * in the row before. Cells that can't be crossed are HOWDEREK_GRID_FAR.
+ *
+ * \return 1 if it changed
+ */
+static inline int __howderek_grid_vertical_cell(uint32_t* current, const uint32_t* previous, const uint8_t* row,
+                                                uint8_t open, uint32_t width, uint32_t x) {
+  uint32_t nearest = previous[x];
+  uint32_t distance;
+  if (x > 0 && previous[x - 1] < nearest) {
+    nearest = previous[x - 1];
+  }
+  if (x + 1 < width && previous[x + 1] < nearest) {
+    nearest = previous[x + 1];
+  }
+  nearest = __howderek_grid_next(nearest);
+  distance = (row[x] != open) ? HOWDEREK_GRID_FAR : ((nearest < current[x]) ? nearest : current[x]);
+  if (distance != current[x]) {
+    current[x] = distance;
+    return 1;
+  }
+  return 0;
+}
+
+
+
+int __howderek_grid_vertical(uint32_t* current, const uint32_t* previous, const uint8_t* row,
+                             uint8_t open, uint32_t width) {
+  int changed = 0;
+  uint32_t x;
+  for (x = 0; x < width; x++) {
+    changed |= __howderek_grid_vertical_cell(current, previous, row, open, width, x);
+  }
+  return changed;
+}
+
+
+
+#ifdef HOWDEREK_GRID_AVX2
+__attribute__((target("avx2")))
+int __howderek_grid_vertical_avx2(uint32_t* current, const uint32_t* previous, const uint8_t* row,
+                                  uint8_t open, uint32_t width) {
+  const __m256i far = _mm256_set1_epi32(-1);
+  const __m256i openValue = _mm256_set1_epi32(open);
+  __m256i changed = _mm256_setzero_si256();
+  __m256i nearest;
+  __m256i old;
+  __m256i distance;
+  __m256i crossable;
+  int result = 0;
+  uint32_t x = 0;
+  if (width > 0) {
+    result |= __howderek_grid_vertical_cell(current, previous, row, open, width, x++);
+  }
+  // Eight cells at a time, as long as the cell right of the last one is there
+  for (; x + 9 <= width; x += 8) {
+    nearest = _mm256_min_epu32(_mm256_loadu_si256((const __m256i*) (previous + x - 1)),
+                               _mm256_loadu_si256((const __m256i*) (previous + x)));
+    nearest = _mm256_min_epu32(nearest, _mm256_loadu_si256((const __m256i*) (previous + x + 1)));
+    // Adding 1 to HOWDEREK_GRID_FAR wraps to 0, so put it back
+    nearest = _mm256_or_si256(_mm256_sub_epi32(nearest, far), _mm256_cmpeq_epi32(nearest, far));
+    old = _mm256_loadu_si256((const __m256i*) (current + x));
+    distance = _mm256_min_epu32(old, nearest);
+    crossable = _mm256_cmpeq_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (row + x))), openValue);
+    distance = _mm256_or_si256(distance, _mm256_andnot_si256(crossable, far));
+    changed = _mm256_or_si256(changed, _mm256_xor_si256(distance, old));
+    _mm256_storeu_si256((__m256i*) (current + x), distance);
+  }
+  for (; x < width; x++) {
+    result |= __howderek_grid_vertical_cell(current, previous, row, open, width, x);
+  }
+  return result | !_mm256_testz_si256(changed, changed);
+}
+#endif
+
+
+
+/**
+ * Carry distances along a row from one cell to the next
+ *
+ * \return 1 if it changed
+ */
+static inline int __howderek_grid_carry(uint32_t* current, const uint8_t* row, uint8_t open, uint32_t x,
+                                        uint32_t* carried) {
+  const uint32_t next = __howderek_grid_next(*carried);
+  const uint32_t distance = (row[x] != open) ? HOWDEREK_GRID_FAR : ((next < current[x]) ? next : current[x]);
+  const int changed = (distance != current[x]);
+  current[x] = distance;
+  *carried = distance;
+  return changed;
+}
+
+
+
+/**
+ * Carry distances along a row both ways. Each cell depends on the one
+ * before it, so this part isn't vectorized.
+ *
+ * \return 1 if anything changed
+ */
+int __howderek_grid_horizontal(uint32_t* current, const uint8_t* row, uint8_t open, uint32_t width) {
+  uint32_t carried = HOWDEREK_GRID_FAR;
+  int changed = 0;
+  uint32_t x;
+  for (x = 0; x < width; x++) {
+    changed |= __howderek_grid_carry(current, row, open, x, &carried);
+  }
+  carried = HOWDEREK_GRID_FAR;
+  for (x = width; x > 0; x--) {
+    changed |= __howderek_grid_carry(current, row, open, x - 1, &carried);
+  }
+  return changed;
+}
+
+
+
+/**
+ * Sweep every row, down if step is 1 and up if it's -1
+ *
+ * \return 1 if anything changed
+ */
+int __howderek_grid_sweep(const struct howderek_grid* grid, uint8_t open, uint32_t width, uint32_t height,
+                          uint32_t* distances, int step, uint8_t* row,
+                          int (*vertical)(uint32_t*, const uint32_t*, const uint8_t*, uint8_t, uint32_t)) {
+  uint32_t* current;
+  int changed = 0;
+  uint32_t i;
+  uint32_t y;
+  for (i = 0; i < height; i++) {
+    y = (step > 0) ? i : height - 1 - i;
+    current = distances + (size_t) y * width;
+    __howderek_grid_copy_row(grid, y, width, row);
+    if (i > 0) {
+      changed |= vertical(current, current - (ptrdiff_t) step * width, row, open, width);
+    }
+    // Both ways, so paths that go back and forth between obstacles while
+    // heading the same way up or down only take one sweep
+    changed |= __howderek_grid_horizontal(current, row, open, width);
+  }
+  return changed;
+}
+
+
+
+unsigned howderek_grid_distances(const struct howderek_grid* grid, uint8_t open, uint32_t width, uint32_t height,
+                                 uint32_t* distances, unsigned rounds) {
+  int (*vertical)(uint32_t*, const uint32_t*, const uint8_t*, uint8_t, uint32_t) = __howderek_grid_vertical;
+  uint8_t* row;
+  unsigned round = 0;
+  int changed = 1;
+  if (width == 0 || height == 0) {
+    return 0;
+  }
+#ifdef HOWDEREK_GRID_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    vertical = __howderek_grid_vertical_avx2;
+  }
+#endif
+  row = __howderek_grid_alloc(width);
+  while (changed && (rounds == 0 || round < rounds)) {
+    changed = __howderek_grid_sweep(grid, open, width, height, distances, 1, row, vertical);
+    changed |= __howderek_grid_sweep(grid, open, width, height, distances, -1, row, vertical);
+    round++;
+  }
+  free(row);
+  return round;
+}
@@ -0,0 +1,202 @@
+/*! \file howderek_grid.h
+ *  \brief Copy-on-write grid of cells split into square tiles
+ *
+ *  Snapshots share every tile with the grid they came from. Writing to a
+ *  cell copies only the tile it's in, and only if another snapshot still
+ *  shares it. Tiles that were never written aren't allocated and read as
+ *  the grid's fill value.
+ *
+ *     grid A ──┐                 ┌── tile (0,0)
+ *              ├── tile table ───┼── tile (1,0)
+ *     grid B ──┘   (shared)      └── NULL (all fill)
+ *
+ *  The tile table is shared as well, so taking a snapshot and releasing one
+ *  that was never written are both O(1). The first write to a snapshot
+ *  copies the table (one pointer per tile) and then the tile it touches.
+ *
+ *  Cells are 2 bits, so they hold 0 to 3. Each row of a tile is packed into
+ *  64 bit words of 32 cells, cell x of a word in bits 2x and 2x + 1, so a
+ *  tile of 64x64 cells takes 1KB and howderek_grid_word reads 32 cells of a
+ *  row at once.
+ *
+ *  Reference counts are atomic, so snapshots of one grid can be taken and
+ *  released from any thread. Each snapshot must only be written by one
+ *  thread at a time.
+*/
+
+#ifndef H_LIBHOWDEREK_GRID_H
+#define H_LIBHOWDEREK_GRID_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "howderek.h"
+
+#ifndef HOWDEREK_GRID_CONFIG
+// Tiles are 2^TILE_BITS cells on a side, at least a word across
+#define HOWDEREK_GRID_TILE_BITS 6
+#endif
+
+// Cells are 2 bits, 2^WORD_BITS of them to a word
+#define HOWDEREK_GRID_CELL_BITS  2
+#define HOWDEREK_GRID_CELL_MASK  3
+#define HOWDEREK_GRID_WORD_BITS  5
+
+// Distance to cells no source can reach
+#define HOWDEREK_GRID_FAR UINT32_MAX
+
+#define HOWDEREK_GRID_TILE_SIZE  (1u << HOWDEREK_GRID_TILE_BITS)
+#define HOWDEREK_GRID_TILE_MASK  (HOWDEREK_GRID_TILE_SIZE - 1)
+#define HOWDEREK_GRID_TILE_CELLS (HOWDEREK_GRID_TILE_SIZE * HOWDEREK_GRID_TILE_SIZE)
+#define HOWDEREK_GRID_WORD_CELLS (1u << HOWDEREK_GRID_WORD_BITS)
+#define HOWDEREK_GRID_WORD_MASK  (HOWDEREK_GRID_WORD_CELLS - 1)
+#define HOWDEREK_GRID_ROW_WORDS  (HOWDEREK_GRID_TILE_SIZE >> HOWDEREK_GRID_WORD_BITS)
+#define HOWDEREK_GRID_TILE_WORDS (HOWDEREK_GRID_TILE_SIZE * HOWDEREK_GRID_ROW_WORDS)
+
+#if HOWDEREK_GRID_TILE_BITS < HOWDEREK_GRID_WORD_BITS
+#error "HOWDEREK_GRID_TILE_BITS has to be at least HOWDEREK_GRID_WORD_BITS"
+#endif
+
+struct howderek_grid_tile {
+  uint32_t references;               // snapshots sharing this tile
+  uint64_t words[HOWDEREK_GRID_TILE_WORDS];  // row major, HOWDEREK_GRID_ROW_WORDS per row
+};
+
+struct howderek_grid_table {
+  uint32_t references;               // snapshots sharing this table
+  uint32_t tilesX;
+  uint32_t tilesY;
+  struct howderek_grid_tile* tiles[];  // row major, NULL if every cell is fill
+};
+
+struct howderek_grid {
+  struct howderek_grid_table* table;
+  uint8_t fill;                      // value of cells that were never written, 0 to 3
+};
+
+/**
+ * Create a grid. It grows to fit whatever is written to it.
+ *
+ * \param width   cells to make room for across
+ * \param height  cells to make room for down
+ * \param fill    value every cell starts with, 0 to 3
+ */
+struct howderek_grid* howderek_grid_create(uint32_t width, uint32_t height, uint8_t fill);
+
+/**
+ * Take a snapshot of a grid in O(1). Writes to either one aren't seen by
+ * the other.
+ *
+ * \param grid  grid to take a snapshot of
+ */
+struct howderek_grid* howderek_grid_snapshot(struct howderek_grid* grid);
+
+/**
+ * Destroy a grid or snapshot. O(1) unless it was the last one using its
+ * tiles.
+ *
+ * \param grid  grid to destroy
+ */
+void howderek_grid_destroy(struct howderek_grid* grid);
+
+/**
+ * Set a cell, copying its tile first if it's shared
+ *
+ * \param grid   grid to change
+ * \param x      column
+ * \param y      row
+ * \param value  new value, 0 to 3
+ */
+void howderek_grid_set(struct howderek_grid* grid, uint32_t x, uint32_t y, uint8_t value);
+
+/**
+ * Set the 32 cells of a row that share a word, copying their tile first if
+ * it's shared. Much faster than howderek_grid_set for loading a whole grid.
+ *
+ * \param grid   grid to change
+ * \param x      any column in the word, rounded down to a multiple of 32
+ * \param y      row
+ * \param word   new cells, laid out like howderek_grid_word
+ */
+void howderek_grid_set_word(struct howderek_grid* grid, uint32_t x, uint32_t y, uint64_t word);
+
+/**
+ * Number of tiles this grid shares with a snapshot
+ *
+ * \param grid  grid to check
+ */
+size_t howderek_grid_shared_tiles(struct howderek_grid* grid);
+
+/**
+ * Distance from every cell to the nearest source, moving between cells equal
+ * to open in any of the 8 directions at a cost of 1 per move, diagonals
+ * included. The grid is swept down and then up like a chamfer distance
+ * transform, each row taking one more than the smallest of the three cells
+ * next to it in the row before and then carrying that along itself both
+ * ways. Without obstacles one round of sweeps is exact, and so is any path
+ * that only heads up or only heads down. Each further round lets paths turn
+ * back once more, until nothing changes. Rows are combined with AVX2 when
+ * the CPU has it.
+ *
+ * \param grid       grid to measure
+ * \param open       value of the cells that can be crossed
+ * \param width      columns to measure
+ * \param height     rows to measure
+ * \param distances  width * height, row major. Set sources to 0 and every
+ *                   other cell to HOWDEREK_GRID_FAR first. Cells no source
+ *                   can reach are left at HOWDEREK_GRID_FAR.
+ * \param rounds     most rounds of sweeps to take, 0 to go until nothing
+ *                   changes. 1 is enough when nothing is in the way.
+ * \return           rounds taken
+ */
+unsigned howderek_grid_distances(const struct howderek_grid* grid, uint8_t open, uint32_t width, uint32_t height,
+                                 uint32_t* distances, unsigned rounds);
+
+/**
+ * A word with every cell set to value
+ *
+ * \param value  value of the cells, 0 to 3
+ * \return       the word
+ */
+static inline uint64_t howderek_grid_fill_word(uint8_t value) {
+  return (uint64_t) (value & HOWDEREK_GRID_CELL_MASK) * 0x5555555555555555ULL;
+}
+
+/**
+ * Get the 32 cells of a row that share a word
+ *
+ * \param grid  grid to read
+ * \param x     any column in the word, rounded down to a multiple of 32
+ * \param y     row
+ * \return      the cells, cell x % 32 in bits 2 * (x % 32) and the one
+ *              above. Cells that were never written are fill.
+ */
+static inline uint64_t howderek_grid_word(const struct howderek_grid* grid, uint32_t x, uint32_t y) {
+  const uint32_t tileX = x >> HOWDEREK_GRID_TILE_BITS;
+  const uint32_t tileY = y >> HOWDEREK_GRID_TILE_BITS;
+  const struct howderek_grid_tile* tile;
+  if (tileX >= grid->table->tilesX || tileY >= grid->table->tilesY) {
+    return howderek_grid_fill_word(grid->fill);
+  }
+  tile = grid->table->tiles[(size_t) tileY * grid->table->tilesX + tileX];
+  if (tile == NULL) {
+    return howderek_grid_fill_word(grid->fill);
+  }
+  return tile->words[(y & HOWDEREK_GRID_TILE_MASK) * HOWDEREK_GRID_ROW_WORDS
+                     + ((x & HOWDEREK_GRID_TILE_MASK) >> HOWDEREK_GRID_WORD_BITS)];
+}
+
+/**
+ * Get a cell
+ *
+ * \param grid  grid to read
+ * \param x     column
+ * \param y     row
+ * \return      value of the cell, fill if it was never written
+ */
+static inline uint8_t howderek_grid_get(const struct howderek_grid* grid, uint32_t x, uint32_t y) {
+  return (howderek_grid_word(grid, x, y) >> ((x & HOWDEREK_GRID_WORD_MASK) * HOWDEREK_GRID_CELL_BITS))
+         & HOWDEREK_GRID_CELL_MASK;
+}
+
+#endif
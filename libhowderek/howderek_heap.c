@@ -43,8 +43,8 @@ void howderek_heap_destroy(struct howderek_heap* heap, int freeData) {
 
 
 
-void howderek_heap_push(struct howderek_heap* heap, howderek_array_value_t value) {
-  size_t i = heap->store->count;
+void __howderek_heap_sift_up(struct howderek_heap* heap, size_t i) {
+  howderek_array_value_t value = howderek_array_get(heap->store, i);
   while (i != 0 && heap->compareFunction(HOWDEREK_HEAP_PARENT(heap, i), value) > 0) {
     howderek_array_swap(heap->store, i, HOWDEREK_HEAP_PARENT_INDEX(heap, i));
     i = HOWDEREK_HEAP_PARENT_INDEX(heap, i);
@@ -53,15 +53,8 @@ void howderek_heap_push(struct howderek_heap* heap, howderek_array_value_t value
 
 
 
-howderek_array_value_t howderek_heap_pop(struct howderek_heap* heap) {
-  if (heap->store->count == 0) {
-    return HOWDEREK_ARRAY_EMPTY_VALUE;
-  }
-
-  howderek_array_swap(heap->store, 0, heap->store->count - 1);
-  howderek_array_value_t result = howderek_array_pop(heap->store);
-  size_t index = 0;
-  size_t min = 0;
+void __howderek_heap_sift_down(struct howderek_heap* heap, size_t index) {
+  size_t min = index;
   size_t i = 0;
   do {
     index = min;
@@ -74,5 +67,81 @@ howderek_array_value_t howderek_heap_pop(struct howderek_heap* heap) {
       howderek_array_swap(heap->store, index, min);
     }
   } while (index != min);
- return result;
+}
+
+
+
+struct howderek_heap* howderek_heap_build(uint8_t childrenPerNode,
+                                          int8_t (*compareFunction)(howderek_array_value_t left, howderek_array_value_t right),
+                                          howderek_array_value_t* values,
+                                          size_t count) {
+  struct howderek_heap* heap = howderek_heap_create(childrenPerNode, compareFunction);
+  howderek_heap_push_many(heap, values, count);
+  return heap;
+}
+
+
+
+void howderek_heap_push(struct howderek_heap* heap, howderek_array_value_t value) {
+  howderek_array_push(heap->store, value);
+  __howderek_heap_sift_up(heap, heap->store->count - 1);
+}
+
+
+
+void howderek_heap_push_many(struct howderek_heap* heap, howderek_array_value_t* values, size_t count) {
+  if (count == 0) {
+    return;
+  }
+  size_t oldCount = heap->store->count;
+  size_t i;
+  if (heap->store->size < oldCount + count) {
+    howderek_array_grow(heap->store, oldCount + count);
+  }
+  for (i = 0; i < count; i++) {
+    howderek_array_push(heap->store, values[i]);
+  }
+
+  /*
+   * Floyd's bottom-up heapify, restricted to the ancestors of the new values
+   *
+   *          O              Every subtree that doesn't contain a new value
+   *      O   O   X          is still a heap, so only the nodes between the
+   *     O O O O X X X       parents of the first and last new value need
+   *     O O O O N N N N     to sift down. Each level up shrinks that range
+   *                         by a factor of d until it reaches the root.
+   *
+   * With an empty heap this is the plain linear-time heapify.
+   */
+  size_t low = oldCount;
+  size_t high = heap->store->count - 1;
+  while (high != 0) {
+    low = HOWDEREK_HEAP_PARENT_INDEX(heap, low);
+    high = HOWDEREK_HEAP_PARENT_INDEX(heap, high);
+    for (i = high + 1; i > low; i--) {
+      __howderek_heap_sift_down(heap, i - 1);
+    }
+  }
+}
+
+
+
+howderek_array_value_t howderek_heap_peek(struct howderek_heap* heap) {
+  if (heap->store->count == 0) {
+    return HOWDEREK_ARRAY_EMPTY_VALUE;
+  }
+  return howderek_array_get(heap->store, 0);
+}
+
+
+
+howderek_array_value_t howderek_heap_pop(struct howderek_heap* heap) {
+  if (heap->store->count == 0) {
+    return HOWDEREK_ARRAY_EMPTY_VALUE;
+  }
+
+  howderek_array_swap(heap->store, 0, heap->store->count - 1);
+  howderek_array_value_t result = howderek_array_pop(heap->store);
+  __howderek_heap_sift_down(heap, 0);
+  return result;
 }
@@ -37,6 +37,20 @@ struct howderek_heap {
  */
 struct howderek_heap* howderek_heap_create(uint8_t childrenPerNode, int8_t (*compareFunction)(howderek_array_value_t left, howderek_array_value_t right));
 
+/**
+ * Create a heap from an existing array using Floyd's bottom-up heapify. O(n)
+ * instead of the O(n log n) it would take to push each value.
+ *
+ * \param childrenPerNode  the d in d-ary, defaults to HOWDEREK_HEAP_DEFAULT_D if < 2
+ * \param compareFunction  comparison used to order the heap
+ * \param values           values to copy into the heap
+ * \param count            number of values
+ */
+struct howderek_heap* howderek_heap_build(uint8_t childrenPerNode,
+                                          int8_t (*compareFunction)(howderek_array_value_t left, howderek_array_value_t right),
+                                          howderek_array_value_t* values,
+                                          size_t count);
+
 /**
  * Clears the heap
  */
@@ -53,7 +67,18 @@ void howderek_heap_destroy(struct howderek_heap* heap, int freeData);
 void howderek_heap_push(struct howderek_heap* heap, howderek_array_value_t value);
 
 /**
- * Removes the last object from the array
+ * Adds several objects at once. The values are appended and only their
+ * ancestors are sifted down, so this is linear in count rather than
+ * count * log(n).
+ *
+ * \param heap    heap to push to
+ * \param values  values to push
+ * \param count   number of values
+ */
+void howderek_heap_push_many(struct howderek_heap* heap, howderek_array_value_t* values, size_t count);
+
+/**
+ * Returns the top of the heap without removing it
  */
 howderek_array_value_t howderek_heap_peek(struct howderek_heap* heap);
 
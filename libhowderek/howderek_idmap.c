@@ -0,0 +1,118 @@
+/*! \file howderek_idmap.c
+ *  \brief Maps sparse 64-bit ids to dense 32-bit indices and back
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "howderek.h"
+#include "howderek_idmap.h"
+
+
+// Finalizer from splitmix64, spreads packed coordinates across the table
+static inline uint64_t __howderek_idmap_hash(uint64_t id) {
+  id ^= id >> 30;
+  id *= 0xbf58476d1ce4e5b9ULL;
+  id ^= id >> 27;
+  id *= 0x94d049bb133111ebULL;
+  id ^= id >> 31;
+  return id;
+}
+
+
+
+void* __howderek_idmap_alloc(void* old, size_t size) {
+  void* result = realloc(old, size);
+  if (result == NULL) {
+    howderek_log(HOWDEREK_LOG_FATAL, "libhowderek_idmap: allocation failed for %lu bytes", size);
+    exit(ENOMEM);
+  }
+  return result;
+}
+
+
+
+void __howderek_idmap_rehash(struct howderek_idmap* map, size_t slotCount) {
+  uint32_t i;
+  uint64_t slot;
+  free(map->slots);
+  map->slots = calloc(slotCount, sizeof(uint32_t));
+  if (map->slots == NULL) {
+    howderek_log(HOWDEREK_LOG_FATAL, "libhowderek_idmap: allocation failed for %lu slots", slotCount);
+    exit(ENOMEM);
+  }
+  map->slotMask = slotCount - 1;
+  for (i = 0; i < map->count; i++) {
+    slot = __howderek_idmap_hash(map->ids[i]) & map->slotMask;
+    while (map->slots[slot] != 0) {
+      slot = (slot + 1) & map->slotMask;
+    }
+    map->slots[slot] = i + 1;
+  }
+}
+
+
+
+struct howderek_idmap* howderek_idmap_create(size_t expectedCount) {
+  struct howderek_idmap* map = __howderek_idmap_alloc(NULL, sizeof(struct howderek_idmap));
+  size_t slotCount = 16;
+  while (slotCount * HOWDEREK_IDMAP_MAX_LOAD < expectedCount) {
+    slotCount <<= 1;
+  }
+  map->count = 0;
+  map->capacity = (expectedCount > 16) ? expectedCount : 16;
+  map->ids = __howderek_idmap_alloc(NULL, sizeof(uint64_t) * map->capacity);
+  map->slots = NULL;
+  __howderek_idmap_rehash(map, slotCount);
+  return map;
+}
+
+
+
+void howderek_idmap_destroy(struct howderek_idmap* map) {
+  if (map == NULL) {
+    return;
+  }
+  free(map->slots);
+  free(map->ids);
+  free(map);
+}
+
+
+
+uint32_t howderek_idmap_get(struct howderek_idmap* map, uint64_t id) {
+  uint64_t slot = __howderek_idmap_hash(id) & map->slotMask;
+  while (map->slots[slot] != 0) {
+    if (map->ids[map->slots[slot] - 1] == id) {
+      return map->slots[slot] - 1;
+    }
+    slot = (slot + 1) & map->slotMask;
+  }
+  return HOWDEREK_IDMAP_NOT_FOUND;
+}
+
+
+
+uint32_t howderek_idmap_insert(struct howderek_idmap* map, uint64_t id) {
+  uint64_t slot = __howderek_idmap_hash(id) & map->slotMask;
+  while (map->slots[slot] != 0) {
+    if (map->ids[map->slots[slot] - 1] == id) {
+      return map->slots[slot] - 1;
+    }
+    slot = (slot + 1) & map->slotMask;
+  }
+
+  if (map->count == map->capacity) {
+    map->capacity *= 2;
+    map->ids = __howderek_idmap_alloc(map->ids, sizeof(uint64_t) * map->capacity);
+  }
+  const uint32_t index = map->count++;
+  map->ids[index] = id;
+  if (map->count > (map->slotMask + 1) * HOWDEREK_IDMAP_MAX_LOAD) {
+    __howderek_idmap_rehash(map, ((size_t) map->slotMask + 1) * 2);
+  } else {
+    map->slots[slot] = index + 1;
+  }
+  return index;
+}
@@ -0,0 +1,80 @@
+/*! \file howderek_idmap.h
+ *  \brief Maps sparse 64-bit ids to dense 32-bit indices and back
+ *
+ *  Indices are handed out in insertion order starting at 0, so anything
+ *  keyed by id can be stored in a plain array. The hash table only stores
+ *  indices, and the ids live in a dense array that doubles as the reverse
+ *  mapping.
+ *
+ *     slots  | 0 | 2 | 0 | 1 | 3 | 0 |    (index + 1, 0 is empty)
+ *     ids    | 9001 | 42 | 7 |            (index -> id)
+ *
+ *  Indices are never reused, so they stay valid for as long as the map does.
+*/
+
+#ifndef H_LIBHOWDEREK_IDMAP_H
+#define H_LIBHOWDEREK_IDMAP_H
+
+#ifndef HOWDEREK_IDMAP_CONFIG
+// Grow once more than this fraction of the slots are used
+#define HOWDEREK_IDMAP_MAX_LOAD 0.7
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "howderek.h"
+
+#define HOWDEREK_IDMAP_NOT_FOUND UINT32_MAX
+
+struct howderek_idmap {
+  uint32_t* slots;       // index + 1 of the id hashed here, 0 if empty
+  uint64_t* ids;         // index -> id
+  uint32_t count;        // indices handed out
+  uint32_t capacity;     // size of ids
+  uint32_t slotMask;     // number of slots - 1, always a power of two minus one
+};
+
+/**
+ * Create an id map
+ *
+ * \param expectedCount  number of ids it should hold without growing
+ */
+struct howderek_idmap* howderek_idmap_create(size_t expectedCount);
+
+/**
+ * Destroy an id map
+ *
+ * \param map  map to destroy
+ */
+void howderek_idmap_destroy(struct howderek_idmap* map);
+
+/**
+ * Get the index of an id, assigning the next free index if it is new
+ *
+ * \param map  map to insert into
+ * \param id   id to insert
+ * \return     index of id
+ */
+uint32_t howderek_idmap_insert(struct howderek_idmap* map, uint64_t id);
+
+/**
+ * Get the index of an id
+ *
+ * \param map  map to search
+ * \param id   id to find
+ * \return     index of id, HOWDEREK_IDMAP_NOT_FOUND if it was never inserted
+ */
+uint32_t howderek_idmap_get(struct howderek_idmap* map, uint64_t id);
+
+/**
+ * Get the id at an index
+ *
+ * \param map    map to search
+ * \param index  index less than map->count
+ */
+static inline uint64_t howderek_idmap_id(struct howderek_idmap* map, uint32_t index) {
+  return map->ids[index];
+}
+
+#endif
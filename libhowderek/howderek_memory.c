@@ -5,11 +5,80 @@
 #include <time.h>
 #include <errno.h>
 #include <signal.h>
+#include <pthread.h>
 
 #include "howderek.h"
 #include "howderek_memory.h"
 
-static struct howderek_memory_hashmap* __howderek_global_memory = NULL;
+#define HOWDEREK_MEMORY_CHUNK_HEADER_SIZE  HOWDEREK_MEMORY_ALIGN(sizeof(struct howderek_memory_chunk))
+#define HOWDEREK_MEMORY_REGION_SIZE        HOWDEREK_MEMORY_ALIGN(sizeof(struct howderek_memory_region))
+#define HOWDEREK_MEMORY_HEADER_SIZE        HOWDEREK_MEMORY_ALIGN(sizeof(struct howderek_memory_header))
+#define HOWDEREK_MEMORY_CHUNK_DATA(chunk)  ((char*) (chunk) + HOWDEREK_MEMORY_CHUNK_HEADER_SIZE)
+// Allocations of more than this get a chunk of their own
+#define HOWDEREK_MEMORY_DEDICATED          (HOWDEREK_MEMORY_CHUNK_SIZE / 4)
+
+// Chunks are aligned to pages of 2^PAGE_BITS bytes and every page a chunk
+// covers points back to it, so howderek_free can tell its own pointers
+// apart without reading memory it doesn't own. The page table has two
+// levels of 2^16 entries, enough for 48 bit addresses.
+#define HOWDEREK_MEMORY_PAGE_BITS  16
+#define HOWDEREK_MEMORY_PAGE_SIZE  ((size_t) 1 << HOWDEREK_MEMORY_PAGE_BITS)
+#define HOWDEREK_MEMORY_PAGE_LEVEL ((size_t) 1 << 16)
+
+#if HOWDEREK_MEMORY_DEDICATED < 2 * HOWDEREK_MEMORY_SMALL
+#error "HOWDEREK_MEMORY_CHUNK_SIZE is too small for HOWDEREK_MEMORY_SMALL"
+#endif
+
+// Counters only the thread that owns them writes, read by other threads
+#define HOWDEREK_MEMORY_COUNT(counter, amount) \
+  __atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (amount), __ATOMIC_RELAXED)
+#define HOWDEREK_MEMORY_READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+// Regions aren't locked, each one belongs to whoever owns its root. Nothing
+// an allocation or a free touches is shared between threads except live and
+// peak bytes of its type, which are atomic. The rest of the profile is
+// counted per thread and added up when it's read. Only making or destroying
+// a region locks anything, to keep the list of regions.
+struct howderek_memory_thread {
+  struct howderek_memory_type_stats types[HOWDEREK_MEMORY_PROFILE_TYPES];  // live and peak aren't used
+  size_t sampleCountdown;
+  struct howderek_memory_thread* prev;
+  struct howderek_memory_thread* next;
+};
+
+static struct howderek_memory_region* __howderek_memory_regions = NULL;
+static size_t __howderek_memory_region_count = 0;
+static size_t __howderek_memory_chunk_count = 0;
+static pthread_mutex_t __howderek_memory_regions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct howderek_memory_thread* __howderek_memory_thread = NULL;
+static struct howderek_memory_thread* __howderek_memory_threads = NULL;
+// Counts of threads that have exited
+static struct howderek_memory_type_stats __howderek_memory_retired[HOWDEREK_MEMORY_PROFILE_TYPES];
+static pthread_mutex_t __howderek_memory_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t __howderek_memory_thread_key;
+static pthread_once_t __howderek_memory_thread_once = PTHREAD_ONCE_INIT;
+
+// The last type slot collects everything once the table is full
+static struct howderek_memory_type_stats __howderek_memory_types[HOWDEREK_MEMORY_PROFILE_TYPES];
+static struct howderek_memory_site_stats __howderek_memory_sites[HOWDEREK_MEMORY_PROFILE_SITES];
+// Type slots by the address of the type string, so most lookups skip the hash
+static struct {
+  const char* type;
+  struct howderek_memory_type_stats* stats;
+} __howderek_memory_type_cache[HOWDEREK_MEMORY_PROFILE_TYPES];
+static pthread_mutex_t __howderek_memory_types_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t __howderek_memory_profile_requested = 0;
+static size_t __howderek_memory_sample_rate = HOWDEREK_MEMORY_SAMPLE_RATE;
+static size_t __howderek_memory_samples_dropped = 0;
+// Counts as of the last reset, subtracted from what's read
+static struct howderek_memory_type_stats __howderek_memory_profile_base[HOWDEREK_MEMORY_PROFILE_TYPES];
+static struct howderek_memory_stats __howderek_memory_stats_base = { 0, 0, 0, 0 };
+static struct timespec __howderek_memory_profile_start = { 0, 0 };
+static pthread_mutex_t __howderek_memory_profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct howderek_memory_chunk** __howderek_memory_pages[HOWDEREK_MEMORY_PAGE_LEVEL];
+static pthread_mutex_t __howderek_memory_pages_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void __dump_on_signal(int signo) {
   howderek_log(HOWDEREK_LOG_FATAL, "Recieved SIGQUIT, displaying memory...");
@@ -19,65 +88,482 @@ void __dump_on_signal(int signo) {
   }
 }
 
-void __howderek_memory_push(struct howderek_memory_hashmap_node* node);
 
-void __howderek_memory_hashmap_resize(size_t size) {
-  struct howderek_memory_hashmap* oldMemories = __howderek_global_memory;
-  __howderek_global_memory = malloc(sizeof(struct howderek_memory_hashmap));
-  size_t i = 0;
-  for (i = 0; i < HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS; i++) {
-    __howderek_global_memory->tables[i] = NULL;
+
+// Only async-signal-safe things can happen here, so the profile is printed
+// by the next allocation
+void __profile_on_signal(int signo) {
+  __howderek_memory_profile_requested = 1;
+}
+
+
+
+/**
+ * Global slot for a type. Regions remember it, so this only runs the first
+ * time a region sees a type.
+ */
+struct howderek_memory_type_stats* __howderek_memory_type_lookup(const char* type) {
+  const size_t cached = ((uintptr_t) type >> 3) % HOWDEREK_MEMORY_PROFILE_TYPES;
+  struct howderek_memory_type_stats* stats;
+  const char* c;
+  size_t hash = 5381;
+  size_t i;
+  pthread_mutex_lock(&__howderek_memory_types_lock);
+  if (__howderek_memory_type_cache[cached].type == type) {
+    stats = __howderek_memory_type_cache[cached].stats;
+    pthread_mutex_unlock(&__howderek_memory_types_lock);
+    return stats;
+  }
+  // Hash the string rather than the pointer, the same literal can have a
+  // different address in each translation unit
+  for (c = type; *c != '\0'; c++) {
+    hash = hash * 33 + (unsigned char) *c;
+  }
+  const size_t slots = HOWDEREK_MEMORY_PROFILE_TYPES - 1;
+  stats = &__howderek_memory_types[slots];
+  for (i = 0; i < slots; i++) {
+    if (__howderek_memory_types[(hash + i) % slots].type == NULL) {
+      stats = &__howderek_memory_types[(hash + i) % slots];
+      __atomic_store_n(&stats->type, type, __ATOMIC_RELEASE);
+      break;
+    }
+    if (strcmp(__howderek_memory_types[(hash + i) % slots].type, type) == 0) {
+      stats = &__howderek_memory_types[(hash + i) % slots];
+      break;
+    }
+  }
+  if (stats->type == NULL) {
+    __atomic_store_n(&stats->type, "(other)", __ATOMIC_RELEASE);
+  }
+  __howderek_memory_type_cache[cached].type = type;
+  __howderek_memory_type_cache[cached].stats = stats;
+  pthread_mutex_unlock(&__howderek_memory_types_lock);
+  return stats;
+}
+
+
+
+void __howderek_memory_sample(const char* type, size_t size, void* site) {
+  size_t hash = ((uintptr_t) site >> 2) % HOWDEREK_MEMORY_PROFILE_SITES;
+  size_t i;
+  void* claimed;
+  for (i = 0; i < HOWDEREK_MEMORY_PROFILE_SITES; i++) {
+    struct howderek_memory_site_stats* stats = &__howderek_memory_sites[(hash + i) % HOWDEREK_MEMORY_PROFILE_SITES];
+    claimed = NULL;
+    if (__atomic_compare_exchange_n(&stats->site, &claimed, site, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      __atomic_store_n(&stats->type, type, __ATOMIC_RELEASE);
+      claimed = site;
+    }
+    if (claimed == site) {
+      __atomic_add_fetch(&stats->samples, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&stats->bytes, size, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+  __atomic_add_fetch(&__howderek_memory_samples_dropped, 1, __ATOMIC_RELAXED);
+}
+
+
+
+/**
+ * Fold an exiting thread's counts into the retired ones
+ */
+void __howderek_memory_thread_exit(void* data) {
+  struct howderek_memory_thread* thread = data;
+  size_t i, j;
+  pthread_mutex_lock(&__howderek_memory_threads_lock);
+  for (i = 0; i < HOWDEREK_MEMORY_PROFILE_TYPES; i++) {
+    __howderek_memory_retired[i].allocations += thread->types[i].allocations;
+    __howderek_memory_retired[i].deallocations += thread->types[i].deallocations;
+    __howderek_memory_retired[i].bytes += thread->types[i].bytes;
+    for (j = 0; j < HOWDEREK_MEMORY_HISTOGRAM_BUCKETS; j++) {
+      __howderek_memory_retired[i].histogram[j] += thread->types[i].histogram[j];
+    }
   }
-  __howderek_global_memory->__primeCount = size;
-  __howderek_global_memory->size         = howderek_artisan_primes[size];
-  howderek_reset_memory_management();
-  if (oldMemories != NULL) {
-    int i, j;
-    for (i = 0; i < HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS; i++) {
-      for (j = 0; j < oldMemories->size; j++) {
-        if (oldMemories->tables[i][j].parent != NULL) {
-         __howderek_memory_push(&oldMemories->tables[i][j]);
-        }
+  if (thread->prev != NULL) {
+    thread->prev->next = thread->next;
+  } else {
+    __howderek_memory_threads = thread->next;
+  }
+  if (thread->next != NULL) {
+    thread->next->prev = thread->prev;
+  }
+  pthread_mutex_unlock(&__howderek_memory_threads_lock);
+  free(thread);
+}
+
+
+
+void __howderek_memory_thread_key_create() {
+  pthread_key_create(&__howderek_memory_thread_key, __howderek_memory_thread_exit);
+}
+
+
+
+/**
+ * \return the calling thread's counters, made the first time it allocates
+ */
+struct howderek_memory_thread* __howderek_memory_thread_get() {
+  struct howderek_memory_thread* thread = __howderek_memory_thread;
+  if (thread != NULL) {
+    return thread;
+  }
+  thread = calloc(1, sizeof(struct howderek_memory_thread));
+  if (thread == NULL) {
+    howderek_log(HOWDEREK_LOG_FATAL, "error in %s (calloc failed for thread counters)", __func__);
+    exit(ENOMEM);
+  }
+  thread->sampleCountdown = __atomic_load_n(&__howderek_memory_sample_rate, __ATOMIC_RELAXED);
+  pthread_once(&__howderek_memory_thread_once, __howderek_memory_thread_key_create);
+  pthread_setspecific(__howderek_memory_thread_key, thread);
+  pthread_mutex_lock(&__howderek_memory_threads_lock);
+  thread->next = __howderek_memory_threads;
+  if (thread->next != NULL) {
+    thread->next->prev = thread;
+  }
+  __howderek_memory_threads = thread;
+  pthread_mutex_unlock(&__howderek_memory_threads_lock);
+  __howderek_memory_thread = thread;
+  return thread;
+}
+
+
+
+/**
+ * Add up every thread's counters for each type, less the last reset
+ *
+ * \param sums  one per type slot
+ */
+void __howderek_memory_sum(struct howderek_memory_type_stats* sums) {
+  struct howderek_memory_thread* thread;
+  size_t i, j;
+  pthread_mutex_lock(&__howderek_memory_threads_lock);
+  memcpy(sums, __howderek_memory_retired, sizeof(__howderek_memory_retired));
+  for (thread = __howderek_memory_threads; thread != NULL; thread = thread->next) {
+    for (i = 0; i < HOWDEREK_MEMORY_PROFILE_TYPES; i++) {
+      sums[i].allocations += HOWDEREK_MEMORY_READ(thread->types[i].allocations);
+      sums[i].deallocations += HOWDEREK_MEMORY_READ(thread->types[i].deallocations);
+      sums[i].bytes += HOWDEREK_MEMORY_READ(thread->types[i].bytes);
+      for (j = 0; j < HOWDEREK_MEMORY_HISTOGRAM_BUCKETS; j++) {
+        sums[i].histogram[j] += HOWDEREK_MEMORY_READ(thread->types[i].histogram[j]);
       }
     }
-    for (i = 0; i < HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS; i++) {
-      free(oldMemories->tables[i]);
+  }
+  pthread_mutex_unlock(&__howderek_memory_threads_lock);
+  for (i = 0; i < HOWDEREK_MEMORY_PROFILE_TYPES; i++) {
+    sums[i].type = __atomic_load_n(&__howderek_memory_types[i].type, __ATOMIC_ACQUIRE);
+    sums[i].live = __atomic_load_n(&__howderek_memory_types[i].live, __ATOMIC_RELAXED);
+    sums[i].peak = __atomic_load_n(&__howderek_memory_types[i].peak, __ATOMIC_RELAXED);
+  }
+}
+
+
+
+/**
+ * Point every page a chunk covers at value, the chunk itself or NULL
+ */
+void __howderek_memory_pages_set(struct howderek_memory_chunk* chunk, struct howderek_memory_chunk* value) {
+  const uintptr_t first = (uintptr_t) chunk >> HOWDEREK_MEMORY_PAGE_BITS;
+  const uintptr_t last = ((uintptr_t) HOWDEREK_MEMORY_CHUNK_DATA(chunk) + chunk->size - 1) >> HOWDEREK_MEMORY_PAGE_BITS;
+  struct howderek_memory_chunk** leaf;
+  uintptr_t page;
+  pthread_mutex_lock(&__howderek_memory_pages_lock);
+  for (page = first; page <= last; page++) {
+    if ((page >> 32) != 0) {
+      howderek_log(HOWDEREK_LOG_FATAL, "error in %s (%p is past 48 bit addresses)", __func__, (void*) chunk);
+      exit(EFAULT);
+    }
+    leaf = __atomic_load_n(&__howderek_memory_pages[page >> 16], __ATOMIC_ACQUIRE);
+    if (leaf == NULL) {
+      if (value == NULL) {
+        continue;
+      }
+      leaf = calloc(HOWDEREK_MEMORY_PAGE_LEVEL, sizeof(struct howderek_memory_chunk*));
+      if (leaf == NULL) {
+        howderek_log(HOWDEREK_LOG_FATAL, "error in %s (calloc failed for the page table)", __func__);
+        exit(ENOMEM);
+      }
+      __atomic_store_n(&__howderek_memory_pages[page >> 16], leaf, __ATOMIC_RELEASE);
     }
+    __atomic_store_n(&leaf[page & (HOWDEREK_MEMORY_PAGE_LEVEL - 1)], value, __ATOMIC_RELEASE);
   }
+  pthread_mutex_unlock(&__howderek_memory_pages_lock);
 }
 
 
 
-void __howderek_memory_push(struct howderek_memory_hashmap_node* node) {
-  struct howderek_memory_hashmap_node* position;
-  while ((position = howderek_memory_hash(node->ptr)) == NULL) {
-    __howderek_memory_hashmap_resize(__howderek_global_memory->__primeCount + 1);
+/**
+ * \return the chunk ptr points into, NULL if howderek_memory didn't allocate it
+ */
+struct howderek_memory_chunk* __howderek_memory_chunk_of(const void* ptr) {
+  const uintptr_t page = (uintptr_t) ptr >> HOWDEREK_MEMORY_PAGE_BITS;
+  struct howderek_memory_chunk** leaf;
+  if ((page >> 32) != 0) {
+    return NULL;
   }
-  struct howderek_memory_hashmap_node* parent;
-  while ((parent = howderek_memory_hash(node->parent)) == NULL) {
-    __howderek_memory_hashmap_resize(__howderek_global_memory->__primeCount + 1);
+  leaf = __atomic_load_n(&__howderek_memory_pages[page >> 16], __ATOMIC_ACQUIRE);
+  if (leaf == NULL) {
+    return NULL;
+  }
+  return __atomic_load_n(&leaf[page & (HOWDEREK_MEMORY_PAGE_LEVEL - 1)], __ATOMIC_ACQUIRE);
+}
+
+
+
+struct howderek_memory_chunk* __howderek_memory_chunk_create(size_t size) {
+  struct howderek_memory_chunk* chunk;
+  if (posix_memalign((void**) &chunk, HOWDEREK_MEMORY_PAGE_SIZE, HOWDEREK_MEMORY_CHUNK_HEADER_SIZE + size) != 0) {
+    howderek_log(HOWDEREK_LOG_FATAL, "error in %s (malloc failed for %lu bytes)", __func__, size);
+    exit(ENOMEM);
+  }
+  chunk->next = NULL;
+  chunk->prev = NULL;
+  chunk->size = size;
+  chunk->used = 0;
+  __howderek_memory_pages_set(chunk, chunk);
+  __atomic_add_fetch(&__howderek_memory_chunk_count, 1, __ATOMIC_RELAXED);
+  return chunk;
+}
+
+
+
+void __howderek_memory_chunk_destroy(struct howderek_memory_chunk* chunk) {
+  __howderek_memory_pages_set(chunk, NULL);
+  free(chunk);
+  __atomic_sub_fetch(&__howderek_memory_chunk_count, 1, __ATOMIC_RELAXED);
+}
+
+
+
+/**
+ * Bytes set aside for an allocation of size, so every allocation in a size
+ * class can take the place of any other
+ */
+size_t __howderek_memory_capacity(size_t size) {
+  const size_t aligned = HOWDEREK_MEMORY_ALIGN(size);
+  size_t rounded;
+  if (aligned <= HOWDEREK_MEMORY_SMALL) {
+    return aligned;
   }
+  rounded = (size_t) 1 << (sizeof(unsigned long) * CHAR_BIT - __builtin_clzl(aligned - 1));
+  // Dedicated chunks are released rather than reused, so don't round them
+  return (HOWDEREK_MEMORY_HEADER_SIZE + rounded > HOWDEREK_MEMORY_DEDICATED) ? aligned : rounded;
+}
 
-  // Pointers!
-  if (parent->ptr == NULL) {
-    parent->type = node->type;
-    parent->ptr = node->parent;
-    parent->parent =node->parent;
-    __howderek_global_memory->count++;
+
+
+/**
+ * \return the free list for a capacity, HOWDEREK_MEMORY_CLASSES if it gets
+ *         a chunk of its own
+ */
+size_t __howderek_memory_class(size_t capacity) {
+  if (capacity <= HOWDEREK_MEMORY_SMALL) {
+    return capacity / HOWDEREK_MEMORY_ALIGNMENT;
   }
-  if (parent->prev) {
-    position->prev = parent->prev;
-    position->prev->next = position;
+  if (HOWDEREK_MEMORY_HEADER_SIZE + capacity > HOWDEREK_MEMORY_DEDICATED || (capacity & (capacity - 1)) != 0) {
+    return HOWDEREK_MEMORY_CLASSES;
   }
-  parent->prev = position;
-  position->next = parent;
-  // Attributes
-  position->size = node->size;
-  position->parent = node->parent;
-  position->type = node->type;
-  position->ptr = node->ptr;
-  position->allocated = node->allocated;
-  __howderek_global_memory->count++;
+  return HOWDEREK_MEMORY_SMALL / HOWDEREK_MEMORY_ALIGNMENT
+         + __builtin_ctzl(capacity) - __builtin_ctzl(HOWDEREK_MEMORY_SMALL);
+}
+
+
+
+size_t __howderek_memory_bucket(size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  size_t bucket = sizeof(unsigned long) * CHAR_BIT - 1 - __builtin_clzl(size);
+  return (bucket < HOWDEREK_MEMORY_HISTOGRAM_BUCKETS) ? bucket : HOWDEREK_MEMORY_HISTOGRAM_BUCKETS - 1;
+}
+
+
+
+/**
+ * Take bytes from the region's current chunk for its own bookkeeping
+ */
+void* __howderek_memory_bump(struct howderek_memory_region* region, size_t size) {
+  struct howderek_memory_chunk* chunk = region->chunks;
+  void* result;
+  size = HOWDEREK_MEMORY_ALIGN(size);
+  if (chunk->size - chunk->used < size) {
+    chunk = __howderek_memory_chunk_create(HOWDEREK_MEMORY_CHUNK_SIZE - HOWDEREK_MEMORY_CHUNK_HEADER_SIZE);
+    chunk->next = region->chunks;
+    region->chunks->prev = chunk;
+    region->chunks = chunk;
+    HOWDEREK_MEMORY_COUNT(region->chunkCount, 1);
+  }
+  result = HOWDEREK_MEMORY_CHUNK_DATA(chunk) + chunk->used;
+  chunk->used += size;
+  return result;
+}
+
+
+
+/**
+ * \return the region's totals for type, made if it's the first of its type
+ */
+struct howderek_memory_region_type* __howderek_memory_region_type(struct howderek_memory_region* region,
+                                                                  const char* type) {
+  struct howderek_memory_region_type* totals;
+  struct howderek_memory_region_type** link;
+  // Regions hold a few types and allocate the same one over and over, so
+  // keep the last one used in front
+  for (link = &region->types; *link != NULL; link = &(*link)->next) {
+    if ((*link)->type == type) {
+      totals = *link;
+      *link = totals->next;
+      totals->next = region->types;
+      region->types = totals;
+      return totals;
+    }
+  }
+  totals = __howderek_memory_bump(region, sizeof(struct howderek_memory_region_type));
+  totals->type = type;
+  totals->stats = __howderek_memory_type_lookup(type);
+  totals->live = 0;
+  totals->count = 0;
+  totals->next = region->types;
+  region->types = totals;
+  return totals;
+}
+
+
+
+void* __howderek_memory_place(struct howderek_memory_region* region, struct howderek_memory_header* header,
+                              const char* type, size_t size) {
+  struct howderek_memory_region_type* totals = (region->types != NULL && region->types->type == type)
+                                             ? region->types : __howderek_memory_region_type(region, type);
+  struct howderek_memory_type_stats* stats = totals->stats;
+  struct howderek_memory_type_stats* counts = &__howderek_memory_thread_get()->types[stats - __howderek_memory_types];
+  const size_t live = __atomic_add_fetch(&stats->live, size, __ATOMIC_RELAXED);
+  size_t peak = __atomic_load_n(&stats->peak, __ATOMIC_RELAXED);
+  while (live > peak && !__atomic_compare_exchange_n(&stats->peak, &peak, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+  header->region = region;
+  header->type = type;
+  header->size = size;
+  header->totals = totals;
+  totals->live += size;
+  totals->count++;
+  HOWDEREK_MEMORY_COUNT(counts->allocations, 1);
+  HOWDEREK_MEMORY_COUNT(counts->bytes, size);
+  HOWDEREK_MEMORY_COUNT(counts->histogram[__howderek_memory_bucket(size)], 1);
+  HOWDEREK_MEMORY_COUNT(region->count, 1);
+  HOWDEREK_MEMORY_COUNT(region->size, size);
+  return (char*) header + HOWDEREK_MEMORY_HEADER_SIZE;
+}
+
+
+
+void* __howderek_memory_carve(struct howderek_memory_region* region, const char* type, size_t size) {
+  const size_t capacity = __howderek_memory_capacity(size);
+  const size_t needed = HOWDEREK_MEMORY_HEADER_SIZE + capacity;
+  const size_t class = __howderek_memory_class(capacity);
+  struct howderek_memory_chunk* chunk = region->chunks;
+  struct howderek_memory_header* header;
+
+  if (class < HOWDEREK_MEMORY_CLASSES && region->free[class] != NULL) {
+    header = region->free[class];
+    region->free[class] = header->next;
+    return __howderek_memory_place(region, header, type, size);
+  }
+  if (class == HOWDEREK_MEMORY_CLASSES) {
+    // Big allocations get their own chunk behind the current one, so the
+    // space left in the current chunk is still used
+    chunk = __howderek_memory_chunk_create(needed);
+    chunk->prev = region->chunks;
+    chunk->next = region->chunks->next;
+    if (chunk->next != NULL) {
+      chunk->next->prev = chunk;
+    }
+    region->chunks->next = chunk;
+    HOWDEREK_MEMORY_COUNT(region->chunkCount, 1);
+  } else if (chunk->size - chunk->used < needed) {
+    chunk = __howderek_memory_chunk_create(HOWDEREK_MEMORY_CHUNK_SIZE - HOWDEREK_MEMORY_CHUNK_HEADER_SIZE);
+    chunk->next = region->chunks;
+    region->chunks->prev = chunk;
+    region->chunks = chunk;
+    HOWDEREK_MEMORY_COUNT(region->chunkCount, 1);
+  }
+  header = (struct howderek_memory_header*) (HOWDEREK_MEMORY_CHUNK_DATA(chunk) + chunk->used);
+  chunk->used += needed;
+  return __howderek_memory_place(region, header, type, size);
+}
+
+
+
+struct howderek_memory_region* __howderek_memory_region_create(const char* type, size_t firstAllocation) {
+  const size_t needed = HOWDEREK_MEMORY_HEADER_SIZE + __howderek_memory_capacity(firstAllocation);
+  // Room for the root's totals as well
+  size_t size = HOWDEREK_MEMORY_REGION_SIZE + needed + HOWDEREK_MEMORY_ALIGN(sizeof(struct howderek_memory_region_type));
+  size = (size > HOWDEREK_MEMORY_CHUNK_SIZE - HOWDEREK_MEMORY_CHUNK_HEADER_SIZE)
+       ? size : HOWDEREK_MEMORY_CHUNK_SIZE - HOWDEREK_MEMORY_CHUNK_HEADER_SIZE;
+  struct howderek_memory_chunk* chunk = __howderek_memory_chunk_create(size);
+
+  // The region lives at the start of its first chunk, then the root
+  struct howderek_memory_region* region = (struct howderek_memory_region*) HOWDEREK_MEMORY_CHUNK_DATA(chunk);
+  chunk->used = HOWDEREK_MEMORY_REGION_SIZE + needed;
+  region->chunks = chunk;
+  region->count = 0;
+  region->size = 0;
+  region->chunkCount = 1;
+  region->types = NULL;
+  memset(region->free, 0, sizeof(region->free));
+  region->owner = __howderek_memory_place(region, (struct howderek_memory_header*) (HOWDEREK_MEMORY_CHUNK_DATA(chunk)
+                                          + HOWDEREK_MEMORY_REGION_SIZE), type, firstAllocation);
+  region->prev = NULL;
+  pthread_mutex_lock(&__howderek_memory_regions_lock);
+  region->next = __howderek_memory_regions;
+  if (region->next != NULL) {
+    region->next->prev = region;
+  }
+  __howderek_memory_regions = region;
+  __howderek_memory_region_count++;
+  pthread_mutex_unlock(&__howderek_memory_regions_lock);
+  region->base = chunk->used;
+  return region;
+}
+
+
+
+/**
+ * Free a region's chunks once it's off the list of regions
+ */
+void __howderek_memory_region_destroy(struct howderek_memory_region* region) {
+  struct howderek_memory_thread* thread = __howderek_memory_thread_get();
+  // Whatever is still live comes off the per-type counters a type at a time
+  struct howderek_memory_region_type* totals;
+  for (totals = region->types; totals != NULL; totals = totals->next) {
+    __atomic_sub_fetch(&totals->stats->live, totals->live, __ATOMIC_RELAXED);
+    HOWDEREK_MEMORY_COUNT(thread->types[totals->stats - __howderek_memory_types].deallocations, totals->count);
+  }
+
+  // The region itself is in one of the chunks, so read next before freeing
+  struct howderek_memory_chunk* chunk = region->chunks;
+  struct howderek_memory_chunk* old;
+  while (chunk != NULL) {
+    old = chunk;
+    chunk = chunk->next;
+    __howderek_memory_chunk_destroy(old);
+  }
+}
+
+
+
+/**
+ * Take a region off the list of regions. The caller holds the lock.
+ */
+void __howderek_memory_region_unlink(struct howderek_memory_region* region) {
+  if (region->prev != NULL) {
+    region->prev->next = region->next;
+  } else {
+    __howderek_memory_regions = region->next;
+  }
+  if (region->next != NULL) {
+    region->next->prev = region->prev;
+  }
+  __howderek_memory_region_count--;
 }
 
 
@@ -86,193 +572,386 @@ void howderek_initalize_memory_management() {
   if (signal(3, __dump_on_signal) == SIG_ERR) {
     howderek_log(HOWDEREK_LOG_DEBUG, "failed to setup default SIGQUIT signal handler");
   }
-  __howderek_memory_hashmap_resize(HOWDEREK_MEMORY_HASHMAP_DEFAULT_SIZE);
-  __howderek_global_memory->resizes = 0;
+  if (signal(SIGUSR1, __profile_on_signal) == SIG_ERR) {
+    howderek_log(HOWDEREK_LOG_DEBUG, "failed to setup SIGUSR1 profile signal handler");
+  }
+  pthread_mutex_lock(&__howderek_memory_profile_lock);
+  clock_gettime(CLOCK_MONOTONIC, &__howderek_memory_profile_start);
+  pthread_mutex_unlock(&__howderek_memory_profile_lock);
 }
 
 
 
-void* howderek_allocate(const char* type, void* parent, size_t size) {
-  struct howderek_memory_hashmap_node newNode;
-  newNode.type = type;
-  newNode.size = size;
-  newNode.ptr = malloc(size);
-  newNode.allocated = 1;
+void* __howderek_memory_allocate(const char* type, void* parent, size_t size, void* site) {
+  struct howderek_memory_thread* thread = __howderek_memory_thread_get();
+  const size_t rate = __atomic_load_n(&__howderek_memory_sample_rate, __ATOMIC_RELAXED);
+  if (__howderek_memory_profile_requested && __atomic_exchange_n(&__howderek_memory_profile_requested, 0,
+                                                                 __ATOMIC_RELAXED)) {
+    howderek_display_memory_profile(stderr);
+  }
+  // The rate may have gone down since the countdown started
+  thread->sampleCountdown = (thread->sampleCountdown > rate) ? rate : thread->sampleCountdown;
+  if (rate != 0 && --thread->sampleCountdown == 0) {
+    thread->sampleCountdown = rate;
+    __howderek_memory_sample(type, size, site);
+  }
   if (parent == NULL) {
-    newNode.parent = newNode.ptr;
+    return __howderek_memory_region_create(type, size)->owner;
   }
-  __howderek_global_memory->allocations++;
-  __howderek_memory_push(&newNode);
-  return newNode.ptr;
+  return __howderek_memory_carve(howderek_memory_header(parent)->region, type, size);
+}
+
+
+
+void* howderek_allocate(const char* type, void* parent, size_t size) {
+  return __howderek_memory_allocate(type, parent, size, __builtin_return_address(0));
 }
 
 
 
 void* howderek_allocate_and_zero(const char* type, void* parent, size_t size) {
-  void* ptr = howderek_allocate(type, parent, size);
+  void* ptr = __howderek_memory_allocate(type, parent, size, __builtin_return_address(0));
   memset(ptr, 0, size);
   return ptr;
 }
 
 
 
-struct howderek_memory_hashmap_node* howderek_memory_hash(void* ptr) {
-  size_t hash_array[HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS];
-  size_t i;
-  hash_array[0] = (size_t) ptr % __howderek_global_memory->size;
-  for (i = 0; i < HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS - 1; i++) {
-    hash_array[i + 1] = ((size_t) ptr / howderek_artisan_primes[__howderek_global_memory->__primeCount + i]) % __howderek_global_memory->size;
-  }
-  // Try to find that key
-  for (i = 0; i < HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS; i++) {
-    if (__howderek_global_memory->tables[i][hash_array[i]].ptr == ptr) {
-      return &(__howderek_global_memory->tables[i][hash_array[i]]);
-    }
-  }
-  // If that key doesn't exist, find the first empty node
-  for (i = 0; i < HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS; i++) {
-    if (__howderek_global_memory->tables[i][hash_array[i]].ptr == NULL) {
-      return &(__howderek_global_memory->tables[i][hash_array[i]]);
-    }
-  }
-  // If there are as many collisions as hashes, return NULL (needs resize)
-  return NULL;
+struct howderek_memory_header* howderek_memory_header(void* ptr) {
+  return (struct howderek_memory_header*) ((char*) ptr - HOWDEREK_MEMORY_HEADER_SIZE);
 }
 
 
 
 size_t howderek_object_memory_usage(void* parent) {
-  struct howderek_memory_hashmap_node* iter = howderek_memory_hash(parent);
-  size_t result = 0;
-  while (iter != NULL) {
-    iter = iter->prev;
-    result += iter->size;
+  struct howderek_memory_header* header = howderek_memory_header(parent);
+  if (header->region->owner == parent) {
+    return header->region->size;
   }
-  return result;
+  return header->size;
 }
 
 
 
 void howderek_free(void* ptr) {
-  struct howderek_memory_hashmap_node* pos = howderek_memory_hash(ptr);
-  struct howderek_memory_hashmap_node* head = howderek_memory_hash(pos->parent);
-  if (pos == NULL || pos->ptr == NULL) {
+  struct howderek_memory_chunk* chunk = __howderek_memory_chunk_of(ptr);
+  if (chunk == NULL || (char*) ptr < HOWDEREK_MEMORY_CHUNK_DATA(chunk) + HOWDEREK_MEMORY_HEADER_SIZE
+      || (char*) ptr >= HOWDEREK_MEMORY_CHUNK_DATA(chunk) + chunk->size) {
     // This was probably not allocated by howderek_allocate
     return;
   }
-  if (head->prev == pos) {
-    head->prev = pos->prev;
-  }
-  if (pos->prev != NULL) {
-    pos->prev->next = pos->next;
+  struct howderek_memory_header* header = howderek_memory_header(ptr);
+  if (header->type == NULL) {
+    // Already freed
+    return;
   }
-  if (pos->next != NULL) {
-    pos->next->prev = pos->prev;
+  struct howderek_memory_region* region = header->region;
+  struct howderek_memory_type_stats* stats = header->totals->stats;
+  size_t class;
+  if (region->owner == ptr) {
+    pthread_mutex_lock(&__howderek_memory_regions_lock);
+    __howderek_memory_region_unlink(region);
+    pthread_mutex_unlock(&__howderek_memory_regions_lock);
+    __howderek_memory_region_destroy(region);
+    return;
   }
-  // Make sure we have something to free (not parents or NULL)
-  if (pos->allocated && pos->ptr != NULL) {
-    free(pos->ptr);
-    pos->ptr    = NULL;
-    pos->allocated = 0;
+  header->type = NULL;
+  header->totals->live -= header->size;
+  header->totals->count--;
+  __atomic_sub_fetch(&stats->live, header->size, __ATOMIC_RELAXED);
+  HOWDEREK_MEMORY_COUNT(__howderek_memory_thread_get()->types[stats - __howderek_memory_types].deallocations, 1);
+  HOWDEREK_MEMORY_COUNT(region->count, -1);
+  HOWDEREK_MEMORY_COUNT(region->size, -header->size);
+  class = __howderek_memory_class(__howderek_memory_capacity(header->size));
+  if (class < HOWDEREK_MEMORY_CLASSES) {
+    header->next = region->free[class];
+    region->free[class] = header;
+  } else {
+    // Nothing else is in a dedicated chunk, and it's never the first one
+    chunk->prev->next = chunk->next;
+    if (chunk->next != NULL) {
+      chunk->next->prev = chunk->prev;
+    }
+    HOWDEREK_MEMORY_COUNT(region->chunkCount, -1);
+    __howderek_memory_chunk_destroy(chunk);
   }
-  pos->parent = NULL;
-  pos->next   = NULL;
-  pos->prev   = NULL;
-  pos->type   = NULL;
-  __howderek_global_memory->count--;
-  __howderek_global_memory->deallocations++;
 }
 
 
 
 void howderek_destroy(void* parent) {
-  struct howderek_memory_hashmap_node* head = howderek_memory_hash(parent);
-  struct howderek_memory_hashmap_node* iter = head->prev;
-  struct howderek_memory_hashmap_node* oldIter;
-  while (iter != NULL) {
-    oldIter = iter;
-    iter = iter->prev;
-    if (oldIter->parent == parent) {
-      howderek_free(oldIter->ptr);
+  howderek_free(parent);
+}
+
+
+
+void howderek_reset(void* parent) {
+  struct howderek_memory_chunk* first = __howderek_memory_chunk_of(parent);
+  if (first == NULL || (char*) parent < HOWDEREK_MEMORY_CHUNK_DATA(first) + HOWDEREK_MEMORY_HEADER_SIZE
+      || (char*) parent >= HOWDEREK_MEMORY_CHUNK_DATA(first) + first->size) {
+    return;
+  }
+  struct howderek_memory_header* header = howderek_memory_header(parent);
+  struct howderek_memory_region* region = header->region;
+  if (header->type == NULL || region->owner != parent) {
+    return;
+  }
+  struct howderek_memory_thread* thread = __howderek_memory_thread_get();
+  struct howderek_memory_region_type* totals;
+  struct howderek_memory_chunk* chunk;
+  struct howderek_memory_chunk* old;
+  size_t live, count;
+  // Everything but the root comes off the per-type counters
+  for (totals = region->types; totals != NULL; totals = totals->next) {
+    live = totals->live - ((totals == header->totals) ? header->size : 0);
+    count = totals->count - (totals == header->totals);
+    __atomic_sub_fetch(&totals->stats->live, live, __ATOMIC_RELAXED);
+    HOWDEREK_MEMORY_COUNT(thread->types[totals->stats - __howderek_memory_types].deallocations, count);
+  }
+  // The root is in the first chunk, with its totals right behind it
+  chunk = region->chunks;
+  while (chunk != NULL) {
+    old = chunk;
+    chunk = chunk->next;
+    if (old != first) {
+      __howderek_memory_chunk_destroy(old);
     }
   }
-  howderek_free(parent);
+  first->next = NULL;
+  first->prev = NULL;
+  first->used = region->base;
+  region->chunks = first;
+  region->types = header->totals;
+  region->types->next = NULL;
+  region->types->live = header->size;
+  region->types->count = 1;
+  memset(region->free, 0, sizeof(region->free));
+  __atomic_store_n(&region->count, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&region->size, header->size, __ATOMIC_RELAXED);
+  __atomic_store_n(&region->chunkCount, 1, __ATOMIC_RELAXED);
+}
+
+
+
+struct howderek_memory_stats howderek_memory_stats() {
+  struct howderek_memory_type_stats sums[HOWDEREK_MEMORY_PROFILE_TYPES];
+  struct howderek_memory_stats result = { 0, 0, 0, 0 };
+  size_t i;
+  __howderek_memory_sum(sums);
+  for (i = 0; i < HOWDEREK_MEMORY_PROFILE_TYPES; i++) {
+    result.allocations += sums[i].allocations;
+    result.deallocations += sums[i].deallocations;
+  }
+  pthread_mutex_lock(&__howderek_memory_regions_lock);
+  result.regions = __howderek_memory_region_count;
+  result.allocations -= __howderek_memory_stats_base.allocations;
+  result.deallocations -= __howderek_memory_stats_base.deallocations;
+  pthread_mutex_unlock(&__howderek_memory_regions_lock);
+  result.chunks = __atomic_load_n(&__howderek_memory_chunk_count, __ATOMIC_RELAXED);
+  return result;
 }
 
 
 
 void howderek_display_memory_usage() {
-  size_t i, j, k;
-  size_t objects = HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS;
-  size_t size = sizeof(struct howderek_memory_hashmap*) + (sizeof(struct howderek_memory_hashmap_node) * __howderek_global_memory->size * HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS);
-  printf("Memory Hashmap Metadata:\n"
-         "+-----------------------+---------------------------------+--------+-----------------------------+\n"
-         "| Count                 | Prime                           | Tables |  Size                       |\n"
-         "+-----------------------+---------------------------------+--------+-----------------------------+\n"
-         "| %-21lu | Prime %-2d: %-21lu | %-6d | %21lu bytes |\n"
-         "+-----------------------+---------------------------------+--------+-----------------------------+\n\n",
-         __howderek_global_memory->count, __howderek_global_memory->__primeCount, __howderek_global_memory->size, HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS, size);
-  for (i = 0; i < HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS; i++) {
-    for (j = 0; j < __howderek_global_memory->size; j++) {
-      struct howderek_memory_hashmap_node* current = &__howderek_global_memory->tables[i][j];
-      if (current->parent == current->ptr && current->parent != NULL) {
-       printf("\nparent %s* at %p\n---------------------------------------------------------------------\n", current->type, current->ptr);
-       struct howderek_memory_hashmap_node* iter = current->prev;
-       size_t totalSize = 0;
-       for (k = 0; iter != NULL; k++) {
-         printf("child %lu: %lu byte %s at %p\n", k, iter->size, iter->type, iter->ptr);
-         totalSize += iter->size;
-         iter = iter->prev;
-       }
-       printf("total size: %lu bytes\n", totalSize);
-       size += totalSize;
-       objects++;
-      }
-    }
+  const struct howderek_memory_stats stats = howderek_memory_stats();
+  size_t k;
+  size_t size = 0;
+  size_t objects = 0;
+  struct howderek_memory_region* region;
+  printf("Memory Region Metadata:\n"
+         "+-----------------------+-----------------------+-----------------------+-----------------------+\n"
+         "| Regions               | Chunks                | Allocations           | Deallocations         |\n"
+         "+-----------------------+-----------------------+-----------------------+-----------------------+\n"
+         "| %-21lu | %-21lu | %-21lu | %-21lu |\n"
+         "+-----------------------+-----------------------+-----------------------+-----------------------+\n\n",
+         stats.regions, stats.chunks, stats.allocations, stats.deallocations);
+  pthread_mutex_lock(&__howderek_memory_regions_lock);
+  for (region = __howderek_memory_regions, k = 0; region != NULL; region = region->next, k++) {
+    printf("\nregion %lu: parent %s* at %p\n---------------------------------------------------------------------\n",
+           k, howderek_memory_header(region->owner)->type, region->owner);
+    printf("live: %lu bytes in %lu objects (%lu chunks)\n", HOWDEREK_MEMORY_READ(region->size),
+           HOWDEREK_MEMORY_READ(region->count), HOWDEREK_MEMORY_READ(region->chunkCount));
+    size += HOWDEREK_MEMORY_READ(region->size);
+    objects += HOWDEREK_MEMORY_READ(region->count);
   }
-  printf(HOWDEREK_BOLD "\nallocated memory: %lu bytes in %lu objects (%lu unique pointers)\n\n" HOWDEREK_RESET,
-         size, objects, HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS + __howderek_global_memory->count);
+  pthread_mutex_unlock(&__howderek_memory_regions_lock);
+  printf(HOWDEREK_BOLD "\nallocated memory: %lu bytes in %lu objects (%lu regions)\n\n" HOWDEREK_RESET,
+         size, objects, stats.regions);
 }
 
-void howderek_reset_memory_management() {
-  __howderek_global_memory->count = 0;
-  __howderek_global_memory->allocations = 0;
-  __howderek_global_memory->deallocations = 0;
-  __howderek_global_memory->resizes++;
+/**
+ * Subtract the counts as of the last reset from sums
+ */
+void __howderek_memory_since_reset(struct howderek_memory_type_stats* sums) {
   size_t i, j;
-  for (i = 0; i < HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS; i++) {
-    if (__howderek_global_memory->tables[i] != NULL) {
-      free(__howderek_global_memory->tables[i]);
+  for (i = 0; i < HOWDEREK_MEMORY_PROFILE_TYPES; i++) {
+    sums[i].allocations -= __howderek_memory_profile_base[i].allocations;
+    sums[i].deallocations -= __howderek_memory_profile_base[i].deallocations;
+    sums[i].bytes -= __howderek_memory_profile_base[i].bytes;
+    for (j = 0; j < HOWDEREK_MEMORY_HISTOGRAM_BUCKETS; j++) {
+      sums[i].histogram[j] -= __howderek_memory_profile_base[i].histogram[j];
     }
-    __howderek_global_memory->tables[i] = malloc(sizeof(struct howderek_memory_hashmap_node) * __howderek_global_memory->size);
-    if (__howderek_global_memory->tables[i] == NULL) {
-      howderek_log(HOWDEREK_LOG_FATAL, "error in %s (malloc failed)", __func__);
+  }
+}
+
+
+
+struct howderek_memory_type_stats howderek_memory_type_stats(const char* type) {
+  struct howderek_memory_type_stats sums[HOWDEREK_MEMORY_PROFILE_TYPES];
+  struct howderek_memory_type_stats result;
+  size_t i;
+  __howderek_memory_sum(sums);
+  pthread_mutex_lock(&__howderek_memory_profile_lock);
+  __howderek_memory_since_reset(sums);
+  pthread_mutex_unlock(&__howderek_memory_profile_lock);
+  for (i = 0; i < HOWDEREK_MEMORY_PROFILE_TYPES; i++) {
+    if (sums[i].type != NULL && strcmp(sums[i].type, type) == 0) {
+      return sums[i];
     }
-    for (j = 0; j < __howderek_global_memory->size; j++) {
-      __howderek_global_memory->tables[i][j].type = NULL;
-      __howderek_global_memory->tables[i][j].parent = NULL;
-      __howderek_global_memory->tables[i][j].prev = NULL;
-      __howderek_global_memory->tables[i][j].ptr = NULL;
-      __howderek_global_memory->tables[i][j].size = 0;
-      __howderek_global_memory->tables[i][j].allocated = 0;
-     }
   }
+  memset(&result, 0, sizeof(result));
+  result.type = type;
+  return result;
 }
 
-void howderek_clean_up() {
-  size_t i, j, k;
-  size_t objects = HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS;
-  size_t size = sizeof(struct howderek_memory_hashmap*) + (sizeof(struct howderek_memory_hashmap_node) * __howderek_global_memory->size * HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS);
-  for (i = 0; i < HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS; i++) {
-    for (j = 0; j < __howderek_global_memory->size; j++) {
-      struct howderek_memory_hashmap_node* current = &__howderek_global_memory->tables[i][j];
-      if (current->allocated) {
-        free(current->ptr);
-        size += current->size;
-        objects += 1;
+
+
+void howderek_memory_set_sample_rate(size_t rate) {
+  __atomic_store_n(&__howderek_memory_sample_rate, rate, __ATOMIC_RELAXED);
+}
+
+
+
+int __howderek_memory_compare_types(const void* left, const void* right) {
+  const struct howderek_memory_type_stats* l = *(const struct howderek_memory_type_stats**) left;
+  const struct howderek_memory_type_stats* r = *(const struct howderek_memory_type_stats**) right;
+  return (l->live < r->live) - (l->live > r->live);
+}
+
+
+
+int __howderek_memory_compare_sites(const void* left, const void* right) {
+  const struct howderek_memory_site_stats* l = *(const struct howderek_memory_site_stats**) left;
+  const struct howderek_memory_site_stats* r = *(const struct howderek_memory_site_stats**) right;
+  return (l->bytes < r->bytes) - (l->bytes > r->bytes);
+}
+
+
+
+void howderek_display_memory_profile(FILE* out) {
+  struct howderek_memory_type_stats sums[HOWDEREK_MEMORY_PROFILE_TYPES];
+  struct howderek_memory_site_stats copies[HOWDEREK_MEMORY_PROFILE_SITES];
+  struct howderek_memory_type_stats* types[HOWDEREK_MEMORY_PROFILE_TYPES];
+  struct howderek_memory_site_stats* sites[HOWDEREK_MEMORY_PROFILE_SITES];
+  const size_t rate = __atomic_load_n(&__howderek_memory_sample_rate, __ATOMIC_RELAXED);
+  size_t typeCount = 0;
+  size_t siteCount = 0;
+  size_t i, j;
+  struct timespec now;
+
+  __howderek_memory_sum(sums);
+  pthread_mutex_lock(&__howderek_memory_profile_lock);
+  __howderek_memory_since_reset(sums);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double seconds = (now.tv_sec - __howderek_memory_profile_start.tv_sec)
+                 + (now.tv_nsec - __howderek_memory_profile_start.tv_nsec) / 1e9;
+  pthread_mutex_unlock(&__howderek_memory_profile_lock);
+  seconds = (seconds > 0) ? seconds : 1;
+
+  for (i = 0; i < HOWDEREK_MEMORY_PROFILE_TYPES; i++) {
+    if (sums[i].type != NULL) {
+      types[typeCount++] = &sums[i];
+    }
+  }
+  for (i = 0; i < HOWDEREK_MEMORY_PROFILE_SITES; i++) {
+    copies[i].site = __atomic_load_n(&__howderek_memory_sites[i].site, __ATOMIC_ACQUIRE);
+    copies[i].type = __atomic_load_n(&__howderek_memory_sites[i].type, __ATOMIC_ACQUIRE);
+    copies[i].samples = __atomic_load_n(&__howderek_memory_sites[i].samples, __ATOMIC_RELAXED);
+    copies[i].bytes = __atomic_load_n(&__howderek_memory_sites[i].bytes, __ATOMIC_RELAXED);
+    // A site claimed a moment ago might not have its type yet
+    if (copies[i].site != NULL && copies[i].type != NULL) {
+      sites[siteCount++] = &copies[i];
+    }
+  }
+  qsort(types, typeCount, sizeof(types[0]), __howderek_memory_compare_types);
+  qsort(sites, siteCount, sizeof(sites[0]), __howderek_memory_compare_sites);
+
+  fprintf(out, "Memory Profile (%.1fs):\n"
+               "+------------------------+--------------+--------------+--------------+--------------+\n"
+               "| Type                   | Live bytes   | Peak bytes   | Allocations  | Allocs/sec   |\n"
+               "+------------------------+--------------+--------------+--------------+--------------+\n",
+               seconds);
+  for (i = 0; i < typeCount; i++) {
+    fprintf(out, "| %-22.22s | %-12lu | %-12lu | %-12lu | %-12.1f |\n", types[i]->type, types[i]->live,
+            types[i]->peak, types[i]->allocations, types[i]->allocations / seconds);
+    fprintf(out, "|   sizes:");
+    for (j = 0; j < HOWDEREK_MEMORY_HISTOGRAM_BUCKETS; j++) {
+      if (types[i]->histogram[j] != 0) {
+        fprintf(out, " %lu+:%lu", (size_t) 1 << j, types[i]->histogram[j]);
       }
     }
-    free(__howderek_global_memory->tables[i]);
+    fprintf(out, "\n");
+  }
+  fprintf(out, "+------------------------+--------------+--------------+--------------+--------------+\n");
+
+  if (siteCount > 0) {
+    fprintf(out, "\nSampled call sites (1 in %lu, %lu dropped):\n", rate,
+            __atomic_load_n(&__howderek_memory_samples_dropped, __ATOMIC_RELAXED));
+    for (i = 0; i < siteCount && i < 20; i++) {
+      fprintf(out, "  %-18p %-22.22s %-8lu samples  ~%lu bytes\n", sites[i]->site, sites[i]->type,
+              sites[i]->samples, sites[i]->bytes * rate);
+    }
+  }
+  fprintf(out, "\n");
+}
+
+
+
+void howderek_reset_memory_profile() {
+  struct howderek_memory_type_stats sums[HOWDEREK_MEMORY_PROFILE_TYPES];
+  size_t i;
+  // Other threads keep counting, so remember where they were rather than
+  // clearing their counters
+  __howderek_memory_sum(sums);
+  pthread_mutex_lock(&__howderek_memory_profile_lock);
+  memcpy(__howderek_memory_profile_base, sums, sizeof(sums));
+  for (i = 0; i < HOWDEREK_MEMORY_PROFILE_TYPES; i++) {
+    __atomic_store_n(&__howderek_memory_types[i].peak, __atomic_load_n(&__howderek_memory_types[i].live,
+                     __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+  }
+  for (i = 0; i < HOWDEREK_MEMORY_PROFILE_SITES; i++) {
+    __atomic_store_n(&__howderek_memory_sites[i].samples, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&__howderek_memory_sites[i].bytes, 0, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&__howderek_memory_samples_dropped, 0, __ATOMIC_RELAXED);
+  clock_gettime(CLOCK_MONOTONIC, &__howderek_memory_profile_start);
+  pthread_mutex_unlock(&__howderek_memory_profile_lock);
+}
+
+
+
+void howderek_reset_memory_management() {
+  struct howderek_memory_stats stats;
+  howderek_clean_up();
+  stats = howderek_memory_stats();
+  pthread_mutex_lock(&__howderek_memory_regions_lock);
+  __howderek_memory_stats_base.allocations += stats.allocations;
+  __howderek_memory_stats_base.deallocations += stats.deallocations;
+  pthread_mutex_unlock(&__howderek_memory_regions_lock);
+}
+
+void howderek_clean_up() {
+  size_t objects = 0;
+  size_t size = 0;
+  struct howderek_memory_region* region;
+  pthread_mutex_lock(&__howderek_memory_regions_lock);
+  while ((region = __howderek_memory_regions) != NULL) {
+    objects += region->count;
+    size += region->size;
+    __howderek_memory_region_unlink(region);
+    __howderek_memory_region_destroy(region);
   }
+  pthread_mutex_unlock(&__howderek_memory_regions_lock);
   howderek_log(HOWDEREK_LOG_DEBUG, "%lu objects (%lu bytes) freed by howderek_clean_up()", objects, size);
 }
@@ -1,38 +1,131 @@
 /*! \file howderek_memory.h
  *  \brief Memory management
+ *
+ *  Allocations made without a parent start a region. Allocations made with a
+ *  parent are bump allocated out of the chunks of the parent's region, so
+ *  destroying the root frees everything in one pass over its chunks. A header
+ *  in front of each allocation points back to its region, so there is no
+ *  lookup table.
+ *
+ *     region     chunk                      chunk
+ *    +-------+  +---+------+---+--------+  +---+------------+
+ *    | root  |->| h | root | h | child  |->| h | child  ... |
+ *    +-------+  +---+------+---+--------+  +---+------------+
+ *
+ *  Children of a child share the root's region, so howderek_destroy on a
+ *  child frees only that child, and its own children stay until the root is
+ *  destroyed. Freeing a single child puts
+ *  it on the region's free list for its size class, and the next allocation
+ *  of that class in the region takes it back. Allocations bigger than a
+ *  quarter of a chunk get a chunk of their own, which goes back to malloc as
+ *  soon as they're freed. howderek_free ignores pointers it didn't allocate.
+ *
+ *  Every root costs a chunk and a trip through the lock on the list of
+ *  regions, so code that searches over and over keeps one root as scratch
+ *  and howderek_reset's it between searches instead of making a new one.
+ *
+ *  Every allocation is also counted against its type string (live and peak
+ *  bytes, rate and a size histogram), and one in HOWDEREK_MEMORY_SAMPLE_RATE
+ *  records its call site. The profile can be read at any time, or dumped to
+ *  stderr by the next allocation after the process gets SIGUSR1. Each region
+ *  keeps running totals per type, so destroying it never looks at the
+ *  allocations themselves.
+ *
+ *  Any number of threads can allocate and free at once without locking, as
+ *  long as each region is only used by one thread at a time. Profile counts
+ *  are kept per thread. Only making or destroying a region takes a lock.
 */
 
 #ifndef H_LIBHOWDEREK_MEMORY_HASHMAP_H
 #define H_LIBHOWDEREK_MEMORY_HASHMAP_H
 
-#ifndef HOWDEREK_HASHMAP_CONFIG
-#define HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS 3
-#define HOWDEREK_MEMORY_HASHMAP_DEFAULT_SIZE 5
+#ifndef HOWDEREK_MEMORY_CONFIG
+// Bytes in each chunk, larger allocations get a chunk of their own
+#define HOWDEREK_MEMORY_CHUNK_SIZE 65536
+#define HOWDEREK_MEMORY_ALIGNMENT  16
+// Record the call site of one in this many allocations, 0 turns sampling off
+#define HOWDEREK_MEMORY_SAMPLE_RATE 64
+// Distinct type strings and call sites the profiler keeps
+#define HOWDEREK_MEMORY_PROFILE_TYPES 128
+#define HOWDEREK_MEMORY_PROFILE_SITES 256
 #endif
 
+// Allocation sizes are bucketed by floor(log2(size))
+#define HOWDEREK_MEMORY_HISTOGRAM_BUCKETS 32
+
+// Free lists per region. Allocations up to HOWDEREK_MEMORY_SMALL bytes are
+// rounded up to the alignment, bigger ones to a power of two.
+#define HOWDEREK_MEMORY_SMALL   1024
+#define HOWDEREK_MEMORY_CLASSES 96
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
 #include "howderek.h"
 
-struct howderek_memory_hashmap_node {
+#define HOWDEREK_MEMORY_ALIGN(size) \
+  (((size) + HOWDEREK_MEMORY_ALIGNMENT - 1) & ~((size_t) HOWDEREK_MEMORY_ALIGNMENT - 1))
+
+struct howderek_memory_chunk {
+  struct howderek_memory_chunk* next;
+  struct howderek_memory_chunk* prev;
+  size_t size;  // usable bytes after the chunk header
+  size_t used;  // bytes handed out so far
+};
+
+struct howderek_memory_region_type {
   const char* type;
-  size_t size;
-  void* parent;
-  void* ptr;
-  struct howderek_memory_hashmap_node* prev;
-  struct howderek_memory_hashmap_node* next;
-  uint8_t allocated;
+  struct howderek_memory_type_stats* stats;
+  size_t live;                            // bytes of this type live in the region
+  size_t count;                           // allocations of this type live in the region
+  struct howderek_memory_region_type* next;
 };
 
-struct howderek_memory_hashmap {
-  size_t count;
+struct howderek_memory_region {
+  void* owner;                            // the root allocation
+  struct howderek_memory_region_type* types;  // most recently used first
+  struct howderek_memory_chunk* chunks;   // newest first, the region lives in the first one made
+  size_t count;                           // live allocations
+  size_t size;                            // live bytes requested
+  size_t chunkCount;
+  size_t base;                            // bytes of the first chunk the region, root and its totals take
+  struct howderek_memory_region* prev;    // every region, for display and clean up
+  struct howderek_memory_region* next;
+  struct howderek_memory_header* free[HOWDEREK_MEMORY_CLASSES];  // freed children by size class
+};
+
+struct howderek_memory_type_stats {
+  const char* type;
+  size_t live;                            // bytes
+  size_t peak;                            // highest live bytes seen
+  size_t allocations;
+  size_t deallocations;
+  size_t bytes;                           // total bytes ever allocated
+  size_t histogram[HOWDEREK_MEMORY_HISTOGRAM_BUCKETS];
+};
+
+struct howderek_memory_site_stats {
+  void* site;                             // return address into the caller
+  const char* type;
+  size_t samples;
+  size_t bytes;                           // sampled bytes, not scaled
+};
+
+struct howderek_memory_header {
+  struct howderek_memory_region* region;
+  const char* type;                       // NULL once freed
+  union {
+    struct howderek_memory_region_type* totals;
+    struct howderek_memory_header* next;  // next on the free list once freed
+  };
   size_t size;
+};
+
+struct howderek_memory_stats {
+  size_t regions;
+  size_t chunks;
   size_t allocations;
   size_t deallocations;
-  size_t resizes;
-  int    __primeCount;
-  struct howderek_memory_hashmap_node* tables[HOWDEREK_MEMORY_HASHMAP_HASH_FUNCTIONS];
 };
 
 void howderek_initalize_memory_management();
@@ -41,16 +134,60 @@ void* howderek_allocate(const char* type, void* parent, size_t size);
 
 void* howderek_allocate_and_zero(const char* type, void* parent, size_t size);
 
-struct howderek_memory_hashmap_node* howderek_memory_hash(void* ptr);
+struct howderek_memory_header* howderek_memory_header(void* ptr);
 
 size_t howderek_object_memory_usage(void* parent);
 
 void howderek_free(void* ptr);
 
+/**
+ * Free an allocation. Destroying a root frees its whole region, destroying a
+ * child only frees the child, the same as howderek_free.
+ *
+ * \param parent  the allocation
+ */
 void howderek_destroy(void* parent);
 
+/**
+ * Free every child of a root at once and keep the root, its first chunk and
+ * its place on the list of regions for the next round of allocations.
+ * Pointers that aren't roots are left alone.
+ *
+ * \param parent  a root, allocated with no parent
+ */
+void howderek_reset(void* parent);
+
+struct howderek_memory_stats howderek_memory_stats();
+
 void howderek_display_memory_usage();
 
+/**
+ * Get the profile of one type string. Unknown types come back zeroed.
+ *
+ * \param type  type string passed to howderek_allocate
+ */
+struct howderek_memory_type_stats howderek_memory_type_stats(const char* type);
+
+/**
+ * Change how often call sites are sampled
+ *
+ * \param rate  record one in rate allocations, 0 to stop sampling
+ */
+void howderek_memory_set_sample_rate(size_t rate);
+
+/**
+ * Print the per-type profile and the hottest sampled call sites. Does not
+ * exit, so it is safe to call from a long running process.
+ *
+ * \param out  stream to print to
+ */
+void howderek_display_memory_profile(FILE* out);
+
+/**
+ * Forget all profile counters and samples. Live bytes are kept.
+ */
+void howderek_reset_memory_profile();
+
 void howderek_clean_up();
 
 void howderek_reset_memory_management();
@@ -0,0 +1,127 @@
+/*! \file howderek_parallel.c
+ *  \brief Fork-join helpers for running one task on several threads
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "howderek.h"
+#include "howderek_parallel.h"
+
+struct __howderek_parallel_worker {
+  pthread_t thread;
+  unsigned index;
+  unsigned threads;
+  void (*task)(void* context, unsigned thread, unsigned threads);
+  void (*each)(void* context);       // run instead of task if set
+  void* context;
+};
+
+
+
+void howderek_barrier_init(struct howderek_barrier* barrier, unsigned count) {
+  pthread_mutex_init(&barrier->mutex, NULL);
+  pthread_cond_init(&barrier->cond, NULL);
+  barrier->count = count;
+  barrier->waiting = 0;
+  barrier->generation = 0;
+}
+
+
+
+void howderek_barrier_destroy(struct howderek_barrier* barrier) {
+  pthread_cond_destroy(&barrier->cond);
+  pthread_mutex_destroy(&barrier->mutex);
+}
+
+
+
+void howderek_barrier_wait(struct howderek_barrier* barrier) {
+  pthread_mutex_lock(&barrier->mutex);
+  const unsigned generation = barrier->generation;
+  if (++barrier->waiting == barrier->count) {
+    barrier->waiting = 0;
+    barrier->generation++;
+    pthread_cond_broadcast(&barrier->cond);
+  } else {
+    // The generation check guards against spurious wakeups
+    while (generation == barrier->generation) {
+      pthread_cond_wait(&barrier->cond, &barrier->mutex);
+    }
+  }
+  pthread_mutex_unlock(&barrier->mutex);
+}
+
+
+
+unsigned howderek_parallel_threads(void) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores < 1) {
+    return 1;
+  }
+  return (cores > HOWDEREK_PARALLEL_MAX_THREADS) ? HOWDEREK_PARALLEL_MAX_THREADS : cores;
+}
+
+
+
+void* __howderek_parallel_start(void* worker_as_void_ptr) {
+  struct __howderek_parallel_worker* worker = worker_as_void_ptr;
+  if (worker->each != NULL) {
+    worker->each(worker->context);
+  } else {
+    worker->task(worker->context, worker->index, worker->threads);
+  }
+  return NULL;
+}
+
+
+
+/**
+ * Start workers 1 and up, run worker 0 on the calling thread and join them
+ */
+unsigned __howderek_parallel_fork_join(unsigned threads,
+                                      void (*task)(void* context, unsigned thread, unsigned threads),
+                                      void (*each)(void* context),
+                                      void* context) {
+  struct __howderek_parallel_worker workers[HOWDEREK_PARALLEL_MAX_THREADS];
+  unsigned i;
+  unsigned started;
+
+  threads = (threads == 0) ? howderek_parallel_threads() : threads;
+  threads = (threads > HOWDEREK_PARALLEL_MAX_THREADS) ? HOWDEREK_PARALLEL_MAX_THREADS : threads;
+  for (i = 0; i < threads; i++) {
+    workers[i].index = i;
+    workers[i].threads = threads;
+    workers[i].task = task;
+    workers[i].each = each;
+    workers[i].context = context;
+  }
+  for (started = 1; started < threads; started++) {
+    if (pthread_create(&workers[started].thread, NULL, __howderek_parallel_start, &workers[started]) != 0) {
+      // Tasks may be waiting on barriers sized for every thread, so there
+      // is no way to continue with fewer
+      howderek_log(HOWDEREK_LOG_FATAL, "libhowderek_parallel: failed to start thread %u of %u", started, threads);
+      exit(1);
+    }
+  }
+  __howderek_parallel_start(&workers[0]);
+  for (i = 1; i < threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  return threads;
+}
+
+
+
+unsigned howderek_parallel_run(unsigned threads,
+                               void (*task)(void* context, unsigned thread, unsigned threads),
+                               void* context) {
+  return __howderek_parallel_fork_join(threads, task, NULL, context);
+}
+
+
+
+unsigned howderek_parallel_each(unsigned threads, void (*task)(void* context), void* context) {
+  return __howderek_parallel_fork_join(threads, NULL, task, context);
+}
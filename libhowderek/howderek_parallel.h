@@ -0,0 +1,83 @@
+/*! \file howderek_parallel.h
+ *  \brief Fork-join helpers for running one task on several threads
+ *
+ *  howderek_parallel_run starts a task on every thread and waits for all of
+ *  them. Tasks that work in rounds (like a level-synchronous BFS) keep their
+ *  threads alive and line up between rounds with a howderek_barrier, which
+ *  is cheaper than starting threads for every round.
+*/
+
+#ifndef H_LIBHOWDEREK_PARALLEL_H
+#define H_LIBHOWDEREK_PARALLEL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "howderek.h"
+
+#ifndef HOWDEREK_PARALLEL_CONFIG
+// Upper bound on threads, no matter how many cores there are
+#define HOWDEREK_PARALLEL_MAX_THREADS 256
+#endif
+
+struct howderek_barrier {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  unsigned count;          // threads that have to arrive
+  unsigned waiting;        // threads that have arrived this round
+  unsigned generation;     // bumped when a round completes
+};
+
+/**
+ * Initialize a barrier
+ *
+ * \param barrier  barrier to initialize
+ * \param count    number of threads that wait on it
+ */
+void howderek_barrier_init(struct howderek_barrier* barrier, unsigned count);
+
+/**
+ * Destroy a barrier
+ *
+ * \param barrier  barrier to destroy
+ */
+void howderek_barrier_destroy(struct howderek_barrier* barrier);
+
+/**
+ * Wait until every thread reaches the barrier. Everything written before
+ * the barrier is visible to every thread after it.
+ *
+ * \param barrier  barrier to wait on
+ */
+void howderek_barrier_wait(struct howderek_barrier* barrier);
+
+/**
+ * Number of threads to use by default, the number of online cores
+ */
+unsigned howderek_parallel_threads(void);
+
+/**
+ * Run task on threads threads and wait for all of them. The calling thread
+ * runs thread 0.
+ *
+ * \param threads  number of threads, 0 for howderek_parallel_threads()
+ * \param task     function to run, given its thread number and the total
+ * \param context  passed to every task
+ * \return         number of threads used
+ */
+unsigned howderek_parallel_run(unsigned threads,
+                               void (*task)(void* context, unsigned thread, unsigned threads),
+                               void* context);
+
+/**
+ * howderek_parallel_run for tasks that take their work from a shared
+ * counter, so they don't need to know which thread they are
+ *
+ * \param threads  number of threads, 0 for howderek_parallel_threads()
+ * \param task     function to run on every thread
+ * \param context  passed to every task
+ * \return         number of threads used
+ */
+unsigned howderek_parallel_each(unsigned threads, void (*task)(void* context), void* context);
+
+#endif
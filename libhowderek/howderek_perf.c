@@ -0,0 +1,219 @@
+/*! \file howderek_perf.c
+ *  \brief Reads hardware performance counters around a phase of work
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "howderek.h"
+#include "howderek_perf.h"
+
+// What a PERF_FORMAT_GROUP read of the leader returns, one value per
+// counter in the order they joined the group
+struct __howderek_perf_reading {
+  uint64_t count;
+  uint64_t timeEnabled;
+  uint64_t timeRunning;
+  uint64_t values[HOWDEREK_PERF_COUNTERS];
+};
+
+
+
+uint64_t __howderek_perf_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+
+/**
+ * Open one counter
+ *
+ * \param type     perf event type
+ * \param config   perf event config
+ * \param leader   group to join, -1 to start a new one
+ * \param inherit  whether threads started later are counted too
+ */
+int __howderek_perf_event_open(uint32_t type, uint64_t config, int leader, int inherit) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  // Members follow their leader, so only the leader starts disabled
+  attr.disabled = (leader < 0);
+  attr.inherit = inherit;
+  // Counting our own user space code is allowed at perf_event_paranoid 2
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+
+
+unsigned howderek_perf_open(struct howderek_perf* perf) {
+  const uint32_t types[HOWDEREK_PERF_COUNTERS] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+  };
+  const uint64_t configs[HOWDEREK_PERF_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    PERF_COUNT_HW_BRANCH_MISSES
+  };
+  unsigned opened = 0;
+  unsigned i;
+  int inherit = 1;
+
+  memset(perf, 0, sizeof(struct howderek_perf));
+  perf->leader = -1;
+  // Cycles lead the group, or the first counter after them that opens
+  for (i = 0; i < HOWDEREK_PERF_COUNTERS; i++) {
+    perf->fds[i] = __howderek_perf_event_open(types[i], configs[i], perf->leader, inherit);
+    // Kernels before 4.3 can't read an inherited group
+    if (perf->fds[i] < 0 && errno == EINVAL && perf->leader < 0 && inherit) {
+      perf->fds[i] = __howderek_perf_event_open(types[i], configs[i], perf->leader, 0);
+      inherit = (perf->fds[i] < 0);
+    }
+    if (perf->leader < 0) {
+      perf->leader = perf->fds[i];
+    }
+    if (perf->fds[i] < 0) {
+      howderek_log(HOWDEREK_LOG_VERBOSE, "libhowderek_perf: %s unavailable (%s)",
+                   howderek_perf_counter_string(i), strerror(errno));
+    } else {
+      opened++;
+    }
+  }
+  return opened;
+}
+
+
+
+void howderek_perf_close(struct howderek_perf* perf) {
+  unsigned i;
+  // Members first, closing the leader would leave them as groups of their own
+  for (i = HOWDEREK_PERF_COUNTERS; i-- > 0;) {
+    if (perf->fds[i] >= 0) {
+      close(perf->fds[i]);
+      perf->fds[i] = -1;
+    }
+  }
+  perf->leader = -1;
+}
+
+
+
+/**
+ * Read the whole group from its leader
+ *
+ * \return 1 if every counter was read
+ */
+int __howderek_perf_read(struct howderek_perf* perf, struct __howderek_perf_reading* reading) {
+  unsigned i;
+  unsigned members = 0;
+  ssize_t size;
+  for (i = 0; i < HOWDEREK_PERF_COUNTERS; i++) {
+    members += (perf->fds[i] >= 0);
+  }
+  size = read(perf->leader, reading, sizeof(struct __howderek_perf_reading));
+  return size == (ssize_t) (sizeof(uint64_t) * (3 + members)) && reading->count == members;
+}
+
+
+
+void howderek_perf_begin(struct howderek_perf* perf) {
+  struct __howderek_perf_reading reading;
+  memset(&perf->base, 0, sizeof(perf->base));
+  if (perf->leader >= 0) {
+    // Counts inherited from threads that exited survive PERF_EVENT_IOC_RESET,
+    // so the phase is measured from a reading taken here instead
+    ioctl(perf->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    if (__howderek_perf_read(perf, &reading)) {
+      memcpy(&perf->base, &reading.timeEnabled, sizeof(uint64_t) * (2 + reading.count));
+    }
+  }
+  perf->started = __howderek_perf_now();
+}
+
+
+
+void howderek_perf_end(struct howderek_perf* perf) {
+  struct __howderek_perf_reading reading;
+  uint64_t enabled, running, value;
+  unsigned i;
+  unsigned member = 0;
+  perf->elapsed = __howderek_perf_now() - perf->started;
+  memset(perf->values, 0, sizeof(perf->values));
+  if (perf->leader < 0) {
+    return;
+  }
+  ioctl(perf->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  if (!__howderek_perf_read(perf, &reading)) {
+    return;
+  }
+  enabled = reading.timeEnabled - perf->base[0];
+  running = reading.timeRunning - perf->base[1];
+  for (i = 0; i < HOWDEREK_PERF_COUNTERS; i++) {
+    if (perf->fds[i] < 0) {
+      continue;
+    }
+    value = reading.values[member] - perf->base[2 + member];
+    member++;
+    // The group was only on the hardware part of the time
+    if (running != 0 && running < enabled) {
+      value = (double) value * enabled / running;
+    }
+    perf->values[i] = value;
+  }
+}
+
+
+
+const char* howderek_perf_counter_string(enum howderek_perf_counter counter) {
+  switch (counter) {
+    case HOWDEREK_PERF_CYCLES:
+      return "cycles";
+    case HOWDEREK_PERF_INSTRUCTIONS:
+      return "instructions";
+    case HOWDEREK_PERF_L1D_MISSES:
+      return "L1d misses";
+    case HOWDEREK_PERF_LLC_MISSES:
+      return "LLC misses";
+    case HOWDEREK_PERF_BRANCH_MISSES:
+      return "branch misses";
+    default:
+      return "unknown";
+  }
+}
+
+
+
+void howderek_perf_report(struct howderek_perf* perf, FILE* output, const char* phase,
+                          uint64_t units, const char* unitName) {
+  const double per = (units != 0) ? units : 1;
+  unsigned i;
+  fprintf(output, "%-24s %12.3f ms  %10.1f ns/%s\n", phase, perf->elapsed / 1e6, perf->elapsed / per, unitName);
+  for (i = 0; i < HOWDEREK_PERF_COUNTERS; i++) {
+    if (howderek_perf_available(perf, i)) {
+      fprintf(output, "  %-22s %15lu  %10.2f /%s\n", howderek_perf_counter_string(i), perf->values[i],
+              perf->values[i] / per, unitName);
+    } else {
+      fprintf(output, "  %-22s %15s\n", howderek_perf_counter_string(i), "n/a");
+    }
+  }
+  if (howderek_perf_available(perf, HOWDEREK_PERF_CYCLES) && howderek_perf_available(perf, HOWDEREK_PERF_INSTRUCTIONS)
+      && perf->values[HOWDEREK_PERF_CYCLES] != 0) {
+    fprintf(output, "  %-22s %15.2f\n", "IPC",
+            (double) perf->values[HOWDEREK_PERF_INSTRUCTIONS] / perf->values[HOWDEREK_PERF_CYCLES]);
+  }
+}
@@ -0,0 +1,108 @@
+/*! \file howderek_perf.h
+ *  \brief Reads hardware performance counters around a phase of work
+ *
+ *  Counters come from perf_event_open and count this process and the
+ *  threads it starts, in user space. They are opened as one group led by
+ *  the first counter available, so they're all on the hardware at the same
+ *  time and ratios like IPC compare counts from the same window. Any counter the kernel or the hardware won't give us (containers,
+ *  virtual machines, perf_event_paranoid) is marked unavailable and
+ *  reported as "n/a" instead of failing.
+ *
+ *  struct howderek_perf perf;
+ *  howderek_perf_open(&perf);
+ *  howderek_perf_begin(&perf);
+ *  ...
+ *  howderek_perf_end(&perf);
+ *  howderek_perf_report(&perf, stdout, "dijkstra", vertices, "vertex");
+ *  howderek_perf_close(&perf);
+*/
+
+#ifndef H_LIBHOWDEREK_PERF_H
+#define H_LIBHOWDEREK_PERF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "howderek.h"
+
+enum howderek_perf_counter {
+  HOWDEREK_PERF_CYCLES = 0,
+  HOWDEREK_PERF_INSTRUCTIONS,
+  HOWDEREK_PERF_L1D_MISSES,
+  HOWDEREK_PERF_LLC_MISSES,
+  HOWDEREK_PERF_BRANCH_MISSES,
+  HOWDEREK_PERF_COUNTERS
+};
+
+struct howderek_perf {
+  int fds[HOWDEREK_PERF_COUNTERS];   // -1 if the counter is unavailable
+  int leader;                        // fd of the group leader, -1 if none opened
+  uint64_t values[HOWDEREK_PERF_COUNTERS];
+  uint64_t base[2 + HOWDEREK_PERF_COUNTERS]; // times and counts read by howderek_perf_begin
+  uint64_t started;                  // nanoseconds, monotonic clock
+  uint64_t elapsed;                  // nanoseconds in the last phase
+};
+
+/**
+ * Open every counter that's available. Nothing is counted until
+ * howderek_perf_begin.
+ *
+ * \param perf  counters to open
+ * \return      number of counters that opened
+ */
+unsigned howderek_perf_open(struct howderek_perf* perf);
+
+/**
+ * Close the counters
+ *
+ * \param perf  counters to close
+ */
+void howderek_perf_close(struct howderek_perf* perf);
+
+/**
+ * Start counting
+ *
+ * \param perf  counters to start
+ */
+void howderek_perf_begin(struct howderek_perf* perf);
+
+/**
+ * Stop counting and read the counters. Counts are scaled up if the kernel
+ * had to share the hardware with other counters, by the same factor for
+ * every counter since the group is scheduled as a whole.
+ *
+ * \param perf  counters to stop
+ */
+void howderek_perf_end(struct howderek_perf* perf);
+
+/**
+ * Whether a counter could be opened
+ *
+ * \param perf     counters
+ * \param counter  counter to check
+ */
+static inline int howderek_perf_available(struct howderek_perf* perf, enum howderek_perf_counter counter) {
+  return perf->fds[counter] >= 0;
+}
+
+/**
+ * Name of a counter
+ *
+ * \param counter  counter to name
+ */
+const char* howderek_perf_counter_string(enum howderek_perf_counter counter);
+
+/**
+ * Print the time and counters of the last phase, in total and per unit of
+ * work
+ *
+ * \param perf      counters
+ * \param output    where to print
+ * \param phase     name of the phase
+ * \param units     amount of work done, like vertices settled
+ * \param unitName  what one unit is, like "vertex"
+ */
+void howderek_perf_report(struct howderek_perf* perf, FILE* output, const char* phase,
+                          uint64_t units, const char* unitName);
+
+#endif
@@ -25,9 +25,59 @@ void __howderek_skip_default_mutation(struct howderek_skip_node* left, struct ho
 
 
 
+size_t __howderek_skip_node_size(int level) {
+  return sizeof(struct howderek_skip_node)
+      + (sizeof(struct howderek_skip_node*) + sizeof(size_t)) * (level + 1);
+}
+
+
+
+struct howderek_skip_node* __howderek_skip_create_node(struct howderek_skip* list, int level) {
+  struct howderek_skip_slab_class* slabClass = &list->slabs[level];
+  struct howderek_skip_node* node;
+  const size_t nodeSize = __howderek_skip_node_size(level);
+
+  if (slabClass->freeList != NULL) {
+    node = slabClass->freeList;
+    slabClass->freeList = node->data;
+  } else {
+    if (slabClass->slabs == NULL || slabClass->used == slabClass->capacity) {
+      if (slabClass->capacity == 0) {
+        slabClass->capacity = HOWDEREK_SKIP_SLAB_NODES >> (2 * level);
+        slabClass->capacity = (slabClass->capacity > 0) ? slabClass->capacity : 1;
+      }
+      // Slabs come out of the list's region and are freed with it
+      struct howderek_skip_slab* slab = howderek_allocate("skiplist_slab", list, sizeof(struct howderek_skip_slab)
+                                                          + nodeSize * slabClass->capacity);
+      slab->next = slabClass->slabs;
+      slabClass->slabs = slab;
+      slabClass->used = 0;
+    }
+    node = (struct howderek_skip_node*) ((char*) (slabClass->slabs + 1) + nodeSize * slabClass->used);
+    slabClass->used++;
+  }
+
+  memset(node, 0, nodeSize);
+  // next and span live right after the node
+  node->next = (struct howderek_skip_node**) (node + 1);
+  node->span = (size_t*) (node->next + level + 1);
+  node->level = level;
+  return node;
+}
+
+
+
+void __howderek_skip_free_node(struct howderek_skip* list, struct howderek_skip_node* node) {
+  struct howderek_skip_slab_class* slabClass = &list->slabs[node->level];
+  node->data = slabClass->freeList;
+  slabClass->freeList = node;
+}
+
+
+
 struct howderek_skip* howderek_skip_create_custom(howderek_skip_value_t (*compareFunction)(struct howderek_skip_node* left, struct howderek_skip_node* right), void (*mutationFunction)(struct howderek_skip_node* left, struct howderek_skip_node* right)) {
   struct howderek_skip* list;
-  list = howderek_allocate_and_zero("skiplist", &list, sizeof(struct howderek_skip));
+  list = howderek_allocate_and_zero("skiplist", NULL, sizeof(struct howderek_skip));
   if (list == 0) {
     fprintf(stderr, "fatal error in %s:%d - out of memory\n", __FILE__, __LINE__);
     exit(ENOMEM);
@@ -48,10 +98,8 @@ struct howderek_skip* howderek_skip_create_custom(howderek_skip_value_t (*compar
   }
 
   size_t i;
-  list->head = howderek_allocate_and_zero("skiplist->head", &list, sizeof(struct howderek_skip_node));
-
-  list->head->next = howderek_allocate_and_zero("skiplist_node", list->head, sizeof(struct howderek_skip_node*) * HOWDEREK_SKIP_MAX_LEVEL + 1);
-  for (i = 0; i < HOWDEREK_SKIP_MAX_LEVEL; i++) {
+  list->head = __howderek_skip_create_node(list, HOWDEREK_SKIP_MAX_LEVEL);
+  for (i = 0; i <= HOWDEREK_SKIP_MAX_LEVEL; i++) {
     list->head->next[i] = list->head;
   }
 
@@ -74,24 +122,16 @@ struct howderek_skip* howderek_skip_create() {
 
 
 void howderek_skip_destroy(struct howderek_skip* list, int freeData) {
-  struct howderek_skip_node *iter = list->head->next[0];
-  struct howderek_skip_node *old = list->head;
+  struct howderek_skip_node *iter;
 
-  while (iter->next[0] != list->head) {
-    old = iter;
-    iter = iter->next[0];
-    howderek_free(old->next);
-    if (old->data != NULL && freeData == 1) {
-      free(old->data);
+  // Only the data needs a walk, the nodes go away with the region
+  if (freeData == 1) {
+    for (iter = list->head->next[0]; iter != list->head; iter = iter->next[0]) {
+      free(iter->data);
     }
-    howderek_free(old);
   }
-  howderek_free(iter->next);
-  howderek_free(iter);
 
-  howderek_free(list->head->next);
-  howderek_free(list->head);
-  howderek_free(list);
+  howderek_destroy(list);
 }
 
 
@@ -126,6 +166,7 @@ void howderek_skip_push(struct howderek_skip* list, howderek_skip_value_t id, vo
   int i = 0;
   int currentLevel;
   struct howderek_skip_node *update[HOWDEREK_SKIP_MAX_LEVEL + 2];
+  size_t rank[HOWDEREK_SKIP_MAX_LEVEL + 2];
   struct howderek_skip_node *iter = list->head;
   struct howderek_skip_node newNode;
 
@@ -144,14 +185,17 @@ void howderek_skip_push(struct howderek_skip* list, howderek_skip_value_t id, vo
   *
   * During the traversal, the furthest desination of each link is
   * recorded into update. That array is used to update the links
-  * after the correct position is found.
+  * after the correct position is found. rank records the position
+  * of each update node so the spans can be split around the new node.
   */
   for (currentLevel = list->level; currentLevel >= 0; currentLevel--) {
+    rank[currentLevel] = (currentLevel == list->level) ? 0 : rank[currentLevel + 1];
     while (iter->next[currentLevel] != list->head) {
       if (list->compareFunction(iter->next[currentLevel], &newNode) >= 0) {
         break;
       } else {
         // Follow link
+        rank[currentLevel] += iter->span[currentLevel];
         iter = iter->next[currentLevel];
       }
     }
@@ -177,23 +221,31 @@ void howderek_skip_push(struct howderek_skip* list, howderek_skip_value_t id, vo
   // for the O(1) random suggestion
   //newLevel = __builtin_ffs(rand() & (HOWDEREK_SKIP_MAX_LEVEL - 1));
 
-  // If height changed, initalize new level
+  // If height changed, initalize new level. The head spans the whole list there.
   if (newLevel > list->level) {
     for (i = list->level + 1; i <= newLevel; i++) {
+      rank[i] = 0;
       update[i] = list->head;
+      update[i]->span[i] = list->count;
     }
     list->level = newLevel;
   }
 
   // Set forward links on the new node
-  iter = howderek_allocate_and_zero("skiplist_node", list->head, sizeof(struct howderek_skip_node));
-  iter->next = howderek_allocate_and_zero("skiplist_node", list->head, sizeof(struct howderek_skip_node*) * newLevel + 1);
+  iter = __howderek_skip_create_node(list, newLevel);
   iter->id = id;
   iter->data = data;
-  iter->level = newLevel;
   for (i = 0; i <= newLevel; i++) {
     iter->next[i] = update[i]->next[i];
     update[i]->next[i] = iter;
+    // update[i] is (rank[0] - rank[i]) nodes behind the new node's predecessor
+    iter->span[i] = update[i]->span[i] - (rank[0] - rank[i]);
+    update[i]->span[i] = (rank[0] - rank[i]) + 1;
+  }
+
+  // Links that pass over the new node now skip one more
+  for (; i <= list->level; i++) {
+    update[i]->span[i]++;
   }
 
   list->count++;
@@ -202,8 +254,30 @@ void howderek_skip_push(struct howderek_skip* list, howderek_skip_value_t id, vo
 
 
 
+void __howderek_skip_unlink(struct howderek_skip* list,
+                            struct howderek_skip_node** update,
+                            struct howderek_skip_node* node) {
+  int i;
+  // Detach the node from the list by updating the links that attach to it
+  for (i = 0; i <= list->level; i++) {
+    if (update[i]->next[i] == node) {
+      update[i]->span[i] += node->span[i] - 1;
+      update[i]->next[i] = node->next[i];
+    } else {
+      update[i]->span[i]--;
+    }
+  }
+  list->count--;
+
+  // Update list level in case that node was the tallest
+  while (list->level > 0 && list->head->next[list->level] == list->head) {
+    list->level--;
+  }
+}
+
+
+
 int howderek_skip_delete(struct howderek_skip* list, howderek_skip_value_t id, void* data) {
-  int i = 0;
   int currentLevel;
   struct howderek_skip_node *update[HOWDEREK_SKIP_MAX_LEVEL + 2];
   struct howderek_skip_node *iter = list->head;
@@ -238,21 +312,12 @@ int howderek_skip_delete(struct howderek_skip* list, howderek_skip_value_t id, v
       return 0;
   }
 
-  // Detach the node from the list by updating the links that attach to it
-  for (i = 0; i <= list->level && update[i]->next[i] == iter; i++) {
-    update[i]->next[i] = iter->next[i];
-  }
+  __howderek_skip_unlink(list, update, iter);
 
   if (data != NULL) {
     free(iter->data);
   }
-  howderek_free(iter);
-  list->count--;
-
-  // Update list level in case that node was the tallest
-  while (list->level > 0 && list->head->next[list->level] != list->head) {
-    list->level--;
-  }
+  __howderek_skip_free_node(list, iter);
   return 1;
 }
 
@@ -271,8 +336,8 @@ struct howderek_skip_node* howderek_skip_search(struct howderek_skip* list, howd
 
   // Traverse the skip list
   for (currentLevel = list->level; currentLevel >= 0; currentLevel--) {
-    while (iter != list->head) {
-      if (list->compareFunction(iter, &newNode) >= 0) {
+    while (iter->next[currentLevel] != list->head) {
+      if (list->compareFunction(iter->next[currentLevel], &newNode) >= 0) {
         break;
       }
       iter = iter->next[currentLevel];
@@ -288,25 +353,76 @@ struct howderek_skip_node* howderek_skip_search(struct howderek_skip* list, howd
   return NULL;
 }
 
-struct howderek_skip_node* howderek_skip_index(struct howderek_skip* list, size_t i) {
-  struct howderek_skip_node* iter = list->head;
-  for (;i > 0 && iter != NULL; i--) {
-    iter = iter->next[0];
+size_t howderek_skip_rank(struct howderek_skip* list, howderek_skip_value_t id, void* data) {
+  struct howderek_skip_node *iter = list->head;
+  long int currentLevel;
+  size_t rank = 0;
+  struct howderek_skip_node newNode;
+
+  newNode.id = id;
+  newNode.data = data;
+
+  // Same traversal as a search, but count every node that gets skipped
+  for (currentLevel = list->level; currentLevel >= 0; currentLevel--) {
+    while (iter->next[currentLevel] != list->head) {
+      if (list->compareFunction(iter->next[currentLevel], &newNode) >= 0) {
+        break;
+      }
+      rank += iter->span[currentLevel];
+      iter = iter->next[currentLevel];
+    }
   }
-  if (i == 0) {
-    return iter->next[0];
-  } else {
+  iter = iter->next[0];
+
+  if (iter != list->head && list->compareFunction(iter, &newNode) == 0) {
+    return rank;
+  }
+  return HOWDEREK_SKIP_NOT_FOUND;
+}
+
+/*
+ * Walk towards position i, staying as high as possible without overshooting.
+ * Fills update (if not NULL) with the last node before position i on each level.
+ */
+struct howderek_skip_node* __howderek_skip_find_index(struct howderek_skip* list,
+                                                      size_t i,
+                                                      struct howderek_skip_node** update) {
+  struct howderek_skip_node* iter = list->head;
+  long int currentLevel;
+  size_t traversed = 0;
+  if (i >= list->count) {
     return NULL;
   }
+  for (currentLevel = list->level; currentLevel >= 0; currentLevel--) {
+    while (iter->next[currentLevel] != list->head
+           && traversed + iter->span[currentLevel] <= i) {
+      traversed += iter->span[currentLevel];
+      iter = iter->next[currentLevel];
+    }
+    if (update != NULL) {
+      update[currentLevel] = iter;
+    }
+  }
+  return iter->next[0];
+}
+
+struct howderek_skip_node* howderek_skip_index(struct howderek_skip* list, size_t i) {
+  return __howderek_skip_find_index(list, i, NULL);
 }
 
 int howderek_skip_delete_index(struct howderek_skip* list, size_t i, int freeData) {
-  struct howderek_skip_node* toDelete = howderek_skip_index(list, i);
+  struct howderek_skip_node *update[HOWDEREK_SKIP_MAX_LEVEL + 2];
+  struct howderek_skip_node* toDelete = __howderek_skip_find_index(list, i, update);
   if (toDelete == NULL) {
     return 0;
-  } else {
-    return howderek_skip_delete(list, toDelete->id, (freeData) ? toDelete->data : NULL);
   }
+  list->ops++;
+  __howderek_skip_unlink(list, update, toDelete);
+  if (freeData) {
+    free(toDelete->data);
+  }
+  __howderek_skip_free_node(list, toDelete);
+  return 1;
 }
 
 
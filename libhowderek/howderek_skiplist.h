@@ -8,6 +8,10 @@
            Search      O(log n)   O(n)
            Insert      O(log n)   O(n)
            Delete      O(log n)   O(n)
+           Index       O(log n)   O(n)
+
+           Every link also stores its span (how many nodes it skips), so
+           positional lookups can skip ahead the same way searches do.
 
            Thanks to William Pugh [1] for his description of Skip Lists and Thomas 
            Niemann at the University of Auckland [2] for his reference implementation 
@@ -22,13 +26,21 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #ifndef HOWDEREK_SKIP_MAX_LEVEL
 #define HOWDEREK_SKIP_MAX_LEVEL 20
 #endif
 
+#ifndef HOWDEREK_SKIP_SLAB_NODES
+// Nodes per level 0 slab. Each level up holds a quarter as many, matching the
+// odds of a node reaching that level.
+#define HOWDEREK_SKIP_SLAB_NODES 256
+#endif
+
 typedef long int howderek_skip_value_t;
 #define HOWDEREK_SKIP_VALUE_PRINTF_STR "%lu"
+#define HOWDEREK_SKIP_NOT_FOUND SIZE_MAX
 
 enum howderek_skip_data_status {
   HOWDEREK_SKIP_DATA_ON_STACK = 1,
@@ -40,10 +52,28 @@ struct howderek_skip_node {
   int level;
   void* data; // Data associated with this node
   struct howderek_skip_node** next; // All linked nodes
+  size_t* span; // Number of level 0 links skipped by each next[] link
+};
+
+/*
+ * Nodes are carved out of slabs owned by the list, with next[] and span[]
+ * stored inline after the node. There is one slab class per level so every
+ * node in a slab is the same size and freed nodes can be reused as-is.
+ */
+struct howderek_skip_slab {
+  struct howderek_skip_slab* next; // Older slab in the same class
+};
+
+struct howderek_skip_slab_class {
+  struct howderek_skip_slab* slabs;     // Newest slab first
+  struct howderek_skip_node* freeList;  // Freed nodes, linked through data
+  size_t used;                          // Nodes handed out from the newest slab
+  size_t capacity;                      // Nodes per slab
 };
 
 struct howderek_skip {
   struct howderek_skip_node* head;
+  struct howderek_skip_slab_class slabs[HOWDEREK_SKIP_MAX_LEVEL + 1];
   howderek_skip_value_t (*compareFunction)(struct howderek_skip_node* left, struct howderek_skip_node* right); // Function that is used to compare nodes and sort
   void (*mutationFunction)(struct howderek_skip_node* left, struct howderek_skip_node* right); // Function that is used when an id already exists
   size_t count;
@@ -96,19 +126,33 @@ void howderek_skip_destroy(struct howderek_skip* list, int freeData);
 struct howderek_skip_node* howderek_skip_search(struct howderek_skip* list, howderek_skip_value_t id, void* data);
 
 /**
- * Returns the ith element
+ * Returns the ith element in O(log n) by following the span of each link
  *
- * \param input  input file
+ * \param list  skip list to search
+ * \param i     zero-based position
  */
 struct howderek_skip_node* howderek_skip_index(struct howderek_skip* list, size_t i);
 
 /**
- * Returns the ith element
+ * Removes the ith element in O(log n)
  *
- * \param input  input file
+ * \param list      skip list to delete from
+ * \param i         zero-based position
+ * \param freeData  1 if the data of the removed node should be freed
+ * \return          1 if a node was removed, 0 otherwise
  */
 int howderek_skip_delete_index(struct howderek_skip* list, size_t i, int freeData);
 
+/**
+ * Returns the zero-based position of a value in O(log n)
+ *
+ * \param list  skip list to search
+ * \param id    id to find
+ * \param data  data used by custom compare functions
+ * \return      position of the value or HOWDEREK_SKIP_NOT_FOUND
+ */
+size_t howderek_skip_rank(struct howderek_skip* list, howderek_skip_value_t id, void* data);
+
 /**
  * Remove a value from the skiplist
  * 
@@ -0,0 +1,430 @@
+/*! \file howderek_skiplist_concurrent.c
+    \brief Lock-free skiplist with epoch based reclamation
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include "howderek.h"
+#include "howderek_skiplist_concurrent.h"
+
+#define HOWDEREK_CSKIP_MARK              ((uintptr_t) 1)
+#define HOWDEREK_CSKIP_IS_MARKED(link)   ((link) & HOWDEREK_CSKIP_MARK)
+#define HOWDEREK_CSKIP_POINTER(link)     ((struct howderek_cskip_node*) ((link) & ~HOWDEREK_CSKIP_MARK))
+
+#define HOWDEREK_CSKIP_LOAD(ptr)         __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+#define HOWDEREK_CSKIP_STORE(ptr, val)   __atomic_store_n(ptr, val, __ATOMIC_SEQ_CST)
+#define HOWDEREK_CSKIP_CAS(ptr, expected, desired) \
+  __atomic_compare_exchange_n(ptr, expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+
+/*
+ * Epochs
+ * ---------------------
+ * Every thread that touches a list gets a record. While an operation runs the
+ * record is active and holds the global epoch it started in. Retired pointers
+ * are tagged with the global epoch after they were unlinked and can be freed
+ * once the global epoch is two ahead of that tag, because by then every thread
+ * that could have seen them has finished its operation.
+ */
+
+struct __howderek_cskip_retired {
+  void* ptr;
+  uint64_t epoch;
+};
+
+struct __howderek_cskip_thread {
+  uint64_t epoch;                          // Epoch this thread is running in
+  int active;                              // 1 while inside an operation
+  int inUse;                               // 1 while owned by a thread
+  uint64_t rng;                            // Per-thread xorshift state for levels
+  uint64_t lastScan;                       // Global epoch at the last limbo scan
+  size_t sinceAdvance;                     // Retires since the last advance attempt
+  struct __howderek_cskip_retired* limbo;  // Retired but not yet freed
+  size_t limboCount;
+  size_t limboSize;
+  struct __howderek_cskip_thread* next;    // Registry link, never changes once published
+};
+
+static uint64_t __howderek_cskip_global_epoch = 0;
+static struct __howderek_cskip_thread* __howderek_cskip_threads = NULL;
+static __thread struct __howderek_cskip_thread* __howderek_cskip_self = NULL;
+
+
+
+struct __howderek_cskip_thread* __howderek_cskip_thread(void) {
+  struct __howderek_cskip_thread* self = __howderek_cskip_self;
+  if (self != NULL) {
+    return self;
+  }
+
+  // Reuse a record left behind by a detached thread
+  for (self = HOWDEREK_CSKIP_LOAD(&__howderek_cskip_threads); self != NULL; self = self->next) {
+    int unused = 0;
+    if (HOWDEREK_CSKIP_LOAD(&self->inUse) == 0 && HOWDEREK_CSKIP_CAS(&self->inUse, &unused, 1)) {
+      __howderek_cskip_self = self;
+      return self;
+    }
+  }
+
+  self = calloc(1, sizeof(struct __howderek_cskip_thread));
+  if (self == NULL) {
+    howderek_log(HOWDEREK_LOG_FATAL, "error in %s (malloc failed)", __func__);
+    exit(ENOMEM);
+  }
+  self->inUse = 1;
+  self->rng = ((uint64_t) (uintptr_t) self * 0x9E3779B97F4A7C15ULL) ^ (uint64_t) time(NULL);
+  self->rng = (self->rng == 0) ? 0x9E3779B97F4A7C15ULL : self->rng;
+  struct __howderek_cskip_thread* head = HOWDEREK_CSKIP_LOAD(&__howderek_cskip_threads);
+  do {
+    self->next = head;
+  } while (!HOWDEREK_CSKIP_CAS(&__howderek_cskip_threads, &head, self));
+  __howderek_cskip_self = self;
+  return self;
+}
+
+
+
+void __howderek_cskip_scan(struct __howderek_cskip_thread* self, uint64_t global) {
+  size_t i;
+  size_t kept = 0;
+  for (i = 0; i < self->limboCount; i++) {
+    if (self->limbo[i].epoch + 2 <= global) {
+      free(self->limbo[i].ptr);
+    } else {
+      self->limbo[kept++] = self->limbo[i];
+    }
+  }
+  self->limboCount = kept;
+  self->lastScan = global;
+}
+
+
+
+struct __howderek_cskip_thread* __howderek_cskip_enter(void) {
+  struct __howderek_cskip_thread* self = __howderek_cskip_thread();
+  HOWDEREK_CSKIP_STORE(&self->active, 1);
+  uint64_t global = HOWDEREK_CSKIP_LOAD(&__howderek_cskip_global_epoch);
+  HOWDEREK_CSKIP_STORE(&self->epoch, global);
+  if (global != self->lastScan && self->limboCount > 0) {
+    __howderek_cskip_scan(self, global);
+  }
+  return self;
+}
+
+
+
+void __howderek_cskip_exit(struct __howderek_cskip_thread* self) {
+  __atomic_store_n(&self->active, 0, __ATOMIC_RELEASE);
+}
+
+
+
+void __howderek_cskip_try_advance(void) {
+  uint64_t global = HOWDEREK_CSKIP_LOAD(&__howderek_cskip_global_epoch);
+  struct __howderek_cskip_thread* iter;
+  for (iter = HOWDEREK_CSKIP_LOAD(&__howderek_cskip_threads); iter != NULL; iter = iter->next) {
+    if (HOWDEREK_CSKIP_LOAD(&iter->active) && HOWDEREK_CSKIP_LOAD(&iter->epoch) != global) {
+      return;
+    }
+  }
+  HOWDEREK_CSKIP_CAS(&__howderek_cskip_global_epoch, &global, global + 1);
+}
+
+
+
+void __howderek_cskip_retire(struct __howderek_cskip_thread* self, void* ptr) {
+  if (self->limboCount == self->limboSize) {
+    self->limboSize = (self->limboSize == 0) ? HOWDEREK_CSKIP_RETIRE_BATCH : self->limboSize * 2;
+    self->limbo = realloc(self->limbo, sizeof(struct __howderek_cskip_retired) * self->limboSize);
+    if (self->limbo == NULL) {
+      howderek_log(HOWDEREK_LOG_FATAL, "error in %s (realloc failed)", __func__);
+      exit(ENOMEM);
+    }
+  }
+  self->limbo[self->limboCount].ptr = ptr;
+  self->limbo[self->limboCount].epoch = HOWDEREK_CSKIP_LOAD(&__howderek_cskip_global_epoch);
+  self->limboCount++;
+  if (++self->sinceAdvance >= HOWDEREK_CSKIP_RETIRE_BATCH) {
+    self->sinceAdvance = 0;
+    __howderek_cskip_try_advance();
+  }
+}
+
+
+
+void howderek_cskip_thread_detach(void) {
+  struct __howderek_cskip_thread* self = __howderek_cskip_self;
+  if (self == NULL) {
+    return;
+  }
+  __howderek_cskip_try_advance();
+  __howderek_cskip_scan(self, HOWDEREK_CSKIP_LOAD(&__howderek_cskip_global_epoch));
+  __howderek_cskip_self = NULL;
+  HOWDEREK_CSKIP_STORE(&self->inUse, 0);
+}
+
+
+
+int __howderek_cskip_random_level(struct __howderek_cskip_thread* self) {
+  // xorshift64, then the same 1 in 4 coin flips as howderek_skip_push
+  uint64_t x = self->rng;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  self->rng = x;
+  int level = 0;
+  while ((x & 3) == 0 && level < HOWDEREK_SKIP_MAX_LEVEL) {
+    level++;
+    x >>= 2;
+  }
+  return level;
+}
+
+
+
+struct howderek_cskip_node* __howderek_cskip_create_node(howderek_skip_value_t id, void* data, int level) {
+  struct howderek_cskip_node* node = calloc(1, sizeof(struct howderek_cskip_node)
+                                               + sizeof(uintptr_t) * (level + 1));
+  if (node == NULL) {
+    fprintf(stderr, "fatal error in %s:%d - out of memory\n", __FILE__, __LINE__);
+    exit(ENOMEM);
+  }
+  node->id = id;
+  node->data = data;
+  node->level = level;
+  node->refs = 2;
+  return node;
+}
+
+
+
+struct howderek_cskip* howderek_cskip_create(void) {
+  struct howderek_cskip* list = malloc(sizeof(struct howderek_cskip));
+  if (list == NULL) {
+    fprintf(stderr, "fatal error in %s:%d - out of memory\n", __FILE__, __LINE__);
+    exit(ENOMEM);
+  }
+  list->head = __howderek_cskip_create_node(0, NULL, HOWDEREK_SKIP_MAX_LEVEL);
+  list->count = 0;
+  list->level = 0;
+  return list;
+}
+
+
+
+void howderek_cskip_destroy(struct howderek_cskip* list, int freeData) {
+  struct howderek_cskip_node* iter = HOWDEREK_CSKIP_POINTER(list->head->next[0]);
+  struct howderek_cskip_node* old;
+  while (iter != NULL) {
+    old = iter;
+    iter = HOWDEREK_CSKIP_POINTER(iter->next[0]);
+    if (freeData == 1) {
+      free(old->data);
+    }
+    free(old);
+  }
+  free(list->head);
+  free(list);
+}
+
+
+
+/*
+ * Find the nodes on either side of id on every level, unlinking any marked
+ * nodes on the way. Returns 1 if an unmarked node with that id was found
+ * (it will be succs[0]).
+ *
+ *   pred --> curr(marked) --> succ      becomes      pred --> succ
+ *
+ * If the unlink fails, something changed under us and the search restarts.
+ */
+int __howderek_cskip_find(struct howderek_cskip* list,
+                          howderek_skip_value_t id,
+                          struct howderek_cskip_node** preds,
+                          struct howderek_cskip_node** succs) {
+  struct howderek_cskip_node* pred;
+  struct howderek_cskip_node* curr;
+  uintptr_t succLink;
+  int currentLevel;
+
+retry:
+  pred = list->head;
+  for (currentLevel = HOWDEREK_CSKIP_LOAD(&list->level); currentLevel >= 0; currentLevel--) {
+    curr = HOWDEREK_CSKIP_POINTER(HOWDEREK_CSKIP_LOAD(&pred->next[currentLevel]));
+    while (curr != NULL) {
+      succLink = HOWDEREK_CSKIP_LOAD(&curr->next[currentLevel]);
+      while (HOWDEREK_CSKIP_IS_MARKED(succLink)) {
+        uintptr_t expected = (uintptr_t) curr;
+        if (!HOWDEREK_CSKIP_CAS(&pred->next[currentLevel], &expected,
+                                (uintptr_t) HOWDEREK_CSKIP_POINTER(succLink))) {
+          goto retry;
+        }
+        curr = HOWDEREK_CSKIP_POINTER(succLink);
+        if (curr == NULL) {
+          break;
+        }
+        succLink = HOWDEREK_CSKIP_LOAD(&curr->next[currentLevel]);
+      }
+      if (curr == NULL || curr->id >= id) {
+        break;
+      }
+      pred = curr;
+      curr = HOWDEREK_CSKIP_POINTER(succLink);
+    }
+    preds[currentLevel] = pred;
+    succs[currentLevel] = curr;
+  }
+  return succs[0] != NULL && succs[0]->id == id;
+}
+
+
+
+void __howderek_cskip_release(struct __howderek_cskip_thread* self, struct howderek_cskip_node* node) {
+  if (__atomic_sub_fetch(&node->refs, 1, __ATOMIC_SEQ_CST) == 0) {
+    __howderek_cskip_retire(self, node);
+  }
+}
+
+
+
+void howderek_cskip_push(struct howderek_cskip* list, howderek_skip_value_t id, void* data) {
+  struct howderek_cskip_node* preds[HOWDEREK_SKIP_MAX_LEVEL + 1];
+  struct howderek_cskip_node* succs[HOWDEREK_SKIP_MAX_LEVEL + 1];
+  struct __howderek_cskip_thread* self = __howderek_cskip_enter();
+  int newLevel = __howderek_cskip_random_level(self);
+  int i;
+
+  // Make sure searches start high enough to see the new node
+  int level = HOWDEREK_CSKIP_LOAD(&list->level);
+  while (level < newLevel && !HOWDEREK_CSKIP_CAS(&list->level, &level, newLevel));
+
+  for (;;) {
+    if (__howderek_cskip_find(list, id, preds, succs)) {
+      // Already exists, replace the data
+      (void) __atomic_exchange_n(&succs[0]->data, data, __ATOMIC_SEQ_CST);
+      __howderek_cskip_exit(self);
+      return;
+    }
+
+    struct howderek_cskip_node* node = __howderek_cskip_create_node(id, data, newLevel);
+    for (i = 0; i <= newLevel; i++) {
+      node->next[i] = (uintptr_t) succs[i];
+    }
+
+    // The node exists once it is on level 0
+    uintptr_t expected = (uintptr_t) succs[0];
+    if (!HOWDEREK_CSKIP_CAS(&preds[0]->next[0], &expected, (uintptr_t) node)) {
+      free(node); // Nobody else could have seen it
+      continue;
+    }
+    __atomic_add_fetch(&list->count, 1, __ATOMIC_SEQ_CST);
+
+    // Link the upper levels one at a time, stopping if the node gets deleted
+    for (i = 1; i <= newLevel; i++) {
+      for (;;) {
+        uintptr_t link = HOWDEREK_CSKIP_LOAD(&node->next[i]);
+        if (HOWDEREK_CSKIP_IS_MARKED(link)) {
+          goto linked;
+        }
+        if (link != (uintptr_t) succs[i] && !HOWDEREK_CSKIP_CAS(&node->next[i], &link, (uintptr_t) succs[i])) {
+          goto linked; // Only fails if the link was just marked
+        }
+        expected = (uintptr_t) succs[i];
+        if (HOWDEREK_CSKIP_CAS(&preds[i]->next[i], &expected, (uintptr_t) node)) {
+          break;
+        }
+        if (!__howderek_cskip_find(list, id, preds, succs) || succs[0] != node) {
+          goto linked;
+        }
+      }
+    }
+
+  linked:
+    // If it was deleted while we were linking, the delete may have missed the
+    // levels linked after it, so unlink them here
+    if (HOWDEREK_CSKIP_IS_MARKED(HOWDEREK_CSKIP_LOAD(&node->next[0]))) {
+      __howderek_cskip_find(list, id, preds, succs);
+    }
+    __howderek_cskip_release(self, node);
+    __howderek_cskip_exit(self);
+    return;
+  }
+}
+
+
+
+void* howderek_cskip_search(struct howderek_cskip* list, howderek_skip_value_t id) {
+  struct __howderek_cskip_thread* self = __howderek_cskip_enter();
+  struct howderek_cskip_node* pred = list->head;
+  struct howderek_cskip_node* curr = NULL;
+  void* data = NULL;
+  int currentLevel;
+
+  // Marked nodes are stepped over, not unlinked, so searches never write
+  for (currentLevel = HOWDEREK_CSKIP_LOAD(&list->level); currentLevel >= 0; currentLevel--) {
+    curr = HOWDEREK_CSKIP_POINTER(HOWDEREK_CSKIP_LOAD(&pred->next[currentLevel]));
+    while (curr != NULL && curr->id < id) {
+      pred = curr;
+      curr = HOWDEREK_CSKIP_POINTER(HOWDEREK_CSKIP_LOAD(&curr->next[currentLevel]));
+    }
+  }
+
+  if (curr != NULL && curr->id == id && !HOWDEREK_CSKIP_IS_MARKED(HOWDEREK_CSKIP_LOAD(&curr->next[0]))) {
+    data = HOWDEREK_CSKIP_LOAD(&curr->data);
+  }
+  __howderek_cskip_exit(self);
+  return data;
+}
+
+
+
+int howderek_cskip_delete(struct howderek_cskip* list, howderek_skip_value_t id, int freeData) {
+  struct howderek_cskip_node* preds[HOWDEREK_SKIP_MAX_LEVEL + 1];
+  struct howderek_cskip_node* succs[HOWDEREK_SKIP_MAX_LEVEL + 1];
+  struct __howderek_cskip_thread* self = __howderek_cskip_enter();
+  int i;
+
+  if (!__howderek_cskip_find(list, id, preds, succs)) {
+    __howderek_cskip_exit(self);
+    return 0;
+  }
+  struct howderek_cskip_node* victim = succs[0];
+
+  // Mark from the top down so the node disappears from the express lanes first
+  for (i = victim->level; i >= 1; i--) {
+    uintptr_t link = HOWDEREK_CSKIP_LOAD(&victim->next[i]);
+    while (!HOWDEREK_CSKIP_IS_MARKED(link)) {
+      HOWDEREK_CSKIP_CAS(&victim->next[i], &link, link | HOWDEREK_CSKIP_MARK);
+    }
+  }
+
+  // Whoever marks level 0 owns the delete
+  uintptr_t link = HOWDEREK_CSKIP_LOAD(&victim->next[0]);
+  for (;;) {
+    if (HOWDEREK_CSKIP_IS_MARKED(link)) {
+      __howderek_cskip_exit(self);
+      return 0;
+    }
+    if (HOWDEREK_CSKIP_CAS(&victim->next[0], &link, link | HOWDEREK_CSKIP_MARK)) {
+      break;
+    }
+  }
+  __atomic_sub_fetch(&list->count, 1, __ATOMIC_SEQ_CST);
+
+  if (freeData) {
+    void* data = __atomic_exchange_n(&victim->data, NULL, __ATOMIC_SEQ_CST);
+    if (data != NULL) {
+      __howderek_cskip_retire(self, data);
+    }
+  }
+
+  // Physically unlink it from every level
+  __howderek_cskip_find(list, id, preds, succs);
+  __howderek_cskip_release(self, victim);
+  __howderek_cskip_exit(self);
+  return 1;
+}
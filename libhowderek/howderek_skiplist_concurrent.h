@@ -0,0 +1,94 @@
+/*! \file howderek_skiplist_concurrent.h
+    \brief Lock-free skiplist that can be shared between threads. Same idea as
+           howderek_skiplist.h, but links are swapped in with compare-and-swap
+           instead of being written through an update[] array.
+
+           Deleting is done in two steps. First the node's links are marked
+           (the lowest bit of each next pointer is set), which logically
+           removes it. Any thread that walks past a marked node unlinks it.
+           Nodes are only freed once no thread can still be looking at them,
+           which is tracked with epochs: every operation runs inside an
+           epoch, and retired nodes are freed two epochs later.
+
+           Nodes are ordered by id only, and ids are unique.
+
+           [1] Herlihy, Shavit. The Art of Multiprocessor Programming, 14.4
+           [2] Fraser. Practical lock-freedom (UCAM-CL-TR-579)
+*/
+
+#ifndef H_LIBHOWDEREK_SKIPLIST_CONCURRENT_H
+#define H_LIBHOWDEREK_SKIPLIST_CONCURRENT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "howderek_skiplist.h"
+
+#ifndef HOWDEREK_CSKIP_RETIRE_BATCH
+// How many nodes a thread retires before it tries to advance the epoch
+#define HOWDEREK_CSKIP_RETIRE_BATCH 64
+#endif
+
+struct howderek_cskip_node {
+  howderek_skip_value_t id;
+  void* data;       // Data associated with this node, swapped atomically
+  int level;
+  int refs;         // Dropped by the insert and the delete, freed at 0
+  uintptr_t next[]; // All linked nodes, lowest bit set when logically deleted
+};
+
+struct howderek_cskip {
+  struct howderek_cskip_node* head;
+  size_t count;
+  int level;        // Highest level in use, only grows
+};
+
+/**
+ * Create a concurrent skip list
+ */
+struct howderek_cskip* howderek_cskip_create(void);
+
+/**
+ * Destroy a concurrent skip list. No other thread may be using it.
+ *
+ * \param list      list to destroy
+ * \param freeData  1 if the data of each node should be freed
+ */
+void howderek_cskip_destroy(struct howderek_cskip* list, int freeData);
+
+/**
+ * Push a value. If the id already exists its data is replaced (the old data
+ * is not freed, since another thread may have just read it).
+ *
+ * \param list   list to push to
+ * \param id     index
+ * \param data   pointer to data to store
+ */
+void howderek_cskip_push(struct howderek_cskip* list, howderek_skip_value_t id, void* data);
+
+/**
+ * Return the data stored for an id, or NULL if not found. If other threads
+ * delete with freeData, the caller has to keep the data alive itself.
+ *
+ * \param list   list to search
+ * \param id     id to find
+ */
+void* howderek_cskip_search(struct howderek_cskip* list, howderek_skip_value_t id);
+
+/**
+ * Remove a value from the skiplist
+ *
+ * \param list      list to delete from
+ * \param id        id to delete
+ * \param freeData  1 if the data should be freed once no thread can see it
+ * \return          1 if this call removed the value, 0 otherwise
+ */
+int howderek_cskip_delete(struct howderek_cskip* list, howderek_skip_value_t id, int freeData);
+
+/**
+ * Release the calling thread's epoch record so another thread can reuse it.
+ * Call before a thread that used any concurrent skip list exits.
+ */
+void howderek_cskip_thread_detach(void);
+
+#endif
@@ -0,0 +1,321 @@
+/*! \file howderek_trace.c
+ *  \brief Records timed spans and counters and writes them as a Chrome trace
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "howderek.h"
+#include "howderek_trace.h"
+
+// Blocks never move once they're written, so the trace can be written while
+// other threads are still adding to it
+struct __howderek_trace_block {
+  struct howderek_trace_event events[HOWDEREK_TRACE_BLOCK];
+  size_t count;
+  struct __howderek_trace_block* next;
+};
+
+struct __howderek_trace_buffer {
+  uint32_t thread;
+  // Events from before the last howderek_trace_reset are stale, the thread
+  // throws them away the next time it records
+  uint32_t generation;
+  struct __howderek_trace_block* first;
+  struct __howderek_trace_block* last;
+  struct __howderek_trace_buffer* next;
+};
+
+static int __howderek_trace_enabled = 0;
+static int __howderek_trace_at_exit = 0;
+static uint32_t __howderek_trace_generation = 0;
+static uint64_t __howderek_trace_origin = 0;
+static const char* __howderek_trace_path = NULL;
+static uint32_t __howderek_trace_threads = 0;
+// Buffers of threads that are running, and of threads that exited since the
+// trace was last written
+static struct __howderek_trace_buffer* __howderek_trace_buffers = NULL;
+static struct __howderek_trace_buffer* __howderek_trace_retired = NULL;
+// Only taken when a thread records for the first time or exits, and when
+// writing or resetting
+static pthread_mutex_t __howderek_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t __howderek_trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t __howderek_trace_key;
+static __thread struct __howderek_trace_buffer* __howderek_trace_local = NULL;
+
+
+
+struct __howderek_trace_block* __howderek_trace_block_create(void) {
+  struct __howderek_trace_block* block = malloc(sizeof(struct __howderek_trace_block));
+  if (block == NULL) {
+    howderek_log(HOWDEREK_LOG_FATAL, "libhowderek_trace: allocation failed for %lu bytes",
+                 sizeof(struct __howderek_trace_block));
+    exit(ENOMEM);
+  }
+  block->count = 0;
+  block->next = NULL;
+  return block;
+}
+
+
+
+void __howderek_trace_blocks_destroy(struct __howderek_trace_block* block) {
+  struct __howderek_trace_block* next;
+  for (; block != NULL; block = next) {
+    next = block->next;
+    free(block);
+  }
+}
+
+
+
+void __howderek_trace_buffers_destroy(struct __howderek_trace_buffer* buffer) {
+  struct __howderek_trace_buffer* next;
+  for (; buffer != NULL; buffer = next) {
+    next = buffer->next;
+    __howderek_trace_blocks_destroy(buffer->first);
+    free(buffer);
+  }
+}
+
+
+
+// Moves an exiting thread's buffer to the retired list, where
+// howderek_trace_write picks up its last events and frees it
+void __howderek_trace_thread_exit(void* data) {
+  struct __howderek_trace_buffer* buffer = data;
+  struct __howderek_trace_buffer** iter;
+  __howderek_trace_local = NULL;
+  pthread_mutex_lock(&__howderek_trace_lock);
+  for (iter = &__howderek_trace_buffers; *iter != NULL; iter = &(*iter)->next) {
+    if (*iter == buffer) {
+      *iter = buffer->next;
+      break;
+    }
+  }
+  // Events from before a reset aren't worth keeping
+  if (buffer->generation != __howderek_trace_generation) {
+    buffer->next = NULL;
+    __howderek_trace_buffers_destroy(buffer);
+  } else {
+    buffer->next = __howderek_trace_retired;
+    __howderek_trace_retired = buffer;
+  }
+  pthread_mutex_unlock(&__howderek_trace_lock);
+}
+
+
+
+void __howderek_trace_key_create(void) {
+  if (pthread_key_create(&__howderek_trace_key, __howderek_trace_thread_exit) != 0) {
+    howderek_log(HOWDEREK_LOG_FATAL, "libhowderek_trace: could not create a thread key");
+    exit(EAGAIN);
+  }
+}
+
+
+
+struct __howderek_trace_buffer* __howderek_trace_buffer_create(void) {
+  struct __howderek_trace_buffer* buffer = malloc(sizeof(struct __howderek_trace_buffer));
+  if (buffer == NULL) {
+    howderek_log(HOWDEREK_LOG_FATAL, "libhowderek_trace: allocation failed for %lu bytes",
+                 sizeof(struct __howderek_trace_buffer));
+    exit(ENOMEM);
+  }
+  buffer->first = __howderek_trace_block_create();
+  buffer->last = buffer->first;
+  pthread_once(&__howderek_trace_once, __howderek_trace_key_create);
+  pthread_mutex_lock(&__howderek_trace_lock);
+  buffer->thread = ++__howderek_trace_threads;
+  buffer->generation = __howderek_trace_generation;
+  buffer->next = __howderek_trace_buffers;
+  __howderek_trace_buffers = buffer;
+  pthread_mutex_unlock(&__howderek_trace_lock);
+  pthread_setspecific(__howderek_trace_key, buffer);
+  return buffer;
+}
+
+
+
+void __howderek_trace_record(const char* name, char phase, int64_t value) {
+  struct __howderek_trace_buffer* buffer = __howderek_trace_local;
+  struct __howderek_trace_block* block;
+  struct howderek_trace_event* event;
+  uint32_t generation;
+
+  if (!__atomic_load_n(&__howderek_trace_enabled, __ATOMIC_RELAXED)) {
+    return;
+  }
+  if (buffer == NULL) {
+    buffer = __howderek_trace_local = __howderek_trace_buffer_create();
+  } else if (buffer->generation != (generation = __atomic_load_n(&__howderek_trace_generation, __ATOMIC_ACQUIRE))) {
+    // howderek_trace_write skips stale buffers, so nobody is reading these
+    __howderek_trace_blocks_destroy(buffer->first->next);
+    buffer->first->next = NULL;
+    buffer->first->count = 0;
+    buffer->last = buffer->first;
+    __atomic_store_n(&buffer->generation, generation, __ATOMIC_RELEASE);
+  }
+  block = buffer->last;
+  if (block->count == HOWDEREK_TRACE_BLOCK) {
+    block = __howderek_trace_block_create();
+    __atomic_store_n(&buffer->last->next, block, __ATOMIC_RELEASE);
+    buffer->last = block;
+  }
+  event = &block->events[block->count];
+  event->name = name;
+  event->phase = phase;
+  event->value = value;
+  event->time = howderek_trace_now() - __howderek_trace_origin;
+  __atomic_store_n(&block->count, block->count + 1, __ATOMIC_RELEASE);
+}
+
+
+
+uint64_t howderek_trace_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+
+void __howderek_trace_write_at_exit(void) {
+  FILE* output = fopen(__howderek_trace_path, "w");
+  if (output == NULL) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_trace: could not open %s", __howderek_trace_path);
+    return;
+  }
+  howderek_trace_write(output);
+  if (fclose(output) != 0) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_trace: could not close %s", __howderek_trace_path);
+  }
+}
+
+
+
+void howderek_trace_start(const char* path) {
+  if (__atomic_load_n(&__howderek_trace_enabled, __ATOMIC_RELAXED)) {
+    return;
+  }
+  __howderek_trace_origin = howderek_trace_now();
+  if (path != NULL) {
+    __howderek_trace_path = path;
+    if (!__howderek_trace_at_exit) {
+      __howderek_trace_at_exit = 1;
+      atexit(__howderek_trace_write_at_exit);
+    }
+  }
+  __atomic_store_n(&__howderek_trace_enabled, 1, __ATOMIC_RELEASE);
+}
+
+
+
+void howderek_trace_stop(void) {
+  __atomic_store_n(&__howderek_trace_enabled, 0, __ATOMIC_RELEASE);
+}
+
+
+
+void howderek_trace_reset(void) {
+  struct __howderek_trace_buffer* retired;
+  pthread_mutex_lock(&__howderek_trace_lock);
+  retired = __howderek_trace_retired;
+  __howderek_trace_retired = NULL;
+  // Running threads own their blocks, so they empty their own buffers the
+  // next time they record
+  __atomic_store_n(&__howderek_trace_generation, __howderek_trace_generation + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&__howderek_trace_lock);
+  __howderek_trace_buffers_destroy(retired);
+}
+
+
+
+const char* howderek_trace_begin(const char* name) {
+  __howderek_trace_record(name, 'B', 0);
+  return name;
+}
+
+
+
+void howderek_trace_end(const char* name) {
+  __howderek_trace_record(name, 'E', 0);
+}
+
+
+
+void __howderek_trace_scope_end(const char** name) {
+  __howderek_trace_record(*name, 'E', 0);
+}
+
+
+
+void howderek_trace_counter(const char* name, int64_t value) {
+  __howderek_trace_record(name, 'C', value);
+}
+
+
+
+void __howderek_trace_write_string(FILE* output, const char* string) {
+  fputc('"', output);
+  for (; *string != '\0'; string++) {
+    if (*string == '"' || *string == '\\') {
+      fputc('\\', output);
+    }
+    fputc(*string, output);
+  }
+  fputc('"', output);
+}
+
+
+
+void __howderek_trace_write_buffers(FILE* output, struct __howderek_trace_buffer* buffer, const char** separator) {
+  struct __howderek_trace_block* block;
+  size_t count, i;
+  for (; buffer != NULL; buffer = buffer->next) {
+    if (__atomic_load_n(&buffer->generation, __ATOMIC_ACQUIRE) != __howderek_trace_generation) {
+      continue;
+    }
+    for (block = buffer->first; block != NULL; block = __atomic_load_n(&block->next, __ATOMIC_ACQUIRE)) {
+      count = __atomic_load_n(&block->count, __ATOMIC_ACQUIRE);
+      for (i = 0; i < count; i++) {
+        const struct howderek_trace_event* event = &block->events[i];
+        // Timestamps are in microseconds
+        fprintf(output, "%s{\"name\":", *separator);
+        __howderek_trace_write_string(output, event->name);
+        fprintf(output, ",\"ph\":\"%c\",\"ts\":%lu.%03lu,\"pid\":1,\"tid\":%u",
+                event->phase, event->time / 1000, event->time % 1000, buffer->thread);
+        if (event->phase == 'C') {
+          fprintf(output, ",\"args\":{\"value\":%ld}", event->value);
+        }
+        fputc('}', output);
+        *separator = ",\n";
+      }
+    }
+  }
+}
+
+
+
+int howderek_trace_write(FILE* output) {
+  struct __howderek_trace_buffer* retired;
+  const char* separator = "\n";
+
+  fprintf(output, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  pthread_mutex_lock(&__howderek_trace_lock);
+  __howderek_trace_write_buffers(output, __howderek_trace_buffers, &separator);
+  __howderek_trace_write_buffers(output, __howderek_trace_retired, &separator);
+  retired = __howderek_trace_retired;
+  __howderek_trace_retired = NULL;
+  pthread_mutex_unlock(&__howderek_trace_lock);
+  __howderek_trace_buffers_destroy(retired);
+  fprintf(output, "\n]}\n");
+  if (ferror(output)) {
+    howderek_log(HOWDEREK_LOG_ERROR, "libhowderek_trace: failed to write trace");
+    return EIO;
+  }
+  return 0;
+}
@@ -0,0 +1,117 @@
+/*! \file howderek_trace.h
+ *  \brief Records timed spans and counters and writes them as a Chrome trace
+ *
+ *  Every thread records into its own buffer, so tracing never takes a lock
+ *  after a thread's first event. Times come from the monotonic clock in
+ *  nanoseconds. Open the output in chrome://tracing or ui.perfetto.dev.
+ *
+ *  void search(void) {
+ *    HOWDEREK_TRACE_SCOPE("search");      // ends when search returns
+ *    ...
+ *    howderek_trace_counter("frontier", size);
+ *  }
+ *
+ *  Nothing is recorded until howderek_trace_start is called, until then each
+ *  call only checks a flag. howderek_trace_stop and howderek_trace_reset end
+ *  and clear a recording, so a program can trace several phases separately.
+*/
+
+#ifndef H_LIBHOWDEREK_TRACE_H
+#define H_LIBHOWDEREK_TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "howderek.h"
+
+#ifndef HOWDEREK_TRACE_CONFIG
+// Events each thread makes room for at a time
+#define HOWDEREK_TRACE_BLOCK 4096
+#endif
+
+#define __HOWDEREK_TRACE_CONCAT(a, b) a##b
+#define __HOWDEREK_TRACE_NAME(line) __HOWDEREK_TRACE_CONCAT(__howderek_trace_scope_, line)
+
+/**
+ * Begin a span that ends when the enclosing block is left, returns included
+ *
+ * \param name  string literal naming the span
+ */
+#define HOWDEREK_TRACE_SCOPE(name)                                                     \
+  const char* __HOWDEREK_TRACE_NAME(__LINE__) __attribute__((cleanup(__howderek_trace_scope_end))) \
+    = howderek_trace_begin(name)
+
+struct howderek_trace_event {
+  const char* name;
+  uint64_t time;                     // nanoseconds since howderek_trace_start
+  int64_t value;                     // counters only
+  char phase;                        // 'B'egin, 'E'nd or 'C'ounter, as in the trace format
+};
+
+/**
+ * Nanoseconds on the monotonic clock
+ */
+uint64_t howderek_trace_now(void);
+
+/**
+ * Start recording
+ *
+ * \param path  where to write the trace when the program exits, NULL to only
+ *              write it with howderek_trace_write
+ */
+void howderek_trace_start(const char* path);
+
+/**
+ * Stop recording. Calls already in progress on other threads may still
+ * add their event.
+ */
+void howderek_trace_stop(void);
+
+/**
+ * Throw away everything recorded so far. Threads that are still running
+ * empty their own buffers the next time they record, so this never waits
+ * on them.
+ */
+void howderek_trace_reset(void);
+
+/**
+ * Begin a span on this thread. Spans have to end in the reverse order they
+ * began.
+ *
+ * \param name  string literal naming the span, it isn't copied
+ * \return      name
+ */
+const char* howderek_trace_begin(const char* name);
+
+/**
+ * End the most recent span on this thread
+ *
+ * \param name  name it began with
+ */
+void howderek_trace_end(const char* name);
+
+/**
+ * Record the value of a counter
+ *
+ * \param name   string literal naming the counter, it isn't copied
+ * \param value  value right now
+ */
+void howderek_trace_counter(const char* name, int64_t value);
+
+/**
+ * Write everything recorded so far as Chrome trace-event JSON. Threads that
+ * are still recording may be missing their latest events. Buffers of
+ * threads that have exited are freed once they're written, so later calls
+ * leave them out.
+ *
+ * \param output  file to write to
+ * \return        0 on success, an errno otherwise
+ */
+int howderek_trace_write(FILE* output);
+
+/**
+ * Ends a HOWDEREK_TRACE_SCOPE, don't call it directly
+ */
+void __howderek_trace_scope_end(const char** name);
+
+#endif
@@ -1,5 +1,5 @@
 /*! \file main.c
-    \brief Skiplist implemenetation by Derek Howard
+    \brief Runs the robots in the map given on the command line to their goals
 */
 #include <stdio.h>
 #include <limits.h>
@@ -7,6 +7,7 @@
 #include <math.h>
 
 #include "libhowderek/howderek.h"
+#include "libhowderek/howderek_trace.h"
 #include "world.h"
 #include "robot.h"
 #include "ui.h"
@@ -21,41 +22,31 @@
 */
 
 
-//int main(int argc, char** argv) {
-//  struct howderek_configuration_t config = howderek_parse_command_line_options(argc, argv);
-//  howderek_log(HOWDEREK_LOG_INFO, "Loading...");
-//  struct world* w = load_world(config.in);
-//  return 0;
-//}
-
-int main(void)
+int main(int argc, char** argv)
 {
-    howderek_set_log_level(HOWDEREK_LOG_DEBUG);
-    struct world* test = world_let_there_be_light(10);
-    int i;
-    for (i = 1; i < 11; i++) {
-      position_t tmp;
-      tmp.coordinates.x = i;
-      tmp.coordinates.y = i;
-      world_add(test, tmp);
+    howderek_set_log_level(HOWDEREK_LOG_INFO);
+    if (argc != 2) {
+      howderek_log(HOWDEREK_LOG_FATAL, "usage: %s map.txt", argv[0]);
+      return 1;
     }
-    howderek_graph_display(test->graph);
-    position_t start;
-    position_t end;
-    start.coordinates.x = 1;
-    start.coordinates.y = 1;
-    end.coordinates.x = 10;
-    end.coordinates.y = 10;
-    struct pathfinding_data* list;
-    struct howderek_graph_vertex* startV = world_at_position(test, start);
-    struct howderek_graph_vertex* endV = world_at_position(test, end);
-    list = astar(test->graph, startV, endV);
-    while (list != NULL) {
-      position_t pos;
-      pos.bits = list->v->id;
-      printf("x: %u, y: %u\n", pos.coordinates.x, pos.coordinates.y);
-      list = list->next;
+    // HOWDEREK_TRACE=trace.json writes a Chrome trace of the run
+    if (getenv("HOWDEREK_TRACE") != NULL) {
+      howderek_trace_start(getenv("HOWDEREK_TRACE"));
     }
-
-    return 0;
+    FILE* file = fopen(argv[1], "r");
+    if (file == NULL) {
+      howderek_log(HOWDEREK_LOG_FATAL, "couldn't open %s", argv[1]);
+      return 1;
+    }
+    howderek_log(HOWDEREK_LOG_INFO, "Loading...");
+    struct world* w = load_world(file);
+    fclose(file);
+    if (w == NULL) {
+      return 1;
+    }
+    int solved = world_simulate(w, renderer);
+    howderek_log(HOWDEREK_LOG_INFO, solved ? "Both robots reached their goals"
+                                           : "The robots can't reach their goals");
+    world_destroy(w);
+    return solved ? 0 : 1;
 }
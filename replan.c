@@ -0,0 +1,297 @@
+/*! \file replan.c
+ *  \brief Incremental path planning with D* Lite
+ */
+
+#include <math.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libhowderek/howderek.h"
+#include "libhowderek/howderek_memory.h"
+#include "libhowderek/howderek_graph.h"
+#include "libhowderek/howderek_heap.h"
+#include "libhowderek/howderek_trace.h"
+#include "world.h"
+#include "replan.h"
+
+#define REPLAN_ENTRY_BLOCK 256
+
+
+int8_t __replan_compare(howderek_array_value_t left, howderek_array_value_t right) {
+  const struct replan_entry* l = left;
+  const struct replan_entry* r = right;
+  if (l->key[0] != r->key[0]) {
+    return (l->key[0] > r->key[0]) - (l->key[0] < r->key[0]);
+  }
+  return (l->key[1] > r->key[1]) - (l->key[1] < r->key[1]);
+}
+
+int __replan_less(const double* left, const double* right) {
+  return left[0] < right[0] || (left[0] == right[0] && left[1] < right[1]);
+}
+
+/**
+ * Moves between two positions if nothing is in the way, which never
+ * overestimates on the 8-connected world
+ */
+double __replan_heuristic(position_t from, position_t to) {
+  const int64_t dx = llabs((int64_t) from.coordinates.x - (int64_t) to.coordinates.x);
+  const int64_t dy = llabs((int64_t) from.coordinates.y - (int64_t) to.coordinates.y);
+  return (dx > dy) ? dx : dy;
+}
+
+position_t __replan_position(struct replan* planner, uint32_t v) {
+  position_t pos;
+  pos.bits = planner->world->graph->vertices[v]->id;
+  return pos;
+}
+
+int __replan_is_open(struct replan* planner, uint32_t v) {
+  const position_t pos = __replan_position(planner, v);
+  return howderek_grid_get(planner->world->grid, pos.coordinates.x, pos.coordinates.y) == WORLD_CELL_OPEN;
+}
+
+/**
+ * Cost of an edge, INFINITY if either end is blocked
+ */
+double __replan_cost(struct replan* planner, uint32_t u, struct howderek_graph_edge* edge) {
+  if (!__replan_is_open(planner, u) || !__replan_is_open(planner, edge->vertex->index)) {
+    return INFINITY;
+  }
+  return edge->weight;
+}
+
+void __replan_calculate_key(struct replan* planner, uint32_t v, position_t start, double* key) {
+  const double m = fmin(planner->g[v], planner->rhs[v]);
+  key[0] = m + __replan_heuristic(start, __replan_position(planner, v)) + planner->km;
+  key[1] = m;
+}
+
+void __replan_push(struct replan* planner, uint32_t v, position_t start) {
+  struct replan_entry* entry;
+  size_t i;
+  if (planner->freeEntries == NULL) {
+    // Entries come from the planner's region, so they are freed with it
+    entry = howderek_allocate("replan_entry", planner, sizeof(struct replan_entry) * REPLAN_ENTRY_BLOCK);
+    for (i = 0; i < REPLAN_ENTRY_BLOCK; i++) {
+      entry[i].next = planner->freeEntries;
+      planner->freeEntries = &entry[i];
+    }
+  }
+  entry = planner->freeEntries;
+  planner->freeEntries = entry->next;
+  __replan_calculate_key(planner, v, start, entry->key);
+  entry->vertex = v;
+  planner->key[2 * v] = entry->key[0];
+  planner->key[2 * v + 1] = entry->key[1];
+  planner->queued[v] = 1;
+  howderek_heap_push(planner->heap, entry);
+}
+
+void __replan_release(struct replan* planner, struct replan_entry* entry) {
+  entry->next = planner->freeEntries;
+  planner->freeEntries = entry;
+}
+
+/**
+ * The queued entry with the smallest key. A vertex's key changes by
+ * queueing it again, so entries that no longer match are dropped here
+ * instead of being removed from the middle of the heap.
+ */
+struct replan_entry* __replan_top(struct replan* planner) {
+  struct replan_entry* entry;
+  while ((entry = howderek_heap_peek(planner->heap)) != NULL) {
+    const uint32_t v = entry->vertex;
+    if (planner->queued[v]
+        && planner->key[2 * v] == entry->key[0]
+        && planner->key[2 * v + 1] == entry->key[1]) {
+      return entry;
+    }
+    howderek_heap_pop(planner->heap);
+    __replan_release(planner, entry);
+  }
+  return NULL;
+}
+
+void __replan_update_vertex(struct replan* planner, uint32_t u, position_t start) {
+  struct howderek_graph_edge* edge;
+  if (u != planner->goalIndex) {
+    planner->rhs[u] = INFINITY;
+    for (edge = planner->world->graph->vertices[u]->edges; edge != NULL; edge = edge->next) {
+      planner->rhs[u] = fmin(planner->rhs[u], __replan_cost(planner, u, edge) + planner->g[edge->vertex->index]);
+    }
+  }
+  planner->queued[u] = 0;
+  if (planner->g[u] != planner->rhs[u]) {
+    __replan_push(planner, u, start);
+  }
+}
+
+void __replan_update_neighbours(struct replan* planner, uint32_t u, position_t start) {
+  struct howderek_graph_edge* edge;
+  for (edge = planner->world->graph->vertices[u]->edges; edge != NULL; edge = edge->next) {
+    __replan_update_vertex(planner, edge->vertex->index, start);
+  }
+}
+
+void __replan_compute(struct replan* planner, uint32_t s, position_t start) {
+  struct replan_entry* top;
+  double startKey[2];
+  double oldKey[2];
+  double newKey[2];
+  uint32_t u;
+  while ((top = __replan_top(planner)) != NULL) {
+    __replan_calculate_key(planner, s, start, startKey);
+    if (!__replan_less(top->key, startKey) && planner->rhs[s] == planner->g[s]) {
+      break;
+    }
+    u = top->vertex;
+    oldKey[0] = top->key[0];
+    oldKey[1] = top->key[1];
+    howderek_heap_pop(planner->heap);
+    __replan_release(planner, top);
+    planner->queued[u] = 0;
+    __replan_calculate_key(planner, u, start, newKey);
+    if (__replan_less(oldKey, newKey)) {
+      __replan_push(planner, u, start);
+    } else if (planner->g[u] > planner->rhs[u]) {
+      planner->g[u] = planner->rhs[u];
+      __replan_update_neighbours(planner, u, start);
+    } else {
+      planner->g[u] = INFINITY;
+      __replan_update_vertex(planner, u, start);
+      __replan_update_neighbours(planner, u, start);
+    }
+  }
+}
+
+/**
+ * Make room for vertices the world added since the last call
+ */
+void __replan_reserve(struct replan* planner) {
+  const uint32_t count = planner->world->graph->vertex_map->count;
+  uint32_t capacity = (planner->capacity == 0) ? 64 : planner->capacity;
+  uint32_t v;
+  if (count <= planner->capacity) {
+    return;
+  }
+  while (capacity < count) {
+    capacity *= 2;
+  }
+  planner->g = realloc(planner->g, sizeof(double) * capacity);
+  planner->rhs = realloc(planner->rhs, sizeof(double) * capacity);
+  planner->key = realloc(planner->key, sizeof(double) * 2 * capacity);
+  planner->queued = realloc(planner->queued, sizeof(uint8_t) * capacity);
+  if (planner->g == NULL || planner->rhs == NULL || planner->key == NULL || planner->queued == NULL) {
+    howderek_log(HOWDEREK_LOG_FATAL, "replan: out of memory for %u vertices", capacity);
+    exit(ENOMEM);
+  }
+  for (v = planner->capacity; v < capacity; v++) {
+    planner->g[v] = INFINITY;
+    planner->rhs[v] = INFINITY;
+    planner->queued[v] = 0;
+  }
+  planner->capacity = capacity;
+}
+
+/**
+ * Throw away the search and start over from the goal
+ */
+void __replan_restart(struct replan* planner, uint32_t goal, position_t start) {
+  struct replan_entry* entry;
+  uint32_t v;
+  while ((entry = howderek_heap_pop(planner->heap)) != NULL) {
+    __replan_release(planner, entry);
+  }
+  for (v = 0; v < planner->capacity; v++) {
+    planner->g[v] = INFINITY;
+    planner->rhs[v] = INFINITY;
+    planner->queued[v] = 0;
+  }
+  planner->km = 0;
+  planner->last = start;
+  planner->version = planner->world->version;
+  planner->goalIndex = goal;
+  planner->rhs[goal] = 0;
+  __replan_push(planner, goal, start);
+}
+
+struct replan* replan_create(struct world* w, position_t goal) {
+  struct replan* planner = howderek_allocate_and_zero("replan", NULL, sizeof(struct replan));
+  planner->world = w;
+  planner->goal = goal;
+  planner->goalIndex = HOWDEREK_GRAPH_NO_VERTEX;
+  planner->heap = howderek_heap_create(HOWDEREK_HEAP_DEFAULT_D, __replan_compare);
+  return planner;
+}
+
+size_t replan_path(struct replan* planner, position_t start, position_t* path, size_t maxLength) {
+  HOWDEREK_TRACE_SCOPE("replan_path");
+  struct world* w = planner->world;
+  struct howderek_graph_vertex* startVertex = howderek_graph_get(w->graph, start.bits);
+  struct howderek_graph_vertex* goalVertex = howderek_graph_get(w->graph, planner->goal.bits);
+  struct howderek_graph_edge* edge;
+  size_t length = 0;
+  uint64_t version;
+  uint32_t best;
+  uint32_t v;
+  double bestCost;
+
+  if (startVertex == NULL || goalVertex == NULL) {
+    return 0;
+  }
+  __replan_reserve(planner);
+  if (planner->goalIndex == HOWDEREK_GRAPH_NO_VERTEX || w->version - planner->version > WORLD_CHANGE_LOG) {
+    __replan_restart(planner, goalVertex->index, start);
+  } else {
+    // Keys already queued were computed from where the robot was
+    planner->km += __replan_heuristic(planner->last, start);
+    planner->last = start;
+    for (version = planner->version + 1; version <= w->version; version++) {
+      // Opening or blocking a space changes the cost of every edge around it
+      v = howderek_graph_get(w->graph, w->changes[version % WORLD_CHANGE_LOG].bits)->index;
+      __replan_update_vertex(planner, v, start);
+      __replan_update_neighbours(planner, v, start);
+    }
+    planner->version = w->version;
+  }
+  __replan_compute(planner, startVertex->index, start);
+
+  v = startVertex->index;
+  if (planner->g[v] == INFINITY || !__replan_is_open(planner, v)) {
+    return 0;
+  }
+  // Follow the distances down to the goal
+  while (1) {
+    if (path != NULL && length < maxLength) {
+      path[length] = __replan_position(planner, v);
+    }
+    length++;
+    if (v == planner->goalIndex || length > planner->capacity) {
+      break;
+    }
+    best = HOWDEREK_GRAPH_NO_VERTEX;
+    bestCost = INFINITY;
+    for (edge = w->graph->vertices[v]->edges; edge != NULL; edge = edge->next) {
+      const double cost = __replan_cost(planner, v, edge) + planner->g[edge->vertex->index];
+      if (cost < bestCost) {
+        bestCost = cost;
+        best = edge->vertex->index;
+      }
+    }
+    if (best == HOWDEREK_GRAPH_NO_VERTEX) {
+      return 0;
+    }
+    v = best;
+  }
+  return length;
+}
+
+void replan_destroy(struct replan* planner) {
+  free(planner->g);
+  free(planner->rhs);
+  free(planner->key);
+  free(planner->queued);
+  howderek_heap_destroy(planner->heap, 0);
+  howderek_free(planner);
+}
@@ -0,0 +1,76 @@
+/*! \file replan.h
+ *  \brief Incremental path planning with D* Lite. A planner keeps its search
+ *         between calls, and when spaces are opened or blocked with
+ *         world_add and world_remove it only repairs the part of the search
+ *         those changes affect instead of planning again from scratch.
+ *
+ *  The search runs backwards from the goal, so the robot can move along
+ *  its path and ask for a new one from wherever it is.
+ *
+ *  struct replan* planner = replan_create(w, goal);
+ *  length = replan_path(planner, start, path, maxLength);
+ *  world_remove(w, door);
+ *  length = replan_path(planner, start, path, maxLength);  // repairs
+ *  replan_destroy(planner);
+ */
+
+#pragma once
+
+#include "libhowderek/howderek_graph.h"
+#include "libhowderek/howderek_heap.h"
+#include "world.h"
+
+struct replan_entry {
+  double key[2];                     // key the vertex had when it was queued
+  uint32_t vertex;
+  struct replan_entry* next;         // free list
+};
+
+struct replan {
+  struct world* world;
+  position_t goal;
+  position_t last;                   // start when km was last brought up to date
+  uint64_t version;                  // world->version the search has caught up to
+  uint32_t goalIndex;                // HOWDEREK_GRAPH_NO_VERTEX until the search starts
+  uint32_t capacity;                 // vertices the arrays below have room for
+  double km;                         // how far the start has moved, keeps old keys valid
+  double* g;                         // distance to the goal as of the last expansion
+  double* rhs;                       // one step lookahead of g
+  double* key;                       // two per vertex, the key it's queued with
+  uint8_t* queued;                   // 1 if the vertex's current key is in the heap
+  struct howderek_heap* heap;        // stale entries are skipped when popped
+  struct replan_entry* freeEntries;
+};
+
+/**
+ * Create a planner for paths to goal. Nothing is searched until the first
+ * call to replan_path.
+ *
+ * \param w           the world, which must outlive the planner
+ * \param goal        where the robot is going
+ *
+ * \return            the planner
+ */
+struct replan* replan_create(struct world* w, position_t goal);
+
+/**
+ * Find a shortest path from start to the goal. The first call searches,
+ * later calls repair the search for the spaces that changed since. If more
+ * than WORLD_CHANGE_LOG changed, it searches from scratch.
+ *
+ * \param planner     the planner
+ * \param start       where the robot is now
+ * \param path        where to write the positions, start first, may be NULL
+ * \param maxLength   room in path, only the first maxLength are written
+ *
+ * \return            number of positions in the path, 0 if the goal can't
+ *                    be reached
+ */
+size_t replan_path(struct replan* planner, position_t start, position_t* path, size_t maxLength);
+
+/**
+ * Destroy a planner
+ *
+ * \param planner     the planner
+ */
+void replan_destroy(struct replan* planner);
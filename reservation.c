@@ -0,0 +1,209 @@
+/*! \file reservation.c
+ *  \brief Space-time reservation table
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include "libhowderek/howderek.h"
+#include "reservation.h"
+
+// Steps past any real one, for what's known about a space at every step
+#define RESERVATION_PARKED      UINT32_MAX        // robot parked in the space
+#define RESERVATION_PARKED_FROM (UINT32_MAX - 1)  // step it parked at
+#define RESERVATION_LAST        (UINT32_MAX - 2)  // last step the space is reserved at
+
+
+void* __reservation_alloc(size_t count) {
+  void* result = calloc(count, sizeof(struct reservation_slot));
+  if (result == NULL) {
+    howderek_log(HOWDEREK_LOG_FATAL, "reservation: out of memory for %lu slots", count);
+    exit(ENOMEM);
+  }
+  return result;
+}
+
+uint64_t __reservation_hash(uint64_t key) {
+  // splitmix64's finalizer, steps and spaces are small and close together
+  key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+  return key ^ (key >> 31);
+}
+
+struct reservation_slot* __reservation_find(struct reservation* table, uint64_t key) {
+  size_t i;
+  for (i = __reservation_hash(key) & table->mask; table->slots[i].epoch == table->epoch; i = (i + 1) & table->mask) {
+    if (table->slots[i].key == key) {
+      break;
+    }
+  }
+  return &table->slots[i];
+}
+
+/**
+ * \return  the slot for space at step, NULL if nothing's there
+ */
+struct reservation_slot* __reservation_get(struct reservation* table, uint32_t space, uint32_t step) {
+  struct reservation_slot* slot = __reservation_find(table, ((uint64_t) step << 32) | space);
+  return (slot->epoch == table->epoch) ? slot : NULL;
+}
+
+void __reservation_set(struct reservation* table, uint32_t space, uint32_t step, uint32_t value) {
+  const uint64_t key = ((uint64_t) step << 32) | space;
+  struct reservation_slot* slot;
+  struct reservation_slot* old;
+  size_t oldSize;
+  size_t i;
+  // Keep at most half the slots full so probes stay short
+  if ((table->count + 1) * 2 > table->mask + 1) {
+    old = table->slots;
+    oldSize = table->mask + 1;
+    table->slots = __reservation_alloc(oldSize * 2);
+    table->mask = oldSize * 2 - 1;
+    for (i = 0; i < oldSize; i++) {
+      if (old[i].epoch == table->epoch) {
+        *__reservation_find(table, old[i].key) = old[i];
+      }
+    }
+    free(old);
+  }
+  slot = __reservation_find(table, key);
+  if (slot->epoch != table->epoch) {
+    table->count++;
+  }
+  slot->key = key;
+  slot->value = value;
+  slot->epoch = table->epoch;
+}
+
+/**
+ * Empty a slot, moving later slots of the same probe run back into the gap
+ * so lookups never stop early at it
+ */
+void __reservation_delete(struct reservation* table, struct reservation_slot* slot) {
+  size_t hole = slot - table->slots;
+  size_t i;
+  size_t home;
+  for (i = (hole + 1) & table->mask; table->slots[i].epoch == table->epoch; i = (i + 1) & table->mask) {
+    home = __reservation_hash(table->slots[i].key) & table->mask;
+    // Entries whose probe started at or before the hole, going around, can
+    // fill it and still be found
+    if (((i - home) & table->mask) >= ((i - hole) & table->mask)) {
+      table->slots[hole] = table->slots[i];
+      hole = i;
+    }
+  }
+  // Epoch 0 is never the table's, so the slot reads as empty
+  table->slots[hole].epoch = 0;
+  table->count--;
+}
+
+struct reservation* reservation_create(size_t expected) {
+  struct reservation* table = malloc(sizeof(struct reservation));
+  size_t size = 16;
+  while (size < expected * 2) {
+    size *= 2;
+  }
+  table->slots = __reservation_alloc(size);
+  table->mask = size - 1;
+  table->count = 0;
+  table->epoch = 1;
+  table->latest = 0;
+  return table;
+}
+
+void reservation_destroy(struct reservation* table) {
+  free(table->slots);
+  free(table);
+}
+
+void reservation_clear(struct reservation* table) {
+  table->count = 0;
+  table->latest = 0;
+  if (++table->epoch == 0) {
+    memset(table->slots, 0, sizeof(struct reservation_slot) * (table->mask + 1));
+    table->epoch = 1;
+  }
+}
+
+void reservation_add(struct reservation* table, uint32_t robot, uint32_t space, uint32_t step) {
+  struct reservation_slot* last = __reservation_get(table, space, RESERVATION_LAST);
+  // Adding can grow the table, so last isn't safe to use after
+  const int later = (last == NULL || last->value < step);
+  __reservation_set(table, space, step, robot);
+  if (later) {
+    __reservation_set(table, space, RESERVATION_LAST, step);
+  }
+  table->latest = (step > table->latest) ? step : table->latest;
+}
+
+void reservation_remove(struct reservation* table, uint32_t space, uint32_t step) {
+  struct reservation_slot* slot = __reservation_get(table, space, step);
+  struct reservation_slot* last;
+  uint32_t earlier;
+  if (slot == NULL) {
+    return;
+  }
+  __reservation_delete(table, slot);
+  last = __reservation_get(table, space, RESERVATION_LAST);
+  if (last == NULL || last->value != step) {
+    return;
+  }
+  // The space is now free after the latest step still reserved before this one
+  for (earlier = step; earlier-- > 0;) {
+    if (__reservation_get(table, space, earlier) != NULL) {
+      last->value = earlier;
+      return;
+    }
+  }
+  __reservation_delete(table, last);
+}
+
+void reservation_add_path(struct reservation* table, uint32_t robot, const uint32_t* path,
+                          uint32_t length, int park) {
+  uint32_t step;
+  for (step = 0; step < length; step++) {
+    reservation_add(table, robot, path[step], step);
+  }
+  if (park && length != 0) {
+    __reservation_set(table, path[length - 1], RESERVATION_PARKED, robot);
+    __reservation_set(table, path[length - 1], RESERVATION_PARKED_FROM, length - 1);
+  }
+}
+
+uint32_t reservation_get(struct reservation* table, uint32_t space, uint32_t step) {
+  struct reservation_slot* slot = __reservation_get(table, space, step);
+  if (slot != NULL) {
+    return slot->value;
+  }
+  slot = __reservation_get(table, space, RESERVATION_PARKED_FROM);
+  if (slot != NULL && step >= slot->value) {
+    return __reservation_get(table, space, RESERVATION_PARKED)->value;
+  }
+  return RESERVATION_NONE;
+}
+
+int reservation_allows(struct reservation* table, uint32_t from, uint32_t to, uint32_t step) {
+  struct reservation_slot* arriving;
+  struct reservation_slot* leaving;
+  if (reservation_get(table, to, step) != RESERVATION_NONE) {
+    return 0;
+  }
+  if (from == to || step == 0) {
+    return 1;
+  }
+  // Someone coming the other way along the same edge. Parked robots don't
+  // move, so only the steps themselves need checking.
+  arriving = __reservation_get(table, from, step);
+  leaving = __reservation_get(table, to, step - 1);
+  return arriving == NULL || leaving == NULL || arriving->value != leaving->value;
+}
+
+uint32_t reservation_free_from(struct reservation* table, uint32_t space) {
+  struct reservation_slot* last;
+  if (__reservation_get(table, space, RESERVATION_PARKED) != NULL) {
+    return RESERVATION_NONE;
+  }
+  last = __reservation_get(table, space, RESERVATION_LAST);
+  return (last != NULL) ? last->value + 1 : 0;
+}
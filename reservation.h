@@ -0,0 +1,122 @@
+/*! \file reservation.h
+ *  \brief Space-time reservation table. Records which robot is in which
+ *         space at every step, so robots planned later can stay out of the
+ *         way of robots planned earlier.
+ *
+ *  Spaces are vertex indices in the world's graph. Entries are kept in an
+ *  open addressed hash table keyed by (step << 32 | space), so it only
+ *  takes memory for the steps robots actually reserve. Once a robot's path
+ *  ends it stays parked in its last space for good.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define RESERVATION_NONE UINT32_MAX
+
+struct reservation_slot {
+  uint64_t key;                      // step << 32 | space
+  uint32_t value;
+  uint32_t epoch;                    // empty unless it's the table's epoch
+};
+
+struct reservation {
+  struct reservation_slot* slots;
+  size_t mask;                       // number of slots - 1
+  size_t count;
+  uint32_t epoch;                    // bumped by reservation_clear
+  uint32_t latest;                   // nothing is reserved after this step
+};
+
+/**
+ * Create a reservation table
+ *
+ * \param expected    number of reservations it should hold without growing
+ *
+ * \return            the table
+ */
+struct reservation* reservation_create(size_t expected);
+
+/**
+ * Destroy a reservation table
+ *
+ * \param table       the table
+ */
+void reservation_destroy(struct reservation* table);
+
+/**
+ * Remove every reservation in O(1)
+ *
+ * \param table       the table
+ */
+void reservation_clear(struct reservation* table);
+
+/**
+ * Reserve a space at a step
+ *
+ * \param table       the table
+ * \param robot       robot reserving it
+ * \param space       vertex index
+ * \param step        when
+ */
+void reservation_add(struct reservation* table, uint32_t robot, uint32_t space, uint32_t step);
+
+/**
+ * Give up a space at a step, so reservation_free_from and
+ * reservation_allows see it as free again. Parked robots aren't affected.
+ *
+ * \param table       the table
+ * \param space       vertex index
+ * \param step        when
+ */
+void reservation_remove(struct reservation* table, uint32_t space, uint32_t step);
+
+/**
+ * Reserve every space along a path, then park the robot at the end of it
+ *
+ * \param table       the table
+ * \param robot       robot reserving it
+ * \param path        vertex index at each step, starting at step 0
+ * \param length      steps in the path
+ * \param park        1 to keep the last space reserved forever
+ */
+void reservation_add_path(struct reservation* table, uint32_t robot, const uint32_t* path,
+                          uint32_t length, int park);
+
+/**
+ * Robot in a space at a step, including robots parked there
+ *
+ * \param table       the table
+ * \param space       vertex index
+ * \param step        when
+ *
+ * \return            the robot, RESERVATION_NONE if it's free
+ */
+uint32_t reservation_get(struct reservation* table, uint32_t space, uint32_t step);
+
+/**
+ * Whether a robot can move from one space to another, arriving at step,
+ * without running into a reserved space or swapping places with a robot
+ * going the other way. Staying put is moving to the same space.
+ *
+ * \param table       the table
+ * \param from        vertex index it's in at step - 1
+ * \param to          vertex index it's in at step
+ * \param step        when it arrives
+ *
+ * \return            1 if the move is free
+ */
+int reservation_allows(struct reservation* table, uint32_t from, uint32_t to, uint32_t step);
+
+/**
+ * First step from which nobody has a space reserved, so a robot can stop
+ * there for good
+ *
+ * \param table       the table
+ * \param space       vertex index
+ *
+ * \return            the step, RESERVATION_NONE if a robot is parked there
+ */
+uint32_t reservation_free_from(struct reservation* table, uint32_t space);
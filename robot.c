@@ -9,34 +9,22 @@
 #include "libhowderek/howderek_graph.h"
 #include "libhowderek/howderek_array.h"
 #include "libhowderek/howderek_heap.h"
+#include "libhowderek/howderek_trace.h"
 #include "world.h"
+#include "reservation.h"
 
-int8_t __howderek_graph_sum_compare(howderek_array_value_t left, howderek_array_value_t right) {
-  struct howderek_graph_vertex* u = left;
-  struct howderek_graph_vertex* v = right;
+// Search nodes allocated at once by astar_reserved
+#define ROBOT_NODE_BLOCK 1024
 
-  if (u != NULL &&
-      v != NULL &&
-      u->id != HOWDEREK_HASHMAP_NULL_ID &&
-      v->id != HOWDEREK_HASHMAP_NULL_ID &&
-      u->data != NULL &&
-      v->data != NULL) {
-
-    struct pathfinding_data* uData = u->data;
-    struct pathfinding_data* vData = v->data;
-
-    if (u->id == v->id) {
-      return 0;
-    } else {
-      int8_t result = (uData->sumOfDistances == vData->sumOfDistances) ? 0 : ((uData->sumOfDistances > vData->sumOfDistances) ? 1 : -1);
-      return result;
-    }
-
-  } else if (u != NULL && v != NULL) {
-    return u->id - v->id;
-  } else {
-    return -1;
+int8_t __pathfinding_compare(howderek_array_value_t left, howderek_array_value_t right) {
+  const struct pathfinding_data* l = left;
+  const struct pathfinding_data* r = right;
+  if (l->sumOfDistances != r->sumOfDistances) {
+    return (l->sumOfDistances > r->sumOfDistances) - (l->sumOfDistances < r->sumOfDistances);
   }
+  // Closer to the goal first. Usually that's just deeper, but when f has to
+  // wait for the goal to free up it keeps robots from putting off moving.
+  return (l->heuristicDistance > r->heuristicDistance) - (l->heuristicDistance < r->heuristicDistance);
 }
 
 int __calc_heuristic (struct howderek_graph_vertex* v1, struct howderek_graph_vertex* goal) {
@@ -67,12 +55,14 @@ int __is_goal (struct howderek_graph_vertex* v, struct howderek_graph_vertex* go
     }
 }
 
-struct pathfinding_data* astar (struct howderek_graph* g, struct howderek_graph_vertex* startVertex, struct howderek_graph_vertex* endVertex) {
-    const enum howderek_vertex_status unvisitedColor = HOWDEREK_GRAPH_COLOR(startVertex->status);
-    const enum howderek_vertex_status visitedColor = (unvisitedColor == HOWDEREK_GRAPH_BLACK) ? HOWDEREK_GRAPH_WHITE : HOWDEREK_GRAPH_BLACK;
+struct pathfinding_data* astar (struct howderek_graph* g, struct howderek_graph_vertex* startVertex, struct howderek_graph_vertex* endVertex, struct howderek_graph_paths* paths) {
+    HOWDEREK_TRACE_SCOPE("astar");
+    // The closed set is kept in paths instead of the vertex colours, so
+    // several robots can plan on the same graph at once
+    struct howderek_graph_paths* ownPaths = NULL;
     struct pathfinding_data* closedList;
     struct pathfinding_data* closedListEnd = NULL;
-    struct howderek_heap* openList = howderek_heap_create(0, __howderek_graph_sum_compare);
+    struct howderek_heap* openList = howderek_heap_create(0, __pathfinding_compare);
     struct pathfinding_data* curr;
     struct pathfinding_data* tmp;
     struct howderek_graph_edge* edge;
@@ -82,7 +72,13 @@ struct pathfinding_data* astar (struct howderek_graph* g, struct howderek_graph_
     start->heuristicDistance = __calc_heuristic(start->v, endVertex);
     start->sumOfDistances = start->distance + start->heuristicDistance;
     start->next = NULL;
+    start->time = 0;
+    start->parent = NULL;
 
+    if (paths == NULL) {
+        paths = ownPaths = howderek_graph_paths_create(g->vertex_map->count);
+    }
+    howderek_graph_paths_clear(paths);
     howderek_heap_push(openList, start);
 
     while ((curr = howderek_heap_pop(openList)) != NULL) {
@@ -96,7 +92,7 @@ struct pathfinding_data* astar (struct howderek_graph* g, struct howderek_graph_
             closedListEnd = curr;
         }
 
-        HOWDEREK_GRAPH_SET_COLOR(curr->v->status, visitedColor);
+        howderek_graph_paths_set(paths, curr->v->index, curr->distance, HOWDEREK_GRAPH_NO_VERTEX);
         edge = curr->v->edges;
 
         while (edge != NULL) {
@@ -108,18 +104,189 @@ struct pathfinding_data* astar (struct howderek_graph* g, struct howderek_graph_
                 closedListEnd->sumOfDistances = closedListEnd->distance + closedListEnd->heuristicDistance;
                 closedListEnd->v = edge->vertex;
                 closedListEnd->next = NULL;
+                closedListEnd->time = 0;
+                closedListEnd->parent = curr;
+                if (ownPaths != NULL) {
+                    howderek_graph_paths_destroy(ownPaths);
+                }
+                howderek_heap_destroy(openList, 0);
                 return closedList;
-            } else if (HOWDEREK_GRAPH_COLOR(edge->vertex->status) != visitedColor) {
+            } else if (howderek_graph_paths_distance(paths, edge->vertex->index) == INFINITY) {
                 tmp = malloc(sizeof(struct pathfinding_data));
                 tmp->distance = curr->distance + 1;
                 tmp->heuristicDistance = __calc_heuristic(edge->vertex, endVertex);
                 tmp->sumOfDistances = tmp->distance + tmp->heuristicDistance;
                 tmp->v = edge->vertex;
                 tmp->next = NULL;
+                tmp->time = 0;
+                tmp->parent = curr;
                 howderek_heap_push(openList, tmp);
             }
             edge = edge->next;
         } // end while (edge)
     } // end while (open list)
+    if (ownPaths != NULL) {
+        howderek_graph_paths_destroy(ownPaths);
+    }
+    howderek_heap_destroy(openList, 0);
     return NULL;
 }
+
+struct robot_search {
+  struct reservation* reserved;
+  struct reservation* closed;        // (step, vertex) pairs already expanded
+  const uint32_t* distances;
+  uint32_t earliest;                 // first step it can stop at the goal
+  uint32_t settled;                  // step after the last reservation
+  void* region;                      // every node, reset at once
+  struct pathfinding_data* nodes;
+  uint32_t nodesLeft;
+};
+
+/**
+ * Step a state is closed at. Nothing changes once every reservation has
+ * passed, so every later step is the same as the one after the last.
+ */
+uint32_t __robot_closed_step(struct robot_search* search, uint32_t time) {
+  return (time < search->settled) ? time : search->settled;
+}
+
+/**
+ * Queue the move from curr to v unless it's blocked, reserved or expanded
+ */
+void __robot_expand(struct robot_search* search, struct howderek_heap* open,
+                    struct pathfinding_data* curr, struct howderek_graph_vertex* v) {
+  const uint32_t time = curr->time + 1;
+  struct pathfinding_data* next;
+  if (search->distances[v->index] == WORLD_UNREACHABLE
+      || reservation_get(search->closed, v->index, __robot_closed_step(search, time)) != RESERVATION_NONE
+      || !reservation_allows(search->reserved, curr->v->index, v->index, time)) {
+    return;
+  }
+  if (search->nodesLeft == 0) {
+    search->nodes = howderek_allocate("robot_nodes", search->region,
+                                      sizeof(struct pathfinding_data) * ROBOT_NODE_BLOCK);
+    search->nodesLeft = ROBOT_NODE_BLOCK;
+  }
+  next = search->nodes++;
+  search->nodesLeft--;
+  next->v = v;
+  next->time = time;
+  next->distance = time;
+  next->heuristicDistance = search->distances[v->index];
+  next->sumOfDistances = next->distance + next->heuristicDistance;
+  // Without this every state that could arrive too early ties for the best
+  next->sumOfDistances = (next->sumOfDistances > search->earliest) ? next->sumOfDistances : search->earliest;
+  next->next = NULL;
+  next->parent = curr;
+  howderek_heap_push(open, next);
+}
+
+uint32_t* astar_reserved(struct howderek_graph_vertex* startVertex,
+                         struct howderek_graph_vertex* endVertex, const uint32_t* distances,
+                         struct reservation* reserved, uint32_t window, void* region,
+                         void* scratch, uint32_t* length) {
+  HOWDEREK_TRACE_SCOPE("astar_reserved");
+  struct robot_search search;
+  struct howderek_heap* open;
+  struct pathfinding_data start;
+  struct pathfinding_data* curr;
+  struct howderek_graph_edge* edge;
+  uint32_t* path = NULL;
+  const uint32_t goal = endVertex->index;
+  const uint32_t parked = reservation_free_from(reserved, goal);
+
+  // With a window it only has to get closer, even if it can't stop yet
+  if (distances[startVertex->index] == WORLD_UNREACHABLE || (parked == RESERVATION_NONE && window == 0)
+      || reservation_get(reserved, startVertex->index, 0) != RESERVATION_NONE) {
+    return NULL;
+  }
+  search.reserved = reserved;
+  search.closed = reservation_create(1024);
+  search.distances = distances;
+  search.earliest = (parked != RESERVATION_NONE) ? parked : 0;
+  search.settled = reserved->latest + 1;
+  search.region = scratch;
+  search.nodesLeft = 0;
+  start.v = startVertex;
+  start.time = 0;
+  start.distance = 0;
+  start.heuristicDistance = distances[startVertex->index];
+  start.sumOfDistances = (start.heuristicDistance > search.earliest) ? start.heuristicDistance : search.earliest;
+  start.next = NULL;
+  start.parent = NULL;
+
+  open = howderek_heap_create(HOWDEREK_HEAP_DEFAULT_D, __pathfinding_compare);
+  howderek_heap_push(open, &start);
+  while ((curr = howderek_heap_pop(open)) != NULL) {
+    if (reservation_get(search.closed, curr->v->index, __robot_closed_step(&search, curr->time)) != RESERVATION_NONE) {
+      continue;
+    }
+    reservation_add(search.closed, 0, curr->v->index, __robot_closed_step(&search, curr->time));
+    if ((curr->v->index == goal && curr->time >= parked) || (window != 0 && curr->time == window)) {
+      *length = curr->time + 1;
+      path = howderek_allocate("astar_reserved_path", region, sizeof(uint32_t) * *length);
+      for (; curr != NULL; curr = curr->parent) {
+        path[curr->time] = curr->v->index;
+      }
+      break;
+    }
+    // Waiting is moving to the same vertex
+    __robot_expand(&search, open, curr, curr->v);
+    for (edge = curr->v->edges; edge != NULL; edge = edge->next) {
+      __robot_expand(&search, open, curr, edge->vertex);
+    }
+  }
+  howderek_heap_destroy(open, 0);
+  howderek_reset(search.region);
+  reservation_destroy(search.closed);
+  return path;
+}
+
+struct robot_paths* robot_plan_prioritized(struct world* w, const uint32_t* order) {
+  HOWDEREK_TRACE_SCOPE("robot_plan_prioritized");
+  struct robot_paths* result = howderek_allocate_and_zero("robot_paths", NULL, sizeof(struct robot_paths));
+  struct reservation* reserved = reservation_create((size_t) w->robotCount * 64);
+  void* scratch = howderek_allocate("robot_plan_prioritized", NULL, 1);
+  void* nodes = howderek_allocate("robot_nodes", NULL, 1);
+  uint32_t* distances = howderek_allocate("robot_distances", scratch,
+                                          sizeof(uint32_t) * w->graph->vertex_map->count);
+  uint32_t* path;
+  position_t goal;
+  uint32_t robot;
+  uint32_t length;
+  uint32_t i;
+  uint32_t t;
+
+  result->robotCount = w->robotCount;
+  result->lengths = howderek_allocate_and_zero("robot_paths_lengths", result, sizeof(uint32_t) * w->robotCount);
+  result->paths = howderek_allocate_and_zero("robot_paths_paths", result, sizeof(position_t*) * w->robotCount);
+  for (i = 0; i < w->robotCount; i++) {
+    robot = (order != NULL) ? order[i] : i;
+    goal.bits = w->robots[robot].goal->id;
+    world_distances(w, goal, distances);
+    path = astar_reserved(w->robots[robot].pos, w->robots[robot].goal, distances, reserved, 0, scratch, nodes,
+                          &length);
+    if (path == NULL) {
+      howderek_log(HOWDEREK_LOG_INFO, "robot_plan_prioritized: no path for robot %u", robot);
+      howderek_free(result);
+      result = NULL;
+      break;
+    }
+    reservation_add_path(reserved, robot, path, length, 1);
+    result->lengths[robot] = length;
+    result->paths[robot] = howderek_allocate("robot_paths_path", result, sizeof(position_t) * length);
+    for (t = 0; t < length; t++) {
+      result->paths[robot][t].bits = w->graph->vertices[path[t]]->id;
+    }
+    result->cost += length - 1;
+  }
+  reservation_destroy(reserved);
+  howderek_free(nodes);
+  howderek_free(scratch);
+  return result;
+}
+
+void robot_paths_destroy(struct robot_paths* paths) {
+  howderek_free(paths);
+}
@@ -7,6 +7,10 @@
 #pragma once
 
 #include "libhowderek/howderek_graph.h"
+#include "world.h"
+#include "reservation.h"
+
+struct world;
 
 struct robot {
     struct howderek_graph_vertex* pos;
@@ -19,6 +23,69 @@ struct pathfinding_data {
     uint64_t sumOfDistances;
     struct pathfinding_data* next;
     struct howderek_graph_vertex* v;
+    uint32_t time;                     // step it's reached at, for searches in space-time
+    struct pathfinding_data* parent;   // where it was reached from
+};
+
+struct robot_paths {
+    uint32_t robotCount;
+    uint32_t* lengths;                 // positions in each robot's path
+    position_t** paths;                // paths[robot][t], robots wait at their goals once their paths end
+    uint64_t cost;                     // moves and waits until every robot has arrived for good
 };
 
-struct pathfinding_data* astar (struct howderek_graph* g, struct howderek_graph_vertex* startVertex, struct howderek_graph_vertex* endVertex);
+/**
+ * Find a path for a robot with A*
+ *
+ * \param g            graph to search, which isn't modified
+ * \param startVertex  where the robot is
+ * \param endVertex    where the robot is going
+ * \param paths        search state sized for g, one per thread searching at
+ *                     once. NULL to allocate one for this search.
+ * \return             vertices in the order they were closed, ending with
+ *                     the goal. NULL if it can't be reached.
+ */
+struct pathfinding_data* astar (struct howderek_graph* g, struct howderek_graph_vertex* startVertex, struct howderek_graph_vertex* endVertex, struct howderek_graph_paths* paths);
+
+/**
+ * Find a path for a robot with space-time A*, staying out of the spaces and
+ * edges other robots have reserved. Waiting in place costs a step like
+ * moving does, and the robot only stops at its goal once nobody else needs
+ * it.
+ *
+ * \param startVertex  where the robot is at step 0
+ * \param endVertex    where the robot is going
+ * \param distances    moves from every space to endVertex, from world_distances
+ * \param reserved     what the other robots have reserved
+ * \param window       steps to plan, after which the rest of the way is left
+ *                     to distances. 0 to plan all the way to the goal.
+ * \param region       what the path is allocated from, NULL for a new one
+ * \param scratch      a root the search's nodes are taken from, reset before
+ *                     it returns. Reused from one search to the next.
+ * \param length       set to the positions in the path
+ * \return             vertex index at each step, NULL if there's no path
+ */
+uint32_t* astar_reserved(struct howderek_graph_vertex* startVertex,
+                         struct howderek_graph_vertex* endVertex, const uint32_t* distances,
+                         struct reservation* reserved, uint32_t window, void* region,
+                         void* scratch, uint32_t* length);
+
+/**
+ * Plan every robot in the world one at a time. Each robot's path is reserved
+ * before the next is planned, so later robots go around earlier ones. Much
+ * faster than cbs_solve for large fleets, but the paths aren't the shortest
+ * and it can fail where cbs_solve wouldn't.
+ *
+ * \param w            the world, with robots added by world_add_robot
+ * \param order        indices of the robots in the order to plan them, NULL
+ *                     to plan them in the order they were added
+ * \return             the paths, NULL if a robot couldn't find one
+ */
+struct robot_paths* robot_plan_prioritized(struct world* w, const uint32_t* order);
+
+/**
+ * Destroy paths from robot_plan_prioritized
+ *
+ * \param paths        the paths
+ */
+void robot_paths_destroy(struct robot_paths* paths);
@@ -0,0 +1,30 @@
+/*! \file test.h
+ *  \brief Checks shared by the test programs. A check that fails is logged
+ *         and counted instead of stopping the test, and test_result turns
+ *         the count into the exit status.
+ */
+
+#pragma once
+
+#include "libhowderek/howderek.h"
+
+static int failures = 0;
+
+#define TEST_CHECK(condition, ...)                                          \
+  do {                                                                      \
+    if (!(condition)) {                                                     \
+      howderek_log(HOWDEREK_LOG_ERROR, __VA_ARGS__);                        \
+      failures++;                                                           \
+    }                                                                       \
+  } while (0)
+
+/**
+ * \return 0 if every check passed, 1 if any failed
+ */
+static inline int test_result(void) {
+  if (failures != 0) {
+    howderek_log(HOWDEREK_LOG_ERROR, "%d checks failed", failures);
+    return 1;
+  }
+  return 0;
+}
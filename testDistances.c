@@ -0,0 +1,98 @@
+/*! \file testDistances.c
+ *  \brief Checks that world_distance_field, over the grid, gives the same
+ *         distances as world_distances does over the graph, on a world with
+ *         scattered walls and a walled off room nothing outside can reach.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libhowderek/howderek.h"
+#include "test.h"
+#include "world.h"
+
+// Odd sizes, so rows don't line up with vector widths
+#define TEST_WIDTH  61
+#define TEST_HEIGHT 45
+#define TEST_GOALS  40
+
+/**
+ * Whether a space is a wall: about one in four at random, plus the walls of
+ * a room from (40, 10) to (50, 20)
+ */
+int __test_wall(uint32_t x, uint32_t y) {
+  if ((x == 40 || x == 50) && y >= 10 && y <= 20) {
+    return 1;
+  }
+  if ((y == 10 || y == 20) && x >= 40 && x <= 50) {
+    return 1;
+  }
+  if (x > 40 && x < 50 && y > 10 && y < 20) {
+    return 0;
+  }
+  return rand() % 4 == 0;
+}
+
+/**
+ * Compare both ways of measuring from goal at every space
+ */
+void __test_goal(struct world* w, position_t goal, uint32_t* field, uint32_t* distances) {
+  struct howderek_graph_vertex* v;
+  position_t pos;
+  uint32_t expected;
+  uint32_t got;
+  world_distance_field(w, goal, TEST_WIDTH, TEST_HEIGHT, field);
+  if (world_at_position(w, goal) != NULL) {
+    world_distances(w, goal, distances);
+  }
+  for (pos.coordinates.y = 0; pos.coordinates.y < TEST_HEIGHT; pos.coordinates.y++) {
+    for (pos.coordinates.x = 0; pos.coordinates.x < TEST_WIDTH; pos.coordinates.x++) {
+      v = world_at_position(w, pos);
+      expected = (v != NULL && world_at_position(w, goal) != NULL) ? distances[v->index] : WORLD_UNREACHABLE;
+      got = field[pos.coordinates.y * TEST_WIDTH + pos.coordinates.x];
+      TEST_CHECK(got == expected, "goal (%u, %u): (%u, %u) is %u away on the grid, %u on the graph",
+                 goal.coordinates.x, goal.coordinates.y, pos.coordinates.x, pos.coordinates.y, got, expected);
+    }
+  }
+}
+
+int main(void) {
+  struct world* w = world_let_there_be_light(TEST_WIDTH * TEST_HEIGHT);
+  uint32_t* field = malloc(sizeof(uint32_t) * TEST_WIDTH * TEST_HEIGHT);
+  uint32_t* distances;
+  position_t pos;
+  int i;
+
+  howderek_set_log_level(HOWDEREK_LOG_ERROR);
+  srand(49);
+  for (pos.coordinates.y = 0; pos.coordinates.y < TEST_HEIGHT; pos.coordinates.y++) {
+    for (pos.coordinates.x = 0; pos.coordinates.x < TEST_WIDTH; pos.coordinates.x++) {
+      if (!__test_wall(pos.coordinates.x, pos.coordinates.y)) {
+        world_add(w, pos);
+      }
+    }
+  }
+  distances = malloc(sizeof(uint32_t) * w->graph->vertex_map->count);
+
+  // Inside the room, then walls and open spaces anywhere
+  pos.coordinates.x = 45;
+  pos.coordinates.y = 15;
+  __test_goal(w, pos, field, distances);
+  for (i = 0; i < TEST_GOALS; i++) {
+    pos.coordinates.x = rand() % TEST_WIDTH;
+    pos.coordinates.y = rand() % TEST_HEIGHT;
+    __test_goal(w, pos, field, distances);
+  }
+  // Outside what's measured, so nothing can reach it
+  pos.coordinates.x = TEST_WIDTH;
+  pos.coordinates.y = 0;
+  world_distance_field(w, pos, TEST_WIDTH, TEST_HEIGHT, field);
+  for (i = 0; i < TEST_WIDTH * TEST_HEIGHT; i++) {
+    TEST_CHECK(field[i] == WORLD_UNREACHABLE, "a goal outside the field reaches space %d", i);
+  }
+
+  world_destroy(w);
+  free(distances);
+  free(field);
+  return test_result();
+}
@@ -0,0 +1,97 @@
+/*! \file testHeap.c
+ *  \brief Checks that heaps made with howderek_heap_build, grown with
+ *         howderek_heap_push_many and mixed with single pushes and pops,
+ *         give back their values smallest first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libhowderek/howderek.h"
+#include "libhowderek/howderek_heap.h"
+#include "test.h"
+
+#define TEST_VALUES 5000
+#define TEST_BATCH  700
+
+int8_t __test_compare(howderek_array_value_t left, howderek_array_value_t right) {
+  const int l = *(const int*) left;
+  const int r = *(const int*) right;
+  return (l > r) - (l < r);
+}
+
+/**
+ * Pop everything left in a heap, checking it comes out in order
+ *
+ * \param expected    values the heap should hold
+ * \return            values popped
+ */
+size_t __test_drain(struct howderek_heap* heap, size_t expected, uint8_t d) {
+  size_t popped = 0;
+  int last = -1;
+  int* value;
+  while ((value = howderek_heap_pop(heap)) != NULL) {
+    TEST_CHECK(*value >= last, "%u-heap: popped %d after %d", d, *value, last);
+    last = *value;
+    popped++;
+  }
+  TEST_CHECK(popped == expected, "%u-heap: popped %lu values, pushed %lu", d, popped, expected);
+  return popped;
+}
+
+int main(void) {
+  static int values[TEST_VALUES];
+  static howderek_array_value_t pointers[TEST_VALUES];
+  static size_t held[TEST_VALUES / 4];
+  struct howderek_heap* heap;
+  size_t count, i, j;
+  uint8_t d;
+  int* value;
+  int smallest;
+
+  howderek_set_log_level(HOWDEREK_LOG_ERROR);
+  srand(26);
+  // Few distinct values, so plenty of ties
+  for (i = 0; i < TEST_VALUES; i++) {
+    values[i] = rand() % (TEST_VALUES / 4);
+    pointers[i] = &values[i];
+  }
+  for (d = 2; d <= 5; d++) {
+    for (count = 0; count <= TEST_VALUES; count = count * 3 + 1) {
+      heap = howderek_heap_build(d, __test_compare, pointers, count);
+      TEST_CHECK(heap->store->count == count, "%u-heap: built from %lu values, holds %lu", d, count,
+                 heap->store->count);
+      __test_drain(heap, count, d);
+      howderek_heap_destroy(heap, 0);
+    }
+
+    // Batches onto a heap that's already partly popped, between single
+    // pushes. Every pop has to be the smallest value still held.
+    for (i = 0; i < TEST_VALUES / 4; i++) {
+      held[i] = 0;
+    }
+    heap = howderek_heap_build(d, __test_compare, pointers, TEST_BATCH);
+    for (i = 0; i < TEST_BATCH; i++) {
+      held[values[i]]++;
+    }
+    count = TEST_BATCH;
+    for (i = TEST_BATCH; i + TEST_BATCH <= TEST_VALUES; i += TEST_BATCH) {
+      for (j = 0; j < TEST_BATCH / 2; j++) {
+        value = howderek_heap_pop(heap);
+        for (smallest = 0; held[smallest] == 0; smallest++);
+        TEST_CHECK(*value == smallest, "%u-heap: popped %d, %d is still in it", d, *value, smallest);
+        held[*value]--;
+      }
+      count -= TEST_BATCH / 2;
+      howderek_heap_push_many(heap, pointers + i, TEST_BATCH - 1);
+      howderek_heap_push(heap, pointers[i + TEST_BATCH - 1]);
+      for (j = i; j < i + TEST_BATCH; j++) {
+        held[values[j]]++;
+      }
+      count += TEST_BATCH;
+    }
+    __test_drain(heap, count, d);
+    howderek_heap_destroy(heap, 0);
+  }
+  return test_result();
+}
@@ -0,0 +1,277 @@
+/*! \file testPlanners.c
+ *  \brief Loads the maps passed on the command line and plans on them with
+ *         every planner. Each map is followed by 1 if the robots can reach
+ *         their goals and 0 if they can't. --warehouse fills a warehouse
+ *         with robots instead and checks the planners against each other.
+ *
+ *  testPlanners easy.txt 1 impossible.txt 0
+ *  testPlanners --warehouse 30
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libhowderek/howderek.h"
+#include "test.h"
+#include "world.h"
+#include "robot.h"
+#include "cbs.h"
+
+#define TEST_WAREHOUSE_SIZE 48
+
+// Where each robot was after the last tick of world_simulate
+static position_t* previous = NULL;
+
+/**
+ * Where a robot is at step t, waiting at the end of its path once it's over
+ */
+position_t __test_at(uint32_t* lengths, position_t** paths, uint32_t robot, uint32_t t) {
+  return paths[robot][(t < lengths[robot]) ? t : lengths[robot] - 1];
+}
+
+/**
+ * Check that paths take every robot from its start to its goal one move at
+ * a time, without two robots in one space or swapping places
+ *
+ * \return            sum of the shortest distances, a lower bound on the cost
+ */
+uint64_t __test_check_paths(struct world* w, const char* name, uint32_t robotCount,
+                            uint32_t* lengths, position_t** paths) {
+  uint32_t* distances = malloc(sizeof(uint32_t) * w->graph->vertex_map->count);
+  uint64_t lowerBound = 0;
+  uint32_t longest = 0;
+  uint32_t robot, other, t;
+  position_t goal;
+  position_t a, b;
+
+  TEST_CHECK(robotCount == w->robotCount, "%s: %u paths for %u robots", name, robotCount, w->robotCount);
+  for (robot = 0; robot < robotCount; robot++) {
+    goal.bits = w->robots[robot].goal->id;
+    world_distances(w, goal, distances);
+    lowerBound += distances[w->robots[robot].pos->index];
+    longest = (lengths[robot] > longest) ? lengths[robot] : longest;
+    TEST_CHECK(lengths[robot] > distances[w->robots[robot].pos->index], "%s: robot %u is %u moves from its goal, "
+               "its path has %u", name, robot, distances[w->robots[robot].pos->index], lengths[robot]);
+    TEST_CHECK(paths[robot][0].bits == w->robots[robot].pos->id, "%s: robot %u doesn't start where it is", name, robot);
+    TEST_CHECK(paths[robot][lengths[robot] - 1].bits == goal.bits, "%s: robot %u doesn't end at its goal", name, robot);
+    for (t = 1; t < lengths[robot]; t++) {
+      a = paths[robot][t - 1];
+      b = paths[robot][t];
+      TEST_CHECK(world_at_position(w, b) != NULL, "%s: robot %u is in a wall at step %u", name, robot, t);
+      TEST_CHECK(a.bits == b.bits || world_is_adjacent(a, b), "%s: robot %u jumps at step %u", name, robot, t);
+    }
+  }
+  for (t = 0; t < longest; t++) {
+    for (robot = 0; robot < robotCount; robot++) {
+      for (other = robot + 1; other < robotCount; other++) {
+        TEST_CHECK(__test_at(lengths, paths, robot, t).bits != __test_at(lengths, paths, other, t).bits,
+                   "%s: robots %u and %u are in the same space at step %u", name, robot, other, t);
+        TEST_CHECK(t == 0 || __test_at(lengths, paths, robot, t).bits != __test_at(lengths, paths, other, t - 1).bits
+                   || __test_at(lengths, paths, other, t).bits != __test_at(lengths, paths, robot, t - 1).bits,
+                   "%s: robots %u and %u swap places at step %u", name, robot, other, t);
+      }
+    }
+  }
+  free(distances);
+  return lowerBound;
+}
+
+/**
+ * Plan on a map with CBS, prioritized planning and the simulation
+ *
+ * \param path        the map
+ * \param solvable    whether the robots can reach their goals
+ */
+void __test_map(const char* path, int solvable) {
+  FILE* file = fopen(path, "r");
+  struct world* w = world_load_map(file);
+  struct world* simulated;
+  struct cbs_solution* solution;
+  struct robot_paths* paths;
+  uint64_t lowerBound;
+  uint32_t robot;
+
+  if (file != NULL) {
+    fclose(file);
+  }
+  TEST_CHECK(w != NULL && w->robotCount == 2, "%s: couldn't load a map with two robots", path);
+  if (w == NULL || w->robotCount != 2) {
+    world_destroy(w);
+    return;
+  }
+
+  solution = cbs_solve(w, 1.0);
+  TEST_CHECK((solution != NULL) == solvable, "cbs_solve on %s: %s", path, solvable ? "no solution" : "solved");
+  if (solution != NULL) {
+    lowerBound = __test_check_paths(w, path, solution->robotCount, solution->lengths, solution->paths);
+    TEST_CHECK(solution->cost >= lowerBound, "cbs_solve on %s: cost %lu is under the lower bound %lu",
+               path, solution->cost, lowerBound);
+    cbs_solution_destroy(solution);
+  }
+
+  // Prioritized planning can fail where CBS wouldn't, but never the other way
+  paths = robot_plan_prioritized(w, NULL);
+  TEST_CHECK(paths == NULL || solvable, "robot_plan_prioritized on %s: solved", path);
+  if (paths != NULL) {
+    __test_check_paths(w, path, paths->robotCount, paths->lengths, paths->paths);
+    robot_paths_destroy(paths);
+  }
+
+  simulated = world_clone(w);
+  TEST_CHECK(world_simulate(simulated, NULL) == solvable, "world_simulate on %s: %s", path,
+             solvable ? "no solution" : "solved");
+  for (robot = 0; solvable && robot < simulated->robotCount; robot++) {
+    TEST_CHECK(simulated->robots[robot].pos->id == simulated->robots[robot].goal->id,
+               "world_simulate on %s: robot %u didn't arrive", path, robot);
+  }
+  world_destroy(simulated);
+  world_destroy(w);
+}
+
+/**
+ * Renderer for world_simulate that checks every tick's moves instead
+ */
+void __test_watch(struct world* w) {
+  uint32_t robot, other;
+  position_t at, was;
+  for (robot = 0; robot < w->robotCount; robot++) {
+    at.bits = w->robots[robot].pos->id;
+    TEST_CHECK(at.bits == previous[robot].bits || world_is_adjacent(previous[robot], at),
+               "world_simulate: robot %u jumps", robot);
+    for (other = robot + 1; other < w->robotCount; other++) {
+      was.bits = w->robots[other].pos->id;
+      TEST_CHECK(at.bits != was.bits, "world_simulate: robots %u and %u are in the same space", robot, other);
+      TEST_CHECK(at.bits != previous[other].bits || was.bits != previous[robot].bits,
+                 "world_simulate: robots %u and %u swap places", robot, other);
+    }
+  }
+  for (robot = 0; robot < w->robotCount; robot++) {
+    previous[robot].bits = w->robots[robot].pos->id;
+  }
+}
+
+/**
+ * Fill a warehouse, rows of shelves with aisles between them, with robots
+ * going to random spaces. CBS has to find the cheapest paths, so nothing
+ * else may beat it, and on this warehouse every robot can take a shortest
+ * path without waiting.
+ *
+ * \param robots      number of robots
+ */
+void __test_warehouse(uint32_t robots) {
+  struct world* w = world_let_there_be_light(TEST_WAREHOUSE_SIZE * TEST_WAREHOUSE_SIZE);
+  struct world* simulated;
+  struct cbs_solution* solution;
+  struct robot_paths* paths;
+  position_t* goals = malloc(sizeof(position_t) * robots);
+  uint32_t** many = malloc(sizeof(uint32_t*) * robots);
+  uint32_t* distances;
+  uint8_t used[TEST_WAREHOUSE_SIZE][TEST_WAREHOUSE_SIZE] = {{0}};
+  uint64_t lowerBound;
+  uint32_t count;
+  uint32_t robot, v;
+  position_t pos, start;
+  int shelf;
+
+  srand(3);
+  for (pos.coordinates.y = 0; pos.coordinates.y < TEST_WAREHOUSE_SIZE; pos.coordinates.y++) {
+    for (pos.coordinates.x = 0; pos.coordinates.x < TEST_WAREHOUSE_SIZE; pos.coordinates.x++) {
+      shelf = pos.coordinates.y % 3 == 1 && pos.coordinates.x % 8 != 0 && pos.coordinates.x % 8 != 7
+              && pos.coordinates.x > 1 && pos.coordinates.x < TEST_WAREHOUSE_SIZE - 2;
+      if (!shelf) {
+        world_add(w, pos);
+      }
+    }
+  }
+  // No two robots start or end in the same space
+  for (robot = 0; robot < robots; robot++) {
+    do {
+      start.coordinates.x = rand() % TEST_WAREHOUSE_SIZE;
+      start.coordinates.y = rand() % TEST_WAREHOUSE_SIZE;
+    } while (world_at_position(w, start) == NULL || (used[start.coordinates.y][start.coordinates.x] & 1));
+    used[start.coordinates.y][start.coordinates.x] |= 1;
+    do {
+      goals[robot].coordinates.x = rand() % TEST_WAREHOUSE_SIZE;
+      goals[robot].coordinates.y = rand() % TEST_WAREHOUSE_SIZE;
+    } while (world_at_position(w, goals[robot]) == NULL
+             || (used[goals[robot].coordinates.y][goals[robot].coordinates.x] & 2));
+    used[goals[robot].coordinates.y][goals[robot].coordinates.x] |= 2;
+    world_add_robot(w, start, goals[robot]);
+  }
+
+  // Measuring every goal at once gives what measuring them one by one does
+  count = w->graph->vertex_map->count;
+  distances = malloc(sizeof(uint32_t) * count);
+  for (robot = 0; robot < robots; robot++) {
+    many[robot] = malloc(sizeof(uint32_t) * count);
+  }
+  world_distances_many(w, goals, robots, many, 4);
+  for (robot = 0; robot < robots; robot++) {
+    world_distances(w, goals[robot], distances);
+    for (v = 0; v < count && many[robot][v] == distances[v]; v++);
+    TEST_CHECK(v == count, "world_distances_many: goal %u differs from world_distances at vertex %u", robot, v);
+    free(many[robot]);
+  }
+
+  solution = cbs_solve(w, 10.0);
+  TEST_CHECK(solution != NULL, "cbs_solve: no solution for %u robots in the warehouse", robots);
+  if (solution != NULL) {
+    lowerBound = __test_check_paths(w, "cbs_solve", solution->robotCount, solution->lengths, solution->paths);
+    TEST_CHECK(solution->cost == lowerBound, "cbs_solve: cost %lu, the shortest paths cost %lu",
+               solution->cost, lowerBound);
+    for (robot = 0; robot < solution->robotCount; robot++) {
+      world_distances(w, goals[robot], distances);
+      TEST_CHECK(solution->lengths[robot] == distances[w->robots[robot].pos->index] + 1,
+                 "cbs_solve: robot %u takes %u moves, it's %u from its goal", robot,
+                 solution->lengths[robot] - 1, distances[w->robots[robot].pos->index]);
+    }
+  }
+
+  paths = robot_plan_prioritized(w, NULL);
+  TEST_CHECK(paths != NULL, "robot_plan_prioritized: no paths for %u robots in the warehouse", robots);
+  if (paths != NULL) {
+    __test_check_paths(w, "robot_plan_prioritized", paths->robotCount, paths->lengths, paths->paths);
+    TEST_CHECK(solution == NULL || paths->cost >= solution->cost,
+               "robot_plan_prioritized: cost %lu beats cbs_solve's %lu", paths->cost, solution->cost);
+    robot_paths_destroy(paths);
+  }
+  if (solution != NULL) {
+    cbs_solution_destroy(solution);
+  }
+
+  simulated = world_clone(w);
+  previous = malloc(sizeof(position_t) * robots);
+  for (robot = 0; robot < robots; robot++) {
+    previous[robot].bits = simulated->robots[robot].pos->id;
+  }
+  TEST_CHECK(world_simulate(simulated, __test_watch) == 1, "world_simulate: %u robots didn't arrive", robots);
+  for (robot = 0; robot < robots; robot++) {
+    TEST_CHECK(simulated->robots[robot].pos->id == simulated->robots[robot].goal->id,
+               "world_simulate: robot %u didn't arrive", robot);
+  }
+  free(previous);
+  previous = NULL;
+  world_destroy(simulated);
+  world_destroy(w);
+  free(distances);
+  free(many);
+  free(goals);
+}
+
+int main(int argc, char** argv) {
+  int i;
+  howderek_set_log_level(HOWDEREK_LOG_ERROR);
+  if (argc < 3 || argc % 2 == 0) {
+    howderek_log(HOWDEREK_LOG_FATAL, "usage: %s map solvable [map solvable ...] | --warehouse robots", argv[0]);
+    return 1;
+  }
+  for (i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--warehouse") == 0) {
+      __test_warehouse(atoi(argv[i + 1]));
+    } else {
+      __test_map(argv[i], atoi(argv[i + 1]));
+    }
+  }
+  return test_result();
+}
@@ -0,0 +1,131 @@
+/*! \file testReplan.c
+ *  \brief Checks D* Lite against a fresh breadth first search. The robot
+ *         walks its path while spaces are opened and blocked around it, and
+ *         every repaired path has to be as short as one searched from
+ *         scratch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libhowderek/howderek.h"
+#include "test.h"
+#include "world.h"
+#include "replan.h"
+
+#define TEST_SIZE   64
+#define TEST_ROUNDS 2000
+
+/**
+ * Positions in a shortest path from start to goal, searched on the grid
+ * without any of the planner's state
+ *
+ * \return            0 if goal can't be reached
+ */
+size_t __test_bfs(struct world* w, position_t start, position_t goal) {
+  static int32_t distance[TEST_SIZE][TEST_SIZE];
+  static position_t queue[TEST_SIZE * TEST_SIZE];
+  uint32_t head = 0;
+  uint32_t tail = 0;
+  uint32_t x, y;
+  direction_t direction;
+  position_t pos, next;
+
+  for (y = 0; y < TEST_SIZE; y++) {
+    for (x = 0; x < TEST_SIZE; x++) {
+      distance[y][x] = -1;
+    }
+  }
+  if (world_at_position(w, start) == NULL) {
+    return 0;
+  }
+  distance[start.coordinates.y][start.coordinates.x] = 0;
+  queue[tail++] = start;
+  while (head != tail) {
+    pos = queue[head++];
+    if (pos.bits == goal.bits) {
+      return distance[pos.coordinates.y][pos.coordinates.x] + 1;
+    }
+    for (direction = N; direction <= NW; direction++) {
+      next = world_line_from(pos, 1, direction);
+      if (next.coordinates.x >= TEST_SIZE || next.coordinates.y >= TEST_SIZE
+          || distance[next.coordinates.y][next.coordinates.x] >= 0 || world_at_position(w, next) == NULL) {
+        continue;
+      }
+      distance[next.coordinates.y][next.coordinates.x] = distance[pos.coordinates.y][pos.coordinates.x] + 1;
+      queue[tail++] = next;
+    }
+  }
+  return 0;
+}
+
+/**
+ * A random space, never start or goal
+ */
+position_t __test_space(position_t start, position_t goal) {
+  position_t pos;
+  do {
+    pos.coordinates.x = rand() % TEST_SIZE;
+    pos.coordinates.y = rand() % TEST_SIZE;
+  } while (pos.bits == start.bits || pos.bits == goal.bits);
+  return pos;
+}
+
+int main(void) {
+  static position_t path[TEST_SIZE * TEST_SIZE];
+  struct world* w = world_let_there_be_light(TEST_SIZE * TEST_SIZE);
+  struct replan* planner;
+  position_t start, goal, pos;
+  size_t length, expected, i;
+  int round, changes, change;
+
+  howderek_set_log_level(HOWDEREK_LOG_ERROR);
+  srand(7);
+  for (pos.coordinates.y = 0; pos.coordinates.y < TEST_SIZE; pos.coordinates.y++) {
+    for (pos.coordinates.x = 0; pos.coordinates.x < TEST_SIZE; pos.coordinates.x++) {
+      world_add(w, pos);
+    }
+  }
+  start.coordinates.x = 0;
+  start.coordinates.y = 0;
+  goal.coordinates.x = TEST_SIZE - 1;
+  goal.coordinates.y = TEST_SIZE - 1;
+  for (i = 0; i < TEST_SIZE * TEST_SIZE / 4; i++) {
+    world_remove(w, __test_space(start, goal));
+  }
+
+  planner = replan_create(w, goal);
+  for (round = 0; round < TEST_ROUNDS; round++) {
+    length = replan_path(planner, start, path, TEST_SIZE * TEST_SIZE);
+    expected = __test_bfs(w, start, goal);
+    TEST_CHECK(length == expected, "round %d: path has %lu positions, a fresh search found %lu", round, length, expected);
+    if (length != 0) {
+      TEST_CHECK(path[0].bits == start.bits && path[length - 1].bits == goal.bits,
+                 "round %d: path doesn't go from start to goal", round);
+      for (i = 1; i < length; i++) {
+        TEST_CHECK(world_is_adjacent(path[i - 1], path[i]) && world_at_position(w, path[i]) != NULL,
+                   "round %d: step %lu isn't a move into an open space", round, i);
+      }
+    }
+    // The robot moves along, and the search has to follow it
+    if (length > 2 && round % 3 == 0) {
+      start = path[1];
+    }
+    changes = 1 + rand() % 4;
+    // Every so often more change than the log holds, so it starts over
+    if (round % 500 == 499) {
+      changes = WORLD_CHANGE_LOG + 36;
+    }
+    for (change = 0; change < changes; change++) {
+      pos = __test_space(start, goal);
+      if (rand() % 2) {
+        world_remove(w, pos);
+      } else {
+        world_add(w, pos);
+      }
+    }
+  }
+  replan_destroy(planner);
+  world_destroy(w);
+  return test_result();
+}
@@ -0,0 +1,114 @@
+/*! \file testSkiplistConcurrent.c
+ *  \brief Runs inserts, searches and deletes on one concurrent skip list
+ *         from several threads, then checks what's left once they're done.
+ *
+ *  Each thread owns the ids congruent to its number and deletes every third
+ *  one it inserted, so what should survive is known. All of them also fight
+ *  over a shared range of ids, where only consistency can be checked.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "libhowderek/howderek.h"
+#include "libhowderek/howderek_skiplist_concurrent.h"
+#include "test.h"
+
+#define TEST_THREADS 8
+#define TEST_OWNED   20000
+#define TEST_SHARED  512
+#define TEST_ROUNDS  20000
+
+// values[id] is the data stored for id, so a search can tell it got the right node
+static char values[TEST_OWNED + TEST_SHARED + 1];
+static struct howderek_cskip* list;
+static int wrongData = 0;
+
+struct test_thread {
+  pthread_t thread;
+  long number;
+  unsigned seed;
+};
+
+/**
+ * Searches have to find nothing or the data stored for that id
+ */
+void __test_search(howderek_skip_value_t id) {
+  void* data = howderek_cskip_search(list, id);
+  if (data != NULL && data != &values[id]) {
+    __atomic_add_fetch(&wrongData, 1, __ATOMIC_RELAXED);
+  }
+}
+
+void* __test_run(void* arg) {
+  struct test_thread* self = arg;
+  howderek_skip_value_t id;
+  int round;
+  for (id = 1 + self->number; id <= TEST_OWNED; id += TEST_THREADS) {
+    howderek_cskip_push(list, id, &values[id]);
+    __test_search(1 + rand_r(&self->seed) % (TEST_OWNED + TEST_SHARED));
+  }
+  for (id = 1 + self->number; id <= TEST_OWNED; id += TEST_THREADS) {
+    if (id % 3 == 0) {
+      howderek_cskip_delete(list, id, 0);
+    }
+  }
+  for (round = 0; round < TEST_ROUNDS; round++) {
+    id = TEST_OWNED + 1 + rand_r(&self->seed) % TEST_SHARED;
+    switch (rand_r(&self->seed) % 3) {
+      case 0:
+        howderek_cskip_push(list, id, &values[id]);
+        break;
+      case 1:
+        howderek_cskip_delete(list, id, 0);
+        break;
+      default:
+        __test_search(id);
+        break;
+    }
+  }
+  howderek_cskip_thread_detach();
+  return NULL;
+}
+
+int main(void) {
+  struct test_thread threads[TEST_THREADS];
+  struct howderek_cskip_node* node;
+  howderek_skip_value_t id;
+  howderek_skip_value_t last = 0;
+  size_t linked = 0;
+  int found;
+  long i;
+
+  howderek_set_log_level(HOWDEREK_LOG_ERROR);
+  list = howderek_cskip_create();
+  for (i = 0; i < TEST_THREADS; i++) {
+    threads[i].number = i;
+    threads[i].seed = 29 + i;
+    pthread_create(&threads[i].thread, NULL, __test_run, &threads[i]);
+  }
+  for (i = 0; i < TEST_THREADS; i++) {
+    pthread_join(threads[i].thread, NULL);
+  }
+  TEST_CHECK(wrongData == 0, "%d searches found another id's data", wrongData);
+
+  // Nodes that are marked but not unlinked yet don't count
+  for (node = (struct howderek_cskip_node*) (list->head->next[0] & ~(uintptr_t) 1); node != NULL;
+       node = (struct howderek_cskip_node*) (node->next[0] & ~(uintptr_t) 1)) {
+    if (node->next[0] & 1) {
+      continue;
+    }
+    TEST_CHECK(node->id > last, "%ld comes after %ld", node->id, last);
+    TEST_CHECK(node->data == &values[node->id], "%ld has another id's data", node->id);
+    last = node->id;
+    linked++;
+  }
+  TEST_CHECK(linked == list->count, "%lu nodes are linked, count is %lu", linked, list->count);
+  for (id = 1; id <= TEST_OWNED; id++) {
+    found = howderek_cskip_search(list, id) != NULL;
+    TEST_CHECK(found == (id % 3 != 0), "%ld is %s", id, found ? "still there" : "missing");
+  }
+  howderek_cskip_destroy(list, 0);
+  return test_result();
+}
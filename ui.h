@@ -18,3 +18,13 @@ struct pixel {
  * \param w       the world
  */
 void renderer(struct world* w);
+
+/**
+ * Load a map, '#' for walls. 'S' and 'F' are where the two robots start,
+ * 'E' and 'L' where they're going.
+ *
+ * \param file    the map
+ *
+ * \return        the world, NULL if the map is missing a robot
+ */
+struct world* load_world(FILE* file);
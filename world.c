@@ -9,9 +9,14 @@
 #include <string.h>
 
 #include "libhowderek/howderek.h"
+#include "libhowderek/howderek_memory.h"
 #include "libhowderek/howderek_graph.h"
 #include "libhowderek/howderek_hashmap.h"
+#include "libhowderek/howderek_trace.h"
+#include "libhowderek/howderek_parallel.h"
 #include "world.h"
+#include "robot.h"
+#include "reservation.h"
 
 
 const char* DIRECTION_STRINGS[] = {
@@ -31,10 +36,128 @@ struct world* world_let_there_be_light(size_t size) {
     size = 128;
   }
   struct world* creation = malloc(sizeof(struct world));
-  creation->graph = howderek_graph_create(HOWDEREK_GRAPH_UNDIRECTED, 128);
+  creation->graph = howderek_graph_create(HOWDEREK_GRAPH_UNDIRECTED, size);
+  creation->graphReferences = malloc(sizeof(uint32_t));
+  *creation->graphReferences = 1;
+  creation->grid = howderek_grid_create(0, 0, WORLD_CELL_BLOCKED);
+  creation->robots = NULL;
+  creation->robotCount = 0;
+  creation->robotCapacity = 0;
+  creation->height = 0;
+  creation->width = 0;
+  creation->version = 0;
   return creation;
 }
 
+/**
+ * Read a map into a new world, a word of the grid at a time
+ *
+ * \param file        the map
+ *
+ * \return            the world, NULL if the file can't be read
+ */
+struct world* world_load_map(FILE* file) {
+  HOWDEREK_TRACE_SCOPE("world_load_map");
+  const char* markers = "SFEL";            // starts, then goals, in robot order
+  position_t found[4];
+  int have[4] = {0, 0, 0, 0};
+  struct world* w;
+  const char* marker;
+  uint64_t word = 0;
+  uint32_t x = 0;
+  uint32_t y = 0;
+  int c;
+  if (file == NULL) {
+    return NULL;
+  }
+  w = world_let_there_be_light(0);
+  // Walls are the fill, so words of nothing but wall are never stored
+  while ((c = getc(file)) != EOF) {
+    if (c == '\r') {
+      continue;
+    }
+    if (c == '\n' || (x & HOWDEREK_GRID_WORD_MASK) == 0) {
+      if (x != 0 && word != 0) {
+        howderek_grid_set_word(w->grid, x - 1, y, word);
+      }
+      word = 0;
+    }
+    if (c == '\n') {
+      w->width = (x > w->width) ? x : w->width;
+      x = 0;
+      y++;
+      continue;
+    }
+    if (c != '#') {
+      word |= (uint64_t) WORLD_CELL_UNCONNECTED << ((x & HOWDEREK_GRID_WORD_MASK) * HOWDEREK_GRID_CELL_BITS);
+    }
+    marker = (c != 0) ? strchr(markers, c) : NULL;
+    if (marker != NULL) {
+      found[marker - markers].coordinates.x = x;
+      found[marker - markers].coordinates.y = y;
+      have[marker - markers] = 1;
+    }
+    x++;
+  }
+  // The last line doesn't have to end in a newline
+  if (x != 0) {
+    if (word != 0) {
+      howderek_grid_set_word(w->grid, x - 1, y, word);
+    }
+    w->width = (x > w->width) ? x : w->width;
+    y++;
+  }
+  w->height = y;
+  // Adding the robots connects the spaces they can reach
+  if (have[0] && have[2]) {
+    world_add_robot(w, found[0], found[2]);
+  }
+  if (have[1] && have[3]) {
+    world_add_robot(w, found[1], found[3]);
+  }
+  return w;
+}
+
+/**
+ * Record that a space was opened or blocked
+ *
+ * \param w           the world
+ * \param pos         position that changed
+ */
+void __world_changed(struct world* w, position_t pos) {
+  w->version++;
+  w->changes[w->version % WORLD_CHANGE_LOG] = pos;
+}
+
+/**
+ * Give w a graph of its own before changing it, moving the robots over
+ *
+ * \param w           the world
+ */
+void __world_own_graph(struct world* w) {
+  struct howderek_graph* shared = w->graph;
+  uint32_t i;
+  if (__atomic_load_n(w->graphReferences, __ATOMIC_ACQUIRE) == 1) {
+    return;
+  }
+  w->graph = howderek_graph_clone_without_data(shared);
+  for (i = 0; i < w->robotCount; i++) {
+    if (w->robots[i].pos != NULL) {
+      w->robots[i].pos = howderek_graph_get(w->graph, w->robots[i].pos->id);
+    }
+    if (w->robots[i].goal != NULL) {
+      w->robots[i].goal = howderek_graph_get(w->graph, w->robots[i].goal->id);
+    }
+  }
+  if (__atomic_sub_fetch(w->graphReferences, 1, __ATOMIC_ACQ_REL) == 0) {
+    // Whoever shared it was destroyed while we were copying
+    howderek_graph_destroy(&shared, 0);
+  } else {
+    w->graphReferences = malloc(sizeof(uint32_t));
+  }
+  *w->graphReferences = 1;
+}
+
 /**
  * Calulate a new position given a distance and direction
  *
@@ -102,28 +225,115 @@ position_t world_line_from(position_t starting,
  */
 struct howderek_graph_vertex* world_at_position(struct world* w,
                                                 position_t pos) {
+  // Snapshots block spaces in the grid and leave the shared graph alone
+  if (howderek_grid_get(w->grid, pos.coordinates.x, pos.coordinates.y) != WORLD_CELL_OPEN) {
+    return NULL;
+  }
   return howderek_graph_get(w->graph, pos.bits);
 }
 
+/**
+ * Add a vertex for a space, connected to the vertices around it. The graph
+ * has to be w's own.
+ *
+ * \param w           the world
+ * \param pos         position of the space
+ *
+ * \return            the vertex
+ */
+struct howderek_graph_vertex* __world_vertex(struct world* w, position_t pos) {
+  struct howderek_graph_vertex* v = howderek_graph_get(w->graph, pos.bits);
+  if (v != NULL) {
+    return v;
+  }
+  v = howderek_graph_add_vertex(w->graph, pos.bits, NULL);
+  // Connect to blocked neighbours too, the grid decides what's open
+  for (direction_t currentDirection = N; currentDirection <= NW; currentDirection++) {
+    struct howderek_graph_vertex* testVertex = howderek_graph_get(w->graph,
+        world_line_from(pos, 1, currentDirection).bits);
+    if (testVertex != NULL) {
+      howderek_graph_add_edge(w->graph, v, testVertex, 1.0);
+    }
+  }
+  return v;
+}
+
+/**
+ * Add every space of a loaded map that's reachable from pos to the graph,
+ * so a map only gets vertices where a robot can go
+ *
+ * \param w           the world
+ * \param pos         an open space
+ *
+ * \return            number of spaces added
+ */
+uint32_t __world_connect(struct world* w, position_t pos) {
+  position_t* queue = NULL;
+  uint32_t capacity = 0;
+  uint32_t head = 0;
+  uint32_t tail = 0;
+  position_t next;
+  direction_t direction;
+  // Most spaces don't border a map that hasn't been connected yet
+  for (direction = N; direction <= NW; direction++) {
+    next = world_line_from(pos, 1, direction);
+    if (howderek_grid_get(w->grid, next.coordinates.x, next.coordinates.y) == WORLD_CELL_UNCONNECTED) {
+      break;
+    }
+  }
+  if (direction > NW) {
+    return 0;
+  }
+  __world_own_graph(w);
+  capacity = 64;
+  queue = malloc(sizeof(position_t) * capacity);
+  queue[tail++] = pos;
+  while (head != tail) {
+    pos = queue[head++];
+    for (direction = N; direction <= NW; direction++) {
+      next = world_line_from(pos, 1, direction);
+      if (howderek_grid_get(w->grid, next.coordinates.x, next.coordinates.y) != WORLD_CELL_UNCONNECTED) {
+        continue;
+      }
+      howderek_grid_set(w->grid, next.coordinates.x, next.coordinates.y, WORLD_CELL_OPEN);
+      __world_changed(w, next);
+      __world_vertex(w, next);
+      if (tail == capacity) {
+        capacity *= 2;
+        queue = realloc(queue, sizeof(position_t) * capacity);
+      }
+      queue[tail++] = next;
+    }
+  }
+  free(queue);
+  return tail - 1;
+}
+
 /**
  * Add a space that a robot can reach in the world. Automatically connects to
  * nearby spaces
  *
- * \param starting    inital position
- * \param distance    distance, can be positive or negative, must be < UINT32_MAX
- * \param direction   direction to move in
+ * \param w           the world
+ * \param pos         position of the space
  *
- * \return            the vertex created
+ * \return            the space's vertex, the existing one if it was open
  */
 struct howderek_graph_vertex* world_add(struct world* w,
                                         position_t pos) {
-  struct howderek_graph_vertex* v = howderek_graph_add_vertex(w->graph, pos.bits, NULL);
-  for (direction_t currentDirection = N; currentDirection <= NW; currentDirection++) {
-    struct howderek_graph_vertex* testVertex = world_at_position(w, world_line_from(pos, 1, currentDirection));
-    if (testVertex != NULL) {
-      howderek_graph_add_edge(w->graph, v, testVertex, 1.0);
+  struct howderek_graph_vertex* v = howderek_graph_get(w->graph, pos.bits);
+  if (v == NULL) {
+    __world_own_graph(w);
+    v = __world_vertex(w, pos);
+  }
+  if (howderek_grid_get(w->grid, pos.coordinates.x, pos.coordinates.y) != WORLD_CELL_OPEN) {
+    howderek_grid_set(w->grid, pos.coordinates.x, pos.coordinates.y, WORLD_CELL_OPEN);
+    __world_changed(w, pos);
+    // Connecting can copy the graph out from under v
+    if (__world_connect(w, pos) != 0) {
+      v = howderek_graph_get(w->graph, pos.bits);
     }
   }
+  return v;
 }
 
 
@@ -136,23 +346,199 @@ struct howderek_graph_vertex* world_add(struct world* w,
  * \return           1 if successful, 0 if failed
  */
 int world_remove(struct world* w,
-                 position_t pos);
+                 position_t pos) {
+  const uint8_t cell = howderek_grid_get(w->grid, pos.coordinates.x, pos.coordinates.y);
+  if (cell != WORLD_CELL_UNCONNECTED && world_at_position(w, pos) == NULL) {
+    return 0;
+  }
+  // The vertex stays so the space can be added back without copying the graph
+  howderek_grid_set(w->grid, pos.coordinates.x, pos.coordinates.y, WORLD_CELL_BLOCKED);
+  __world_changed(w, pos);
+  return 1;
+}
+
+/**
+ * Add a robot to the world
+ *
+ * \param w          the world
+ * \param pos        where the robot starts
+ * \param goal       where the robot is going
+ *
+ * \return           index of the robot
+ */
+uint32_t world_add_robot(struct world* w,
+                         position_t pos,
+                         position_t goal) {
+  if (w->robotCount == w->robotCapacity) {
+    w->robotCapacity = (w->robotCapacity == 0) ? 4 : w->robotCapacity * 2;
+    w->robots = realloc(w->robots, sizeof(struct robot) * w->robotCapacity);
+  }
+  w->robots[w->robotCount].pos = world_add(w, pos);
+  // Adding the goal can copy the graph and move the other robots
+  w->robots[w->robotCount].goal = world_add(w, goal);
+  w->robots[w->robotCount].pos = howderek_graph_get(w->graph, pos.bits);
+  return w->robotCount++;
+}
+
+/**
+ * Number of moves from every space to goal
+ *
+ * \param w          the world
+ * \param goal       position to measure from
+ * \param distances  one per vertex, by vertex index
+ */
+void world_distances(struct world* w,
+                     position_t goal,
+                     uint32_t* distances) {
+  struct howderek_graph_vertex* goalVertex = world_at_position(w, goal);
+  const uint32_t count = w->graph->vertex_map->count;
+  uint32_t* queue;
+  uint32_t head = 0;
+  uint32_t tail = 0;
+  struct howderek_graph_edge* edge;
+  position_t pos;
+  uint32_t v;
+
+  for (v = 0; v < count; v++) {
+    distances[v] = WORLD_UNREACHABLE;
+  }
+  if (goalVertex == NULL) {
+    return;
+  }
+  queue = malloc(sizeof(uint32_t) * count);
+  distances[goalVertex->index] = 0;
+  queue[tail++] = goalVertex->index;
+  // Every move costs the same, so breadth first order is distance order
+  while (head != tail) {
+    v = queue[head++];
+    for (edge = w->graph->vertices[v]->edges; edge != NULL; edge = edge->next) {
+      pos.bits = edge->vertex->id;
+      if (distances[edge->vertex->index] == WORLD_UNREACHABLE
+          && howderek_grid_get(w->grid, pos.coordinates.x, pos.coordinates.y) == WORLD_CELL_OPEN) {
+        distances[edge->vertex->index] = distances[v] + 1;
+        queue[tail++] = edge->vertex->index;
+      }
+    }
+  }
+  free(queue);
+}
+
+/**
+ * Number of moves from every space to goal, over a dense grid
+ *
+ * \param w          the world
+ * \param goal       position to measure from
+ * \param width      columns to measure
+ * \param height     rows to measure
+ * \param distances  width * height, by y * width + x
+ */
+void world_distance_field(struct world* w,
+                          position_t goal,
+                          uint32_t width,
+                          uint32_t height,
+                          uint32_t* distances) {
+  HOWDEREK_TRACE_SCOPE("world_distance_field");
+  size_t i;
+  for (i = 0; i < (size_t) width * height; i++) {
+    distances[i] = WORLD_UNREACHABLE;
+  }
+  if (goal.coordinates.x >= width || goal.coordinates.y >= height
+      || howderek_grid_get(w->grid, goal.coordinates.x, goal.coordinates.y) != WORLD_CELL_OPEN) {
+    return;
+  }
+  distances[(size_t) goal.coordinates.y * width + goal.coordinates.x] = 0;
+  // WORLD_UNREACHABLE is HOWDEREK_GRID_FAR, so nothing has to be converted
+  howderek_grid_distances(w->grid, WORLD_CELL_OPEN, width, height, distances, 0);
+}
 
 /**
- * Clone a world
+ * Goals shared by the threads of world_distances_many
+ */
+struct world_distances_work {
+  struct world* world;
+  const position_t* goals;
+  uint32_t** distances;
+  uint32_t count;
+  uint32_t next;                     // next goal for a thread to take
+};
+
+void __world_distances_worker(void* context) {
+  struct world_distances_work* work = context;
+  uint32_t i;
+  // Fields take about as long as each other, but taking them one at a time
+  // keeps a slow thread from holding everyone up
+  while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->count) {
+    world_distances(work->world, work->goals[i], work->distances[i]);
+  }
+}
+
+/**
+ * world_distances for several goals at once
  *
- * \param world       the world
+ * \param w          the world
+ * \param goals      positions to measure from
+ * \param count      number of goals
+ * \param distances  one array per goal
+ * \param threads    number of threads, 0 for one per core
+ */
+void world_distances_many(struct world* w,
+                          const position_t* goals,
+                          uint32_t count,
+                          uint32_t** distances,
+                          unsigned threads) {
+  HOWDEREK_TRACE_SCOPE("world_distances_many");
+  struct world_distances_work work;
+  work.world = w;
+  work.goals = goals;
+  work.distances = distances;
+  work.count = count;
+  work.next = 0;
+  threads = (threads == 0) ? howderek_parallel_threads() : threads;
+  threads = (threads > count) ? count : threads;
+  if (threads <= 1) {
+    __world_distances_worker(&work);
+    return;
+  }
+  howderek_parallel_each(threads, __world_distances_worker, &work);
+}
+
+/**
+ * Take a snapshot of a world
+ *
+ * \param w          the world
  *
- * \return            the clone of the world
+ * \return           the snapshot
  */
-struct world* world_clone(struct world* w,
-                          position_t pos) {
-  struct world* newWorld;
-  newWorld->graph = howderek_graph_clone_without_data(w->graph);
-  memcpy(newWorld->robots, w->robots, sizeof(struct robot) * NUMBER_OF_ROBOTS);
+struct world* world_clone(struct world* w) {
+  struct world* newWorld = malloc(sizeof(struct world));
+  memcpy(newWorld, w, sizeof(struct world));
+  __atomic_add_fetch(w->graphReferences, 1, __ATOMIC_RELAXED);
+  newWorld->grid = howderek_grid_snapshot(w->grid);
+  // Robots point into the graph, which the snapshot may have to copy
+  newWorld->robotCapacity = w->robotCount;
+  newWorld->robots = malloc(sizeof(struct robot) * w->robotCount);
+  memcpy(newWorld->robots, w->robots, sizeof(struct robot) * w->robotCount);
   return newWorld;
 }
 
+/**
+ * Destroy a world or a snapshot of one
+ *
+ * \param w          the world
+ */
+void world_destroy(struct world* w) {
+  if (w == NULL) {
+    return;
+  }
+  if (__atomic_sub_fetch(w->graphReferences, 1, __ATOMIC_ACQ_REL) == 0) {
+    howderek_graph_destroy(&w->graph, 0);
+    free(w->graphReferences);
+  }
+  howderek_grid_destroy(w->grid);
+  free(w->robots);
+  free(w);
+}
+
 
 /**
  * Return 1 if start and end are adjacent
@@ -164,8 +550,8 @@ struct world* world_clone(struct world* w,
  */
 char world_is_adjacent(position_t start,
                        position_t end) {
-  int64_t xdiff = end.coordinates.x - start.coordinates.x;
-  int64_t ydiff = end.coordinates.y - start.coordinates.y;
+  int64_t xdiff = (int64_t) end.coordinates.x - start.coordinates.x;
+  int64_t ydiff = (int64_t) end.coordinates.y - start.coordinates.y;
   return ((llabs(xdiff) < 2)
            && (llabs(ydiff) < 2)
            && ((llabs(xdiff) + llabs(ydiff)) != 0));
@@ -180,8 +566,8 @@ char world_is_adjacent(position_t start,
  */
 int __world_goals_exist(struct world* w)
 {
-    int i;
-    for(i = 0; i < NUMBER_OF_ROBOTS; i++)
+    uint32_t i;
+    for(i = 0; i < w->robotCount; i++)
     {
         if(world_at_position(w, (position_t)w->robots[i].goal->id) == NULL) {
             return 0;
@@ -191,6 +577,190 @@ int __world_goals_exist(struct world* w)
     return 1;
 }
 
+/**
+ * State kept by world_simulate between ticks
+ */
+struct world_simulation {
+  struct reservation* reserved;      // the current window's paths
+  void* plans;                       // region the current window's paths are in
+  void* scratch;                     // root astar_reserved's nodes are in
+  uint32_t** paths;                  // paths[robot][step], NULL if it couldn't plan
+  uint32_t* lengths;
+  uint32_t* order;                   // robots in the order they're planned
+  uint8_t* stuck;                    // robots that couldn't follow their paths
+  position_t* goals;                 // where each robot is going
+  uint32_t** distances;              // distances[robot][vertex] to its goal
+  uint32_t* targets;                 // where each robot is moving this tick
+  uint32_t* occupant;                // robot in each space by vertex index, RESERVATION_NONE if empty
+  uint32_t* claimant;                // robot moving into each space this tick
+  uint32_t vertexCount;
+};
+
+/**
+ * Measure every robot's distance to its goal again, after spaces changed
+ *
+ * \return 0 if a robot can't reach its goal
+ */
+int __world_simulation_measure(struct world* w, struct world_simulation* sim) {
+  uint32_t i;
+  if (sim->vertexCount != w->graph->vertex_map->count) {
+    sim->vertexCount = w->graph->vertex_map->count;
+    for (i = 0; i < w->robotCount; i++) {
+      sim->distances[i] = realloc(sim->distances[i], sizeof(uint32_t) * sim->vertexCount);
+    }
+    sim->occupant = realloc(sim->occupant, sizeof(uint32_t) * sim->vertexCount);
+    sim->claimant = realloc(sim->claimant, sizeof(uint32_t) * sim->vertexCount);
+    memset(sim->occupant, 0xff, sizeof(uint32_t) * sim->vertexCount);
+    memset(sim->claimant, 0xff, sizeof(uint32_t) * sim->vertexCount);
+  }
+  for (i = 0; i < w->robotCount; i++) {
+    sim->goals[i].bits = w->robots[i].goal->id;
+  }
+  world_distances_many(w, sim->goals, w->robotCount, sim->distances, 0);
+  for (i = 0; i < w->robotCount; i++) {
+    if (sim->distances[i][w->robots[i].pos->index] == WORLD_UNREACHABLE) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int __world_simulation_is_stuck(struct world_simulation* sim, uint32_t robot) {
+  return sim->stuck[robot];
+}
+
+int __world_simulation_is_moving(struct world* w, uint32_t robot) {
+  return w->robots[robot].pos != w->robots[robot].goal;
+}
+
+/**
+ * Move the stuck robots to the front of the order, or the ones that aren't
+ * at their goals if stuck is 0. The rest keep theirs.
+ */
+void __world_simulation_prioritize(struct world* w, struct world_simulation* sim, int stuck) {
+  uint32_t front = 0;
+  uint32_t robot;
+  uint32_t i;
+  for (i = 0; i < w->robotCount; i++) {
+    robot = sim->order[i];
+    if (stuck ? __world_simulation_is_stuck(sim, robot) : __world_simulation_is_moving(w, robot)) {
+      memmove(&sim->order[front + 1], &sim->order[front], sizeof(uint32_t) * (i - front));
+      sim->order[front++] = robot;
+    }
+  }
+}
+
+/**
+ * Shuffle the order robots are planned in, for when the one they're in has
+ * them waiting on each other
+ */
+void __world_simulation_shuffle(struct world* w, struct world_simulation* sim, uint64_t seed) {
+  uint32_t robot;
+  uint32_t i;
+  uint32_t j;
+  for (i = w->robotCount; i > 1; i--) {
+    // xorshift64, good enough to break ties
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    j = seed % i;
+    robot = sim->order[i - 1];
+    sim->order[i - 1] = sim->order[j];
+    sim->order[j] = robot;
+  }
+}
+
+/**
+ * Plan every robot WORLD_WINDOW steps ahead against a fresh reservation
+ * table. Stuck robots go first, and robots already at their goals go last
+ * so they step aside for the rest. Robots that can't plan wait where they
+ * are.
+ */
+void __world_simulation_plan(struct world* w, struct world_simulation* sim) {
+  HOWDEREK_TRACE_SCOPE("world_simulation_plan");
+  uint32_t robot;
+  uint32_t i;
+  __world_simulation_prioritize(w, sim, 0);
+  __world_simulation_prioritize(w, sim, 1);
+  howderek_reset(sim->plans);
+  reservation_clear(sim->reserved);
+  // Nobody can take a robot's space before it's planned, so it can always
+  // wait a step
+  for (robot = 0; robot < w->robotCount; robot++) {
+    reservation_add(sim->reserved, robot, w->robots[robot].pos->index, 1);
+  }
+  for (i = 0; i < w->robotCount; i++) {
+    robot = sim->order[i];
+    reservation_remove(sim->reserved, w->robots[robot].pos->index, 1);
+    sim->paths[robot] = astar_reserved(w->robots[robot].pos, w->robots[robot].goal, sim->distances[robot],
+                                       sim->reserved, WORLD_WINDOW, sim->plans, sim->scratch,
+                                       &sim->lengths[robot]);
+    if (sim->paths[robot] != NULL) {
+      // Robots that make it to their goal stay there for the rest of the window
+      reservation_add_path(sim->reserved, robot, sim->paths[robot], sim->lengths[robot],
+                           sim->paths[robot][sim->lengths[robot] - 1] == w->robots[robot].goal->index);
+    }
+  }
+}
+
+/**
+ * Move every robot to where its path has it at step, all at once. A robot
+ * whose path has gone stale waits instead of running into another, and so
+ * does anyone moving into its space.
+ *
+ * \return number of robots that couldn't follow their paths
+ */
+uint32_t __world_simulation_step(struct world* w, struct world_simulation* sim, uint32_t step) {
+  uint32_t stuck = 0;
+  uint32_t robot;
+  uint32_t other;
+  uint32_t from;
+  uint32_t to;
+  int changed = 1;
+  for (robot = 0; robot < w->robotCount; robot++) {
+    from = w->robots[robot].pos->index;
+    sim->occupant[from] = robot;
+    sim->targets[robot] = (sim->paths[robot] != NULL)
+        ? sim->paths[robot][(step < sim->lengths[robot]) ? step : sim->lengths[robot] - 1]
+        : from;
+  }
+  // Waiting can block whoever was moving into the space, so keep going
+  // until nobody else has to
+  while (changed) {
+    changed = 0;
+    for (robot = 0; robot < w->robotCount; robot++) {
+      from = w->robots[robot].pos->index;
+      to = sim->targets[robot];
+      if (to == from) {
+        continue;
+      }
+      other = sim->occupant[to];
+      if ((sim->claimant[to] != RESERVATION_NONE && sim->claimant[to] != robot)
+          || (other != RESERVATION_NONE && (sim->targets[other] == to || sim->targets[other] == from))) {
+        // Someone else got there first, is staying there, or would swap with it
+        sim->targets[robot] = from;
+        changed = 1;
+      } else {
+        sim->claimant[to] = robot;
+      }
+    }
+    for (robot = 0; robot < w->robotCount; robot++) {
+      sim->claimant[sim->targets[robot]] = RESERVATION_NONE;
+    }
+  }
+  for (robot = 0; robot < w->robotCount; robot++) {
+    sim->occupant[w->robots[robot].pos->index] = RESERVATION_NONE;
+    w->robots[robot].pos = w->graph->vertices[sim->targets[robot]];
+    sim->stuck[robot] = (sim->paths[robot] == NULL);
+    if (sim->paths[robot] != NULL) {
+      to = sim->paths[robot][(step < sim->lengths[robot]) ? step : sim->lengths[robot] - 1];
+      sim->stuck[robot] = (to != sim->targets[robot]);
+    }
+    stuck += sim->stuck[robot];
+  }
+  return stuck;
+}
+
 /**
  * Run a simulation of the world
  *
@@ -200,4 +770,96 @@ int __world_goals_exist(struct world* w)
  * \return 1 if a solution was found, 0 if a solution does not exist
  */
 int world_simulate(struct world* w,
-                   void(*renderer)(struct world* w));
+                   void(*renderer)(struct world* w)) {
+  HOWDEREK_TRACE_SCOPE("world_simulate");
+  const uint32_t every = (WORLD_REPLAN_TICKS < WORLD_WINDOW) ? WORLD_REPLAN_TICKS : WORLD_WINDOW;
+  struct world_simulation sim;
+  uint64_t version = w->version;
+  uint64_t remaining;
+  uint64_t best = UINT64_MAX;
+  uint32_t stalled = 0;
+  uint32_t planned = 0;
+  uint32_t tick;
+  uint32_t i;
+  int replan = 1;
+  int result = -1;
+
+  if (!__world_goals_exist(w)) {
+    return 0;
+  }
+  sim.reserved = reservation_create((size_t) w->robotCount * (WORLD_WINDOW + 1));
+  sim.plans = howderek_allocate("world_plans", NULL, 1);
+  sim.scratch = howderek_allocate("world_nodes", NULL, 1);
+  sim.paths = calloc(w->robotCount, sizeof(uint32_t*));
+  sim.lengths = calloc(w->robotCount, sizeof(uint32_t));
+  sim.order = malloc(sizeof(uint32_t) * w->robotCount);
+  sim.stuck = calloc(w->robotCount, 1);
+  sim.goals = malloc(sizeof(position_t) * w->robotCount);
+  sim.distances = calloc(w->robotCount, sizeof(uint32_t*));
+  sim.targets = malloc(sizeof(uint32_t) * w->robotCount);
+  sim.occupant = NULL;
+  sim.claimant = NULL;
+  sim.vertexCount = 0;
+  for (i = 0; i < w->robotCount; i++) {
+    sim.order[i] = i;
+  }
+  if (!__world_simulation_measure(w, &sim)) {
+    result = 0;
+  }
+
+  for (tick = 0; result == -1; tick++) {
+    if (w->version != version) {
+      // The renderer, or whatever else, opened or blocked spaces
+      version = w->version;
+      replan = 1;
+      if (!__world_simulation_measure(w, &sim)) {
+        result = 0;
+        break;
+      }
+    }
+    remaining = 0;
+    for (i = 0; i < w->robotCount; i++) {
+      remaining += sim.distances[i][w->robots[i].pos->index];
+    }
+    if (remaining == 0) {
+      result = 1;
+    } else if (remaining < best) {
+      best = remaining;
+      stalled = 0;
+    } else if (++stalled > WORLD_STALL_TICKS) {
+      howderek_log(HOWDEREK_LOG_INFO, "world_simulate: robots stopped getting closer at tick %u", tick);
+      result = 0;
+    }
+    if (result != -1) {
+      break;
+    }
+    if (replan || tick - planned >= every) {
+      if (stalled > WORLD_WINDOW) {
+        __world_simulation_shuffle(w, &sim, 0x9e3779b97f4a7c15ULL * (tick + 1));
+      }
+      __world_simulation_plan(w, &sim);
+      planned = tick;
+    }
+    replan = (__world_simulation_step(w, &sim, tick - planned + 1) != 0);
+    if (renderer != NULL) {
+      renderer(w);
+    }
+  }
+
+  for (i = 0; i < w->robotCount; i++) {
+    free(sim.distances[i]);
+  }
+  free(sim.distances);
+  free(sim.goals);
+  free(sim.claimant);
+  free(sim.occupant);
+  free(sim.targets);
+  free(sim.stuck);
+  free(sim.order);
+  free(sim.lengths);
+  free(sim.paths);
+  howderek_free(sim.plans);
+  howderek_free(sim.scratch);
+  reservation_destroy(sim.reserved);
+  return result;
+}
@@ -9,17 +9,26 @@
 
 #include "libhowderek/howderek_graph.h"
 #include "libhowderek/howderek_hashmap.h"
-#include "robot.h"
-
-#define NUMBER_OF_ROBOTS 2
-
-struct world {
-    struct howderek_graph* graph;
-    struct robot robots[NUMBER_OF_ROBOTS];
-    uint32_t height;
-    uint32_t width;
-    char** rawChars;
-};
+#include "libhowderek/howderek_grid.h"
+
+// Values of the cells in world->grid
+#define WORLD_CELL_BLOCKED     0
+#define WORLD_CELL_OPEN        1
+#define WORLD_CELL_UNCONNECTED 2     // open, but not in the graph until a space next to it is added
+
+// Distance to spaces that can't reach the goal
+#define WORLD_UNREACHABLE UINT32_MAX
+
+#ifndef WORLD_CONFIG
+// Number of recent changes kept for planners that repair their paths
+#define WORLD_CHANGE_LOG 64
+// Steps ahead world_simulate plans each robot
+#define WORLD_WINDOW 16
+// Ticks between world_simulate's replans, at most WORLD_WINDOW
+#define WORLD_REPLAN_TICKS 8
+// Ticks world_simulate waits for the robots to get closer before giving up
+#define WORLD_STALL_TICKS 256
+#endif
 
 typedef union {
   struct {
@@ -29,6 +38,22 @@ typedef union {
   uint64_t bits;
 } position_t;
 
+// Robots plan with positions, so they come after them
+#include "robot.h"
+
+struct world {
+    struct howderek_graph* graph;      // every space ever added, shared with snapshots
+    uint32_t* graphReferences;         // worlds sharing graph
+    struct howderek_grid* grid;        // which spaces are open right now
+    struct robot* robots;              // robotCount of them, added with world_add_robot
+    uint32_t robotCount;
+    uint32_t robotCapacity;
+    uint32_t height;
+    uint32_t width;
+    uint64_t version;                  // number of spaces opened or blocked so far
+    position_t changes[WORLD_CHANGE_LOG];  // changes[version % WORLD_CHANGE_LOG] changed last
+};
+
 typedef enum {
   N,
   NE,
@@ -47,6 +72,20 @@ typedef enum {
  */
 struct world* world_let_there_be_light(size_t size);
 
+/**
+ * Read a map into a new world, '#' for walls and anything else for open
+ * space. 'S' and 'F' mark where two robots start, 'E' and 'L' where they're
+ * going. The map is read into the grid, 2 bits per space, as
+ * WORLD_CELL_UNCONNECTED. Spaces only get vertices once a space next to
+ * them is added, so adding the robots connects the parts of the map they
+ * can reach and the rest never costs more than its 2 bits.
+ *
+ * \param file        the map, one row per line
+ *
+ * \return            the world, NULL if the file can't be read
+ */
+struct world* world_load_map(FILE* file);
+
 /**
  * Calulate a new position given a distance and direction
  *
@@ -73,14 +112,14 @@ struct howderek_graph_vertex* world_at_position(struct world* w,
                                                 position_t pos);
 
 /**
- * Add a space that a robot can reach in the world. Automaticall connects to
- * nearby spaces
+ * Add a space that a robot can reach in the world. Automatically connects to
+ * nearby spaces, along with every WORLD_CELL_UNCONNECTED space it reaches.
+ * Adding a space that's already open changes nothing.
  *
- * \param starting    inital position
- * \param distance    distance, can be positive or negative, must be < UINT32_MAX
- * \param direction   direction to move in
+ * \param w           the world
+ * \param pos         position of the space
  *
- * \return            the vertex created
+ * \return            the space's vertex, the existing one if it was open
  */
 struct howderek_graph_vertex* world_add(struct world* w,
                                         position_t pos);
@@ -98,32 +137,116 @@ int world_remove(struct world* w,
                  position_t pos);
 
 /**
- * Clone a world
+ * Add a robot to the world. Its position and goal are added to the world
+ * if they aren't already.
  *
- * \param world       the world
+ * \param w          the world
+ * \param pos        where the robot starts
+ * \param goal       where the robot is going
  *
- * \return            the clone of the world
+ * \return           index of the robot in w->robots
+ */
+uint32_t world_add_robot(struct world* w,
+                         position_t pos,
+                         position_t goal);
+
+
+/**
+ * Number of moves from every space to goal, going around blocked spaces
+ *
+ * \param w          the world
+ * \param goal       position to measure from
+ * \param distances  one per vertex in w->graph, by vertex index. Set to
+ *                   WORLD_UNREACHABLE for spaces that can't reach goal.
+ */
+void world_distances(struct world* w,
+                     position_t goal,
+                     uint32_t* distances);
+
+/**
+ * world_distances over a dense grid of spaces instead of the graph. Much
+ * cheaper for big, mostly open worlds, and it never touches the vertices or
+ * edges. Gives the same distances, so spaces no robot has connected yet
+ * count as walls.
+ *
+ * \param w          the world
+ * \param goal       position to measure from
+ * \param width      columns to measure
+ * \param height     rows to measure
+ * \param distances  width * height, the space at (x, y) at y * width + x. Set
+ *                   to WORLD_UNREACHABLE for spaces that can't reach goal.
+ */
+void world_distance_field(struct world* w,
+                          position_t goal,
+                          uint32_t width,
+                          uint32_t height,
+                          uint32_t* distances);
+
+/**
+ * world_distances for several goals at once, each thread measuring one goal
+ * at a time. The world is only read, so it can't change until they're done.
+ *
+ * \param w          the world
+ * \param goals      positions to measure from
+ * \param count      number of goals
+ * \param distances  distances[i] is filled in for goals[i], like world_distances
+ * \param threads    number of threads, 0 for one per core
+ */
+void world_distances_many(struct world* w,
+                          const position_t* goals,
+                          uint32_t count,
+                          uint32_t** distances,
+                          unsigned threads);
+
+
+/**
+ * Take a snapshot of a world to try changes on, in O(1) in the size of the
+ * world. The snapshot shares the graph and the grid tiles with w, and only
+ * the robots are copied. world_remove only copies the grid tile it changes,
+ * and the graph is only copied if world_add needs a space that was never
+ * in it.
+ *
+ * \param w          the world
+ *
+ * \return           the snapshot, destroy with world_destroy
+ */
+struct world* world_clone(struct world* w);
+
+
+/**
+ * Destroy a world or a snapshot of one. O(1) unless it's the last one
+ * sharing its graph or grid tiles.
+ *
+ * \param w          the world
  */
-struct world* world_clone(struct world* w, position_t pos);
+void world_destroy(struct world* w);
 
 
 /**
- * Clone a world
+ * Whether a robot can move from start to end in one step, in any of the 8
+ * directions. Walls aren't checked, and a position isn't adjacent to itself.
  *
- * \param world       the world
+ * \param start       where the move starts
+ * \param end         where the move ends
  *
- * \return            the clone of the world
+ * \return            1 if adjacent, 0 if not
  */
 char world_is_adjacent(position_t start, position_t end);
 
 
 /**
- * Run a simulation of the world
+ * Run a simulation of the world, moving every robot one space per tick
+ * until they're all at their goals. Robots are planned with windowed
+ * cooperative A*: every WORLD_REPLAN_TICKS ticks each robot plans only
+ * WORLD_WINDOW steps ahead, around the robots planned before it, so the
+ * time a tick takes doesn't grow with how far the robots have to go.
+ * Robots that get stuck are planned first the next time.
  *
  * \param world       the world to simulate
- * \param renderer    function that renders the world
+ * \param renderer    function that renders the world after every tick, or NULL
  *
- * \return 1 if a solution was found, 0 if a solution does not exist
+ * \return 1 if a solution was found, 0 if a robot can't reach its goal or
+ *         the robots stop getting closer
  */
 int world_simulate(struct world* w,
                    void(*renderer)(struct world* w));